@@ -1,20 +1,42 @@
 #include "types.h"
 #include "mat.h"
+#include "matmul_cpu.h"
+#include "options.h"
 #include "print_utils.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 static void parse_args(int argc, char **argv)
 {
-    (void) argc;
-    (void) argv;
+    for (int arg = 1; arg < argc; ++arg) {
+        const char *s = argv[arg];
+
+        if (strcmp(s, "-h") == 0 || strcmp(s, "--help") == 0) {
+            printf("Usage: %s OPTIONS\n", argv[0]);
+            printf(
+                "       --tune         Measure Strassen crossover on this host and save it\n"
+            );
+            exit(0);
+        }
+
+        if (strcmp(s, "--tune") == 0) {
+            opt_tune = true;
+            continue;
+        }
+    }
 }
 
 int main(int argc, char **argv)
 {
     parse_args(argc, argv);
 
+    if (opt_tune)
+        return strassen_tune_and_save(stdout);
+
     auto m = mat_i64_t::make_matrix(3, 4);
 
     print_mat(m);
 
     return 0;
-}
\ No newline at end of file
+}
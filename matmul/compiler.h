@@ -6,3 +6,12 @@ barrier()
         asm("" ::: "memory");
 }
 
+/*
+ * Per function ISA targets.
+ * Lets a single binary carry kernels for ISA levels wider than the baseline,
+ * callers are responsible for checking cpu_isa() first.
+ */
+#define TARGET_AVX2 __attribute__((target("avx2,fma,f16c")))
+#define TARGET_AVX512 __attribute__((target("avx2,fma,f16c,avx512f,avx512dq")))
+#define TARGET_AVX512_BF16 __attribute__((target("avx2,fma,f16c,avx512f,avx512dq,avx512bw,avx512vl,avx512bf16")))
+#define TARGET_AVX512_VNNI __attribute__((target("avx2,fma,f16c,avx512f,avx512dq,avx512bw,avx512vl,avx512vnni")))
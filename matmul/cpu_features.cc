@@ -0,0 +1,94 @@
+#include "cpu_features.h"
+
+#include <atomic>
+#include <string.h>
+
+static cpu_isa_e cpu_isa_detect_()
+{
+    __builtin_cpu_init();
+
+    /*
+     * __builtin_cpu_supports() also checks XCR0, so we won't pick a level
+     * that the OS doesn't save the register state for.
+     */
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq"))
+        return cpu_isa_e::avx512;
+
+    /* Every AVX2 CPU has F16C, asking just in case. */
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c"))
+        return cpu_isa_e::avx2;
+
+    return cpu_isa_e::generic;
+}
+
+static bool cpu_has_avx512_bf16_()
+{
+    __builtin_cpu_init();
+
+    return cpu_isa_detect_() == cpu_isa_e::avx512
+        && __builtin_cpu_supports("avx512bf16")
+        && __builtin_cpu_supports("avx512bw")
+        && __builtin_cpu_supports("avx512vl");
+}
+
+static bool cpu_has_avx512_vnni_()
+{
+    __builtin_cpu_init();
+
+    return cpu_isa_detect_() == cpu_isa_e::avx512
+        && __builtin_cpu_supports("avx512vnni")
+        && __builtin_cpu_supports("avx512bw");
+}
+
+namespace {
+
+struct {
+    cpu_isa_e detected = cpu_isa_detect_();
+    bool avx512_bf16 = cpu_has_avx512_bf16_();
+    bool avx512_vnni = cpu_has_avx512_vnni_();
+    std::atomic<cpu_isa_e> active = detected;
+} context_cpu_isa;
+
+}
+
+int cpu_isa_from_str(const char * const s, cpu_isa_e &out)
+{
+    for (const auto isa: {cpu_isa_e::generic, cpu_isa_e::avx2, cpu_isa_e::avx512}) {
+        if (strcmp(s, cpu_isa2str(isa)) == 0) {
+            out = isa;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+cpu_isa_e cpu_isa_detect()
+{
+    return context_cpu_isa.detected;
+}
+
+bool cpu_has_avx512_bf16()
+{
+    return context_cpu_isa.avx512_bf16;
+}
+
+bool cpu_has_avx512_vnni()
+{
+    return context_cpu_isa.avx512_vnni;
+}
+
+cpu_isa_e cpu_isa()
+{
+    return context_cpu_isa.active.load(std::memory_order_relaxed);
+}
+
+int cpu_isa_set(const cpu_isa_e isa)
+{
+    if (ucast(isa) > ucast(context_cpu_isa.detected))
+        return 1;
+
+    context_cpu_isa.active.store(isa, std::memory_order_relaxed);
+
+    return 0;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "types.h"
+
+/*
+ * Instruction set levels we have dedicated CPU kernels for.
+ * Ordered, each level implies all the previous ones.
+ */
+enum class cpu_isa_e : u8 {
+    generic,
+    avx2,   /* AVX2 + FMA + F16C */
+    avx512, /* AVX-512F + AVX-512DQ */
+};
+
+constexpr static const char* cpu_isa2str(cpu_isa_e isa)
+{
+    switch(isa) {
+    case cpu_isa_e::generic:
+        return "generic";
+    case cpu_isa_e::avx2:
+        return "avx2";
+    case cpu_isa_e::avx512:
+        return "avx512";
+    }
+
+    __builtin_unreachable();
+
+    return "generic";
+}
+
+/* Returns non-zero if the string does not name a known ISA level. */
+int cpu_isa_from_str(const char *s, cpu_isa_e &out);
+
+/* Widest ISA level supported by the host (CPUID + OS state support). */
+cpu_isa_e cpu_isa_detect();
+
+/*
+ * AVX512-BF16, with the AVX512-BW and AVX512-VL it's always paired with.
+ * Optional extension of the avx512 level, used for f32 to bf16 conversions.
+ */
+bool cpu_has_avx512_bf16();
+
+/* AVX512-VNNI with AVX512-BW, for the int8 GEMM. Optional like the above. */
+bool cpu_has_avx512_vnni();
+
+/* ISA level the CPU kernels currently dispatch to. */
+cpu_isa_e cpu_isa();
+
+/*
+ * Forces the CPU kernels to dispatch to the given ISA level.
+ * Useful for testing all the variants on a single machine.
+ *
+ * Returns non-zero, and leaves the current level untouched, if the host
+ * doesn't support the requested level.
+ */
+int cpu_isa_set(cpu_isa_e isa);
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "types.h"
+
+#include <string.h>
+
+/*
+ * Half width floating point storage types.
+ *
+ *   f16:  IEEE 754 binary16, 1 sign, 5 exponent and 10 mantissa bits.
+ *   bf16: upper half of an f32, 1 sign, 8 exponent and 7 mantissa bits.
+ *
+ * Storage only, there is no half precision arithmetic. Values convert to f32
+ * and back implicitly, products load them half width and accumulate in f32.
+ * Conversion to half rounds to nearest even, like F16C and AVX512-BF16 do.
+ *
+ * The scalar conversions here are the reference ones, rows of matrices are
+ * converted by the per ISA kernels, see cpu_cvt_kernels_t in matmul_cpu.h
+ */
+
+static inline u32 f32_bits(const f32 v)
+{
+    u32 ret;
+    memcpy(&ret, &v, sizeof(ret));
+    return ret;
+}
+
+static inline f32 f32_from_bits(const u32 v)
+{
+    f32 ret;
+    memcpy(&ret, &v, sizeof(ret));
+    return ret;
+}
+
+static inline f32 f16_bits_to_f32(const u16 h)
+{
+    constexpr u32 exp_mask = 0x7c00 << 13;
+    const f32 denorm_magic = f32_from_bits(113 << 23);
+
+    u32 o = (h & 0x7fff) << 13;
+    const u32 exp = o & exp_mask;
+
+    /* Rebias the exponent. */
+    o += (127 - 15) << 23;
+
+    if (exp == exp_mask) {
+        /* Inf or NaN, exponent has to be all ones in f32 too. */
+        o += (128 - 16) << 23;
+    } else if (exp == 0) {
+        /* Zero or subnormal, let the FPU normalize it. */
+        o += 1 << 23;
+        o = f32_bits(f32_from_bits(o) - denorm_magic);
+    }
+
+    return f32_from_bits(o | (u32(h & 0x8000) << 16));
+}
+
+static inline u16 f32_to_f16_bits(const f32 v)
+{
+    constexpr u32 f32_inf = 255 << 23;
+    constexpr u32 f16_max = (127 + 16) << 23;
+    const f32 denorm_magic = f32_from_bits(((127 - 15) + (23 - 10) + 1) << 23);
+
+    u32 f = f32_bits(v);
+    const u32 sign = f & 0x80000000;
+    u16 o;
+
+    f ^= sign;
+
+    if (f >= f16_max) {
+        /* Too big, or Inf/NaN already. NaNs stay NaN, quiet ones. */
+        o = f > f32_inf ? 0x7e00 : 0x7c00;
+    } else if (f < (113 << 23)) {
+        /* Subnormal result, the addition shifts and rounds the mantissa for us. */
+        o = u16(f32_bits(f32_from_bits(f) + denorm_magic) - f32_bits(denorm_magic));
+    } else {
+        const u32 mant_odd = (f >> 13) & 1;
+
+        /* Rebias and round to nearest even, a carry bumps the exponent. */
+        f += (u32(15 - 127) << 23) + 0xfff + mant_odd;
+        o = u16(f >> 13);
+    }
+
+    return o | u16(sign >> 16);
+}
+
+static inline f32 bf16_bits_to_f32(const u16 h)
+{
+    return f32_from_bits(u32(h) << 16);
+}
+
+static inline u16 f32_to_bf16_bits(const f32 v)
+{
+    const u32 f = f32_bits(v);
+
+    /* Truncating could turn a NaN into an Inf. */
+    if ((f & 0x7fffffff) > 0x7f800000)
+        return u16((f >> 16) | 0x40);
+
+    return u16((f + 0x7fff + ((f >> 16) & 1)) >> 16);
+}
+
+struct f16 {
+    f16() = default;
+
+    f16(const f32 v)
+    :bits(f32_to_f16_bits(v))
+    {}
+
+    operator f32() const
+    {
+        return f16_bits_to_f32(this->bits);
+    }
+
+    static f16 from_bits(const u16 bits)
+    {
+        f16 ret;
+        ret.bits = bits;
+        return ret;
+    }
+
+    u16 bits;
+};
+
+struct bf16 {
+    bf16() = default;
+
+    bf16(const f32 v)
+    :bits(f32_to_bf16_bits(v))
+    {}
+
+    operator f32() const
+    {
+        return bf16_bits_to_f32(this->bits);
+    }
+
+    static bf16 from_bits(const u16 bits)
+    {
+        bf16 ret;
+        ret.bits = bits;
+        return ret;
+    }
+
+    u16 bits;
+};
+
+static_assert(sizeof(f16) == 2);
+static_assert(sizeof(bf16) == 2);
@@ -1,13 +1,155 @@
 #pragma once
 
+#include "half.h"
+#include "mat_alloc.h"
 #include "random.h"
 #include "types.h"
 
 #include <assert.h>
 #include <memory>
 #include <algorithm>
+#include <type_traits>
 #include <vector>
 
+class thread_pool;
+class task_pool;
+
+/*
+ * How elements of a matrix are laid out in memory, and what its 'stride' is:
+ *
+ *     row_major  (x, y) at x + y * stride, stride elements from row to row
+ *     col_major  (x, y) at y + x * stride, stride elements from column to column
+ *     tiled      square tiles, 'stride' on a side, each row-major, one after
+ *                another in row-major order of the tiles
+ *     morton     same tiles, in Z-order of the tiles
+ *
+ * Z-order interleaves the bits of the tile coordinates, those of x in the
+ * even ones. Any aligned block of 2^l x 2^l tiles is contiguous, and so are
+ * its four quadrants, at every level: recursive algorithms like Strassen get
+ * each subproblem in one piece, whatever the cache sizes. The grid of tiles
+ * is padded up to a power of two square.
+ *
+ * Everything takes row-major matrices, except for the CPU GEMM, Strassen,
+ * add, sub and convert entry points, which take any layout, and mat_copy(),
+ * which converts.
+ */
+enum class mat_layout_e : u8 {
+    row_major,
+    col_major,
+    tiled,
+    morton,
+};
+
+constexpr static const char* mat_layout2str(mat_layout_e layout)
+{
+    switch(layout) {
+    case mat_layout_e::row_major:
+        return "row_major";
+    case mat_layout_e::col_major:
+        return "col_major";
+    case mat_layout_e::tiled:
+        return "tiled";
+    case mat_layout_e::morton:
+        return "morton";
+    }
+
+    __builtin_unreachable();
+
+    return "row_major";
+}
+
+/* Side of the tiles of tiled and Morton matrices, unless asked otherwise. */
+constexpr u32 MAT_LAYOUT_TILE = 64;
+
+/* Bits of 'v' moved to the even bits of the result. */
+constexpr u64 mat_morton_spread(const u32 v)
+{
+    u64 r = v;
+
+    r = (r | r << 16) & 0x0000ffff0000ffffULL;
+    r = (r | r << 8)  & 0x00ff00ff00ff00ffULL;
+    r = (r | r << 4)  & 0x0f0f0f0f0f0f0f0fULL;
+    r = (r | r << 2)  & 0x3333333333333333ULL;
+    r = (r | r << 1)  & 0x5555555555555555ULL;
+
+    return r;
+}
+
+/* Position of tile (x, y) in Z-order. */
+constexpr u64 mat_morton_index(const u32 x, const u32 y)
+{
+    return mat_morton_spread(x) | mat_morton_spread(y) << 1;
+}
+
+constexpr u32 mat_layout_tiles(const u32 size, const u32 tile)
+{
+    return (size + tile - 1) / tile;
+}
+
+/* Offset of element (x, y) of a 'width' wide matrix. */
+constexpr size_t mat_layout_offset(
+    const mat_layout_e layout,
+    const u32 x,
+    const u32 y,
+    const u32 width,
+    const u32 stride
+) {
+    const size_t in_tile = size_t(y % stride) * stride + x % stride;
+    const size_t tile_elems = size_t(stride) * stride;
+
+    switch (layout) {
+    case mat_layout_e::row_major:
+        return x + size_t(y) * stride;
+    case mat_layout_e::col_major:
+        return y + size_t(x) * stride;
+    case mat_layout_e::tiled:
+        return (size_t(y / stride) * mat_layout_tiles(width, stride) + x / stride) * tile_elems + in_tile;
+    case mat_layout_e::morton:
+        return mat_morton_index(x / stride, y / stride) * tile_elems + in_tile;
+    }
+
+    __builtin_unreachable();
+
+    return 0;
+}
+
+/* Elements a (width x height) matrix takes, padding included. */
+constexpr size_t mat_layout_elems(
+    const mat_layout_e layout,
+    const u32 width,
+    const u32 height,
+    const u32 stride
+) {
+    switch (layout) {
+    case mat_layout_e::row_major:
+        return size_t(height) * stride;
+    case mat_layout_e::col_major:
+        return size_t(width) * stride;
+    case mat_layout_e::tiled:
+        return size_t(mat_layout_tiles(width, stride)) * mat_layout_tiles(height, stride) * stride * stride;
+    case mat_layout_e::morton: {
+        const u32 tiles = std::max(mat_layout_tiles(width, stride), mat_layout_tiles(height, stride));
+
+        size_t side = tiles == 0 ? 0 : 1;
+        while (side < tiles)
+            side *= 2;
+
+        return side * side * stride * stride;
+    }
+    }
+
+    __builtin_unreachable();
+
+    return 0;
+}
+
+/* Matrices or views, for entry points taking row-major ones only. */
+template <typename... ViewTypes>
+bool mat_row_major(const ViewTypes&... m)
+{
+    return ((m.layout == mat_layout_e::row_major) && ...);
+}
+
 template<typename ValueType_>
 struct mat_base_t {
     using ValueType = ValueType_;
@@ -15,6 +157,10 @@ struct mat_base_t {
     using ValueCRef = const ValueType&;
     using ValueCPtr = const ValueType*;
     using InitializerType = std::vector<std::vector<ValueType>>;
+    using DataPtr = std::unique_ptr<ValueType[], mat_deleter_t>;
+
+    /* Memory comes from mat_alloc() and is never constructed nor destructed. */
+    static_assert(std::is_trivially_copyable_v<ValueType> && std::is_trivially_destructible_v<ValueType>);
 
     mat_base_t() = default;
 
@@ -23,6 +169,7 @@ struct mat_base_t {
     ,width(other.width)
     ,height(other.height)
     ,stride(other.stride)
+    ,layout(other.layout)
     { }
 
     mat_base_t& operator=(mat_base_t &&other)
@@ -31,6 +178,7 @@ struct mat_base_t {
         this->width = other.width;
         this->height = other.height;
         this->stride = other.stride;
+        this->layout = other.layout;
 
         return *this;
     }
@@ -47,33 +195,54 @@ struct mat_base_t {
                 this->at(x,y) = init[y][x];
     }
 
+    /* Zeroed, padding included. */
     static mat_base_t make_matrix(const u32 width, const u32 height, u32 stride = 0)
     {
-        if (stride == 0)
-            stride = gen_stride(width);
+        return alloc_matrix(width, height, stride, true);
+    }
 
-        assert(stride >= width);
+    /*
+     * Contents are garbage, padding included. For matrices written whole
+     * before being read, saves a pass over their memory.
+     */
+    static mat_base_t make_matrix_uninit(const u32 width, const u32 height, u32 stride = 0)
+    {
+        return alloc_matrix(width, height, stride, false);
+    }
 
-        mat_base_t ret;
+    /* Every element 'value', padding zeroed. */
+    static mat_base_t make_matrix_filled(const u32 width, const u32 height, const ValueType value, u32 stride = 0)
+    {
+        if (value == ValueType(0))
+            return make_matrix(width, height, stride);
 
-        ret.data = std::make_unique<ValueType[]>(stride * height);
-        ret.width = width;
-        ret.height = height;
-        ret.stride = stride;
+        mat_base_t ret = make_matrix_uninit(width, height, stride);
+
+        for (u32 y = 0; y < height; ++y) {
+            ValueType * const row = ret.data.get() + size_t(y) * ret.stride;
+
+            std::fill(row, row + width, value);
+            std::fill(row + width, row + ret.stride, ValueType(0));
+        }
 
         return ret;
     }
 
+    /*
+     * Copy of packed rows at 'data', converted to ValueType and restrided.
+     * Rows of ValueType already are usable in place by a view over them,
+     * matview_base_t(data, width, height, width), see mat_file.h
+     */
     template <typename T>
     static mat_base_t make_matrix_from_data(const T *data, const u32 width, const u32 height, u32 stride = 0)
     {
-        /* TODO: We don't always have to reallocate */
-        mat_base_t ret = make_matrix(width, height, stride);
+        mat_base_t ret = make_matrix_uninit(width, height, stride);
 
         auto src_row = data;
         auto dst_row = ret.data.get();
         for (u32 y = 0; y < height; ++y) {
             std::copy_n(src_row, width, dst_row);
+            std::fill(dst_row + width, dst_row + ret.stride, ValueType(0));
             src_row += width;
             dst_row += ret.stride;
         }
@@ -86,24 +255,73 @@ struct mat_base_t {
         return (width + 15UL) & (~15UL);
     }
 
-    static mat_base_t make_matrix_zero(const u32 width, const u32 height, u32 stride = 0)
-    {
+    /*
+     * Memory is never constructed: every ValueType is trivial, and all bits
+     * zero is a zero of each. Zeroed memory comes from the allocator, which
+     * may get it from the kernel without touching it, see mat_alloc().
+     */
+    static mat_base_t alloc_matrix(
+        const u32 width,
+        const u32 height,
+        u32 stride,
+        const bool zeroed,
+        const mat_layout_e layout = mat_layout_e::row_major
+    ) {
         if (stride == 0)
-            stride = gen_stride(width);
+            stride = default_stride(width, height, layout);
+
+        assert(layout != mat_layout_e::row_major || stride >= width);
+        assert(layout != mat_layout_e::col_major || stride >= height);
+
+        mat_base_t ret;
 
-        mat_base_t ret = make_matrix(width, height, stride);
+        const size_t num_elems = mat_layout_elems(layout, width, height, stride);
+        const mat_allocator_t &allocator = mat_allocator();
+        const mat_block_t block = mat_alloc(allocator, num_elems * sizeof(ValueType), zeroed);
 
-        ret.set_zero();
+        ret.data = DataPtr(static_cast<ValueType*>(block.ptr), mat_deleter_t{ &allocator, block.size_bytes, block.flags });
+        ret.width = width;
+        ret.height = height;
+        ret.stride = stride;
+        ret.layout = layout;
 
         return ret;
     }
 
-    static mat_base_t make_matrix_random(const u32 width, const u32 height, u32 stride = 0)
+    static u32 default_stride(const u32 width, const u32 height, const mat_layout_e layout)
     {
-        if (stride == 0)
-            stride = gen_stride(width);
+        switch (layout) {
+        case mat_layout_e::row_major:
+            return gen_stride(width);
+        case mat_layout_e::col_major:
+            return gen_stride(height);
+        case mat_layout_e::tiled:
+        case mat_layout_e::morton:
+            return MAT_LAYOUT_TILE;
+        }
 
-        mat_base_t ret = make_matrix(width, height, stride);
+        __builtin_unreachable();
+
+        return 0;
+    }
+
+    /*
+     * Zeroed, in 'layout'. 'stride' is the tile side of tiled and Morton
+     * matrices, MAT_LAYOUT_TILE if 0. Convert with mat_copy().
+     */
+    static mat_base_t make_matrix_layout(const u32 width, const u32 height, const mat_layout_e layout, u32 stride = 0)
+    {
+        return alloc_matrix(width, height, stride, true, layout);
+    }
+
+    static mat_base_t make_matrix_zero(const u32 width, const u32 height, u32 stride = 0)
+    {
+        return make_matrix(width, height, stride);
+    }
+
+    static mat_base_t make_matrix_random(const u32 width, const u32 height, u32 stride = 0)
+    {
+        mat_base_t ret = make_matrix_uninit(width, height, stride);
 
         ret.set_random();
 
@@ -113,12 +331,20 @@ struct mat_base_t {
     static bool has_fractional_part(const ValueType v)
     {
         if constexpr (std::is_floating_point_v<ValueType>)
+            return v != ValueType(i64(v));
+        else
             return false;
+    }
 
-        ValueType dummy;
-        modf(v, &dummy);
-
-        return v == 0.0f || v == -0.0f;
+    /*
+     * Each element from its own random bits, those of an integer of its size,
+     * so the bits come from memset_random() all at once.
+     */
+    static u32 random_bits(const ValueType &v)
+    {
+        u32 ret = 0;
+        __builtin_memcpy(&ret, &v, sizeof(v) < sizeof(ret) ? sizeof(v) : sizeof(ret));
+        return ret;
     }
 
     static mat_base_t make_matrix_in_range(
@@ -128,13 +354,18 @@ struct mat_base_t {
         ValueType low,
         ValueType high
     ) {
-        if (stride == 0)
-            stride = gen_stride(width);
+        assert(high > low);
+        assert(!has_fractional_part(high));
+        assert(!has_fractional_part(low));
 
-        mat_base_t ret = make_matrix(width, height, stride);
+        const auto rand_gap = static_cast<int>(high - low);
+
+        mat_base_t ret = make_matrix_uninit(width, height, stride);
+
+        ret.set_random();
 
         for (u32 y = 0; y < height; ++y) {
-            for (u32 x = 0; x < stride; ++x) {
+            for (u32 x = 0; x < ret.stride; ++x) {
                 ValueType *p = &ret.data.get()[x + y * ret.stride];
 
                 if (x >= width) {
@@ -142,17 +373,13 @@ struct mat_base_t {
                     continue;
                 }
 
-                assert(high > low);
-                assert(!has_fractional_part(high));
-                assert(!has_fractional_part(low));
-
-                const auto rand_gap = static_cast<int>(high - low);
+                const u32 bits = random_bits(*p);
 
                 if constexpr (std::is_floating_point_v<ValueType>) {
-                    const auto rand_0_1 = static_cast<ValueType>(rand() % 1024) / static_cast<ValueType>(1024.0f);
+                    const auto rand_0_1 = static_cast<ValueType>(bits % 1024) / static_cast<ValueType>(1024.0f);
                     *p = (rand_gap * rand_0_1) + low;
                 } else {
-                    *p = (rand() % rand_gap) + low;
+                    *p = (bits % rand_gap) + low;
                 }
             }
         }
@@ -162,7 +389,7 @@ struct mat_base_t {
 
     size_t num_elems() const
     {
-        return this->height * this->stride;
+        return mat_layout_elems(this->layout, this->width, this->height, this->stride);
     }
 
     size_t size_bytes() const
@@ -175,19 +402,27 @@ struct mat_base_t {
         std::fill(this->data.get(), this->data.get() + this->num_elems(), 0);
     }
 
-    void set_random()
+    void set_random(thread_pool *pool = nullptr)
     {
-        memset_random(this->data.get(), this->num_elems() * sizeof(ValueType));
+        memset_random(this->data.get(), this->size_bytes(), pool);
+    }
+
+    size_t offset(u32 x, u32 y) const
+    {
+        if (this->layout == mat_layout_e::row_major)
+            return x + size_t(y) * this->stride;
+
+        return mat_layout_offset(this->layout, x, y, this->width, this->stride);
     }
 
     ValueRef at(u32 x, u32 y)
     {
-        return this->data[y * this->stride + x];
+        return this->data[this->offset(x, y)];
     }
 
     ValueCRef at(u32 x, u32 y) const
     {
-        return this->data[y * this->stride + x];
+        return this->data[this->offset(x, y)];
     }
 
 #if __cplusplus >= 202300L
@@ -202,14 +437,20 @@ struct mat_base_t {
     }
 #endif
 
-    std::unique_ptr<ValueType[]> data;
+    DataPtr data;
     u32 width;
     u32 height;
     u32 stride;
+    mat_layout_e layout = mat_layout_e::row_major;
 };
 
 using mat_i64_t = mat_base_t<i64>;
 using mat_f32_t = mat_base_t<f32>;
+using mat_f16_t = mat_base_t<f16>;
+using mat_bf16_t = mat_base_t<bf16>;
+using mat_i32_t = mat_base_t<i32>;
+using mat_u8_t = mat_base_t<u8>;
+using mat_i8_t = mat_base_t<i8>;
 
 template<typename ParentType_>
 struct matview_base_t {
@@ -224,6 +465,7 @@ struct matview_base_t {
     , width(0)
     , height(0)
     , stride(0)
+    , layout(mat_layout_e::row_major)
     {}
 
     matview_base_t(const matview_base_t &other) = default;
@@ -236,23 +478,39 @@ struct matview_base_t {
     ,width(m.width)
     ,height(m.height)
     ,stride(m.stride)
+    ,layout(m.layout)
     {}
 
-    constexpr matview_base_t(ValuePtr data, u32 width, u32 height, u32 stride)
+    constexpr matview_base_t(
+        ValuePtr data,
+        u32 width,
+        u32 height,
+        u32 stride,
+        mat_layout_e layout = mat_layout_e::row_major
+    )
     :data(data)
     ,width(width)
     ,height(height)
     ,stride(stride)
+    ,layout(layout)
     {}
 
+    size_t offset(u32 x, u32 y) const
+    {
+        if (this->layout == mat_layout_e::row_major)
+            return x + size_t(y) * this->stride;
+
+        return mat_layout_offset(this->layout, x, y, this->width, this->stride);
+    }
+
     ValueRef at(u32 x, u32 y)
     {
-        return this->data[y * this->stride + x];
+        return this->data[this->offset(x, y)];
     }
 
     ValueCRef at(u32 x, u32 y) const
     {
-        return this->data[y * this->stride + x];
+        return this->data[this->offset(x, y)];
     }
 
 #if __cplusplus >= 202300L
@@ -269,7 +527,7 @@ struct matview_base_t {
 
     size_t num_elems() const
     {
-        return this->height * this->stride;
+        return mat_layout_elems(this->layout, this->width, this->height, this->stride);
     }
 
     size_t size_bytes() const
@@ -281,23 +539,48 @@ struct matview_base_t {
     u32 width;
     u32 height;
     u32 stride;
+    mat_layout_e layout;
 };
 
 using matview_i64_t = matview_base_t<mat_i64_t>;
 using matview_f32_t = matview_base_t<mat_f32_t>;
+using matview_f16_t = matview_base_t<mat_f16_t>;
+using matview_bf16_t = matview_base_t<mat_bf16_t>;
+using matview_i32_t = matview_base_t<mat_i32_t>;
+using matview_u8_t = matview_base_t<mat_u8_t>;
+using matview_i8_t = matview_base_t<mat_i8_t>;
 
 enum class mat_type_e {
     i64,
     f32,
+    f16,
+    bf16,
 };
 
+constexpr size_t mat_type_size(const mat_type_e type)
+{
+    switch(type) {
+    case mat_type_e::i64:
+        return sizeof(i64);
+    case mat_type_e::f32:
+        return sizeof(f32);
+    case mat_type_e::f16:
+        return sizeof(f16);
+    case mat_type_e::bf16:
+        return sizeof(bf16);
+    }
+
+    __builtin_unreachable();
+}
+
 template<> struct matview_base_t<void> {
-    constexpr matview_base_t(void *d, u32 w, u32 h, u32 s, mat_type_e t)
+    constexpr matview_base_t(void *d, u32 w, u32 h, u32 s, mat_type_e t, mat_layout_e l = mat_layout_e::row_major)
     :data(d)
     ,width(w)
     ,height(h)
     ,stride(s)
     ,type(t)
+    ,layout(l)
     {}
 
     matview_base_t(mat_i64_t &m)
@@ -306,6 +589,7 @@ template<> struct matview_base_t<void> {
     ,height(m.height)
     ,stride(m.stride)
     ,type(mat_type_e::i64)
+    ,layout(m.layout)
     {}
 
     constexpr matview_base_t(matview_i64_t mv)
@@ -314,6 +598,7 @@ template<> struct matview_base_t<void> {
     ,height(mv.height)
     ,stride(mv.stride)
     ,type(mat_type_e::i64)
+    ,layout(mv.layout)
     {}
 
     matview_base_t(mat_f32_t &m)
@@ -322,6 +607,7 @@ template<> struct matview_base_t<void> {
     ,height(m.height)
     ,stride(m.stride)
     ,type(mat_type_e::f32)
+    ,layout(m.layout)
     {}
 
     constexpr matview_base_t(matview_f32_t mv)
@@ -330,23 +616,53 @@ template<> struct matview_base_t<void> {
     ,height(mv.height)
     ,stride(mv.stride)
     ,type(mat_type_e::f32)
+    ,layout(mv.layout)
+    {}
+
+    matview_base_t(mat_f16_t &m)
+    :data(m.data.get())
+    ,width(m.width)
+    ,height(m.height)
+    ,stride(m.stride)
+    ,type(mat_type_e::f16)
+    ,layout(m.layout)
+    {}
+
+    constexpr matview_base_t(matview_f16_t mv)
+    :data(mv.data)
+    ,width(mv.width)
+    ,height(mv.height)
+    ,stride(mv.stride)
+    ,type(mat_type_e::f16)
+    ,layout(mv.layout)
+    {}
+
+    matview_base_t(mat_bf16_t &m)
+    :data(m.data.get())
+    ,width(m.width)
+    ,height(m.height)
+    ,stride(m.stride)
+    ,type(mat_type_e::bf16)
+    ,layout(m.layout)
+    {}
+
+    constexpr matview_base_t(matview_bf16_t mv)
+    :data(mv.data)
+    ,width(mv.width)
+    ,height(mv.height)
+    ,stride(mv.stride)
+    ,type(mat_type_e::bf16)
+    ,layout(mv.layout)
     {}
 
     size_t num_elems() const
     {
-        return this->height * this->stride;
+        return mat_layout_elems(this->layout, this->width, this->height, this->stride);
     }
 
     size_t size_bytes() const
     {
-        switch(this->type) {
-        case mat_type_e::i64:
-            return this->num_elems() * sizeof(i64);
-        case mat_type_e::f32:
-            return this->num_elems() * sizeof(f32);
-        }
-
-        __builtin_unreachable();
+        return this->num_elems() * mat_type_size(this->type);
     }
 
     void *data;
@@ -354,6 +670,7 @@ template<> struct matview_base_t<void> {
     u32 height;
     u32 stride;
     mat_type_e type;
+    mat_layout_e layout;
 };
 
 using matview_void_t = matview_base_t<void>;
@@ -364,6 +681,160 @@ constexpr bool mat_dim_match(MatViewType m0, MatViewType m1)
     return m0.width == m1.width && m0.height == m1.height;
 }
 
+/*
+ * Memory used by the CPU Strassen variants for their temporaries.
+ * Peak is bounded by the workspace size, which is computed before the run.
+ */
+struct strassen_stats_t {
+    size_t workspace_bytes;
+    size_t peak_bytes;
+    u32 depth; /* Recursion levels above the base case GEMM. */
+};
+
+/*
+ * Operands of a product used transposed. They are read in the order they are
+ * stored, no transposed copy is made. Flags combine, lhs | rhs is both.
+ */
+enum class mat_trans_e : u8 {
+    none = 0,
+    lhs  = 1 << 0,
+    rhs  = 1 << 1,
+    both = lhs | rhs,
+};
+
+constexpr mat_trans_e operator|(const mat_trans_e a, const mat_trans_e b)
+{
+    return mat_trans_e(u8(a) | u8(b));
+}
+
+constexpr bool mat_trans_lhs(const mat_trans_e trans)
+{
+    return u8(trans) & u8(mat_trans_e::lhs);
+}
+
+constexpr bool mat_trans_rhs(const mat_trans_e trans)
+{
+    return u8(trans) & u8(mat_trans_e::rhs);
+}
+
+/*
+ * Affine quantized matrix. Element (x, y) stands for the real value
+ *
+ *     scale * (q[x, y] - zero_point)
+ *
+ * with a single scale and zero point for the whole matrix, or one per row.
+ */
+template <typename MatrixType>
+struct mat_quant_t {
+    MatrixType q;
+    std::vector<f32> scale;
+    std::vector<i32> zero_point;
+};
+
+template <typename ViewType>
+struct matview_quant_t {
+    matview_quant_t(
+        const ViewType q,
+        const f32 *scale,
+        const i32 *zero_point,
+        const bool per_row
+    )
+    :q(q)
+    ,scale(scale)
+    ,zero_point(zero_point)
+    ,per_row(per_row)
+    {}
+
+    matview_quant_t(const mat_quant_t<typename ViewType::ParentType> &m)
+    :q(m.q)
+    ,scale(m.scale.data())
+    ,zero_point(m.zero_point.data())
+    ,per_row(m.scale.size() > 1)
+    {}
+
+    f32 row_scale(const u32 y) const
+    {
+        return this->scale[this->per_row ? y : 0];
+    }
+
+    i32 row_zero_point(const u32 y) const
+    {
+        return this->zero_point[this->per_row ? y : 0];
+    }
+
+    ViewType q;
+    const f32 *scale;
+    const i32 *zero_point;
+    bool per_row; /* q.height entries in 'scale' and 'zero_point', otherwise one. */
+};
+
+using mat_quant_u8_t = mat_quant_t<mat_u8_t>;
+using mat_quant_i8_t = mat_quant_t<mat_i8_t>;
+using matview_quant_u8_t = matview_quant_t<matview_u8_t>;
+using matview_quant_i8_t = matview_quant_t<matview_i8_t>;
+
+/*
+ * One product of a batch, out = lhs @ rhs. 'out' has to be correctly sized.
+ */
+template <typename ViewType>
+struct mat_mul_batch_entry_t {
+    ViewType lhs;
+    ViewType rhs;
+    ViewType out;
+};
+
+using mat_mul_batch_i64_t = mat_mul_batch_entry_t<matview_i64_t>;
+using mat_mul_batch_f32_t = mat_mul_batch_entry_t<matview_f32_t>;
+
+/*
+ * *_batched() run many independent products as one submission: the CPU
+ * variant spreads whole products across the threads of the pool, the OpenCL
+ * one uploads all operands at once and runs a single NDRange. Meant for lots
+ * of small products, where per call setup would dominate.
+ */
+
+/*
+ * mat_rank1_cpu_into() computes the outer product update
+ *
+ *     dst += alpha * x @ y^T
+ *
+ * where 'x' has dst.height and 'y' dst.width elements, either of them a row
+ * or a column vector. The usual weight gradient step.
+ *
+ * Products where one of the operands is a vector are detected by every CPU
+ * GEMM entry point and computed by the bandwidth bound GEMV instead.
+ */
+
+/*
+ * *_into() variants write into a caller provided 'dst' instead of returning
+ * a new matrix, so calling them in a loop doesn't allocate on the heap.
+ * 'dst' has to be correctly sized already. Products compute:
+ *
+ *     dst = alpha * lhs @ rhs + beta * dst
+ *
+ * where lhs and rhs are transposed first, if 'trans' says so.
+ *
+ * With beta == 0 (the default) 'dst' is only written, never read. 'dst' of
+ * a product must not overlap 'lhs' or 'rhs'.
+ *
+ * GPU variants return non-zero on failure.
+ */
+
+/*
+ * CPU products take operands and 'dst' in any layout, see mat_layout_e.
+ * Column-major ones are used in place, as transposes of row-major ones: the
+ * GEMM packs its operands anyway, and reads them as they are stored. Tiled
+ * and Morton ones are copied to row-major temporaries first. Strassen has no
+ * use for transposes: unless all of them are row-major, strassen_cpu() runs
+ * on Morton copies of all of them when the product is close to a cube, on
+ * row-major copies otherwise, as the other variants do. Products too thin to
+ * split go straight to the GEMM.
+ *
+ * Element-wise ones, additions, subtractions and mat_convert(), run on
+ * row-major copies of whichever operands aren't row-major.
+ *
+ * mat_copy() copies between any two layouts.
+ */
 
 /*
  * I32 API
@@ -372,17 +843,57 @@ constexpr bool mat_dim_match(MatViewType m0, MatViewType m1)
 mat_i64_t mat_add_cpu(matview_i64_t lhs, matview_i64_t rhs);
 mat_i64_t mat_sub_cpu(matview_i64_t lhs, matview_i64_t rhs);
 mat_i64_t mat_mul_cpu(matview_i64_t lhs, matview_i64_t rhs);
+mat_i64_t mat_mul_cpu_naive(matview_i64_t lhs, matview_i64_t rhs);
+mat_i64_t mat_mul_cpu_parallel(matview_i64_t lhs, matview_i64_t rhs, thread_pool *pool = nullptr);
 void mat_copy(matview_i64_t dst, matview_i64_t src);
 
-mat_i64_t strassen_cpu(matview_i64_t lhs, matview_i64_t rhs);
+void mat_add_cpu_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs);
+void mat_sub_cpu_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs);
+void mat_mul_cpu_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs, i64 alpha = 1, i64 beta = 0, mat_trans_e trans = mat_trans_e::none);
+void mat_mul_cpu_naive_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs, i64 alpha = 1, i64 beta = 0, mat_trans_e trans = mat_trans_e::none);
+void mat_mul_cpu_parallel_into(
+    matview_i64_t dst,
+    matview_i64_t lhs,
+    matview_i64_t rhs,
+    i64 alpha = 1,
+    i64 beta = 0,
+    mat_trans_e trans = mat_trans_e::none,
+    thread_pool *pool = nullptr
+);
+void mat_mul_cpu_batched(const mat_mul_batch_i64_t *batch, size_t count, thread_pool *pool = nullptr);
+void mat_rank1_cpu_into(matview_i64_t dst, matview_i64_t x, matview_i64_t y, i64 alpha = 1, thread_pool *pool = nullptr);
+
+mat_i64_t strassen_cpu(matview_i64_t lhs, matview_i64_t rhs, strassen_stats_t *stats = nullptr);
+mat_i64_t strassen_winograd_cpu(matview_i64_t lhs, matview_i64_t rhs, strassen_stats_t *stats = nullptr);
+mat_i64_t strassen_cpu_parallel(matview_i64_t lhs, matview_i64_t rhs, task_pool *pool = nullptr, strassen_stats_t *stats = nullptr);
+mat_i64_t strassen_cpu_naive(matview_i64_t lhs, matview_i64_t rhs);
+
+void strassen_cpu_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs, i64 alpha = 1, i64 beta = 0, strassen_stats_t *stats = nullptr);
+void strassen_winograd_cpu_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs, i64 alpha = 1, i64 beta = 0, strassen_stats_t *stats = nullptr);
+void strassen_cpu_parallel_into(
+    matview_i64_t dst,
+    matview_i64_t lhs,
+    matview_i64_t rhs,
+    i64 alpha = 1,
+    i64 beta = 0,
+    task_pool *pool = nullptr,
+    strassen_stats_t *stats = nullptr
+);
 
 mat_i64_t mat_mul_cl(matview_i64_t lhs, matview_i64_t rhs);
+int mat_mul_cl_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs, i64 alpha = 1, i64 beta = 0, mat_trans_e trans = mat_trans_e::none);
+int mat_mul_cl_batched(const mat_mul_batch_i64_t *batch, size_t count);
 
 mat_i64_t mat_mul_cu(matview_i64_t lhs, matview_i64_t rhs);
 mat_i64_t mat_mul_cu_umem_tiled(matview_i64_t lhs, matview_i64_t rhs);
 mat_i64_t mat_mul_cu_tiled(matview_i64_t lhs, matview_i64_t rhs);
 mat_i64_t mat_mul_cu_tiled_input(matview_i64_t lhs, matview_i64_t rhs);
 mat_i64_t mat_mul_cu_test(matview_i64_t lhs, matview_i64_t rhs);
+int mat_mul_cu_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs, i64 alpha = 1, i64 beta = 0);
+int mat_mul_cu_umem_tiled_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs, i64 alpha = 1, i64 beta = 0);
+int mat_mul_cu_tiled_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs, i64 alpha = 1, i64 beta = 0);
+int mat_mul_cu_tiled_input_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs, i64 alpha = 1, i64 beta = 0);
+int mat_mul_cu_test_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs, i64 alpha = 1, i64 beta = 0);
 
 
 /*
@@ -392,14 +903,125 @@ mat_i64_t mat_mul_cu_test(matview_i64_t lhs, matview_i64_t rhs);
 mat_f32_t mat_add_cpu(matview_f32_t lhs, matview_f32_t rhs);
 mat_f32_t mat_sub_cpu(matview_f32_t lhs, matview_f32_t rhs);
 mat_f32_t mat_mul_cpu(matview_f32_t lhs, matview_f32_t rhs);
+mat_f32_t mat_mul_cpu_naive(matview_f32_t lhs, matview_f32_t rhs);
+mat_f32_t mat_mul_cpu_parallel(matview_f32_t lhs, matview_f32_t rhs, thread_pool *pool = nullptr);
 void mat_copy(matview_f32_t dst, matview_f32_t src);
 
-mat_f32_t strassen_cpu(matview_f32_t lhs, matview_f32_t rhs);
+void mat_add_cpu_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs);
+void mat_sub_cpu_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs);
+void mat_mul_cpu_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs, f32 alpha = 1, f32 beta = 0, mat_trans_e trans = mat_trans_e::none);
+void mat_mul_cpu_naive_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs, f32 alpha = 1, f32 beta = 0, mat_trans_e trans = mat_trans_e::none);
+void mat_mul_cpu_parallel_into(
+    matview_f32_t dst,
+    matview_f32_t lhs,
+    matview_f32_t rhs,
+    f32 alpha = 1,
+    f32 beta = 0,
+    mat_trans_e trans = mat_trans_e::none,
+    thread_pool *pool = nullptr
+);
+void mat_mul_cpu_batched(const mat_mul_batch_f32_t *batch, size_t count, thread_pool *pool = nullptr);
+void mat_rank1_cpu_into(matview_f32_t dst, matview_f32_t x, matview_f32_t y, f32 alpha = 1, thread_pool *pool = nullptr);
+
+mat_f32_t strassen_cpu(matview_f32_t lhs, matview_f32_t rhs, strassen_stats_t *stats = nullptr);
+mat_f32_t strassen_winograd_cpu(matview_f32_t lhs, matview_f32_t rhs, strassen_stats_t *stats = nullptr);
+mat_f32_t strassen_cpu_parallel(matview_f32_t lhs, matview_f32_t rhs, task_pool *pool = nullptr, strassen_stats_t *stats = nullptr);
+mat_f32_t strassen_cpu_naive(matview_f32_t lhs, matview_f32_t rhs);
+
+void strassen_cpu_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs, f32 alpha = 1, f32 beta = 0, strassen_stats_t *stats = nullptr);
+void strassen_winograd_cpu_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs, f32 alpha = 1, f32 beta = 0, strassen_stats_t *stats = nullptr);
+void strassen_cpu_parallel_into(
+    matview_f32_t dst,
+    matview_f32_t lhs,
+    matview_f32_t rhs,
+    f32 alpha = 1,
+    f32 beta = 0,
+    task_pool *pool = nullptr,
+    strassen_stats_t *stats = nullptr
+);
 
 mat_f32_t mat_mul_cl(matview_f32_t lhs, matview_f32_t rhs);
+int mat_mul_cl_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs, f32 alpha = 1, f32 beta = 0, mat_trans_e trans = mat_trans_e::none);
+int mat_mul_cl_batched(const mat_mul_batch_f32_t *batch, size_t count);
 
 mat_f32_t mat_mul_cu(matview_f32_t lhs, matview_f32_t rhs);
 mat_f32_t mat_mul_cu_umem_tiled(matview_f32_t lhs, matview_f32_t rhs);
 mat_f32_t mat_mul_cu_tiled(matview_f32_t lhs, matview_f32_t rhs);
 mat_f32_t mat_mul_cu_tiled_input(matview_f32_t lhs, matview_f32_t rhs);
 mat_f32_t mat_mul_cu_test(matview_f32_t lhs, matview_f32_t rhs);
+int mat_mul_cu_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs, f32 alpha = 1, f32 beta = 0);
+int mat_mul_cu_umem_tiled_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs, f32 alpha = 1, f32 beta = 0);
+int mat_mul_cu_tiled_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs, f32 alpha = 1, f32 beta = 0);
+int mat_mul_cu_tiled_input_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs, f32 alpha = 1, f32 beta = 0);
+int mat_mul_cu_test_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs, f32 alpha = 1, f32 beta = 0);
+
+
+/*
+ * F16 and BF16 API
+ *
+ * Half width storage, see half.h. Products load half width operands and
+ * accumulate in f32, results are f32. Convert them back with mat_convert(),
+ * if they have to be stored half width too.
+ */
+
+void mat_convert(matview_f16_t dst, matview_f32_t src);
+void mat_convert(matview_f32_t dst, matview_f16_t src);
+void mat_convert(matview_bf16_t dst, matview_f32_t src);
+void mat_convert(matview_f32_t dst, matview_bf16_t src);
+void mat_copy(matview_f16_t dst, matview_f16_t src);
+void mat_copy(matview_bf16_t dst, matview_bf16_t src);
+
+mat_f32_t mat_mul_cpu(matview_f16_t lhs, matview_f16_t rhs);
+mat_f32_t mat_mul_cpu(matview_bf16_t lhs, matview_bf16_t rhs);
+
+void mat_mul_cpu_into(matview_f32_t dst, matview_f16_t lhs, matview_f16_t rhs, f32 alpha = 1, f32 beta = 0, mat_trans_e trans = mat_trans_e::none);
+void mat_mul_cpu_into(matview_f32_t dst, matview_bf16_t lhs, matview_bf16_t rhs, f32 alpha = 1, f32 beta = 0, mat_trans_e trans = mat_trans_e::none);
+void mat_mul_cpu_parallel_into(
+    matview_f32_t dst,
+    matview_f16_t lhs,
+    matview_f16_t rhs,
+    f32 alpha = 1,
+    f32 beta = 0,
+    mat_trans_e trans = mat_trans_e::none,
+    thread_pool *pool = nullptr
+);
+void mat_mul_cpu_parallel_into(
+    matview_f32_t dst,
+    matview_bf16_t lhs,
+    matview_bf16_t rhs,
+    f32 alpha = 1,
+    f32 beta = 0,
+    mat_trans_e trans = mat_trans_e::none,
+    thread_pool *pool = nullptr
+);
+
+mat_f32_t mat_mul_cl(matview_f16_t lhs, matview_f16_t rhs);
+mat_f32_t mat_mul_cl(matview_bf16_t lhs, matview_bf16_t rhs);
+int mat_mul_cl_into(matview_f32_t dst, matview_f16_t lhs, matview_f16_t rhs, f32 alpha = 1, f32 beta = 0, mat_trans_e trans = mat_trans_e::none);
+int mat_mul_cl_into(matview_f32_t dst, matview_bf16_t lhs, matview_bf16_t rhs, f32 alpha = 1, f32 beta = 0, mat_trans_e trans = mat_trans_e::none);
+
+
+/*
+ * Quantized API
+ *
+ * Products of u8 lhs (activations) and i8 rhs (weights), accumulated exactly
+ * in i32, for K up to 65793. Zero points are subtracted after the product,
+ * from row and column sums of the operands, so they cost O(n^2) only.
+ *
+ * Per row parameters have to follow the rows or columns of the product, the
+ * sum over K can't be scaled otherwise: rows of lhs, and rows of rhs only if
+ * it is used transposed, which is how weights are usually stored anyway.
+ *
+ * The i32 product ignores zero points and scales. The f32 one produces real
+ * values, the i8 one requantizes them with the scale and zero point of 'dst'.
+ */
+
+/* Scale and zero point from the range of values, of each row if 'per_row'. */
+mat_quant_u8_t mat_quantize_u8(matview_f32_t src, bool per_row = false);
+mat_quant_i8_t mat_quantize_i8(matview_f32_t src, bool per_row = false);
+void mat_dequantize(matview_f32_t dst, matview_quant_u8_t src);
+void mat_dequantize(matview_f32_t dst, matview_quant_i8_t src);
+
+void mat_mul_cpu_into(matview_i32_t dst, matview_u8_t lhs, matview_i8_t rhs, mat_trans_e trans = mat_trans_e::none);
+void mat_mul_cpu_into(matview_f32_t dst, matview_quant_u8_t lhs, matview_quant_i8_t rhs, mat_trans_e trans = mat_trans_e::none);
+void mat_mul_cpu_into(matview_quant_i8_t dst, matview_quant_u8_t lhs, matview_quant_i8_t rhs, mat_trans_e trans = mat_trans_e::none);
@@ -0,0 +1,539 @@
+#include "mat_alloc.h"
+#include "panic.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <mutex>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+/* Huge page size on x86-64, the one both THP and the default hugetlb pool use. */
+constexpr size_t MAT_HUGE_PAGE_SIZE = 2 << 20;
+
+static size_t round_up(const size_t size, const size_t alignment)
+{
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+static size_t page_size()
+{
+    static const size_t size = sysconf(_SC_PAGESIZE);
+
+    return size;
+}
+
+static mat_block_t mat_alloc_default(const mat_allocator_t *self, size_t size_bytes, bool zeroed);
+static void mat_free_default(const mat_allocator_t *self, const mat_block_t &block);
+
+namespace {
+
+const mat_allocator_t default_allocator = {
+    .alloc = mat_alloc_default,
+    .free = mat_free_default,
+    .ctx = nullptr,
+};
+
+/* All constant initialized, matrices may be allocated by static constructors. */
+struct {
+    std::atomic<const mat_allocator_t*> allocator = &default_allocator;
+
+    std::mutex config_mtx;
+    mat_alloc_config_t config;
+
+    std::atomic<u64> num_allocs = 0;
+    std::atomic<u64> num_frees = 0;
+    std::atomic<u64> num_huge = 0;
+    std::atomic<u64> bytes_total = 0;
+    std::atomic<u64> bytes_live = 0;
+    std::atomic<u64> bytes_peak = 0;
+    std::atomic<u64> bytes_memset = 0;
+} context_alloc;
+
+}
+
+int mat_huge_pages_from_str(const char * const s, mat_huge_pages_e &out)
+{
+    for (const auto mode: {mat_huge_pages_e::none, mat_huge_pages_e::transparent, mat_huge_pages_e::hugetlb}) {
+        if (strcmp(s, mat_huge_pages2str(mode)) == 0) {
+            out = mode;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Fresh anonymous pages, 'size' a multiple of the page size. Mapped
+ * 'alignment' bigger and trimmed if pages are not aligned enough.
+ */
+static void* mmap_aligned(const size_t size, const size_t alignment)
+{
+    const size_t extra = alignment > page_size() ? alignment : 0;
+
+    void *p = mmap(nullptr, size + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED)
+        return nullptr;
+
+    if (extra == 0)
+        return p;
+
+    u8 * const raw = static_cast<u8*>(p);
+    u8 * const aligned = reinterpret_cast<u8*>(round_up(reinterpret_cast<uintptr_t>(raw), alignment));
+    const size_t head = aligned - raw;
+
+    if (head != 0)
+        munmap(raw, head);
+
+    if (extra - head != 0)
+        munmap(aligned + size, extra - head);
+
+    return aligned;
+}
+
+static mat_block_t mat_alloc_default(const mat_allocator_t *, const size_t size_bytes, const bool zeroed)
+{
+    const mat_alloc_config_t config = mat_alloc_config();
+    const bool huge = config.huge_pages != mat_huge_pages_e::none && size_bytes >= config.huge_pages_min_bytes;
+
+    if (huge && config.huge_pages == mat_huge_pages_e::hugetlb) {
+        void *p = mmap(
+            nullptr,
+            round_up(size_bytes, MAT_HUGE_PAGE_SIZE),
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+            -1,
+            0
+        );
+
+        if (p != MAP_FAILED)
+            return { p, size_bytes, MAT_BLOCK_HUGE_PAGES | MAT_BLOCK_HUGETLB | MAT_BLOCK_ZEROED };
+
+        /* No pages reserved (vm.nr_hugepages), or all taken. */
+    }
+
+    /* Huge page aligned, or the first and last pages of the matrix could never be huge ones. */
+    const size_t alignment = huge ? std::max(config.alignment, MAT_HUGE_PAGE_SIZE) : config.alignment;
+
+    /*
+     * The kernel hands out zeroed pages anyway, and only when first touched:
+     * asking for them directly saves clearing the whole matrix up front,
+     * after malloc() may have recycled dirty memory.
+     */
+    if (zeroed && size_bytes >= config.zeroed_mmap_min_bytes) {
+        const size_t size = round_up(std::max(size_bytes, size_t(1)), page_size());
+        void *p = mmap_aligned(size, alignment);
+
+        if (p) {
+            u32 flags = MAT_BLOCK_ZEROED | MAT_BLOCK_MMAP;
+
+            if (huge && madvise(p, size, MADV_HUGEPAGE) == 0)
+                flags |= MAT_BLOCK_HUGE_PAGES;
+
+            return { p, size_bytes, flags };
+        }
+    }
+
+    const size_t size = round_up(std::max(size_bytes, size_t(1)), alignment);
+
+    void *p = aligned_alloc(alignment, size);
+    u32 flags = 0;
+
+    if (p && huge && madvise(p, size, MADV_HUGEPAGE) == 0)
+        flags |= MAT_BLOCK_HUGE_PAGES;
+
+    return { p, size_bytes, flags };
+}
+
+static void mat_free_default(const mat_allocator_t *, const mat_block_t &block)
+{
+    if (block.flags & MAT_BLOCK_HUGETLB)
+        munmap(block.ptr, round_up(block.size_bytes, MAT_HUGE_PAGE_SIZE));
+    else if (block.flags & MAT_BLOCK_MMAP)
+        munmap(block.ptr, round_up(std::max(block.size_bytes, size_t(1)), page_size()));
+    else
+        free(block.ptr);
+}
+
+void mat_allocator_set(const mat_allocator_t *allocator)
+{
+    context_alloc.allocator.store(allocator ? allocator : &default_allocator, std::memory_order_relaxed);
+}
+
+const mat_allocator_t& mat_allocator()
+{
+    return *context_alloc.allocator.load(std::memory_order_relaxed);
+}
+
+const mat_allocator_t& mat_allocator_default()
+{
+    return default_allocator;
+}
+
+void mat_alloc_configure(const mat_alloc_config_t &config)
+{
+    assert((config.alignment & (config.alignment - 1)) == 0);
+
+    std::lock_guard lck(context_alloc.config_mtx);
+    context_alloc.config = config;
+}
+
+mat_alloc_config_t mat_alloc_config()
+{
+    std::lock_guard lck(context_alloc.config_mtx);
+    return context_alloc.config;
+}
+
+mat_alloc_stats_t mat_alloc_stats()
+{
+    return {
+        .num_allocs = context_alloc.num_allocs.load(std::memory_order_relaxed),
+        .num_frees = context_alloc.num_frees.load(std::memory_order_relaxed),
+        .num_huge = context_alloc.num_huge.load(std::memory_order_relaxed),
+        .bytes_total = context_alloc.bytes_total.load(std::memory_order_relaxed),
+        .bytes_live = context_alloc.bytes_live.load(std::memory_order_relaxed),
+        .bytes_peak = context_alloc.bytes_peak.load(std::memory_order_relaxed),
+        .bytes_memset = context_alloc.bytes_memset.load(std::memory_order_relaxed),
+    };
+}
+
+void mat_alloc_stats_reset()
+{
+    /* Live bytes stay, matrices still alive will be freed later. */
+    context_alloc.num_allocs.store(0, std::memory_order_relaxed);
+    context_alloc.num_frees.store(0, std::memory_order_relaxed);
+    context_alloc.num_huge.store(0, std::memory_order_relaxed);
+    context_alloc.bytes_total.store(0, std::memory_order_relaxed);
+    context_alloc.bytes_memset.store(0, std::memory_order_relaxed);
+    context_alloc.bytes_peak.store(context_alloc.bytes_live.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+mat_block_t mat_alloc(const mat_allocator_t &allocator, const size_t size_bytes, const bool zeroed)
+{
+    const mat_block_t block = allocator.alloc(&allocator, size_bytes, zeroed);
+
+    if (!block.ptr)
+        panic("Failed to allocate %zu bytes for a matrix\n", size_bytes);
+
+    if (zeroed && !(block.flags & MAT_BLOCK_ZEROED)) {
+        memset(block.ptr, 0, size_bytes);
+        context_alloc.bytes_memset.fetch_add(size_bytes, std::memory_order_relaxed);
+    }
+
+    context_alloc.num_allocs.fetch_add(1, std::memory_order_relaxed);
+    context_alloc.bytes_total.fetch_add(size_bytes, std::memory_order_relaxed);
+
+    if (block.flags & MAT_BLOCK_HUGE_PAGES)
+        context_alloc.num_huge.fetch_add(1, std::memory_order_relaxed);
+
+    const u64 live = context_alloc.bytes_live.fetch_add(size_bytes, std::memory_order_relaxed) + size_bytes;
+    u64 peak = context_alloc.bytes_peak.load(std::memory_order_relaxed);
+
+    while (live > peak && !context_alloc.bytes_peak.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+        ;
+
+    return block;
+}
+
+void mat_free(const mat_allocator_t &allocator, const mat_block_t &block)
+{
+    context_alloc.num_frees.fetch_add(1, std::memory_order_relaxed);
+    context_alloc.bytes_live.fetch_sub(block.size_bytes, std::memory_order_relaxed);
+
+    allocator.free(&allocator, block);
+}
+
+/* Pool of freed matrices. */
+
+/* Bigger matrices are rare enough to come from the default allocator every time. */
+constexpr size_t CONFIG_MAT_POOL_MAX_BLOCK_BYTES = size_t(256) << 20;
+
+/* Caps on what stays cached, the rest goes back to the default allocator. */
+constexpr size_t CONFIG_MAT_POOL_MAX_CACHED_BYTES = size_t(1) << 30;
+constexpr size_t CONFIG_MAT_POOL_THREAD_CACHE_BYTES = size_t(64) << 20;
+constexpr u32 CONFIG_MAT_POOL_THREAD_CACHE_BLOCKS = 4; /* Per size class. */
+
+constexpr u32 MAT_POOL_MIN_CLASS_LOG2 = 8;
+
+/*
+ * Size class of 'size' bytes, four classes per power of two above the
+ * smallest, 256 bytes: at most 25% lost to rounding.
+ */
+constexpr u32 mat_pool_class(const size_t size)
+{
+    if (size <= size_t(1) << MAT_POOL_MIN_CLASS_LOG2)
+        return 0;
+
+    const u32 log2 = 63 - __builtin_clzll(size - 1);
+    const u32 sub = u32((size - 1 - (size_t(1) << log2)) >> (log2 - 2));
+
+    return (log2 - MAT_POOL_MIN_CLASS_LOG2) * 4 + sub + 1;
+}
+
+constexpr size_t mat_pool_class_size(const u32 c)
+{
+    if (c == 0)
+        return size_t(1) << MAT_POOL_MIN_CLASS_LOG2;
+
+    const u32 log2 = (c - 1) / 4 + MAT_POOL_MIN_CLASS_LOG2;
+    const u32 sub = (c - 1) % 4;
+
+    return (size_t(1) << log2) + (sub + 1) * (size_t(1) << (log2 - 2));
+}
+
+constexpr u32 MAT_POOL_NUM_CLASSES = mat_pool_class(CONFIG_MAT_POOL_MAX_BLOCK_BYTES) + 1;
+
+static_assert(mat_pool_class_size(mat_pool_class(1000)) >= 1000);
+static_assert(mat_pool_class_size(MAT_POOL_NUM_CLASSES - 1) == CONFIG_MAT_POOL_MAX_BLOCK_BYTES);
+
+static mat_block_t mat_pool_alloc(const mat_allocator_t *self, size_t size_bytes, bool zeroed);
+static void mat_pool_free(const mat_allocator_t *self, const mat_block_t &block);
+
+namespace {
+
+const mat_allocator_t pool_allocator = {
+    .alloc = mat_pool_alloc,
+    .free = mat_pool_free,
+    .ctx = nullptr,
+};
+
+/* A cached block, with the flags the default allocator gave it. */
+struct pool_entry {
+    void *ptr;
+    u32 flags;
+};
+
+/*
+ * Trivially destructible, so still usable by matrices freed while the thread
+ * exits, after pool_thread_flush has run.
+ */
+struct pool_thread_cache {
+    pool_entry entries[MAT_POOL_NUM_CLASSES][CONFIG_MAT_POOL_THREAD_CACHE_BLOCKS];
+    u8 count[MAT_POOL_NUM_CLASSES];
+    size_t bytes;
+    bool flushed;
+    bool registered;
+};
+
+struct pool_shared {
+    std::mutex mtx;
+    std::vector<pool_entry> lists[MAT_POOL_NUM_CLASSES];
+    size_t bytes = 0;
+};
+
+struct pool_thread_flush {
+    ~pool_thread_flush();
+};
+
+struct {
+    std::atomic<u64> num_hits = 0;
+    std::atomic<u64> num_misses = 0;
+    std::atomic<u64> bytes_cached = 0;
+    std::atomic<u64> bytes_footprint = 0;
+    std::atomic<u64> bytes_footprint_peak = 0;
+} context_pool;
+
+thread_local pool_thread_cache pool_cache;
+thread_local pool_thread_flush pool_cache_flush;
+
+}
+
+/* Never destroyed, matrices may be freed by static destructors. */
+static pool_shared& mat_pool_shared()
+{
+    static pool_shared * const shared = new pool_shared;
+    return *shared;
+}
+
+static void mat_pool_release(const pool_entry &entry, const size_t size)
+{
+    const mat_allocator_t &upstream = mat_allocator_default();
+
+    upstream.free(&upstream, { entry.ptr, size, entry.flags });
+    context_pool.bytes_footprint.fetch_sub(size, std::memory_order_relaxed);
+}
+
+/* Everything the calling thread has cached, to the shared lists. */
+static void mat_pool_flush_thread(const bool release)
+{
+    pool_thread_cache &cache = pool_cache;
+    pool_shared &shared = mat_pool_shared();
+
+    std::lock_guard lck(shared.mtx);
+
+    for (u32 c = 0; c < MAT_POOL_NUM_CLASSES; ++c) {
+        const size_t size = mat_pool_class_size(c);
+
+        for (u32 i = 0; i < cache.count[c]; ++i) {
+            if (!release && shared.bytes + size <= CONFIG_MAT_POOL_MAX_CACHED_BYTES) {
+                shared.lists[c].push_back(cache.entries[c][i]);
+                shared.bytes += size;
+                continue;
+            }
+
+            mat_pool_release(cache.entries[c][i], size);
+            context_pool.bytes_cached.fetch_sub(size, std::memory_order_relaxed);
+        }
+
+        cache.count[c] = 0;
+    }
+
+    cache.bytes = 0;
+}
+
+pool_thread_flush::~pool_thread_flush()
+{
+    mat_pool_flush_thread(false);
+    pool_cache.flushed = true;
+}
+
+static bool mat_pool_take(const u32 c, pool_entry &out)
+{
+    pool_thread_cache &cache = pool_cache;
+
+    if (cache.count[c] != 0) {
+        out = cache.entries[c][--cache.count[c]];
+        cache.bytes -= mat_pool_class_size(c);
+        return true;
+    }
+
+    pool_shared &shared = mat_pool_shared();
+    std::lock_guard lck(shared.mtx);
+
+    if (shared.lists[c].empty())
+        return false;
+
+    out = shared.lists[c].back();
+    shared.lists[c].pop_back();
+    shared.bytes -= mat_pool_class_size(c);
+
+    return true;
+}
+
+static void mat_pool_put(const u32 c, const pool_entry &entry)
+{
+    const size_t size = mat_pool_class_size(c);
+    pool_thread_cache &cache = pool_cache;
+
+    if (!cache.registered) {
+        /* Constructs the flusher, which runs when the thread exits. */
+        (void)&pool_cache_flush;
+        cache.registered = true;
+    }
+
+    context_pool.bytes_cached.fetch_add(size, std::memory_order_relaxed);
+
+    if (!cache.flushed
+        && cache.count[c] < CONFIG_MAT_POOL_THREAD_CACHE_BLOCKS
+        && cache.bytes + size <= CONFIG_MAT_POOL_THREAD_CACHE_BYTES) {
+        cache.entries[c][cache.count[c]++] = entry;
+        cache.bytes += size;
+        return;
+    }
+
+    pool_shared &shared = mat_pool_shared();
+    {
+        std::lock_guard lck(shared.mtx);
+
+        if (shared.bytes + size <= CONFIG_MAT_POOL_MAX_CACHED_BYTES) {
+            shared.lists[c].push_back(entry);
+            shared.bytes += size;
+            return;
+        }
+    }
+
+    context_pool.bytes_cached.fetch_sub(size, std::memory_order_relaxed);
+    mat_pool_release(entry, size);
+}
+
+static mat_block_t mat_pool_alloc(const mat_allocator_t *, const size_t size_bytes, const bool zeroed)
+{
+    const bool pooled = size_bytes <= CONFIG_MAT_POOL_MAX_BLOCK_BYTES;
+    const u32 c = pooled ? mat_pool_class(size_bytes) : 0;
+    const size_t size = pooled ? mat_pool_class_size(c) : size_bytes;
+
+    pool_entry entry;
+
+    if (pooled && mat_pool_take(c, entry)) {
+        context_pool.num_hits.fetch_add(1, std::memory_order_relaxed);
+        context_pool.bytes_cached.fetch_sub(size, std::memory_order_relaxed);
+
+        /* Used before, mat_alloc() clears it if asked to. */
+        return { entry.ptr, size_bytes, entry.flags & ~MAT_BLOCK_ZEROED };
+    }
+
+    context_pool.num_misses.fetch_add(1, std::memory_order_relaxed);
+
+    const mat_allocator_t &upstream = mat_allocator_default();
+    const mat_block_t block = upstream.alloc(&upstream, size, zeroed);
+
+    if (!block.ptr)
+        return block;
+
+    const u64 footprint = context_pool.bytes_footprint.fetch_add(size, std::memory_order_relaxed) + size;
+    u64 peak = context_pool.bytes_footprint_peak.load(std::memory_order_relaxed);
+
+    while (footprint > peak && !context_pool.bytes_footprint_peak.compare_exchange_weak(peak, footprint, std::memory_order_relaxed))
+        ;
+
+    return { block.ptr, size_bytes, block.flags };
+}
+
+static void mat_pool_free(const mat_allocator_t *, const mat_block_t &block)
+{
+    if (block.size_bytes > CONFIG_MAT_POOL_MAX_BLOCK_BYTES) {
+        mat_pool_release({ block.ptr, block.flags }, block.size_bytes);
+        return;
+    }
+
+    mat_pool_put(mat_pool_class(block.size_bytes), { block.ptr, block.flags });
+}
+
+const mat_allocator_t& mat_pool_allocator()
+{
+    return pool_allocator;
+}
+
+mat_pool_stats_t mat_pool_stats()
+{
+    return {
+        .num_hits = context_pool.num_hits.load(std::memory_order_relaxed),
+        .num_misses = context_pool.num_misses.load(std::memory_order_relaxed),
+        .bytes_cached = context_pool.bytes_cached.load(std::memory_order_relaxed),
+        .bytes_footprint = context_pool.bytes_footprint.load(std::memory_order_relaxed),
+        .bytes_footprint_peak = context_pool.bytes_footprint_peak.load(std::memory_order_relaxed),
+    };
+}
+
+void mat_pool_stats_reset()
+{
+    context_pool.num_hits.store(0, std::memory_order_relaxed);
+    context_pool.num_misses.store(0, std::memory_order_relaxed);
+    context_pool.bytes_footprint_peak.store(context_pool.bytes_footprint.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+void mat_pool_trim()
+{
+    mat_pool_flush_thread(true);
+
+    pool_shared &shared = mat_pool_shared();
+    std::lock_guard lck(shared.mtx);
+
+    for (u32 c = 0; c < MAT_POOL_NUM_CLASSES; ++c) {
+        const size_t size = mat_pool_class_size(c);
+
+        for (const pool_entry &entry: shared.lists[c]) {
+            mat_pool_release(entry, size);
+            context_pool.bytes_cached.fetch_sub(size, std::memory_order_relaxed);
+        }
+
+        shared.lists[c].clear();
+    }
+
+    shared.bytes = 0;
+}
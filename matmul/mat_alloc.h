@@ -0,0 +1,154 @@
+#pragma once
+
+#include "types.h"
+
+#include <stddef.h>
+
+/*
+ * Memory of matrices.
+ *
+ * make_matrix() gets its memory from the current allocator, see
+ * mat_allocator_set(). The default one aligns every matrix to
+ * mat_alloc_config_t::alignment, a cache line unless configured otherwise,
+ * and can back big matrices with huge pages: one TLB entry then covers 2 MiB
+ * instead of 4 KiB, which the GEMM walking down columns of big operands
+ * otherwise misses a lot.
+ *
+ * Statistics are kept for every allocator, see mat_alloc_stats().
+ *
+ * Plain C++17 without system headers, included by mat.h which nvcc compiles too.
+ */
+
+enum class mat_huge_pages_e : u8 {
+    none,
+    transparent, /* madvise(MADV_HUGEPAGE), the kernel backs what it can with huge pages. */
+    hugetlb,     /* MAP_HUGETLB from the reserved pool, transparent if it runs out. */
+};
+
+constexpr static const char* mat_huge_pages2str(mat_huge_pages_e huge_pages)
+{
+    switch(huge_pages) {
+    case mat_huge_pages_e::none:
+        return "none";
+    case mat_huge_pages_e::transparent:
+        return "transparent";
+    case mat_huge_pages_e::hugetlb:
+        return "hugetlb";
+    }
+
+    __builtin_unreachable();
+
+    return "none";
+}
+
+/* Returns non-zero if the string does not name a known huge page mode. */
+int mat_huge_pages_from_str(const char *s, mat_huge_pages_e &out);
+
+/* Settings of the default allocator. */
+struct mat_alloc_config_t {
+    size_t alignment = 64;  /* Power of two. */
+    mat_huge_pages_e huge_pages = mat_huge_pages_e::none;
+    size_t huge_pages_min_bytes = 4 << 20; /* Smaller matrices never get huge pages. */
+    size_t zeroed_mmap_min_bytes = 1 << 20; /* Zeroed ones at least this big are fresh pages from mmap(). */
+};
+
+/* Allocation made by a mat_allocator_t, returned to it as is. */
+struct mat_block_t {
+    void *ptr;
+    size_t size_bytes; /* As requested. */
+    u32 flags;         /* Private to the allocator, e.g. how it got the memory. */
+};
+
+/* Flags of the blocks of the default allocator, readable by anyone. */
+constexpr u32 MAT_BLOCK_HUGE_PAGES = 1 << 0;
+constexpr u32 MAT_BLOCK_HUGETLB = 1 << 1;
+constexpr u32 MAT_BLOCK_ZEROED = 1 << 2; /* Known to be all zeros, nobody has to clear it. */
+constexpr u32 MAT_BLOCK_MMAP = 1 << 3;
+
+/*
+ * Pluggable allocator. 'alloc' returns a null ptr when out of memory,
+ * 'free' gets the block back exactly as returned.
+ *
+ * 'zeroed' asks for memory reading as zeros. An allocator that can get it
+ * for free, e.g. fresh pages from the kernel, sets MAT_BLOCK_ZEROED on the
+ * block. Otherwise mat_alloc() clears it, allocators are free to ignore it.
+ */
+struct mat_allocator_t {
+    mat_block_t (*alloc)(const mat_allocator_t *self, size_t size_bytes, bool zeroed);
+    void (*free)(const mat_allocator_t *self, const mat_block_t &block);
+    void *ctx; /* For the allocator's own use. */
+};
+
+struct mat_alloc_stats_t {
+    u64 num_allocs;
+    u64 num_frees;
+    u64 num_huge;      /* Allocations with MAT_BLOCK_HUGE_PAGES. */
+    u64 bytes_total;   /* Sum of all allocations ever made. */
+    u64 bytes_live;
+    u64 bytes_peak;    /* Highest bytes_live seen. */
+    u64 bytes_memset;  /* Zeroed by mat_alloc(), the allocator did not hand them out zeroed. */
+};
+
+/*
+ * Allocator make_matrix() uses from now on. Matrices remember theirs, those
+ * allocated before are freed to the previous one. Null restores the default.
+ * The allocator has to outlive every matrix it allocates.
+ */
+void mat_allocator_set(const mat_allocator_t *allocator);
+const mat_allocator_t& mat_allocator();
+const mat_allocator_t& mat_allocator_default();
+
+/* Applies to allocations made from now on. */
+void mat_alloc_configure(const mat_alloc_config_t &config);
+mat_alloc_config_t mat_alloc_config();
+
+mat_alloc_stats_t mat_alloc_stats();
+void mat_alloc_stats_reset();
+
+/*
+ * Allocate and free through 'allocator', counted in the stats.
+ * Aborts when out of memory, like operator new would throw.
+ * The memory is all zeros if 'zeroed', garbage otherwise.
+ */
+mat_block_t mat_alloc(const mat_allocator_t &allocator, size_t size_bytes, bool zeroed = false);
+void mat_free(const mat_allocator_t &allocator, const mat_block_t &block);
+
+/*
+ * Allocator recycling the memory of freed matrices, for workloads creating
+ * and dropping the same few shapes over and over: Strassen temporaries,
+ * training steps, tests. Install it with mat_allocator_set().
+ *
+ * Sizes are rounded up to size classes, four per power of two, and freed
+ * blocks kept on a free list per class: a small cache per thread, taken from
+ * and returned to without locking, then a shared one. Misses, and matrices
+ * too big to pool, go to the default allocator. Recycled blocks keep the
+ * alignment and huge pages they were first allocated with.
+ */
+const mat_allocator_t& mat_pool_allocator();
+
+struct mat_pool_stats_t {
+    u64 num_hits;             /* Allocations served from a free list. */
+    u64 num_misses;           /* Allocations passed to the default allocator. */
+    u64 bytes_cached;         /* Sitting on free lists. */
+    u64 bytes_footprint;      /* Taken from the default allocator, in use or cached. */
+    u64 bytes_footprint_peak;
+};
+
+mat_pool_stats_t mat_pool_stats();
+void mat_pool_stats_reset();
+
+/* Frees the blocks cached on the shared lists and on the calling thread's. */
+void mat_pool_trim();
+
+/* Returns memory of a matrix to the allocator it came from. */
+struct mat_deleter_t {
+    void operator()(void *ptr) const
+    {
+        if (ptr)
+            mat_free(*this->allocator, { ptr, this->size_bytes, this->flags });
+    }
+
+    const mat_allocator_t *allocator = nullptr;
+    size_t size_bytes = 0;
+    u32 flags = 0;
+};
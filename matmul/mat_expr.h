@@ -0,0 +1,273 @@
+#pragma once
+
+#include "mat.h"
+#include "types.h"
+
+#include <cassert>
+#include <cstring>
+#include <type_traits>
+
+/*
+ * Lazy elementwise expressions over matrix views.
+ *
+ *     mat_eval(c11, mat_expr(m1) + m4 - m5 + m7);
+ *     mat_eval(out, 0.5f * (mat_expr(a) - b));
+ *
+ * Operators only build a tree of small value types holding views, nothing
+ * is computed until mat_eval(). That walks the destination once, row by row,
+ * and evaluates the whole tree per element: no temporaries, and every operand
+ * is read exactly once. Chains like the one above would take three separate
+ * passes and two temporary matrices with mat_add_cpu()/mat_sub_cpu().
+ *
+ * Rows are evaluated in packets of GCC vector extension type, so the fused
+ * loop is SIMD no matter what the auto-vectorizer's cost model decides.
+ * Packets are as wide as the registers of the ISA we are compiled for, wider
+ * ones would just be split again and change the calling convention. The
+ * build passes no -march, so that is 16 bytes unless one is added: unlike the
+ * CPU kernels, expressions are instantiated in the caller's code and have no
+ * cpu_isa() dispatch.
+ *
+ * Destination may be one of the operands, each element is read before it is
+ * written. It must not partially overlap any of them though.
+ *
+ * Kept out of mat.h, which is also compiled by nvcc.
+ */
+
+#if defined(__AVX512F__)
+constexpr u32 CONFIG_MAT_EXPR_PACKET_BYTES = 64;
+#elif defined(__AVX__)
+constexpr u32 CONFIG_MAT_EXPR_PACKET_BYTES = 32;
+#else
+constexpr u32 CONFIG_MAT_EXPR_PACKET_BYTES = 16;
+#endif
+
+template <typename ValueType>
+struct mat_expr_packet {
+    constexpr static u32 size_bytes = CONFIG_MAT_EXPR_PACKET_BYTES;
+    constexpr static u32 lanes = size_bytes / sizeof(ValueType);
+
+    typedef ValueType type __attribute__((vector_size(size_bytes)));
+
+    static type load(const ValueType *src)
+    {
+        type ret;
+        memcpy(&ret, src, sizeof(ret));
+        return ret;
+    }
+
+    static void store(ValueType *dst, const type v)
+    {
+        memcpy(dst, &v, sizeof(v));
+    }
+};
+
+struct mat_expr_add {
+    template <typename T>
+    static T apply(const T a, const T b) { return a + b; }
+};
+
+struct mat_expr_sub {
+    template <typename T>
+    static T apply(const T a, const T b) { return a - b; }
+};
+
+struct mat_expr_mul {
+    template <typename T>
+    static T apply(const T a, const T b) { return a * b; }
+};
+
+/*
+ * Every node has:
+ *
+ *   width, height  - 0 for scalars, which broadcast to any size
+ *   row(y)         - cursor over row 'y', with at(x) and packet(x)
+ */
+
+template <typename ValueType_>
+struct mat_expr_leaf {
+    using ValueType = ValueType_;
+    using Packet = mat_expr_packet<ValueType>;
+
+    struct row_t {
+        ValueType at(const u32 x) const { return this->data[x]; }
+        typename Packet::type packet(const u32 x) const { return Packet::load(this->data + x); }
+
+        const ValueType *data;
+    };
+
+    row_t row(const u32 y) const { return { this->data + size_t(y) * this->stride }; }
+
+    const ValueType *data;
+    u32 width;
+    u32 height;
+    u32 stride;
+};
+
+template <typename ValueType_>
+struct mat_expr_scalar {
+    using ValueType = ValueType_;
+    using Packet = mat_expr_packet<ValueType>;
+
+    struct row_t {
+        ValueType at(u32) const { return this->value; }
+        typename Packet::type packet(u32) const { return typename Packet::type{} + this->value; }
+
+        ValueType value;
+    };
+
+    row_t row(u32) const { return { this->value }; }
+
+    ValueType value;
+    constexpr static u32 width = 0;
+    constexpr static u32 height = 0;
+};
+
+template <typename Op, typename Lhs, typename Rhs>
+struct mat_expr_binary {
+    using ValueType = typename Lhs::ValueType;
+    using Packet = mat_expr_packet<ValueType>;
+
+    static_assert(std::is_same_v<ValueType, typename Rhs::ValueType>);
+
+    mat_expr_binary(const Lhs l, const Rhs r)
+    :lhs(l)
+    ,rhs(r)
+    ,width(l.width ? l.width : r.width)
+    ,height(l.height ? l.height : r.height)
+    {
+        assert(!l.width || !r.width || (l.width == r.width && l.height == r.height));
+    }
+
+    struct row_t {
+        ValueType at(const u32 x) const { return Op::apply(this->l.at(x), this->r.at(x)); }
+        typename Packet::type packet(const u32 x) const { return Op::apply(this->l.packet(x), this->r.packet(x)); }
+
+        typename Lhs::row_t l;
+        typename Rhs::row_t r;
+    };
+
+    row_t row(const u32 y) const { return { this->lhs.row(y), this->rhs.row(y) }; }
+
+    Lhs lhs;
+    Rhs rhs;
+    u32 width;
+    u32 height;
+};
+
+template <typename T>
+struct mat_expr_is_node : std::false_type {};
+
+template <typename ValueType>
+struct mat_expr_is_node<mat_expr_leaf<ValueType>> : std::true_type {};
+
+template <typename ValueType>
+struct mat_expr_is_node<mat_expr_scalar<ValueType>> : std::true_type {};
+
+template <typename Op, typename Lhs, typename Rhs>
+struct mat_expr_is_node<mat_expr_binary<Op, Lhs, Rhs>> : std::true_type {};
+
+template <typename T>
+constexpr bool mat_expr_is_node_v = mat_expr_is_node<std::remove_cvref_t<T>>::value;
+
+/*
+ * Starts an expression, the rest of the operands can be plain views or
+ * matrices. Row-major ones, see mat_layout_e.
+ */
+template <typename ParentType>
+mat_expr_leaf<typename ParentType::ValueType> mat_expr(const matview_base_t<ParentType> &m)
+{
+    assert(m.layout == mat_layout_e::row_major);
+    return { m.data, m.width, m.height, m.stride };
+}
+
+template <typename ValueType>
+mat_expr_leaf<ValueType> mat_expr(const mat_base_t<ValueType> &m)
+{
+    assert(m.layout == mat_layout_e::row_major);
+    return { m.data.get(), m.width, m.height, m.stride };
+}
+
+template <typename Node>
+requires mat_expr_is_node_v<Node>
+Node mat_expr(const Node &node)
+{
+    return node;
+}
+
+template <typename Op, typename Lhs, typename Rhs>
+requires (mat_expr_is_node_v<Lhs> || mat_expr_is_node_v<Rhs>)
+auto mat_expr_make_binary(const Lhs &lhs, const Rhs &rhs)
+{
+    auto l = mat_expr(lhs);
+    auto r = mat_expr(rhs);
+
+    return mat_expr_binary<Op, decltype(l), decltype(r)>(l, r);
+}
+
+template <typename Lhs, typename Rhs>
+requires (mat_expr_is_node_v<Lhs> || mat_expr_is_node_v<Rhs>)
+auto operator+(const Lhs &lhs, const Rhs &rhs)
+{
+    return mat_expr_make_binary<mat_expr_add>(lhs, rhs);
+}
+
+template <typename Lhs, typename Rhs>
+requires (mat_expr_is_node_v<Lhs> || mat_expr_is_node_v<Rhs>)
+auto operator-(const Lhs &lhs, const Rhs &rhs)
+{
+    return mat_expr_make_binary<mat_expr_sub>(lhs, rhs);
+}
+
+template <typename Node>
+requires mat_expr_is_node_v<Node>
+auto operator*(const typename Node::ValueType scale, const Node &node)
+{
+    return mat_expr_binary<mat_expr_mul, mat_expr_scalar<typename Node::ValueType>, Node>({ scale }, node);
+}
+
+template <typename Node>
+requires mat_expr_is_node_v<Node>
+auto operator*(const Node &node, const typename Node::ValueType scale)
+{
+    return scale * node;
+}
+
+template <typename Node>
+requires mat_expr_is_node_v<Node>
+auto operator-(const Node &node)
+{
+    return typename Node::ValueType(-1) * node;
+}
+
+/* dst = expr, in a single pass over dst. */
+template <typename ParentType, typename Node>
+requires mat_expr_is_node_v<Node>
+void mat_eval(matview_base_t<ParentType> dst, const Node &expr)
+{
+    using ValueType = typename ParentType::ValueType;
+    using Packet = mat_expr_packet<ValueType>;
+
+    static_assert(std::is_same_v<ValueType, typename Node::ValueType>);
+
+    assert(!expr.width || (dst.width == expr.width && dst.height == expr.height));
+    assert(dst.layout == mat_layout_e::row_major);
+
+    for (u32 y = 0; y < dst.height; ++y) {
+        const auto src = expr.row(y);
+        ValueType * const out = &dst.at(0, y);
+        u32 x = 0;
+
+        for (; x + Packet::lanes <= dst.width; x += Packet::lanes)
+            Packet::store(out + x, src.packet(x));
+
+        for (; x < dst.width; ++x)
+            out[x] = src.at(x);
+    }
+}
+
+template <typename ValueType, typename Node>
+requires mat_expr_is_node_v<Node>
+void mat_eval(mat_base_t<ValueType> &dst, const Node &expr)
+{
+    mat_eval(matview_base_t<mat_base_t<ValueType>>(dst), expr);
+}
@@ -0,0 +1,79 @@
+#include "mat_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <utility>
+
+mat_file_t::mat_file_t(mat_file_t &&other)
+:data(std::exchange(other.data, nullptr))
+,size(std::exchange(other.size, 0))
+{ }
+
+mat_file_t& mat_file_t::operator=(mat_file_t &&other)
+{
+    std::swap(this->data, other.data);
+    std::swap(this->size, other.size);
+
+    return *this;
+}
+
+mat_file_t::~mat_file_t()
+{
+    if (this->data)
+        munmap(const_cast<u8*>(this->data), this->size);
+}
+
+int mat_file_map(const char * const path, const mat_file_prefetch_e prefetch, mat_file_t &out)
+{
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st)) {
+        fprintf(stderr, "Failed to stat %s: %s\n", path, strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    mat_file_t ret;
+    ret.size = st.st_size;
+
+    if (ret.size == 0) {
+        close(fd);
+        out = std::move(ret);
+        return 0;
+    }
+
+    /*
+     * Private and read-only: pages stay those of the page cache. Writable
+     * private mappings would get every populated page copied.
+     */
+    const int flags = MAP_PRIVATE | (prefetch == mat_file_prefetch_e::populate ? MAP_POPULATE : 0);
+    void * const p = mmap(nullptr, ret.size, PROT_READ, flags, fd, 0);
+
+    close(fd);
+
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    ret.data = static_cast<const u8*>(p);
+
+    /* Only a hint, the mapping works without it. */
+    if (prefetch == mat_file_prefetch_e::willneed)
+        madvise(p, ret.size, MADV_WILLNEED);
+
+    out = std::move(ret);
+
+    return 0;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "types.h"
+
+#include <stddef.h>
+
+/*
+ * Files mapped into memory, read-only, for matrices used straight from
+ * them: weights of a checkpoint, test data. A view over rows stored packed
+ * in the file, matview_f32_t(ptr, width, height, width), copies nothing and
+ * takes no memory of its own, its pages are those of the page cache. Those
+ * of views are mutable only because views are, writing through one faults.
+ *
+ * Pages are read in on first touch, unless prefetched when mapped.
+ */
+
+enum class mat_file_prefetch_e : u8 {
+    none,
+    willneed, /* madvise(MADV_WILLNEED), readahead of the whole file starts in the background. */
+    populate, /* MAP_POPULATE, the whole file is read in before mat_file_map() returns. */
+};
+
+constexpr static const char* mat_file_prefetch2str(mat_file_prefetch_e prefetch)
+{
+    switch(prefetch) {
+    case mat_file_prefetch_e::none:
+        return "none";
+    case mat_file_prefetch_e::willneed:
+        return "willneed";
+    case mat_file_prefetch_e::populate:
+        return "populate";
+    }
+
+    __builtin_unreachable();
+
+    return "none";
+}
+
+/* Mapping of a whole file, unmapped when destroyed. Empty files map to null. */
+struct mat_file_t {
+    mat_file_t() = default;
+    mat_file_t(mat_file_t &&other);
+    mat_file_t& operator=(mat_file_t &&other);
+    ~mat_file_t();
+
+    mat_file_t(const mat_file_t&) = delete;
+    mat_file_t& operator=(const mat_file_t&) = delete;
+
+    const u8 *data = nullptr;
+    size_t size = 0;
+};
+
+/* Returns non-zero if the file can't be opened or mapped, 'out' is left untouched then. */
+int mat_file_map(const char *path, mat_file_prefetch_e prefetch, mat_file_t &out);
@@ -0,0 +1,346 @@
+#pragma once
+
+#include "compiler.h"
+#include "cpu_features.h"
+#include "mat.h"
+#include "types.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+/*
+ * Matrices with sizes known at compile time.
+ *
+ *     mat_fixed_t<f32, 4, 4> model, view;
+ *     const auto mv = view * model;
+ *
+ * Elements are stored row by row with no padding and no heap allocation.
+ * All loop bounds are constants, so products are fully unrolled and rows are
+ * kept in registers, instead of going through the stride based loops and the
+ * packing of the general GEMM, which only pay off for big operands.
+ *
+ * mat_fixed_soa_t holds a whole group of same sized matrices, one per SIMD
+ * lane: element (x, y) of every matrix in the group is one vector. Products
+ * of a group are then the very same unrolled code, computing Lanes products
+ * at once without any shuffles, whatever the matrix size. That pays off when
+ * the data lives in groups: transposing plain matrices into groups and back
+ * costs several times more than the product itself, so load()/store() are
+ * meant for the edges only. mat_fixed_mul_batch() and mat_fixed_transform()
+ * take arrays of either layout. Their loops over groups are compiled for
+ * every ISA level and dispatched on cpu_isa(), like the CPU kernels.
+ *
+ * Kept out of mat.h, which is also compiled by nvcc.
+ */
+
+template <typename ValueType_, u32 Rows, u32 Cols>
+struct mat_fixed_t {
+    using ValueType = ValueType_;
+
+    constexpr static u32 rows = Rows;
+    constexpr static u32 cols = Cols;
+
+    ValueType& at(const u32 x, const u32 y)
+    {
+        return this->data[y * Cols + x];
+    }
+
+    const ValueType& at(const u32 x, const u32 y) const
+    {
+        return this->data[y * Cols + x];
+    }
+
+    ValueType& operator[](const u32 x, const u32 y)
+    {
+        return this->at(x, y);
+    }
+
+    const ValueType& operator[](const u32 x, const u32 y) const
+    {
+        return this->at(x, y);
+    }
+
+    template <typename ParentType>
+    static mat_fixed_t from_view(const matview_base_t<ParentType> src)
+    {
+        assert(src.width == Cols);
+        assert(src.height == Rows);
+
+        mat_fixed_t ret;
+
+#pragma GCC unroll 16
+        for (u32 y = 0; y < Rows; ++y)
+            std::copy_n(&src.at(0, y), Cols, &ret.data[y * Cols]);
+
+        return ret;
+    }
+
+    template <typename ParentType>
+    void store(matview_base_t<ParentType> dst) const
+    {
+        assert(dst.width == Cols);
+        assert(dst.height == Rows);
+
+#pragma GCC unroll 16
+        for (u32 y = 0; y < Rows; ++y)
+            std::copy_n(&this->data[y * Cols], Cols, &dst.at(0, y));
+    }
+
+    ValueType data[Rows * Cols];
+};
+
+using mat4_f32_t = mat_fixed_t<f32, 4, 4>;
+using mat8_f32_t = mat_fixed_t<f32, 8, 8>;
+using vec4_f32_t = mat_fixed_t<f32, 4, 1>;
+
+/*
+ * The product, row by row: out row y = sum over k of lhs[k, y] * rhs row k.
+ * Written for any type with * and +, so the SoA groups below use it too.
+ */
+template <typename T, u32 M, u32 K, u32 N, typename LhsAt, typename RhsAt, typename OutAt>
+__attribute__((always_inline)) inline void mat_fixed_mul_(const LhsAt lhs, const RhsAt rhs, const OutAt out)
+{
+#pragma GCC unroll 16
+    for (u32 y = 0; y < M; ++y) {
+        T row[N];
+
+#pragma GCC unroll 16
+        for (u32 x = 0; x < N; ++x)
+            row[x] = lhs(0, y) * rhs(x, 0);
+
+#pragma GCC unroll 16
+        for (u32 k = 1; k < K; ++k) {
+#pragma GCC unroll 16
+            for (u32 x = 0; x < N; ++x)
+                row[x] += lhs(k, y) * rhs(x, k);
+        }
+
+#pragma GCC unroll 16
+        for (u32 x = 0; x < N; ++x)
+            out(x, y) = row[x];
+    }
+}
+
+template <typename ValueType, u32 M, u32 K, u32 N>
+mat_fixed_t<ValueType, M, N> operator*(
+    const mat_fixed_t<ValueType, M, K> &lhs,
+    const mat_fixed_t<ValueType, K, N> &rhs
+) {
+    static_assert(K > 0);
+
+    mat_fixed_t<ValueType, M, N> out;
+
+    mat_fixed_mul_<ValueType, M, K, N>(
+        [&](u32 x, u32 y) { return lhs[x, y]; },
+        [&](u32 x, u32 y) { return rhs[x, y]; },
+        [&](u32 x, u32 y) -> ValueType& { return out[x, y]; }
+    );
+
+    return out;
+}
+
+/*
+ * Bytes of a lane vector by default, one AVX-512 register, 16 f32. Groups are
+ * a storage layout, so this doesn't follow the compile flags: every build and
+ * every host agree on it. Narrower ISA levels split each vector in two or four.
+ */
+constexpr u32 CONFIG_MAT_FIXED_SOA_BYTES = 64;
+
+/* Group of 'Lanes' matrices of the same size, in struct of arrays layout. */
+template <
+    typename ValueType_,
+    u32 Rows,
+    u32 Cols,
+    u32 Lanes = CONFIG_MAT_FIXED_SOA_BYTES / sizeof(ValueType_)
+>
+struct mat_fixed_soa_t {
+    using ValueType = ValueType_;
+    using MatrixType = mat_fixed_t<ValueType, Rows, Cols>;
+
+    constexpr static u32 rows = Rows;
+    constexpr static u32 cols = Cols;
+    constexpr static u32 lanes = Lanes;
+
+    /*
+     * Aligned explicitly: vectors are otherwise only as aligned as the widest
+     * register of the compile target, 16 bytes in the baseline build, while
+     * the loops compiled for wider ones load them with aligned instructions.
+     */
+    typedef ValueType lane_type __attribute__((vector_size(Lanes * sizeof(ValueType)), aligned(Lanes * sizeof(ValueType))));
+
+    lane_type& at(const u32 x, const u32 y)
+    {
+        return this->data[y * Cols + x];
+    }
+
+    const lane_type& at(const u32 x, const u32 y) const
+    {
+        return this->data[y * Cols + x];
+    }
+
+    /* Gathers 'count' <= Lanes matrices, unused lanes are zero. */
+    static mat_fixed_soa_t load(const MatrixType *mats, const u32 count = Lanes)
+    {
+        assert(count <= Lanes);
+
+        /*
+         * Transposed through memory: scalar stores and whole vector loads
+         * are much cheaper than inserting into vectors lane by lane.
+         */
+        ValueType tmp[Rows * Cols][Lanes] = {};
+        mat_fixed_soa_t ret;
+
+        for (u32 lane = 0; lane < count; ++lane) {
+#pragma GCC unroll 16
+            for (u32 i = 0; i < Rows * Cols; ++i)
+                tmp[i][lane] = mats[lane].data[i];
+        }
+
+        memcpy(ret.data, tmp, sizeof(ret.data));
+
+        return ret;
+    }
+
+    /* Every lane holds the same matrix. */
+    static mat_fixed_soa_t broadcast(const MatrixType &m)
+    {
+        mat_fixed_soa_t ret;
+
+#pragma GCC unroll 16
+        for (u32 i = 0; i < Rows * Cols; ++i)
+            ret.data[i] = lane_type{} + m.data[i];
+
+        return ret;
+    }
+
+    void store(MatrixType *mats, const u32 count = Lanes) const
+    {
+        assert(count <= Lanes);
+
+        ValueType tmp[Rows * Cols][Lanes];
+        memcpy(tmp, this->data, sizeof(tmp));
+
+        for (u32 lane = 0; lane < count; ++lane) {
+#pragma GCC unroll 16
+            for (u32 i = 0; i < Rows * Cols; ++i)
+                mats[lane].data[i] = tmp[i][lane];
+        }
+    }
+
+    lane_type data[Rows * Cols];
+};
+
+template <typename ValueType, u32 M, u32 K, u32 N, u32 Lanes>
+__attribute__((always_inline)) inline mat_fixed_soa_t<ValueType, M, N, Lanes> operator*(
+    const mat_fixed_soa_t<ValueType, M, K, Lanes> &lhs,
+    const mat_fixed_soa_t<ValueType, K, N, Lanes> &rhs
+) {
+    static_assert(K > 0);
+
+    using lane_type = typename mat_fixed_soa_t<ValueType, M, N, Lanes>::lane_type;
+
+    mat_fixed_soa_t<ValueType, M, N, Lanes> out;
+
+    mat_fixed_mul_<lane_type, M, K, N>(
+        [&](u32 x, u32 y) -> const lane_type& { return lhs.at(x, y); },
+        [&](u32 x, u32 y) -> const lane_type& { return rhs.at(x, y); },
+        [&](u32 x, u32 y) -> lane_type& { return out.at(x, y); }
+    );
+
+    return out;
+}
+
+/*
+ * fn(i) for i < count, compiled for the ISA level the CPU kernels dispatch
+ * to. The library is built for the baseline, where the product of a group
+ * would take four SSE instructions per lane vector, and even a -march build
+ * would still run them on older hosts. 'fn' must be always_inline, for the
+ * product to be compiled into each of the loops.
+ */
+template <typename Fn>
+__attribute__((always_inline)) inline void mat_fixed_soa_loop_(const size_t count, const Fn &fn)
+{
+    for (size_t i = 0; i < count; ++i)
+        fn(i);
+}
+
+template <typename Fn>
+TARGET_AVX512 void mat_fixed_soa_loop_avx512_(const size_t count, const Fn &fn)
+{
+    mat_fixed_soa_loop_(count, fn);
+}
+
+template <typename Fn>
+TARGET_AVX2 void mat_fixed_soa_loop_avx2_(const size_t count, const Fn &fn)
+{
+    mat_fixed_soa_loop_(count, fn);
+}
+
+template <typename Fn>
+void mat_fixed_soa_for_(const size_t count, const Fn &fn)
+{
+    switch (cpu_isa()) {
+    case cpu_isa_e::avx512:
+        return mat_fixed_soa_loop_avx512_(count, fn);
+    case cpu_isa_e::avx2:
+        return mat_fixed_soa_loop_avx2_(count, fn);
+    case cpu_isa_e::generic:
+        break;
+    }
+
+    mat_fixed_soa_loop_(count, fn);
+}
+
+/* out[i] = lhs[i] * rhs[i], for i < count. */
+template <typename ValueType, u32 M, u32 K, u32 N>
+void mat_fixed_mul_batch(
+    const mat_fixed_t<ValueType, M, K> *lhs,
+    const mat_fixed_t<ValueType, K, N> *rhs,
+    mat_fixed_t<ValueType, M, N> *out,
+    const size_t count
+) {
+    for (size_t i = 0; i < count; ++i)
+        out[i] = lhs[i] * rhs[i];
+}
+
+/* Same for groups, 'count' is in groups of Lanes matrices. */
+template <typename ValueType, u32 M, u32 K, u32 N, u32 Lanes>
+void mat_fixed_mul_batch(
+    const mat_fixed_soa_t<ValueType, M, K, Lanes> *lhs,
+    const mat_fixed_soa_t<ValueType, K, N, Lanes> *rhs,
+    mat_fixed_soa_t<ValueType, M, N, Lanes> *out,
+    const size_t count
+) {
+    mat_fixed_soa_for_(count, [=](const size_t i) __attribute__((always_inline)) {
+        out[i] = lhs[i] * rhs[i];
+    });
+}
+
+/*
+ * out[i] = m * in[i], for i < count. One transform applied to many matrices
+ * or, with N == 1, many vectors: vertices through a model-view-projection.
+ */
+template <typename ValueType, u32 M, u32 K, u32 N>
+void mat_fixed_transform(
+    const mat_fixed_t<ValueType, M, K> &m,
+    const mat_fixed_t<ValueType, K, N> *in,
+    mat_fixed_t<ValueType, M, N> *out,
+    const size_t count
+) {
+    for (size_t i = 0; i < count; ++i)
+        out[i] = m * in[i];
+}
+
+template <typename ValueType, u32 M, u32 K, u32 N, u32 Lanes>
+void mat_fixed_transform(
+    const mat_fixed_t<ValueType, M, K> &m,
+    const mat_fixed_soa_t<ValueType, K, N, Lanes> *in,
+    mat_fixed_soa_t<ValueType, M, N, Lanes> *out,
+    const size_t count
+) {
+    const auto group_m = mat_fixed_soa_t<ValueType, M, K, Lanes>::broadcast(m);
+
+    mat_fixed_soa_for_(count, [&group_m, in, out](const size_t i) __attribute__((always_inline)) {
+        out[i] = group_m * in[i];
+    });
+}
@@ -0,0 +1,131 @@
+#include "mat.h"
+#include "types.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+/*
+ * Copies between memory layouts, see mat_layout_e.
+ *
+ * Row-major, tiled and Morton matrices all keep rows of their tiles
+ * contiguous, a row-major matrix being a single tile as wide as the matrix.
+ * Copies among them are runs of memcpy, each up to the next tile edge of
+ * either side. Column-major matrices keep columns contiguous: to or from one
+ * of them the copy is a transpose, done in square blocks small enough for
+ * both sides to stay in L1 meanwhile.
+ */
+
+/* Side of the blocks transposes work in, 32 x 32 x 8 bytes = 8 KiB. */
+constexpr u32 CONFIG_LAYOUT_TRANSPOSE_BLOCK = 32;
+
+/* Elements contiguous in memory from (x, y) on, along the row. */
+template <typename ViewType>
+static u32 layout_run(const ViewType m, const u32 x)
+{
+    switch (m.layout) {
+    case mat_layout_e::row_major:
+        return m.width - x;
+    case mat_layout_e::col_major:
+        return 1;
+    case mat_layout_e::tiled:
+    case mat_layout_e::morton:
+        return std::min(m.width - x, m.stride - x % m.stride);
+    }
+
+    __builtin_unreachable();
+}
+
+/* Column-major matrix as the row-major transpose it also is, and the other way around. */
+template <typename ViewType>
+static ViewType layout_transposed(const ViewType m)
+{
+    assert(m.layout == mat_layout_e::row_major || m.layout == mat_layout_e::col_major);
+
+    const mat_layout_e layout = m.layout == mat_layout_e::row_major
+        ? mat_layout_e::col_major
+        : mat_layout_e::row_major;
+
+    return ViewType(m.data, m.height, m.width, m.stride, layout);
+}
+
+/*
+ * Neither is column-major. Runs of a row are contiguous in both, let libc
+ * pick the copy loop, glibc already dispatches memcpy to the widest ISA the
+ * host has.
+ */
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static void layout_copy_rows(ViewType dst, ViewType src)
+{
+    for (u32 y = 0; y < dst.height; ++y) {
+        for (u32 x = 0; x < dst.width;) {
+            const u32 n = std::min(layout_run(dst, x), layout_run(src, x));
+
+            std::memcpy(&dst.at(x, y), &src.at(x, y), n * sizeof(ValueType));
+            x += n;
+        }
+    }
+}
+
+/* One of them is column-major, the other is not. */
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static void layout_transpose(ViewType dst, ViewType src)
+{
+    constexpr u32 B = CONFIG_LAYOUT_TRANSPOSE_BLOCK;
+
+    const bool dst_cols = dst.layout == mat_layout_e::col_major;
+    const size_t dst_step = dst_cols ? dst.stride : 1;
+    const size_t src_step = dst_cols ? 1 : src.stride;
+    const ViewType rows = dst_cols ? src : dst;
+
+    for (u32 y0 = 0; y0 < dst.height; y0 += B) {
+        const u32 y1 = std::min(dst.height, y0 + B);
+
+        for (u32 x0 = 0; x0 < dst.width; x0 += B) {
+            const u32 x1 = std::min(dst.width, x0 + B);
+
+            for (u32 y = y0; y < y1; ++y) {
+                for (u32 x = x0; x < x1;) {
+                    const u32 n = std::min(x1 - x, layout_run(rows, x));
+
+                    ValueType * const d = &dst.at(x, y);
+                    const ValueType * const s = &src.at(x, y);
+
+                    for (u32 i = 0; i < n; ++i)
+                        d[i * dst_step] = s[i * src_step];
+
+                    x += n;
+                }
+            }
+        }
+    }
+}
+
+template <typename ViewType>
+static void mat_copy_(ViewType dst, ViewType src)
+{
+    assert(dst.width == src.width);
+    assert(dst.height == src.height);
+
+    const bool dst_cols = dst.layout == mat_layout_e::col_major;
+    const bool src_cols = src.layout == mat_layout_e::col_major;
+
+    if (dst_cols && src_cols)
+        layout_copy_rows(layout_transposed(dst), layout_transposed(src));
+    else if (dst_cols || src_cols)
+        layout_transpose(dst, src);
+    else
+        layout_copy_rows(dst, src);
+}
+
+void mat_copy(matview_i64_t dst, matview_i64_t src)
+{ mat_copy_(dst, src); }
+
+void mat_copy(matview_f32_t dst, matview_f32_t src)
+{ mat_copy_(dst, src); }
+
+void mat_copy(matview_f16_t dst, matview_f16_t src)
+{ mat_copy_(dst, src); }
+
+void mat_copy(matview_bf16_t dst, matview_bf16_t src)
+{ mat_copy_(dst, src); }
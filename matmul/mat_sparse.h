@@ -0,0 +1,107 @@
+#pragma once
+
+#include "mat.h"
+#include "types.h"
+
+#include <vector>
+
+/*
+ * Sparse matrices, for pruned weights that are mostly zeros.
+ *
+ * CSR (compressed sparse row) keeps the nonzeros of each row, with their
+ * column indices, one row after the other. Row y owns the entries in
+ * [row_ptr[y], row_ptr[y + 1]).
+ *
+ * BSR (block sparse row) is the same over (block_h x block_w) blocks: a
+ * block is kept if any of its elements is nonzero, and stored whole, row by
+ * row, zeros included. Less index overhead than CSR and every row of rhs a
+ * block touches is reused for block_h rows of the result, which pays off for
+ * structured pruning, where nonzeros come in clusters. Blocks on the right
+ * and bottom edges are padded with zeros.
+ *
+ * Products are sparse lhs times dense rhs (SpMM), the usual shape of a pruned
+ * layer applied to a batch of activations. Kept out of mat.h, which is also
+ * compiled by nvcc.
+ */
+
+struct mat_csr_f32_t {
+    size_t nnz() const
+    {
+        return this->values.size();
+    }
+
+    u32 width = 0;
+    u32 height = 0;
+
+    std::vector<u32> row_ptr; /* height + 1 entries. */
+    std::vector<u32> col_idx;
+    std::vector<f32> values;
+};
+
+struct mat_bsr_f32_t {
+    u32 block_rows() const
+    {
+        return (this->height + this->block_h - 1) / this->block_h;
+    }
+
+    size_t num_blocks() const
+    {
+        return this->col_idx.size();
+    }
+
+    u32 width = 0;
+    u32 height = 0;
+    u32 block_h = 1;
+    u32 block_w = 1;
+
+    std::vector<u32> row_ptr; /* block_rows() + 1 entries, in blocks. */
+    std::vector<u32> col_idx; /* Index of the block column, not of the element one. */
+    std::vector<f32> values;  /* block_h * block_w per block. */
+};
+
+enum class mat_sparse_format_e : u8 {
+    dense,
+    csr,
+    bsr,
+};
+
+/*
+ * Matrix stored in whichever format multiplies fastest, chosen from its
+ * density by mat_sparse_prepare(). Meant for weights, prepared once and
+ * used in many products. Only the member 'format' names is filled in.
+ */
+struct mat_sparse_f32_t {
+    mat_sparse_format_e format = mat_sparse_format_e::dense;
+
+    mat_f32_t dense;
+    mat_csr_f32_t csr;
+    mat_bsr_f32_t bsr;
+};
+
+/* Fraction of nonzero elements in 'm'. */
+f32 mat_density(matview_f32_t m);
+
+/* Exact zeros are dropped, everything else kept. */
+mat_csr_f32_t mat_to_csr(matview_f32_t src);
+mat_bsr_f32_t mat_to_bsr(matview_f32_t src, u32 block_h = 4, u32 block_w = 4);
+
+void mat_to_dense(matview_f32_t dst, const mat_csr_f32_t &src);
+void mat_to_dense(matview_f32_t dst, const mat_bsr_f32_t &src);
+
+/*
+ * BSR if its blocks come out mostly full and cover little of the matrix, CSR
+ * if few enough elements are nonzero, dense otherwise. See the CONFIG_SPARSE_*
+ * thresholds in matmul_cpu_sparse.cc
+ */
+mat_sparse_f32_t mat_sparse_prepare(matview_f32_t src, u32 block_h = 4, u32 block_w = 4);
+
+/*
+ * Computes:
+ *     dst = alpha * lhs @ rhs + beta * dst
+ *
+ * Rows of 'dst' are split between the threads of 'pool', the default CPU pool
+ * if null.
+ */
+void mat_mul_cpu_into(matview_f32_t dst, const mat_csr_f32_t &lhs, matview_f32_t rhs, f32 alpha = 1, f32 beta = 0, thread_pool *pool = nullptr);
+void mat_mul_cpu_into(matview_f32_t dst, const mat_bsr_f32_t &lhs, matview_f32_t rhs, f32 alpha = 1, f32 beta = 0, thread_pool *pool = nullptr);
+void mat_mul_cpu_into(matview_f32_t dst, const mat_sparse_f32_t &lhs, matview_f32_t rhs, f32 alpha = 1, f32 beta = 0, thread_pool *pool = nullptr);
@@ -12,7 +12,11 @@ __kernel void matmul_i64(
     __global ulong* out,
     uint out_cols,
     uint out_rows,
-    uint out_stride
+    uint out_stride,
+
+    ulong alpha,
+    ulong beta,
+    uint trans
 ) {
     const uint thread_id = (uint)get_global_id(0);
     const uint y = thread_id / out_cols;
@@ -21,12 +25,27 @@ __kernel void matmul_i64(
     if (y >= out_rows)
         return;
 
-    out[x + y * out_stride] = 0;
+    ulong acc = 0;
+
+    /*
+     * Bit 0 of 'trans' transposes lhs, bit 1 rhs. A transposed operand is
+     * read as stored, only its strides are swapped.
+     * We assert: K matches in both operands.
+     */
+    const uint k = trans & 1 ? lhs_rows : lhs_cols;
+    const uint lhs_rs = trans & 1 ? 1 : lhs_stride;
+    const uint lhs_cs = trans & 1 ? lhs_stride : 1;
+    const uint rhs_rs = trans & 2 ? 1 : rhs_stride;
+    const uint rhs_cs = trans & 2 ? rhs_stride : 1;
 
-    /* We assert: lhs_cols == rhs_rows */
+    for (uint i = 0; i < k; ++i)
+        acc += lhs[i * lhs_cs + y * lhs_rs] * rhs[x * rhs_cs + i * rhs_rs];
 
-    for (uint i = 0; i < lhs_cols; ++i)
-        out[x + y * out_stride] += lhs[i + lhs_stride * y] * rhs[x + rhs_stride * i];
+    /* With beta == 0, 'out' wasn't uploaded and must not be read. */
+    if (beta == 0)
+        out[x + y * out_stride] = alpha * acc;
+    else
+        out[x + y * out_stride] = alpha * acc + beta * out[x + y * out_stride];
 }
 
 __kernel void matmul_f32(
@@ -43,7 +62,11 @@ __kernel void matmul_f32(
     __global float* out,
     uint out_cols,
     uint out_rows,
-    uint out_stride
+    uint out_stride,
+
+    float alpha,
+    float beta,
+    uint trans
 ) {
     const uint thread_id = (uint)get_global_id(0);
     const uint y = thread_id / out_cols;
@@ -52,10 +75,191 @@ __kernel void matmul_f32(
     if (y >= out_rows)
         return;
 
-    out[x + y * out_stride] = 0;
+    float acc = 0;
+
+    /*
+     * Bit 0 of 'trans' transposes lhs, bit 1 rhs. A transposed operand is
+     * read as stored, only its strides are swapped.
+     * We assert: K matches in both operands.
+     */
+    const uint k = trans & 1 ? lhs_rows : lhs_cols;
+    const uint lhs_rs = trans & 1 ? 1 : lhs_stride;
+    const uint lhs_cs = trans & 1 ? lhs_stride : 1;
+    const uint rhs_rs = trans & 2 ? 1 : rhs_stride;
+    const uint rhs_cs = trans & 2 ? rhs_stride : 1;
+
+    for (uint i = 0; i < k; ++i)
+        acc += lhs[i * lhs_cs + y * lhs_rs] * rhs[x * rhs_cs + i * rhs_rs];
+
+    /* With beta == 0, 'out' wasn't uploaded and must not be read. */
+    if (beta == 0)
+        out[x + y * out_stride] = alpha * acc;
+    else
+        out[x + y * out_stride] = alpha * acc + beta * out[x + y * out_stride];
+}
+
+/*
+ * Half width operands, f32 accumulation and output. Same arguments as
+ * matmul_f32, except for the types of 'lhs' and 'rhs'.
+ *
+ * vload_half() is core OpenCL, it doesn't need cl_khr_fp16. bf16 is the upper
+ * half of an f32, shifting it back in place is the whole conversion.
+ */
+__kernel void matmul_f16(
+    __global const half* lhs,
+    uint lhs_cols,
+    uint lhs_rows,
+    uint lhs_stride,
+
+    __global const half* rhs,
+    uint rhs_cols,
+    uint rhs_rows,
+    uint rhs_stride,
+
+    __global float* out,
+    uint out_cols,
+    uint out_rows,
+    uint out_stride,
+
+    float alpha,
+    float beta,
+    uint trans
+) {
+    const uint thread_id = (uint)get_global_id(0);
+    const uint y = thread_id / out_cols;
+    const uint x = thread_id % out_cols;
+
+    if (y >= out_rows)
+        return;
+
+    float acc = 0;
+
+    const uint k = trans & 1 ? lhs_rows : lhs_cols;
+    const uint lhs_rs = trans & 1 ? 1 : lhs_stride;
+    const uint lhs_cs = trans & 1 ? lhs_stride : 1;
+    const uint rhs_rs = trans & 2 ? 1 : rhs_stride;
+    const uint rhs_cs = trans & 2 ? rhs_stride : 1;
+
+    for (uint i = 0; i < k; ++i)
+        acc += vload_half(i * lhs_cs + y * lhs_rs, lhs) * vload_half(x * rhs_cs + i * rhs_rs, rhs);
+
+    if (beta == 0)
+        out[x + y * out_stride] = alpha * acc;
+    else
+        out[x + y * out_stride] = alpha * acc + beta * out[x + y * out_stride];
+}
+
+__kernel void matmul_bf16(
+    __global const ushort* lhs,
+    uint lhs_cols,
+    uint lhs_rows,
+    uint lhs_stride,
+
+    __global const ushort* rhs,
+    uint rhs_cols,
+    uint rhs_rows,
+    uint rhs_stride,
+
+    __global float* out,
+    uint out_cols,
+    uint out_rows,
+    uint out_stride,
+
+    float alpha,
+    float beta,
+    uint trans
+) {
+    const uint thread_id = (uint)get_global_id(0);
+    const uint y = thread_id / out_cols;
+    const uint x = thread_id % out_cols;
+
+    if (y >= out_rows)
+        return;
+
+    float acc = 0;
+
+    const uint k = trans & 1 ? lhs_rows : lhs_cols;
+    const uint lhs_rs = trans & 1 ? 1 : lhs_stride;
+    const uint lhs_cs = trans & 1 ? lhs_stride : 1;
+    const uint rhs_rs = trans & 2 ? 1 : rhs_stride;
+    const uint rhs_cs = trans & 2 ? rhs_stride : 1;
+
+    for (uint i = 0; i < k; ++i) {
+        const float a = as_float((uint)lhs[i * lhs_cs + y * lhs_rs] << 16);
+        const float b = as_float((uint)rhs[x * rhs_cs + i * rhs_rs] << 16);
+
+        acc += a * b;
+    }
+
+    if (beta == 0)
+        out[x + y * out_stride] = alpha * acc;
+    else
+        out[x + y * out_stride] = alpha * acc + beta * out[x + y * out_stride];
+}
+
+/*
+ * Many independent products in one NDRange. Operands are packed densely, one
+ * after another, lhs and rhs ones in 'in', products in 'out'. 'desc' holds
+ * 6 uints per product:
+ *
+ *     lhs offset, rhs offset, out offset, M, K, N
+ *
+ * with offsets in elements. Dimension 1 picks the product, dimension 0 the
+ * element of its output. Products smaller than the biggest one leave some
+ * work items idle.
+ */
+__kernel void matmul_batched_i64(
+    __global const ulong* in,
+    __global ulong* out,
+    __global const uint* desc
+) {
+    __global const uint *d = desc + 6 * get_global_id(1);
+    const uint id = (uint)get_global_id(0);
+    const uint m = d[3];
+    const uint k = d[4];
+    const uint n = d[5];
+
+    if (id >= m * n)
+        return;
+
+    const uint y = id / n;
+    const uint x = id % n;
+
+    __global const ulong *lhs = in + d[0] + y * k;
+    __global const ulong *rhs = in + d[1] + x;
+
+    ulong acc = 0;
+
+    for (uint i = 0; i < k; ++i)
+        acc += lhs[i] * rhs[i * n];
+
+    out[d[2] + id] = acc;
+}
+
+__kernel void matmul_batched_f32(
+    __global const float* in,
+    __global float* out,
+    __global const uint* desc
+) {
+    __global const uint *d = desc + 6 * get_global_id(1);
+    const uint id = (uint)get_global_id(0);
+    const uint m = d[3];
+    const uint k = d[4];
+    const uint n = d[5];
+
+    if (id >= m * n)
+        return;
+
+    const uint y = id / n;
+    const uint x = id % n;
+
+    __global const float *lhs = in + d[0] + y * k;
+    __global const float *rhs = in + d[1] + x;
+
+    float acc = 0;
 
-    /* We assert: lhs_cols == rhs_rows */
+    for (uint i = 0; i < k; ++i)
+        acc += lhs[i] * rhs[i * n];
 
-    for (uint i = 0; i < lhs_cols; ++i)
-        out[x + y * out_stride] += lhs[i + lhs_stride * y] * rhs[x + rhs_stride * i];
+    out[d[2] + id] = acc;
 }
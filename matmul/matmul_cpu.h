@@ -0,0 +1,682 @@
+#pragma once
+
+/*
+ * Internal interface shared between the CPU kernels.
+ * Not a part of the public API, see mat.h for that.
+ */
+
+#include "cpu_features.h"
+#include "mat.h"
+#include "types.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+class thread_pool;
+class task_pool;
+
+/* For std::unique_ptr of the aligned_alloc()ed buffers kernels keep per thread. */
+struct free_deleter {
+    void operator()(void *p) const { std::free(p); }
+};
+
+/*
+ * Set of the CPU kernels for one ISA level and value type.
+ *
+ * Every ISA level provides a full table, dispatch picks one of them based on
+ * cpu_isa(). GEMM blocking lives here too, as the best micro-tile shape
+ * depends on the register file we have.
+ */
+template <typename ValueType>
+struct cpu_kernels_t {
+    /*
+     * Computes (mr x nr) block of the output:
+     *     c  = a @ b   if !accumulate
+     *     c += a @ b   if  accumulate
+     *
+     * Where 'a' and 'b' are packed slivers of depth 'kc', see matmul_cpu_blocked.cc
+     */
+    using micro_kernel_fn = void (*)(
+        u32 kc,
+        const ValueType *a,
+        const ValueType *b,
+        ValueType *c,
+        u32 ldc,
+        u32 mr,
+        u32 nr,
+        bool accumulate
+    );
+
+    /* Computes out[i] = lhs[i] (op) rhs[i] for i in [0, n) */
+    using row_binop_fn = void (*)(ValueType *out, const ValueType *lhs, const ValueType *rhs, u32 n);
+
+    /* Returns the sum of a[i] * b[i] for i in [0, n) */
+    using dot_row_fn = ValueType (*)(const ValueType *a, const ValueType *b, u32 n);
+
+    /* Computes y[i] += alpha * x[i] for i in [0, n) */
+    using axpy_row_fn = void (*)(ValueType *y, ValueType alpha, const ValueType *x, u32 n);
+
+    cpu_isa_e isa;
+
+    /* GEMM blocking. mc has to be a multiple of mr and nc of nr. */
+    u32 mr;
+    u32 nr;
+    u32 mc;
+    u32 kc;
+    u32 nc;
+
+    micro_kernel_fn micro_kernel;
+    row_binop_fn add_row;
+    row_binop_fn sub_row;
+    dot_row_fn dot_row;
+    axpy_row_fn axpy_row;
+};
+
+extern const cpu_kernels_t<i64> cpu_kernels_i64_generic;
+extern const cpu_kernels_t<f32> cpu_kernels_f32_generic;
+extern const cpu_kernels_t<i64> cpu_kernels_i64_avx2;
+extern const cpu_kernels_t<f32> cpu_kernels_f32_avx2;
+extern const cpu_kernels_t<i64> cpu_kernels_i64_avx512;
+extern const cpu_kernels_t<f32> cpu_kernels_f32_avx512;
+
+/* Kernels for the given ISA level. */
+template <typename ValueType>
+const cpu_kernels_t<ValueType>& cpu_kernels(cpu_isa_e isa);
+
+template <> const cpu_kernels_t<i64>& cpu_kernels<i64>(cpu_isa_e isa);
+template <> const cpu_kernels_t<f32>& cpu_kernels<f32>(cpu_isa_e isa);
+
+/* Kernels for the currently active ISA level. */
+template <typename ValueType>
+const cpu_kernels_t<ValueType>& cpu_kernels()
+{
+    return cpu_kernels<ValueType>(cpu_isa());
+}
+
+/*
+ * Conversions between f32 and the half width types, one table per ISA level.
+ * Each converts 'n' contiguous elements, see half.h for the rounding.
+ *
+ * The AVX512-BF16 variant treats f32 subnormals as zero, as the instruction
+ * does, the others keep them.
+ */
+struct cpu_cvt_kernels_t {
+    cpu_isa_e isa;
+
+    void (*f16_to_f32)(f32 *out, const f16 *in, u32 n);
+    void (*f32_to_f16)(f16 *out, const f32 *in, u32 n);
+    void (*bf16_to_f32)(f32 *out, const bf16 *in, u32 n);
+    void (*f32_to_bf16)(bf16 *out, const f32 *in, u32 n);
+};
+
+extern const cpu_cvt_kernels_t cpu_cvt_kernels_generic;
+extern const cpu_cvt_kernels_t cpu_cvt_kernels_avx2;
+extern const cpu_cvt_kernels_t cpu_cvt_kernels_avx512;
+extern const cpu_cvt_kernels_t cpu_cvt_kernels_avx512_bf16;
+
+/* Conversions for the given ISA level, with AVX512-BF16 if the host has it. */
+const cpu_cvt_kernels_t& cpu_cvt_kernels(cpu_isa_e isa);
+
+/* Conversions for the currently active ISA level. */
+inline const cpu_cvt_kernels_t& cpu_cvt_kernels()
+{
+    return cpu_cvt_kernels(cpu_isa());
+}
+
+/* Row conversion picked by the element types. */
+inline void cpu_cvt_row(const cpu_cvt_kernels_t &cvt, f32 *out, const f16 *in, const u32 n)
+{ cvt.f16_to_f32(out, in, n); }
+
+inline void cpu_cvt_row(const cpu_cvt_kernels_t &cvt, f16 *out, const f32 *in, const u32 n)
+{ cvt.f32_to_f16(out, in, n); }
+
+inline void cpu_cvt_row(const cpu_cvt_kernels_t &cvt, f32 *out, const bf16 *in, const u32 n)
+{ cvt.bf16_to_f32(out, in, n); }
+
+inline void cpu_cvt_row(const cpu_cvt_kernels_t &cvt, bf16 *out, const f32 *in, const u32 n)
+{ cvt.f32_to_bf16(out, in, n); }
+
+/*
+ * Kernels of the quantized GEMM, u8 lhs times i8 rhs into i32.
+ *
+ * Slivers are packed in groups of 'kgroup' consecutive k, which the
+ * micro-kernel multiplies and sums in one go: byte quads for VNNI vpdpbusd,
+ * or pairs widened to i16 for vpmaddwd. pmaddubsw is no option, its i16
+ * sums of two u8 * i8 products saturate. See matmul_cpu_q8.cc
+ */
+struct cpu_q8_kernels_t {
+    /*
+     * Same as cpu_kernels_t::micro_kernel_fn, over 'kg' groups of k.
+     * 'a' and 'b' point to bytes or i16, as 'widen' says.
+     */
+    using micro_kernel_fn = void (*)(
+        u32 kg,
+        const void *a,
+        const void *b,
+        i32 *c,
+        u32 ldc,
+        u32 mr,
+        u32 nr,
+        bool accumulate
+    );
+
+    cpu_isa_e isa;
+
+    u32 mr;
+    u32 nr;
+    u32 mc;
+    u32 kc; /* Multiple of kgroup. */
+    u32 nc;
+
+    u32 kgroup;
+    bool widen; /* Packed as i16, otherwise as they are. */
+
+    micro_kernel_fn micro_kernel;
+};
+
+extern const cpu_q8_kernels_t cpu_q8_kernels_generic;
+extern const cpu_q8_kernels_t cpu_q8_kernels_avx2;
+extern const cpu_q8_kernels_t cpu_q8_kernels_avx512_vnni;
+
+/*
+ * Quantized kernels for the given ISA level. The avx512 level uses the AVX2
+ * ones, unless the host has AVX512-VNNI: plain AVX-512F has no byte or word
+ * multiplies.
+ */
+const cpu_q8_kernels_t& cpu_q8_kernels(cpu_isa_e isa);
+
+/*
+ * Computes:
+ *     out = op(lhs) @ op(rhs)
+ *
+ * in i32, with the quantized kernels. Zero points are up to the caller.
+ */
+void gemm_q8_cpu(
+    matview_i32_t out,
+    matview_u8_t lhs,
+    matview_i8_t rhs,
+    const cpu_q8_kernels_t &kernels,
+    mat_trans_e trans = mat_trans_e::none
+);
+
+/*
+ * Kernels of the sparse times dense products, see mat_sparse.h
+ *
+ * Each computes 'n' (<= nc) contiguous elements of a row of the result,
+ *
+ *     out = alpha * sum(value * rhs row) + beta * out
+ *
+ * over the nonzeros of the row of lhs, with the sums kept in registers. 'out'
+ * isn't read when beta is zero.
+ */
+struct cpu_sparse_kernels_t {
+    cpu_isa_e isa;
+
+    u32 nc;
+    u32 mr; /* Rows of a block row bsr_rows() does at once. */
+
+    /* Nonzeros given by column index and value. */
+    void (*csr_row)(
+        f32 *out,
+        const f32 *rhs,
+        size_t rhs_stride,
+        const u32 *col_idx,
+        const f32 *values,
+        u32 nnz,
+        f32 alpha,
+        f32 beta,
+        u32 n
+    );
+
+    /*
+     * Up to 'mr' rows of a block row, blocks 'block_w' wide. 'values' points
+     * to the first of the rows within the first block, blocks are
+     * 'block_size' apart. Each row of rhs is loaded once for all the rows.
+     * Only the first 'width' columns of lhs exist, the rest of the last
+     * block is padding.
+     */
+    void (*bsr_rows)(
+        f32 *out,
+        size_t out_stride,
+        const f32 *rhs,
+        size_t rhs_stride,
+        const u32 *block_col_idx,
+        const f32 *values,
+        u32 num_blocks,
+        u32 block_w,
+        u32 block_size,
+        u32 width,
+        u32 rows,
+        f32 alpha,
+        f32 beta,
+        u32 n
+    );
+};
+
+extern const cpu_sparse_kernels_t cpu_sparse_kernels_generic;
+extern const cpu_sparse_kernels_t cpu_sparse_kernels_avx2;
+extern const cpu_sparse_kernels_t cpu_sparse_kernels_avx512;
+
+const cpu_sparse_kernels_t& cpu_sparse_kernels(cpu_isa_e isa);
+
+/* Sparse kernels for the currently active ISA level. */
+inline const cpu_sparse_kernels_t& cpu_sparse_kernels()
+{
+    return cpu_sparse_kernels(cpu_isa());
+}
+
+/*
+ * Philox4x32-10 random number generator, see random.h
+ *
+ * Each kernel produces 'lanes' consecutive 16 byte blocks, counters 'first'
+ * (a multiple of 'lanes') and up of 'stream', keyed by 'seed', stored one
+ * after the other. Same bytes at every ISA level.
+ */
+constexpr u32 PHILOX_M0 = 0xd2511f53;
+constexpr u32 PHILOX_M1 = 0xcd9e8d57;
+constexpr u32 PHILOX_W0 = 0x9e3779b9;
+constexpr u32 PHILOX_W1 = 0xbb67ae85;
+constexpr u32 PHILOX_ROUNDS = 10;
+constexpr u32 PHILOX_MAX_LANES = 16;
+
+struct cpu_random_kernels_t {
+    cpu_isa_e isa;
+
+    u32 lanes;
+
+    void (*philox)(u32 *out, u64 seed, u64 stream, u64 first);
+};
+
+extern const cpu_random_kernels_t cpu_random_kernels_generic;
+extern const cpu_random_kernels_t cpu_random_kernels_avx2;
+extern const cpu_random_kernels_t cpu_random_kernels_avx512;
+
+const cpu_random_kernels_t& cpu_random_kernels(cpu_isa_e isa);
+
+/* Random kernels for the currently active ISA level. */
+inline const cpu_random_kernels_t& cpu_random_kernels()
+{
+    return cpu_random_kernels(cpu_isa());
+}
+
+/*
+ * Computes:
+ *     out = alpha * lhs @ rhs + beta * out
+ *
+ * Using the cache blocked, packed GEMM engine. Operands flagged in 'trans'
+ * are used transposed, packing reads them as they are stored.
+ * Assumes 'out' is correctly sized. With beta == 0, previous contents of 'out'
+ * are never read, so they don't have to be initialized.
+ */
+void gemm_cpu_blocked(
+    matview_i64_t out,
+    matview_i64_t lhs,
+    matview_i64_t rhs,
+    i64 alpha = 1,
+    i64 beta = 0,
+    mat_trans_e trans = mat_trans_e::none
+);
+
+void gemm_cpu_blocked(
+    matview_f32_t out,
+    matview_f32_t lhs,
+    matview_f32_t rhs,
+    f32 alpha = 1,
+    f32 beta = 0,
+    mat_trans_e trans = mat_trans_e::none
+);
+
+/* Same as above, but with explicitly selected kernels. */
+void gemm_cpu_blocked(
+    matview_i64_t out,
+    matview_i64_t lhs,
+    matview_i64_t rhs,
+    const cpu_kernels_t<i64> &kernels,
+    i64 alpha = 1,
+    i64 beta = 0,
+    mat_trans_e trans = mat_trans_e::none
+);
+
+void gemm_cpu_blocked(
+    matview_f32_t out,
+    matview_f32_t lhs,
+    matview_f32_t rhs,
+    const cpu_kernels_t<f32> &kernels,
+    f32 alpha = 1,
+    f32 beta = 0,
+    mat_trans_e trans = mat_trans_e::none
+);
+
+/*
+ * Half width operands, f32 output. Slivers of the operands are converted to
+ * f32 right before they are packed, the f32 micro-kernels do the rest.
+ */
+void gemm_cpu_blocked(
+    matview_f32_t out,
+    matview_f16_t lhs,
+    matview_f16_t rhs,
+    const cpu_kernels_t<f32> &kernels,
+    f32 alpha = 1,
+    f32 beta = 0,
+    mat_trans_e trans = mat_trans_e::none
+);
+
+void gemm_cpu_blocked(
+    matview_f32_t out,
+    matview_bf16_t lhs,
+    matview_bf16_t rhs,
+    const cpu_kernels_t<f32> &kernels,
+    f32 alpha = 1,
+    f32 beta = 0,
+    mat_trans_e trans = mat_trans_e::none
+);
+
+/*
+ * Calls gemm(out, lhs, rhs, trans) with row-major equivalents of operands in
+ * any layout, see mat_layout_e. Column-major operands are row-major ones
+ * used transposed, and for a column-major 'out' the product is computed
+ * transposed, out^T = rhs^T @ lhs^T. Tiled and Morton ones are copied to
+ * row-major temporaries, and 'out' back from its one.
+ */
+template <typename ViewType, typename InViewType, typename ValueType, typename GemmFn>
+void gemm_cpu_any_layout(
+    ViewType out,
+    InViewType lhs,
+    InViewType rhs,
+    const ValueType beta,
+    const mat_trans_e trans,
+    GemmFn &&gemm
+) {
+    using InMatrixType = typename InViewType::ParentType;
+    using MatrixType = typename ViewType::ParentType;
+
+    InMatrixType lhs_tmp, rhs_tmp;
+    MatrixType out_tmp;
+
+    auto row_major = [](auto m, bool &trans, auto &tmp, const bool copy) -> decltype(m) {
+        using View = decltype(m);
+        using Matrix = std::remove_reference_t<decltype(tmp)>;
+
+        switch (m.layout) {
+        case mat_layout_e::row_major:
+            break;
+        case mat_layout_e::col_major:
+            trans = !trans;
+            return View(m.data, m.height, m.width, m.stride);
+        case mat_layout_e::tiled:
+        case mat_layout_e::morton:
+            tmp = Matrix::make_matrix_uninit(m.width, m.height);
+            if (copy)
+                mat_copy(View(tmp), m);
+            return View(tmp);
+        }
+
+        return m;
+    };
+
+    bool trans_lhs = mat_trans_lhs(trans);
+    bool trans_rhs = mat_trans_rhs(trans);
+    bool trans_out = false;
+
+    /* With beta == 0 'out' is never read, its temporary starts empty. */
+    const ViewType dst = out;
+
+    out = row_major(out, trans_out, out_tmp, beta != 0);
+    lhs = row_major(lhs, trans_lhs, lhs_tmp, true);
+    rhs = row_major(rhs, trans_rhs, rhs_tmp, true);
+
+    auto flags = [](const bool lhs, const bool rhs) {
+        return (lhs ? mat_trans_e::lhs : mat_trans_e::none) | (rhs ? mat_trans_e::rhs : mat_trans_e::none);
+    };
+
+    if (trans_out)
+        gemm(out, rhs, lhs, flags(!trans_rhs, !trans_lhs));
+    else
+        gemm(out, lhs, rhs, flags(trans_lhs, trans_rhs));
+
+    if (out_tmp.data)
+        mat_copy(dst, out);
+}
+
+/*
+ * 'm' itself if it's row-major, otherwise a row-major temporary allocated in
+ * 'tmp', with the contents of 'm' copied in if 'copy'. Copy results back with
+ * mat_copy() when 'tmp' got allocated.
+ */
+template <typename ViewType, typename MatrixType = ViewType::ParentType>
+ViewType mat_row_major_tmp(const ViewType m, MatrixType &tmp, const bool copy)
+{
+    if (m.layout == mat_layout_e::row_major)
+        return m;
+
+    tmp = MatrixType::make_matrix_uninit(m.width, m.height);
+    if (copy)
+        mat_copy(ViewType(tmp), m);
+
+    return ViewType(tmp);
+}
+
+/*
+ * Same as gemm_cpu_blocked(), but splits the output into 2D tiles and
+ * computes them on all the threads of 'pool'.
+ *
+ * Blocks until done. Must not be called from a work item of the same pool.
+ */
+void gemm_cpu_parallel(
+    matview_i64_t out,
+    matview_i64_t lhs,
+    matview_i64_t rhs,
+    thread_pool &pool,
+    i64 alpha = 1,
+    i64 beta = 0,
+    mat_trans_e trans = mat_trans_e::none
+);
+
+void gemm_cpu_parallel(
+    matview_f32_t out,
+    matview_f32_t lhs,
+    matview_f32_t rhs,
+    thread_pool &pool,
+    f32 alpha = 1,
+    f32 beta = 0,
+    mat_trans_e trans = mat_trans_e::none
+);
+
+/*
+ * Matrix-vector shaped products, M == 1 or N == 1, see matmul_cpu_gemv.cc
+ * Same semantics as gemm_cpu_blocked(), and spreads the work over 'pool' if
+ * given one. Returns false without touching anything for any other shape,
+ * the caller goes on with GEMM then.
+ */
+bool gemv_cpu(
+    matview_i64_t out,
+    matview_i64_t lhs,
+    matview_i64_t rhs,
+    const cpu_kernels_t<i64> &kernels,
+    i64 alpha,
+    i64 beta,
+    mat_trans_e trans,
+    thread_pool *pool
+);
+
+bool gemv_cpu(
+    matview_f32_t out,
+    matview_f32_t lhs,
+    matview_f32_t rhs,
+    const cpu_kernels_t<f32> &kernels,
+    f32 alpha,
+    f32 beta,
+    mat_trans_e trans,
+    thread_pool *pool
+);
+
+/*
+ * Pools used by the parallel CPU kernels when the caller doesn't provide one.
+ * Created on the first use with opt_num_threads threads, or one per CPU if unset.
+ */
+thread_pool& cpu_thread_pool();
+task_pool& cpu_task_pool();
+
+/*
+ * Number of elements of the workspace strassen_cpu_arena() needs
+ * for (m x k) @ (k x n) product.
+ */
+size_t strassen_cpu_workspace_elems(u32 m, u32 k, u32 n, u32 crossover);
+
+/*
+ * Computes:
+ *     out = lhs @ rhs
+ *
+ * Using Strassen, with all the temporaries carved out of 'workspace', which has
+ * to hold at least strassen_cpu_workspace_elems(m, k, n, crossover) elements.
+ * Doesn't allocate. Recursion stops at 'crossover' and the blocked GEMM
+ * computes the rest. Any shapes are fine, odd dimensions are peeled off.
+ * Row-major operands only.
+ */
+void strassen_cpu_arena(
+    matview_i64_t out,
+    matview_i64_t lhs,
+    matview_i64_t rhs,
+    i64 *workspace,
+    u32 crossover,
+    strassen_stats_t *stats
+);
+
+void strassen_cpu_arena(
+    matview_f32_t out,
+    matview_f32_t lhs,
+    matview_f32_t rhs,
+    f32 *workspace,
+    u32 crossover,
+    strassen_stats_t *stats
+);
+
+/* Same as the two above, but for the Strassen-Winograd variant. */
+size_t strassen_winograd_cpu_workspace_elems(u32 m, u32 k, u32 n, u32 crossover);
+
+void strassen_winograd_cpu_arena(
+    matview_i64_t out,
+    matview_i64_t lhs,
+    matview_i64_t rhs,
+    i64 *workspace,
+    u32 crossover,
+    strassen_stats_t *stats
+);
+
+void strassen_winograd_cpu_arena(
+    matview_f32_t out,
+    matview_f32_t lhs,
+    matview_f32_t rhs,
+    f32 *workspace,
+    u32 crossover,
+    strassen_stats_t *stats
+);
+
+/*
+ * Number of elements of the workspace strassen_cpu_parallel_arena() needs
+ * for (m x k) @ (k x n) product.
+ */
+size_t strassen_cpu_parallel_workspace_elems(u32 m, u32 k, u32 n, u32 crossover, u32 task_depth);
+
+/*
+ * Same as strassen_cpu_arena(), but the top 'task_depth' levels of the
+ * recursion run their seven products as tasks on 'pool'. Blocks until done.
+ * May be called from a task of the same pool.
+ */
+void strassen_cpu_parallel_arena(
+    matview_i64_t out,
+    matview_i64_t lhs,
+    matview_i64_t rhs,
+    i64 *workspace,
+    u32 crossover,
+    u32 task_depth,
+    task_pool &pool,
+    strassen_stats_t *stats
+);
+
+void strassen_cpu_parallel_arena(
+    matview_f32_t out,
+    matview_f32_t lhs,
+    matview_f32_t rhs,
+    f32 *workspace,
+    u32 crossover,
+    u32 task_depth,
+    task_pool &pool,
+    strassen_stats_t *stats
+);
+
+/*
+ * Strassen tuning.
+ *
+ * Crossover is the size at and below which Strassen stops recursing and the
+ * blocked GEMM takes over. It depends on the host, so it is measured by
+ * strassen_tune() and kept in a per-machine tuning file, see strassen_tune.cc
+ */
+enum class strassen_variant_e : u8 {
+    classic,
+    winograd,
+};
+
+/* Crossover of a variant that never pays off on this host, nothing gets split. */
+constexpr u32 STRASSEN_CROSSOVER_NEVER = UINT32_MAX;
+
+struct strassen_tuning_t {
+    cpu_isa_e isa; /* Level the kernels were dispatched to while measuring. */
+    u32 classic_i64;
+    u32 classic_f32;
+    u32 winograd_i64;
+    u32 winograd_f32;
+};
+
+/*
+ * Tuning in use. On the first call it is loaded from strassen_tuning_path(),
+ * or left at the built-in defaults, if there is no file for the active ISA.
+ */
+strassen_tuning_t strassen_tuning();
+
+/* Built-in defaults, what runs without a tuning file. */
+strassen_tuning_t strassen_tuning_default();
+
+/*
+ * Replaces the tuning in use. Safe to call from any thread, Strassen calls
+ * already running keep the crossover they started with.
+ */
+void strassen_tuning_set(const strassen_tuning_t &tuning);
+
+/* Crossover of the given variant, for the tuning in use. */
+template <typename ValueType>
+u32 strassen_crossover(strassen_variant_e variant);
+
+template <> u32 strassen_crossover<i64>(strassen_variant_e variant);
+template <> u32 strassen_crossover<f32>(strassen_variant_e variant);
+
+/*
+ * $MATMUL_TUNING_FILE if set,
+ * otherwise $XDG_CACHE_HOME/matmul-tuning, or ~/.cache/matmul-tuning
+ */
+std::string strassen_tuning_path();
+
+/* Both return non-zero on failure, with the reason printed to stderr. */
+int strassen_tuning_load(const char *path, strassen_tuning_t &out);
+int strassen_tuning_save(const char *path, const strassen_tuning_t &tuning);
+
+/*
+ * Measures the crossovers on this host, takes a few seconds.
+ * Progress is printed to 'log', unless it is null.
+ */
+strassen_tuning_t strassen_tune(FILE *log);
+
+/*
+ * Crossover from whether one level of Strassen beat the blocked GEMM at each
+ * of 'sizes', in increasing order: the biggest size it lost at. Half the
+ * smallest size if it won at all of them, STRASSEN_CROSSOVER_NEVER if it lost
+ * at the biggest.
+ */
+u32 strassen_tune_pick(const u32 *sizes, const bool *level_wins, u32 num_sizes);
+
+/*
+ * strassen_tune(), then makes the result active and saves it to
+ * strassen_tuning_path(). Returns non-zero if saving failed.
+ */
+int strassen_tune_and_save(FILE *log);
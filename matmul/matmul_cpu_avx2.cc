@@ -0,0 +1,719 @@
+#include "compiler.h"
+#include "matmul_cpu.h"
+#include "types.h"
+
+#include <algorithm>
+#include <immintrin.h>
+#include <string.h>
+
+/*
+ * AVX2 + FMA kernels.
+ *
+ * Every function here is compiled for the AVX2 target explicitly, the rest
+ * of the binary stays on the baseline ISA. Only reachable through the
+ * cpu_kernels_*_avx2 tables, which dispatch hands out only when CPUID says so.
+ */
+
+/*
+ * f32 micro-kernel, 6x16 tile.
+ * 12 ymm accumulators + 2 for the rhs row + 1 for the broadcast lhs value.
+ */
+TARGET_AVX2
+static void gemm_micro_kernel_f32_avx2(
+    const u32 kc,
+    const f32 * __restrict a,
+    const f32 * __restrict b,
+    f32 * __restrict c,
+    const u32 ldc,
+    const u32 mr,
+    const u32 nr,
+    const bool accumulate
+) {
+    constexpr u32 MR = 6;
+    constexpr u32 NR = 16;
+
+    __m256 acc[MR][2];
+
+#pragma GCC unroll 6
+    for (u32 i = 0; i < MR; ++i) {
+        acc[i][0] = _mm256_setzero_ps();
+        acc[i][1] = _mm256_setzero_ps();
+    }
+
+    for (u32 k = 0; k < kc; ++k) {
+        const __m256 b0 = _mm256_loadu_ps(b);
+        const __m256 b1 = _mm256_loadu_ps(b + 8);
+
+#pragma GCC unroll 6
+        for (u32 i = 0; i < MR; ++i) {
+            const __m256 ai = _mm256_broadcast_ss(a + i);
+            acc[i][0] = _mm256_fmadd_ps(ai, b0, acc[i][0]);
+            acc[i][1] = _mm256_fmadd_ps(ai, b1, acc[i][1]);
+        }
+
+        a += MR;
+        b += NR;
+    }
+
+    if (mr == MR && nr == NR) [[likely]] {
+#pragma GCC unroll 6
+        for (u32 i = 0; i < MR; ++i) {
+            f32 * const row = c + i * ldc;
+
+            if (accumulate) {
+                acc[i][0] = _mm256_add_ps(acc[i][0], _mm256_loadu_ps(row));
+                acc[i][1] = _mm256_add_ps(acc[i][1], _mm256_loadu_ps(row + 8));
+            }
+
+            _mm256_storeu_ps(row, acc[i][0]);
+            _mm256_storeu_ps(row + 8, acc[i][1]);
+        }
+
+        return;
+    }
+
+    /* Partial tile on the edge of the output, go through memory. */
+    alignas(32) f32 tmp[MR][NR];
+
+    for (u32 i = 0; i < MR; ++i) {
+        _mm256_store_ps(&tmp[i][0], acc[i][0]);
+        _mm256_store_ps(&tmp[i][8], acc[i][1]);
+    }
+
+    for (u32 i = 0; i < mr; ++i)
+        for (u32 j = 0; j < nr; ++j)
+            c[i * ldc + j] = accumulate ? c[i * ldc + j] + tmp[i][j] : tmp[i][j];
+}
+
+/*
+ * AVX2 has no 64-bit lane multiply (vpmullq is AVX-512DQ).
+ * Build the low 64 bits of the product out of three 32x32->64 multiplies:
+ *
+ *   a * b mod 2^64 = lo(a)*lo(b) + ((hi(a)*lo(b) + lo(a)*hi(b)) << 32)
+ *
+ * 'a_hi' and 'b_hi' are passed in already shifted, so that callers can hoist
+ * them out of the loops.
+ */
+TARGET_AVX2
+static inline __m256i mullo_epi64_avx2(const __m256i a, const __m256i a_hi, const __m256i b, const __m256i b_hi)
+{
+    const __m256i lo = _mm256_mul_epu32(a, b);
+    const __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(a_hi, b), _mm256_mul_epu32(a, b_hi));
+
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+/* i64 micro-kernel, 4x8 tile, 8 ymm accumulators. */
+TARGET_AVX2
+static void gemm_micro_kernel_i64_avx2(
+    const u32 kc,
+    const i64 * __restrict a,
+    const i64 * __restrict b,
+    i64 * __restrict c,
+    const u32 ldc,
+    const u32 mr,
+    const u32 nr,
+    const bool accumulate
+) {
+    constexpr u32 MR = 4;
+    constexpr u32 NR = 8;
+
+    __m256i acc[MR][2];
+
+#pragma GCC unroll 4
+    for (u32 i = 0; i < MR; ++i) {
+        acc[i][0] = _mm256_setzero_si256();
+        acc[i][1] = _mm256_setzero_si256();
+    }
+
+    for (u32 k = 0; k < kc; ++k) {
+        const __m256i b0 = _mm256_loadu_si256(rcast<const __m256i*>(b));
+        const __m256i b1 = _mm256_loadu_si256(rcast<const __m256i*>(b + 4));
+        const __m256i b0_hi = _mm256_srli_epi64(b0, 32);
+        const __m256i b1_hi = _mm256_srli_epi64(b1, 32);
+
+#pragma GCC unroll 4
+        for (u32 i = 0; i < MR; ++i) {
+            const __m256i ai = _mm256_set1_epi64x(a[i]);
+            const __m256i ai_hi = _mm256_srli_epi64(ai, 32);
+
+            acc[i][0] = _mm256_add_epi64(acc[i][0], mullo_epi64_avx2(ai, ai_hi, b0, b0_hi));
+            acc[i][1] = _mm256_add_epi64(acc[i][1], mullo_epi64_avx2(ai, ai_hi, b1, b1_hi));
+        }
+
+        a += MR;
+        b += NR;
+    }
+
+    alignas(32) i64 tmp[MR][NR];
+
+    for (u32 i = 0; i < MR; ++i) {
+        _mm256_store_si256(rcast<__m256i*>(&tmp[i][0]), acc[i][0]);
+        _mm256_store_si256(rcast<__m256i*>(&tmp[i][4]), acc[i][1]);
+    }
+
+    for (u32 i = 0; i < mr; ++i)
+        for (u32 j = 0; j < nr; ++j)
+            c[i * ldc + j] = accumulate ? c[i * ldc + j] + tmp[i][j] : tmp[i][j];
+}
+
+TARGET_AVX2
+static void add_row_f32_avx2(f32 *out, const f32 *lhs, const f32 *rhs, const u32 n)
+{
+    u32 i = 0;
+
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(lhs + i), _mm256_loadu_ps(rhs + i)));
+
+    for (; i < n; ++i)
+        out[i] = lhs[i] + rhs[i];
+}
+
+TARGET_AVX2
+static void sub_row_f32_avx2(f32 *out, const f32 *lhs, const f32 *rhs, const u32 n)
+{
+    u32 i = 0;
+
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(out + i, _mm256_sub_ps(_mm256_loadu_ps(lhs + i), _mm256_loadu_ps(rhs + i)));
+
+    for (; i < n; ++i)
+        out[i] = lhs[i] - rhs[i];
+}
+
+TARGET_AVX2
+static void add_row_i64_avx2(i64 *out, const i64 *lhs, const i64 *rhs, const u32 n)
+{
+    u32 i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        const __m256i l = _mm256_loadu_si256(rcast<const __m256i*>(lhs + i));
+        const __m256i r = _mm256_loadu_si256(rcast<const __m256i*>(rhs + i));
+        _mm256_storeu_si256(rcast<__m256i*>(out + i), _mm256_add_epi64(l, r));
+    }
+
+    for (; i < n; ++i)
+        out[i] = lhs[i] + rhs[i];
+}
+
+TARGET_AVX2
+static void sub_row_i64_avx2(i64 *out, const i64 *lhs, const i64 *rhs, const u32 n)
+{
+    u32 i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        const __m256i l = _mm256_loadu_si256(rcast<const __m256i*>(lhs + i));
+        const __m256i r = _mm256_loadu_si256(rcast<const __m256i*>(rhs + i));
+        _mm256_storeu_si256(rcast<__m256i*>(out + i), _mm256_sub_epi64(l, r));
+    }
+
+    for (; i < n; ++i)
+        out[i] = lhs[i] - rhs[i];
+}
+
+TARGET_AVX2
+static f32 hsum_ps_avx2(const __m256 v)
+{
+    const __m128 s4 = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    const __m128 s2 = _mm_add_ps(s4, _mm_movehl_ps(s4, s4));
+    const __m128 s1 = _mm_add_ss(s2, _mm_movehdup_ps(s2));
+
+    return _mm_cvtss_f32(s1);
+}
+
+/* Four accumulators, enough to keep both FMA ports busy while loads stream in. */
+TARGET_AVX2
+static f32 dot_row_f32_avx2(const f32 *a, const f32 *b, const u32 n)
+{
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    u32 i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i),      _mm256_loadu_ps(b + i),      acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8),  _mm256_loadu_ps(b + i + 8),  acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), acc3);
+    }
+
+    for (; i + 8 <= n; i += 8)
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+
+    f32 sum = hsum_ps_avx2(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+
+    for (; i < n; ++i)
+        sum += a[i] * b[i];
+
+    return sum;
+}
+
+TARGET_AVX2
+static void axpy_row_f32_avx2(f32 *y, const f32 alpha, const f32 *x, const u32 n)
+{
+    const __m256 va = _mm256_set1_ps(alpha);
+    u32 i = 0;
+
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+
+    for (; i < n; ++i)
+        y[i] += alpha * x[i];
+}
+
+TARGET_AVX2
+static i64 dot_row_i64_avx2(const i64 *a, const i64 *b, const u32 n)
+{
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    u32 i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        const __m256i a0 = _mm256_loadu_si256(rcast<const __m256i*>(a + i));
+        const __m256i a1 = _mm256_loadu_si256(rcast<const __m256i*>(a + i + 4));
+        const __m256i b0 = _mm256_loadu_si256(rcast<const __m256i*>(b + i));
+        const __m256i b1 = _mm256_loadu_si256(rcast<const __m256i*>(b + i + 4));
+
+        acc0 = _mm256_add_epi64(acc0, mullo_epi64_avx2(a0, _mm256_srli_epi64(a0, 32), b0, _mm256_srli_epi64(b0, 32)));
+        acc1 = _mm256_add_epi64(acc1, mullo_epi64_avx2(a1, _mm256_srli_epi64(a1, 32), b1, _mm256_srli_epi64(b1, 32)));
+    }
+
+    alignas(32) i64 tmp[4];
+    _mm256_store_si256(rcast<__m256i*>(tmp), _mm256_add_epi64(acc0, acc1));
+
+    i64 sum = tmp[0] + tmp[1] + tmp[2] + tmp[3];
+
+    for (; i < n; ++i)
+        sum += a[i] * b[i];
+
+    return sum;
+}
+
+TARGET_AVX2
+static void axpy_row_i64_avx2(i64 *y, const i64 alpha, const i64 *x, const u32 n)
+{
+    const __m256i va = _mm256_set1_epi64x(alpha);
+    const __m256i va_hi = _mm256_srli_epi64(va, 32);
+    u32 i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        const __m256i vx = _mm256_loadu_si256(rcast<const __m256i*>(x + i));
+        const __m256i vy = _mm256_loadu_si256(rcast<const __m256i*>(y + i));
+        const __m256i prod = mullo_epi64_avx2(va, va_hi, vx, _mm256_srli_epi64(vx, 32));
+
+        _mm256_storeu_si256(rcast<__m256i*>(y + i), _mm256_add_epi64(vy, prod));
+    }
+
+    for (; i < n; ++i)
+        y[i] += alpha * x[i];
+}
+
+TARGET_AVX2
+static void f16_to_f32_avx2(f32 *out, const f16 *in, const u32 n)
+{
+    u32 i = 0;
+
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128(rcast<const __m128i*>(in + i))));
+
+    for (; i < n; ++i)
+        out[i] = in[i];
+}
+
+TARGET_AVX2
+static void f32_to_f16_avx2(f16 *out, const f32 *in, const u32 n)
+{
+    u32 i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        const __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm_storeu_si128(rcast<__m128i*>(out + i), h);
+    }
+
+    for (; i < n; ++i)
+        out[i] = in[i];
+}
+
+TARGET_AVX2
+static void bf16_to_f32_avx2(f32 *out, const bf16 *in, const u32 n)
+{
+    u32 i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        const __m256i h = _mm256_cvtepu16_epi32(_mm_loadu_si128(rcast<const __m128i*>(in + i)));
+        _mm256_storeu_si256(rcast<__m256i*>(out + i), _mm256_slli_epi32(h, 16));
+    }
+
+    for (; i < n; ++i)
+        out[i] = in[i];
+}
+
+/* Round to nearest even on the integer bits, NaNs are kept quiet NaNs. */
+TARGET_AVX2
+static void f32_to_bf16_avx2(bf16 *out, const f32 *in, const u32 n)
+{
+    const __m256i bias = _mm256_set1_epi32(0x7fff);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i quiet = _mm256_set1_epi32(0x40);
+    u32 i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        const __m256 v = _mm256_loadu_ps(in + i);
+        const __m256i f = _mm256_castps_si256(v);
+        const __m256i odd = _mm256_and_si256(_mm256_srli_epi32(f, 16), one);
+        const __m256i rounded = _mm256_srli_epi32(_mm256_add_epi32(f, _mm256_add_epi32(bias, odd)), 16);
+        const __m256i nan = _mm256_or_si256(_mm256_srli_epi32(f, 16), quiet);
+        const __m256 is_nan = _mm256_cmp_ps(v, v, _CMP_UNORD_Q);
+        const __m256i h = _mm256_blendv_epi8(rounded, nan, _mm256_castps_si256(is_nan));
+
+        _mm_storeu_si128(
+            rcast<__m128i*>(out + i),
+            _mm_packus_epi32(_mm256_castsi256_si128(h), _mm256_extracti128_si256(h, 1))
+        );
+    }
+
+    for (; i < n; ++i)
+        out[i] = in[i];
+}
+
+/*
+ * Quantized micro-kernel, 6x16 tile over i16 pairs.
+ * vpmaddwd multiplies a broadcast pair of lhs with the pairs of 8 columns
+ * and sums each two products into i32, exact for widened u8 and i8.
+ */
+TARGET_AVX2
+static void gemm_q8_micro_kernel_avx2(
+    const u32 kg,
+    const void *a_,
+    const void *b_,
+    i32 * __restrict c,
+    const u32 ldc,
+    const u32 mr,
+    const u32 nr,
+    const bool accumulate
+) {
+    constexpr u32 MR = 6;
+    constexpr u32 NR = 16;
+    constexpr u32 G = 2;
+
+    const i16 * __restrict a = scast<const i16*>(a_);
+    const i16 * __restrict b = scast<const i16*>(b_);
+
+    __m256i acc[MR][2];
+
+#pragma GCC unroll 6
+    for (u32 i = 0; i < MR; ++i) {
+        acc[i][0] = _mm256_setzero_si256();
+        acc[i][1] = _mm256_setzero_si256();
+    }
+
+    for (u32 k = 0; k < kg; ++k) {
+        const __m256i b0 = _mm256_loadu_si256(rcast<const __m256i*>(b));
+        const __m256i b1 = _mm256_loadu_si256(rcast<const __m256i*>(b + 16));
+
+#pragma GCC unroll 6
+        for (u32 i = 0; i < MR; ++i) {
+            i32 pair;
+            memcpy(&pair, a + i * G, sizeof(pair));
+
+            const __m256i ai = _mm256_set1_epi32(pair);
+            acc[i][0] = _mm256_add_epi32(acc[i][0], _mm256_madd_epi16(ai, b0));
+            acc[i][1] = _mm256_add_epi32(acc[i][1], _mm256_madd_epi16(ai, b1));
+        }
+
+        a += MR * G;
+        b += NR * G;
+    }
+
+    if (mr == MR && nr == NR) [[likely]] {
+#pragma GCC unroll 6
+        for (u32 i = 0; i < MR; ++i) {
+            __m256i * const row = rcast<__m256i*>(c + i * ldc);
+
+            if (accumulate) {
+                acc[i][0] = _mm256_add_epi32(acc[i][0], _mm256_loadu_si256(row));
+                acc[i][1] = _mm256_add_epi32(acc[i][1], _mm256_loadu_si256(row + 1));
+            }
+
+            _mm256_storeu_si256(row, acc[i][0]);
+            _mm256_storeu_si256(row + 1, acc[i][1]);
+        }
+
+        return;
+    }
+
+    alignas(32) i32 tmp[MR][NR];
+
+    for (u32 i = 0; i < MR; ++i) {
+        _mm256_store_si256(rcast<__m256i*>(&tmp[i][0]), acc[i][0]);
+        _mm256_store_si256(rcast<__m256i*>(&tmp[i][8]), acc[i][1]);
+    }
+
+    for (u32 i = 0; i < mr; ++i)
+        for (u32 j = 0; j < nr; ++j)
+            c[i * ldc + j] = accumulate ? c[i * ldc + j] + tmp[i][j] : tmp[i][j];
+}
+
+/*
+ * Sparse row kernels, 32 columns per row in 4 ymm. The block kernel does 2
+ * rows, which with the loaded rhs row is all the registers there are.
+ * Partial rows go through a zero padded copy of the rhs row, AVX2 has no
+ * cheap masked loads.
+ */
+constexpr u32 SPMM_NC_AVX2 = 32;
+constexpr u32 SPMM_MR_AVX2 = 2;
+constexpr u32 SPMM_NV_AVX2 = SPMM_NC_AVX2 / 8;
+
+TARGET_AVX2
+static inline void spmm_load_row_avx2(__m256 *r, const f32 *row, const u32 n)
+{
+    alignas(32) f32 tmp[SPMM_NC_AVX2];
+
+    if (n != SPMM_NC_AVX2) [[unlikely]] {
+        std::fill(std::copy_n(row, n, tmp), tmp + SPMM_NC_AVX2, 0.0f);
+        row = tmp;
+    }
+
+#pragma GCC unroll 4
+    for (u32 q = 0; q < SPMM_NV_AVX2; ++q)
+        r[q] = _mm256_loadu_ps(row + q * 8);
+}
+
+TARGET_AVX2
+static inline void spmm_store_avx2(f32 *out, const __m256 *acc, const f32 alpha, const f32 beta, const u32 n)
+{
+    const __m256 va = _mm256_set1_ps(alpha);
+    const __m256 vb = _mm256_set1_ps(beta);
+
+    if (n == SPMM_NC_AVX2) [[likely]] {
+#pragma GCC unroll 4
+        for (u32 q = 0; q < SPMM_NV_AVX2; ++q) {
+            __m256 r = _mm256_mul_ps(va, acc[q]);
+
+            if (beta != 0)
+                r = _mm256_fmadd_ps(vb, _mm256_loadu_ps(out + q * 8), r);
+
+            _mm256_storeu_ps(out + q * 8, r);
+        }
+
+        return;
+    }
+
+    alignas(32) f32 tmp[SPMM_NC_AVX2];
+
+#pragma GCC unroll 4
+    for (u32 q = 0; q < SPMM_NV_AVX2; ++q)
+        _mm256_store_ps(tmp + q * 8, _mm256_mul_ps(va, acc[q]));
+
+    for (u32 j = 0; j < n; ++j)
+        out[j] = beta == 0 ? tmp[j] : tmp[j] + beta * out[j];
+}
+
+TARGET_AVX2
+static void spmm_csr_row_avx2(
+    f32 *out,
+    const f32 *rhs,
+    const size_t rhs_stride,
+    const u32 *col_idx,
+    const f32 *values,
+    const u32 nnz,
+    const f32 alpha,
+    const f32 beta,
+    const u32 n
+) {
+    __m256 acc[SPMM_NV_AVX2];
+
+#pragma GCC unroll 4
+    for (u32 q = 0; q < SPMM_NV_AVX2; ++q)
+        acc[q] = _mm256_setzero_ps();
+
+    for (u32 e = 0; e < nnz; ++e) {
+        const __m256 v = _mm256_set1_ps(values[e]);
+        __m256 r[SPMM_NV_AVX2];
+
+        spmm_load_row_avx2(r, rhs + col_idx[e] * rhs_stride, n);
+
+#pragma GCC unroll 4
+        for (u32 q = 0; q < SPMM_NV_AVX2; ++q)
+            acc[q] = _mm256_fmadd_ps(v, r[q], acc[q]);
+    }
+
+    spmm_store_avx2(out, acc, alpha, beta, n);
+}
+
+TARGET_AVX2
+static void spmm_bsr_rows_avx2(
+    f32 *out,
+    const size_t out_stride,
+    const f32 *rhs,
+    const size_t rhs_stride,
+    const u32 *block_col_idx,
+    const f32 *values,
+    const u32 num_blocks,
+    const u32 block_w,
+    const u32 block_size,
+    const u32 width,
+    const u32 rows,
+    const f32 alpha,
+    const f32 beta,
+    const u32 n
+) {
+    constexpr u32 MR = SPMM_MR_AVX2;
+
+    __m256 acc[MR][SPMM_NV_AVX2];
+
+#pragma GCC unroll 2
+    for (u32 i = 0; i < MR; ++i)
+#pragma GCC unroll 4
+        for (u32 q = 0; q < SPMM_NV_AVX2; ++q)
+            acc[i][q] = _mm256_setzero_ps();
+
+    for (u32 b = 0; b < num_blocks; ++b) {
+        const u32 x0 = block_col_idx[b] * block_w;
+        const u32 w = std::min(block_w, width - x0);
+        const f32 *v = values + size_t(b) * block_size;
+
+        for (u32 k = 0; k < w; ++k) {
+            __m256 r[SPMM_NV_AVX2];
+
+            spmm_load_row_avx2(r, rhs + (x0 + k) * rhs_stride, n);
+
+            /* Rows past 'rows' only ever see zeros, never stored. */
+#pragma GCC unroll 2
+            for (u32 i = 0; i < MR; ++i) {
+                const __m256 vi = _mm256_set1_ps(i < rows ? v[i * block_w + k] : 0.0f);
+
+#pragma GCC unroll 4
+                for (u32 q = 0; q < SPMM_NV_AVX2; ++q)
+                    acc[i][q] = _mm256_fmadd_ps(vi, r[q], acc[i][q]);
+            }
+        }
+    }
+
+    for (u32 i = 0; i < rows; ++i)
+        spmm_store_avx2(out + i * out_stride, acc[i], alpha, beta, n);
+}
+
+/* 32x32 -> 64 bit products of all 8 lanes, split into high and low halves. */
+TARGET_AVX2
+static inline void philox_mulhilo_avx2(const __m256i a, const __m256i m, __m256i &hi, __m256i &lo)
+{
+    const __m256i even = _mm256_mul_epu32(a, m);
+    const __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), m);
+
+    lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xaa);
+    hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xaa);
+}
+
+/* 8 Philox blocks, one per lane, transposed back to block order on store. */
+TARGET_AVX2
+static void philox_avx2(u32 *out, const u64 seed, const u64 stream, const u64 first)
+{
+    const __m256i m0 = _mm256_set1_epi32(PHILOX_M0);
+    const __m256i m1 = _mm256_set1_epi32(PHILOX_M1);
+
+    /* 'first' is a multiple of 8, the low word can't carry. */
+    __m256i c0 = _mm256_add_epi32(_mm256_set1_epi32(u32(first)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256i c1 = _mm256_set1_epi32(u32(first >> 32));
+    __m256i c2 = _mm256_set1_epi32(u32(stream));
+    __m256i c3 = _mm256_set1_epi32(u32(stream >> 32));
+
+    u32 k0 = u32(seed);
+    u32 k1 = u32(seed >> 32);
+
+    for (u32 r = 0; r < PHILOX_ROUNDS; ++r) {
+        __m256i hi0, lo0, hi1, lo1;
+
+        philox_mulhilo_avx2(c0, m0, hi0, lo0);
+        philox_mulhilo_avx2(c2, m1, hi1, lo1);
+
+        c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), _mm256_set1_epi32(k0));
+        c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), _mm256_set1_epi32(k1));
+        c1 = lo1;
+        c3 = lo0;
+
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+
+    /* 4x4 transposes within 128 bit lanes, rK holds blocks K and K + 4. */
+    const __m256i t0 = _mm256_unpacklo_epi32(c0, c1);
+    const __m256i t1 = _mm256_unpackhi_epi32(c0, c1);
+    const __m256i t2 = _mm256_unpacklo_epi32(c2, c3);
+    const __m256i t3 = _mm256_unpackhi_epi32(c2, c3);
+
+    const __m256i r0 = _mm256_unpacklo_epi64(t0, t2);
+    const __m256i r1 = _mm256_unpackhi_epi64(t0, t2);
+    const __m256i r2 = _mm256_unpacklo_epi64(t1, t3);
+    const __m256i r3 = _mm256_unpackhi_epi64(t1, t3);
+
+    __m256i *o = rcast<__m256i*>(out);
+
+    _mm256_storeu_si256(o + 0, _mm256_permute2x128_si256(r0, r1, 0x20));
+    _mm256_storeu_si256(o + 1, _mm256_permute2x128_si256(r2, r3, 0x20));
+    _mm256_storeu_si256(o + 2, _mm256_permute2x128_si256(r0, r1, 0x31));
+    _mm256_storeu_si256(o + 3, _mm256_permute2x128_si256(r2, r3, 0x31));
+}
+
+const cpu_kernels_t<i64> cpu_kernels_i64_avx2 = {
+    .isa = cpu_isa_e::avx2,
+    .mr = 4,
+    .nr = 8,
+    .mc = 64,
+    .kc = 128,
+    .nc = 2048,
+    .micro_kernel = gemm_micro_kernel_i64_avx2,
+    .add_row = add_row_i64_avx2,
+    .sub_row = sub_row_i64_avx2,
+    .dot_row = dot_row_i64_avx2,
+    .axpy_row = axpy_row_i64_avx2,
+};
+
+const cpu_kernels_t<f32> cpu_kernels_f32_avx2 = {
+    .isa = cpu_isa_e::avx2,
+    .mr = 6,
+    .nr = 16,
+    .mc = 96,
+    .kc = 256,
+    .nc = 4096,
+    .micro_kernel = gemm_micro_kernel_f32_avx2,
+    .add_row = add_row_f32_avx2,
+    .sub_row = sub_row_f32_avx2,
+    .dot_row = dot_row_f32_avx2,
+    .axpy_row = axpy_row_f32_avx2,
+};
+
+const cpu_cvt_kernels_t cpu_cvt_kernels_avx2 = {
+    .isa = cpu_isa_e::avx2,
+    .f16_to_f32 = f16_to_f32_avx2,
+    .f32_to_f16 = f32_to_f16_avx2,
+    .bf16_to_f32 = bf16_to_f32_avx2,
+    .f32_to_bf16 = f32_to_bf16_avx2,
+};
+
+const cpu_q8_kernels_t cpu_q8_kernels_avx2 = {
+    .isa = cpu_isa_e::avx2,
+    .mr = 6,
+    .nr = 16,
+    .mc = 96,
+    .kc = 256,
+    .nc = 4096,
+    .kgroup = 2,
+    .widen = true,
+    .micro_kernel = gemm_q8_micro_kernel_avx2,
+};
+
+const cpu_sparse_kernels_t cpu_sparse_kernels_avx2 = {
+    .isa = cpu_isa_e::avx2,
+    .nc = SPMM_NC_AVX2,
+    .mr = SPMM_MR_AVX2,
+    .csr_row = spmm_csr_row_avx2,
+    .bsr_rows = spmm_bsr_rows_avx2,
+};
+
+const cpu_random_kernels_t cpu_random_kernels_avx2 = {
+    .isa = cpu_isa_e::avx2,
+    .lanes = 8,
+    .philox = philox_avx2,
+};
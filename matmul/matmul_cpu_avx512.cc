@@ -0,0 +1,735 @@
+#include "compiler.h"
+#include "matmul_cpu.h"
+#include "types.h"
+
+#include <algorithm>
+#include <immintrin.h>
+#include <string.h>
+
+/*
+ * AVX-512F + AVX-512DQ kernels.
+ *
+ * Same rules as in matmul_cpu_avx2.cc apply, everything here is compiled for
+ * the AVX-512 target explicitly and only reachable through the tables below.
+ */
+
+/* Lane mask for the first n (<= 16) lanes. */
+static inline __mmask16 mask16(const u32 n)
+{
+    return n >= 16 ? 0xffff : scast<__mmask16>((1u << n) - 1);
+}
+
+/* Lane mask for the first n (<= 8) lanes. */
+static inline __mmask8 mask8(const u32 n)
+{
+    return n >= 8 ? 0xff : scast<__mmask8>((1u << n) - 1);
+}
+
+/*
+ * f32 micro-kernel, 12x32 tile.
+ * 24 zmm accumulators, enough independent FMA chains to cover the latency
+ * on both FMA ports.
+ */
+TARGET_AVX512
+static void gemm_micro_kernel_f32_avx512(
+    const u32 kc,
+    const f32 * __restrict a,
+    const f32 * __restrict b,
+    f32 * __restrict c,
+    const u32 ldc,
+    const u32 mr,
+    const u32 nr,
+    const bool accumulate
+) {
+    constexpr u32 MR = 12;
+    constexpr u32 NR = 32;
+
+    __m512 acc[MR][2];
+
+#pragma GCC unroll 12
+    for (u32 i = 0; i < MR; ++i) {
+        acc[i][0] = _mm512_setzero_ps();
+        acc[i][1] = _mm512_setzero_ps();
+    }
+
+    for (u32 k = 0; k < kc; ++k) {
+        const __m512 b0 = _mm512_loadu_ps(b);
+        const __m512 b1 = _mm512_loadu_ps(b + 16);
+
+#pragma GCC unroll 12
+        for (u32 i = 0; i < MR; ++i) {
+            const __m512 ai = _mm512_set1_ps(a[i]);
+            acc[i][0] = _mm512_fmadd_ps(ai, b0, acc[i][0]);
+            acc[i][1] = _mm512_fmadd_ps(ai, b1, acc[i][1]);
+        }
+
+        a += MR;
+        b += NR;
+    }
+
+    /* Masked loads/stores take care of the partial tiles, no extra pass needed. */
+    const __mmask16 m0 = mask16(nr);
+    const __mmask16 m1 = mask16(nr > 16 ? nr - 16 : 0);
+
+#pragma GCC unroll 12
+    for (u32 i = 0; i < MR; ++i) {
+        if (i >= mr)
+            break;
+
+        f32 * const row = c + i * ldc;
+
+        if (accumulate) {
+            acc[i][0] = _mm512_add_ps(acc[i][0], _mm512_maskz_loadu_ps(m0, row));
+            acc[i][1] = _mm512_add_ps(acc[i][1], _mm512_maskz_loadu_ps(m1, row + 16));
+        }
+
+        _mm512_mask_storeu_ps(row, m0, acc[i][0]);
+        _mm512_mask_storeu_ps(row + 16, m1, acc[i][1]);
+    }
+}
+
+/* i64 micro-kernel, 8x16 tile, 16 zmm accumulators, native vpmullq. */
+TARGET_AVX512
+static void gemm_micro_kernel_i64_avx512(
+    const u32 kc,
+    const i64 * __restrict a,
+    const i64 * __restrict b,
+    i64 * __restrict c,
+    const u32 ldc,
+    const u32 mr,
+    const u32 nr,
+    const bool accumulate
+) {
+    constexpr u32 MR = 8;
+    constexpr u32 NR = 16;
+
+    __m512i acc[MR][2];
+
+#pragma GCC unroll 8
+    for (u32 i = 0; i < MR; ++i) {
+        acc[i][0] = _mm512_setzero_si512();
+        acc[i][1] = _mm512_setzero_si512();
+    }
+
+    for (u32 k = 0; k < kc; ++k) {
+        const __m512i b0 = _mm512_loadu_si512(b);
+        const __m512i b1 = _mm512_loadu_si512(b + 8);
+
+#pragma GCC unroll 8
+        for (u32 i = 0; i < MR; ++i) {
+            const __m512i ai = _mm512_set1_epi64(a[i]);
+            acc[i][0] = _mm512_add_epi64(acc[i][0], _mm512_mullo_epi64(ai, b0));
+            acc[i][1] = _mm512_add_epi64(acc[i][1], _mm512_mullo_epi64(ai, b1));
+        }
+
+        a += MR;
+        b += NR;
+    }
+
+    const __mmask8 m0 = mask8(nr);
+    const __mmask8 m1 = mask8(nr > 8 ? nr - 8 : 0);
+
+#pragma GCC unroll 8
+    for (u32 i = 0; i < MR; ++i) {
+        if (i >= mr)
+            break;
+
+        i64 * const row = c + i * ldc;
+
+        if (accumulate) {
+            acc[i][0] = _mm512_add_epi64(acc[i][0], _mm512_maskz_loadu_epi64(m0, row));
+            acc[i][1] = _mm512_add_epi64(acc[i][1], _mm512_maskz_loadu_epi64(m1, row + 8));
+        }
+
+        _mm512_mask_storeu_epi64(row, m0, acc[i][0]);
+        _mm512_mask_storeu_epi64(row + 8, m1, acc[i][1]);
+    }
+}
+
+TARGET_AVX512
+static void add_row_f32_avx512(f32 *out, const f32 *lhs, const f32 *rhs, const u32 n)
+{
+    for (u32 i = 0; i < n; i += 16) {
+        const __mmask16 m = mask16(n - i);
+        const __m512 l = _mm512_maskz_loadu_ps(m, lhs + i);
+        const __m512 r = _mm512_maskz_loadu_ps(m, rhs + i);
+        _mm512_mask_storeu_ps(out + i, m, _mm512_add_ps(l, r));
+    }
+}
+
+TARGET_AVX512
+static void sub_row_f32_avx512(f32 *out, const f32 *lhs, const f32 *rhs, const u32 n)
+{
+    for (u32 i = 0; i < n; i += 16) {
+        const __mmask16 m = mask16(n - i);
+        const __m512 l = _mm512_maskz_loadu_ps(m, lhs + i);
+        const __m512 r = _mm512_maskz_loadu_ps(m, rhs + i);
+        _mm512_mask_storeu_ps(out + i, m, _mm512_sub_ps(l, r));
+    }
+}
+
+TARGET_AVX512
+static void add_row_i64_avx512(i64 *out, const i64 *lhs, const i64 *rhs, const u32 n)
+{
+    for (u32 i = 0; i < n; i += 8) {
+        const __mmask8 m = mask8(n - i);
+        const __m512i l = _mm512_maskz_loadu_epi64(m, lhs + i);
+        const __m512i r = _mm512_maskz_loadu_epi64(m, rhs + i);
+        _mm512_mask_storeu_epi64(out + i, m, _mm512_add_epi64(l, r));
+    }
+}
+
+TARGET_AVX512
+static void sub_row_i64_avx512(i64 *out, const i64 *lhs, const i64 *rhs, const u32 n)
+{
+    for (u32 i = 0; i < n; i += 8) {
+        const __mmask8 m = mask8(n - i);
+        const __m512i l = _mm512_maskz_loadu_epi64(m, lhs + i);
+        const __m512i r = _mm512_maskz_loadu_epi64(m, rhs + i);
+        _mm512_mask_storeu_epi64(out + i, m, _mm512_sub_epi64(l, r));
+    }
+}
+
+/*
+ * Horizontal sums through memory, _mm512_reduce_add_*() of GCC 12 trip
+ * -Wuninitialized inside the intrinsics header.
+ */
+TARGET_AVX512
+static f32 hsum_ps_avx512(const __m512 v)
+{
+    alignas(64) f32 tmp[16];
+    _mm512_store_ps(tmp, v);
+
+    f32 sum = 0;
+    for (u32 i = 0; i < 16; ++i)
+        sum += tmp[i];
+
+    return sum;
+}
+
+TARGET_AVX512
+static i64 hsum_epi64_avx512(const __m512i v)
+{
+    alignas(64) i64 tmp[8];
+    _mm512_store_si512(tmp, v);
+
+    i64 sum = 0;
+    for (u32 i = 0; i < 8; ++i)
+        sum += tmp[i];
+
+    return sum;
+}
+
+TARGET_AVX512
+static f32 dot_row_f32_avx512(const f32 *a, const f32 *b, const u32 n)
+{
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    __m512 acc2 = _mm512_setzero_ps();
+    __m512 acc3 = _mm512_setzero_ps();
+    u32 i = 0;
+
+    for (; i + 64 <= n; i += 64) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i),      _mm512_loadu_ps(b + i),      acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+        acc2 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 32), _mm512_loadu_ps(b + i + 32), acc2);
+        acc3 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 48), _mm512_loadu_ps(b + i + 48), acc3);
+    }
+
+    for (; i < n; i += 16) {
+        const __mmask16 m = mask16(n - i);
+        acc0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i), acc0);
+    }
+
+    return hsum_ps_avx512(_mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+}
+
+TARGET_AVX512
+static void axpy_row_f32_avx512(f32 *y, const f32 alpha, const f32 *x, const u32 n)
+{
+    const __m512 va = _mm512_set1_ps(alpha);
+
+    for (u32 i = 0; i < n; i += 16) {
+        const __mmask16 m = mask16(n - i);
+        const __m512 vy = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(m, x + i), _mm512_maskz_loadu_ps(m, y + i));
+        _mm512_mask_storeu_ps(y + i, m, vy);
+    }
+}
+
+TARGET_AVX512
+static i64 dot_row_i64_avx512(const i64 *a, const i64 *b, const u32 n)
+{
+    __m512i acc0 = _mm512_setzero_si512();
+    __m512i acc1 = _mm512_setzero_si512();
+    u32 i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_add_epi64(acc0, _mm512_mullo_epi64(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i)));
+        acc1 = _mm512_add_epi64(acc1, _mm512_mullo_epi64(_mm512_loadu_si512(a + i + 8), _mm512_loadu_si512(b + i + 8)));
+    }
+
+    for (; i < n; i += 8) {
+        const __mmask8 m = mask8(n - i);
+        const __m512i prod = _mm512_mullo_epi64(_mm512_maskz_loadu_epi64(m, a + i), _mm512_maskz_loadu_epi64(m, b + i));
+        acc0 = _mm512_add_epi64(acc0, prod);
+    }
+
+    return hsum_epi64_avx512(_mm512_add_epi64(acc0, acc1));
+}
+
+TARGET_AVX512
+static void axpy_row_i64_avx512(i64 *y, const i64 alpha, const i64 *x, const u32 n)
+{
+    const __m512i va = _mm512_set1_epi64(alpha);
+
+    for (u32 i = 0; i < n; i += 8) {
+        const __mmask8 m = mask8(n - i);
+        const __m512i prod = _mm512_mullo_epi64(va, _mm512_maskz_loadu_epi64(m, x + i));
+        _mm512_mask_storeu_epi64(y + i, m, _mm512_add_epi64(_mm512_maskz_loadu_epi64(m, y + i), prod));
+    }
+}
+
+/*
+ * Conversions. AVX-512F has no masked 16 bit loads and stores, tails are
+ * converted one by one, with the same rounding.
+ *
+ * GCC 12 headers fill the unused lanes of unmasked conversions and shifts
+ * from a self initialized variable, which -Wmaybe-uninitialized flags.
+ */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+TARGET_AVX512
+static void f16_to_f32_avx512(f32 *out, const f16 *in, const u32 n)
+{
+    u32 i = 0;
+
+    for (; i + 16 <= n; i += 16)
+        _mm512_storeu_ps(out + i, _mm512_cvtph_ps(_mm256_loadu_si256(rcast<const __m256i*>(in + i))));
+
+    for (; i < n; ++i)
+        out[i] = in[i];
+}
+
+TARGET_AVX512
+static void f32_to_f16_avx512(f16 *out, const f32 *in, const u32 n)
+{
+    u32 i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        const __m256i h = _mm512_cvtps_ph(_mm512_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm256_storeu_si256(rcast<__m256i*>(out + i), h);
+    }
+
+    for (; i < n; ++i)
+        out[i] = in[i];
+}
+
+TARGET_AVX512
+static void bf16_to_f32_avx512(f32 *out, const bf16 *in, const u32 n)
+{
+    u32 i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        const __m512i h = _mm512_cvtepu16_epi32(_mm256_loadu_si256(rcast<const __m256i*>(in + i)));
+        _mm512_storeu_si512(out + i, _mm512_slli_epi32(h, 16));
+    }
+
+    for (; i < n; ++i)
+        out[i] = in[i];
+}
+
+/* Round to nearest even on the integer bits, NaNs are kept quiet NaNs. */
+TARGET_AVX512
+static void f32_to_bf16_avx512(bf16 *out, const f32 *in, const u32 n)
+{
+    const __m512i bias = _mm512_set1_epi32(0x7fff);
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512i quiet = _mm512_set1_epi32(0x40);
+    u32 i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        const __m512 v = _mm512_loadu_ps(in + i);
+        const __m512i f = _mm512_castps_si512(v);
+        const __m512i hi = _mm512_srli_epi32(f, 16);
+        const __m512i odd = _mm512_and_si512(hi, one);
+        const __m512i rounded = _mm512_srli_epi32(_mm512_add_epi32(f, _mm512_add_epi32(bias, odd)), 16);
+        const __mmask16 is_nan = _mm512_cmp_ps_mask(v, v, _CMP_UNORD_Q);
+        const __m512i h = _mm512_mask_or_epi32(rounded, is_nan, hi, quiet);
+
+        _mm256_storeu_si256(rcast<__m256i*>(out + i), _mm512_cvtepi32_epi16(h));
+    }
+
+    for (; i < n; ++i)
+        out[i] = in[i];
+}
+
+#pragma GCC diagnostic pop
+
+/*
+ * AVX512-BF16 converts and rounds in a single instruction, with masked 16 bit
+ * stores from AVX512-BW for the tail. Subnormal inputs become zeros.
+ */
+TARGET_AVX512_BF16
+static void f32_to_bf16_avx512_bf16(bf16 *out, const f32 *in, const u32 n)
+{
+    for (u32 i = 0; i < n; i += 16) {
+        const __mmask16 m = mask16(n - i);
+        const __m256bh h = _mm512_cvtneps_pbh(_mm512_maskz_loadu_ps(m, in + i));
+
+        _mm256_mask_storeu_epi16(out + i, m, (__m256i)h);
+    }
+}
+
+/*
+ * Quantized micro-kernel, 8x32 tile over byte quads.
+ * vpdpbusd multiplies a broadcast quad of u8 lhs with the i8 quads of 16
+ * columns and adds the four products into the i32 accumulators, no
+ * intermediate saturation. 16 zmm accumulators.
+ */
+TARGET_AVX512_VNNI
+static void gemm_q8_micro_kernel_avx512_vnni(
+    const u32 kg,
+    const void *a_,
+    const void *b_,
+    i32 * __restrict c,
+    const u32 ldc,
+    const u32 mr,
+    const u32 nr,
+    const bool accumulate
+) {
+    constexpr u32 MR = 8;
+    constexpr u32 NR = 32;
+    constexpr u32 G = 4;
+
+    const u8 * __restrict a = scast<const u8*>(a_);
+    const i8 * __restrict b = scast<const i8*>(b_);
+
+    __m512i acc[MR][2];
+
+#pragma GCC unroll 8
+    for (u32 i = 0; i < MR; ++i) {
+        acc[i][0] = _mm512_setzero_si512();
+        acc[i][1] = _mm512_setzero_si512();
+    }
+
+    for (u32 k = 0; k < kg; ++k) {
+        const __m512i b0 = _mm512_loadu_si512(b);
+        const __m512i b1 = _mm512_loadu_si512(b + 64);
+
+#pragma GCC unroll 8
+        for (u32 i = 0; i < MR; ++i) {
+            i32 quad;
+            memcpy(&quad, a + i * G, sizeof(quad));
+
+            const __m512i ai = _mm512_set1_epi32(quad);
+            acc[i][0] = _mm512_dpbusd_epi32(acc[i][0], ai, b0);
+            acc[i][1] = _mm512_dpbusd_epi32(acc[i][1], ai, b1);
+        }
+
+        a += MR * G;
+        b += NR * G;
+    }
+
+    if (mr == MR && nr == NR) [[likely]] {
+#pragma GCC unroll 8
+        for (u32 i = 0; i < MR; ++i) {
+            i32 * const row = c + i * ldc;
+
+            if (accumulate) {
+                acc[i][0] = _mm512_add_epi32(acc[i][0], _mm512_loadu_si512(row));
+                acc[i][1] = _mm512_add_epi32(acc[i][1], _mm512_loadu_si512(row + 16));
+            }
+
+            _mm512_storeu_si512(row, acc[i][0]);
+            _mm512_storeu_si512(row + 16, acc[i][1]);
+        }
+
+        return;
+    }
+
+    alignas(64) i32 tmp[MR][NR];
+
+    for (u32 i = 0; i < MR; ++i) {
+        _mm512_store_si512(&tmp[i][0], acc[i][0]);
+        _mm512_store_si512(&tmp[i][16], acc[i][1]);
+    }
+
+    for (u32 i = 0; i < mr; ++i)
+        for (u32 j = 0; j < nr; ++j)
+            c[i * ldc + j] = accumulate ? c[i * ldc + j] + tmp[i][j] : tmp[i][j];
+}
+
+/*
+ * Sparse row kernels, 64 columns per row in 4 zmm. The block kernel does 4
+ * rows, 16 accumulators: one load of rhs feeds 4 FMAs.
+ */
+constexpr u32 SPMM_NC_AVX512 = 64;
+constexpr u32 SPMM_MR_AVX512 = 4;
+constexpr u32 SPMM_NV_AVX512 = SPMM_NC_AVX512 / 16;
+
+TARGET_AVX512
+static inline void spmm_masks_avx512(__mmask16 *m, const u32 n)
+{
+#pragma GCC unroll 4
+    for (u32 q = 0; q < SPMM_NV_AVX512; ++q)
+        m[q] = n > q * 16 ? mask16(n - q * 16) : 0;
+}
+
+TARGET_AVX512
+static inline void spmm_store_avx512(
+    f32 *out,
+    const __m512 *acc,
+    const __mmask16 *m,
+    const f32 alpha,
+    const f32 beta
+) {
+    const __m512 va = _mm512_set1_ps(alpha);
+    const __m512 vb = _mm512_set1_ps(beta);
+
+#pragma GCC unroll 4
+    for (u32 q = 0; q < SPMM_NV_AVX512; ++q) {
+        __m512 r = _mm512_mul_ps(va, acc[q]);
+
+        if (beta != 0)
+            r = _mm512_fmadd_ps(vb, _mm512_maskz_loadu_ps(m[q], out + q * 16), r);
+
+        _mm512_mask_storeu_ps(out + q * 16, m[q], r);
+    }
+}
+
+TARGET_AVX512
+static void spmm_csr_row_avx512(
+    f32 *out,
+    const f32 *rhs,
+    const size_t rhs_stride,
+    const u32 *col_idx,
+    const f32 *values,
+    const u32 nnz,
+    const f32 alpha,
+    const f32 beta,
+    const u32 n
+) {
+    __m512 acc[SPMM_NV_AVX512];
+    __mmask16 m[SPMM_NV_AVX512];
+
+    spmm_masks_avx512(m, n);
+
+#pragma GCC unroll 4
+    for (u32 q = 0; q < SPMM_NV_AVX512; ++q)
+        acc[q] = _mm512_setzero_ps();
+
+    for (u32 e = 0; e < nnz; ++e) {
+        const f32 *row = rhs + col_idx[e] * rhs_stride;
+        const __m512 v = _mm512_set1_ps(values[e]);
+
+#pragma GCC unroll 4
+        for (u32 q = 0; q < SPMM_NV_AVX512; ++q)
+            acc[q] = _mm512_fmadd_ps(v, _mm512_maskz_loadu_ps(m[q], row + q * 16), acc[q]);
+    }
+
+    spmm_store_avx512(out, acc, m, alpha, beta);
+}
+
+TARGET_AVX512
+static void spmm_bsr_rows_avx512(
+    f32 *out,
+    const size_t out_stride,
+    const f32 *rhs,
+    const size_t rhs_stride,
+    const u32 *block_col_idx,
+    const f32 *values,
+    const u32 num_blocks,
+    const u32 block_w,
+    const u32 block_size,
+    const u32 width,
+    const u32 rows,
+    const f32 alpha,
+    const f32 beta,
+    const u32 n
+) {
+    constexpr u32 MR = SPMM_MR_AVX512;
+
+    __m512 acc[MR][SPMM_NV_AVX512];
+    __mmask16 m[SPMM_NV_AVX512];
+
+    spmm_masks_avx512(m, n);
+
+#pragma GCC unroll 4
+    for (u32 i = 0; i < MR; ++i)
+#pragma GCC unroll 4
+        for (u32 q = 0; q < SPMM_NV_AVX512; ++q)
+            acc[i][q] = _mm512_setzero_ps();
+
+    for (u32 b = 0; b < num_blocks; ++b) {
+        const u32 x0 = block_col_idx[b] * block_w;
+        const u32 w = std::min(block_w, width - x0);
+        const f32 *v = values + size_t(b) * block_size;
+
+        for (u32 k = 0; k < w; ++k) {
+            const f32 *row = rhs + (x0 + k) * rhs_stride;
+            __m512 r[SPMM_NV_AVX512];
+
+#pragma GCC unroll 4
+            for (u32 q = 0; q < SPMM_NV_AVX512; ++q)
+                r[q] = _mm512_maskz_loadu_ps(m[q], row + q * 16);
+
+            /* Rows past 'rows' only ever see zeros, never stored. */
+#pragma GCC unroll 4
+            for (u32 i = 0; i < MR; ++i) {
+                const __m512 vi = _mm512_set1_ps(i < rows ? v[i * block_w + k] : 0.0f);
+
+#pragma GCC unroll 4
+                for (u32 q = 0; q < SPMM_NV_AVX512; ++q)
+                    acc[i][q] = _mm512_fmadd_ps(vi, r[q], acc[i][q]);
+            }
+        }
+    }
+
+    for (u32 i = 0; i < rows; ++i)
+        spmm_store_avx512(out + i * out_stride, acc[i], m, alpha, beta);
+}
+
+/* GCC 12 headers again, -Wuninitialized this time, from the unmasked shifts and shuffles. */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+
+/* 32x32 -> 64 bit products of all 16 lanes, split into high and low halves. */
+TARGET_AVX512
+static inline void philox_mulhilo_avx512(const __m512i a, const __m512i m, __m512i &hi, __m512i &lo)
+{
+    const __m512i even = _mm512_mul_epu32(a, m);
+    const __m512i odd = _mm512_mul_epu32(_mm512_srli_epi64(a, 32), m);
+
+    lo = _mm512_mask_blend_epi32(0xaaaa, even, _mm512_slli_epi64(odd, 32));
+    hi = _mm512_mask_blend_epi32(0xaaaa, _mm512_srli_epi64(even, 32), odd);
+}
+
+/* 16 Philox blocks, one per lane, transposed back to block order on store. */
+TARGET_AVX512
+static void philox_avx512(u32 *out, const u64 seed, const u64 stream, const u64 first)
+{
+    const __m512i m0 = _mm512_set1_epi32(PHILOX_M0);
+    const __m512i m1 = _mm512_set1_epi32(PHILOX_M1);
+
+    /* 'first' is a multiple of 16, the low word can't carry. */
+    __m512i c0 = _mm512_add_epi32(
+        _mm512_set1_epi32(u32(first)),
+        _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)
+    );
+    __m512i c1 = _mm512_set1_epi32(u32(first >> 32));
+    __m512i c2 = _mm512_set1_epi32(u32(stream));
+    __m512i c3 = _mm512_set1_epi32(u32(stream >> 32));
+
+    u32 k0 = u32(seed);
+    u32 k1 = u32(seed >> 32);
+
+    for (u32 r = 0; r < PHILOX_ROUNDS; ++r) {
+        __m512i hi0, lo0, hi1, lo1;
+
+        philox_mulhilo_avx512(c0, m0, hi0, lo0);
+        philox_mulhilo_avx512(c2, m1, hi1, lo1);
+
+        c0 = _mm512_ternarylogic_epi32(hi1, c1, _mm512_set1_epi32(k0), 0x96);
+        c2 = _mm512_ternarylogic_epi32(hi0, c3, _mm512_set1_epi32(k1), 0x96);
+        c1 = lo1;
+        c3 = lo0;
+
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+
+    /* 4x4 transposes within 128 bit lanes, rK holds blocks K, K + 4, K + 8 and K + 12. */
+    const __m512i t0 = _mm512_unpacklo_epi32(c0, c1);
+    const __m512i t1 = _mm512_unpackhi_epi32(c0, c1);
+    const __m512i t2 = _mm512_unpacklo_epi32(c2, c3);
+    const __m512i t3 = _mm512_unpackhi_epi32(c2, c3);
+
+    const __m512i r0 = _mm512_unpacklo_epi64(t0, t2);
+    const __m512i r1 = _mm512_unpackhi_epi64(t0, t2);
+    const __m512i r2 = _mm512_unpacklo_epi64(t1, t3);
+    const __m512i r3 = _mm512_unpackhi_epi64(t1, t3);
+
+    /* Then the 128 bit lanes, gathering the blocks of each 64 bytes. */
+    const __m512i s0 = _mm512_shuffle_i32x4(r0, r1, 0x44);
+    const __m512i s1 = _mm512_shuffle_i32x4(r2, r3, 0x44);
+    const __m512i s2 = _mm512_shuffle_i32x4(r0, r1, 0xee);
+    const __m512i s3 = _mm512_shuffle_i32x4(r2, r3, 0xee);
+
+    _mm512_storeu_si512(out + 0, _mm512_shuffle_i32x4(s0, s1, 0x88));
+    _mm512_storeu_si512(out + 16, _mm512_shuffle_i32x4(s0, s1, 0xdd));
+    _mm512_storeu_si512(out + 32, _mm512_shuffle_i32x4(s2, s3, 0x88));
+    _mm512_storeu_si512(out + 48, _mm512_shuffle_i32x4(s2, s3, 0xdd));
+}
+
+#pragma GCC diagnostic pop
+
+const cpu_kernels_t<i64> cpu_kernels_i64_avx512 = {
+    .isa = cpu_isa_e::avx512,
+    .mr = 8,
+    .nr = 16,
+    .mc = 64,
+    .kc = 128,
+    .nc = 2048,
+    .micro_kernel = gemm_micro_kernel_i64_avx512,
+    .add_row = add_row_i64_avx512,
+    .sub_row = sub_row_i64_avx512,
+    .dot_row = dot_row_i64_avx512,
+    .axpy_row = axpy_row_i64_avx512,
+};
+
+const cpu_kernels_t<f32> cpu_kernels_f32_avx512 = {
+    .isa = cpu_isa_e::avx512,
+    .mr = 12,
+    .nr = 32,
+    .mc = 144,
+    .kc = 256,
+    .nc = 4096,
+    .micro_kernel = gemm_micro_kernel_f32_avx512,
+    .add_row = add_row_f32_avx512,
+    .sub_row = sub_row_f32_avx512,
+    .dot_row = dot_row_f32_avx512,
+    .axpy_row = axpy_row_f32_avx512,
+};
+
+const cpu_cvt_kernels_t cpu_cvt_kernels_avx512 = {
+    .isa = cpu_isa_e::avx512,
+    .f16_to_f32 = f16_to_f32_avx512,
+    .f32_to_f16 = f32_to_f16_avx512,
+    .bf16_to_f32 = bf16_to_f32_avx512,
+    .f32_to_bf16 = f32_to_bf16_avx512,
+};
+
+const cpu_cvt_kernels_t cpu_cvt_kernels_avx512_bf16 = {
+    .isa = cpu_isa_e::avx512,
+    .f16_to_f32 = f16_to_f32_avx512,
+    .f32_to_f16 = f32_to_f16_avx512,
+    .bf16_to_f32 = bf16_to_f32_avx512,
+    .f32_to_bf16 = f32_to_bf16_avx512_bf16,
+};
+
+const cpu_q8_kernels_t cpu_q8_kernels_avx512_vnni = {
+    .isa = cpu_isa_e::avx512,
+    .mr = 8,
+    .nr = 32,
+    .mc = 128,
+    .kc = 512,
+    .nc = 4096,
+    .kgroup = 4,
+    .widen = false,
+    .micro_kernel = gemm_q8_micro_kernel_avx512_vnni,
+};
+
+const cpu_sparse_kernels_t cpu_sparse_kernels_avx512 = {
+    .isa = cpu_isa_e::avx512,
+    .nc = SPMM_NC_AVX512,
+    .mr = SPMM_MR_AVX512,
+    .csr_row = spmm_csr_row_avx512,
+    .bsr_rows = spmm_bsr_rows_avx512,
+};
+
+const cpu_random_kernels_t cpu_random_kernels_avx512 = {
+    .isa = cpu_isa_e::avx512,
+    .lanes = 16,
+    .philox = philox_avx512,
+};
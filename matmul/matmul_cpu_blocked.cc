@@ -0,0 +1,444 @@
+#include "mat.h"
+#include "matmul_cpu.h"
+#include "types.h"
+
+#include <cassert>
+#include <cstdlib>
+#include <memory>
+#include <type_traits>
+
+/*
+ * Cache blocked GEMM, in the spirit of GotoBLAS/BLIS.
+ *
+ * The output is walked in NC wide column panels, K in KC deep slices
+ * and M in MC tall row panels. For each (KC x NC) slice of rhs we pack it
+ * once into NR wide slivers, and for each (MC x KC) block of lhs into MR tall
+ * slivers. Packed slivers are contiguous in the order micro-kernel consumes
+ * them, so the innermost loop streams through memory linearly:
+ *
+ *   - packed lhs block stays in L2,
+ *   - one packed rhs sliver (KC x NR) stays in L1,
+ *   - whole packed rhs slice (KC x NC) stays in L3.
+ *
+ * The micro-kernel computes MR x NR block of the output held in registers.
+ * Micro-kernels, and the block sizes that suit them, are picked per ISA level.
+ * See matmul_cpu.h
+ *
+ * Half width operands take the same path. Each sliver is converted to f32
+ * just before it is packed, so the rest of the engine never sees them and
+ * the operands are only ever read half width from memory.
+ */
+
+namespace {
+
+/*
+ * Per thread packing buffers.
+ * Grown on demand and reused by every following call.
+ */
+template <typename ValueType>
+struct gemm_pack_buffers {
+    constexpr static size_t alignment = 64;
+
+    static ValueType* alloc(const size_t num_elems)
+    {
+        const size_t size_bytes = (num_elems * sizeof(ValueType) + alignment - 1) & ~(alignment - 1);
+        return static_cast<ValueType*>(std::aligned_alloc(alignment, size_bytes));
+    }
+
+    void reserve(const cpu_kernels_t<ValueType> &kernels, const bool staging)
+    {
+        const size_t a_req = size_t(kernels.mc) * kernels.kc;
+        const size_t b_req = size_t(kernels.kc) * kernels.nc;
+        const size_t stage_req = staging ? size_t(std::max(kernels.mr, kernels.nr)) * kernels.kc : 0;
+
+        if (a_req > this->a_size) {
+            this->a.reset(alloc(a_req));
+            this->a_size = a_req;
+        }
+
+        if (b_req > this->b_size) {
+            this->b.reset(alloc(b_req));
+            this->b_size = b_req;
+        }
+
+        if (stage_req > this->stage_size) {
+            this->stage.reset(alloc(stage_req));
+            this->stage_size = stage_req;
+        }
+    }
+
+    static gemm_pack_buffers& get()
+    {
+        thread_local gemm_pack_buffers buffers;
+        return buffers;
+    }
+
+    std::unique_ptr<ValueType[], free_deleter> a;
+    std::unique_ptr<ValueType[], free_deleter> b;
+    std::unique_ptr<ValueType[], free_deleter> stage; /* One converted sliver. */
+    size_t a_size = 0;
+    size_t b_size = 0;
+    size_t stage_size = 0;
+};
+
+/*
+ * Operand as the engine sees it. Element (row, col) of the logical, possibly
+ * transposed, matrix is data[row * rs + col * cs]. Transposing an operand
+ * just swaps its strides, packing then reads it in the order it is stored.
+ */
+template <typename ValueType>
+struct gemm_operand {
+    const ValueType* at(const u32 row, const u32 col) const
+    {
+        return this->data + row * this->rs + col * this->cs;
+    }
+
+    const ValueType *data;
+    size_t rs;
+    size_t cs;
+};
+
+}
+
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static gemm_operand<ValueType> gemm_make_operand(const ViewType m, const bool trans)
+{
+    if (trans)
+        return { m.data, 1, m.stride };
+
+    return { m.data, m.stride, 1 };
+}
+
+/*
+ * Block of 'src', (rows x cols) starting at (row0, col0), as an operand of
+ * ValueType. Operands of ValueType already are used in place.
+ */
+template <typename ValueType>
+static gemm_operand<ValueType> gemm_stage(
+    ValueType *,
+    const gemm_operand<ValueType> src,
+    const u32 row0,
+    const u32 col0,
+    const u32,
+    const u32,
+    const cpu_cvt_kernels_t &
+) {
+    return { src.at(row0, col0), src.rs, src.cs };
+}
+
+/*
+ * Half width operands are converted into 'buf'. The block keeps the order it
+ * is stored in, so every stored line is one contiguous, vectorized conversion.
+ */
+template <typename ValueType, typename SrcType>
+static gemm_operand<ValueType> gemm_stage(
+    ValueType * __restrict buf,
+    const gemm_operand<SrcType> src,
+    const u32 row0,
+    const u32 col0,
+    const u32 rows,
+    const u32 cols,
+    const cpu_cvt_kernels_t &cvt
+) {
+    if (src.cs == 1) {
+        for (u32 i = 0; i < rows; ++i)
+            cpu_cvt_row(cvt, buf + size_t(i) * cols, src.at(row0 + i, col0), cols);
+
+        return { buf, cols, 1 };
+    }
+
+    for (u32 j = 0; j < cols; ++j)
+        cpu_cvt_row(cvt, buf + size_t(j) * rows, src.at(row0, col0 + j), rows);
+
+    return { buf, 1, rows };
+}
+
+/*
+ * Packs (mc x kc) block of lhs, starting at (row0, col0), into MR tall slivers.
+ * Inside a sliver, elements are stored column by column.
+ * Rows past 'mc' are zero filled, so micro-kernel never has to check bounds.
+ *
+ * Elements are multiplied by 'alpha' on the way, which makes the product
+ * scaled for free: lhs is packed anyway and the micro-kernel stays the same.
+ */
+template <typename ValueType, typename SrcType>
+static void gemm_pack_lhs(
+    ValueType * __restrict out,
+    const gemm_operand<SrcType> lhs,
+    const u32 row0,
+    const u32 col0,
+    const u32 mc,
+    const u32 kc,
+    const u32 MR,
+    const ValueType alpha,
+    ValueType *stage,
+    const cpu_cvt_kernels_t &cvt
+) {
+    for (u32 ir = 0; ir < mc; ir += MR) {
+        const u32 mr = std::min(MR, mc - ir);
+        const auto sliver = gemm_stage(stage, lhs, row0 + ir, col0, mr, kc, cvt);
+
+        for (u32 k = 0; k < kc; ++k) {
+            const ValueType *src = sliver.at(0, k);
+            u32 i = 0;
+
+            if (alpha == 1)
+                for (; i < mr; ++i)
+                    out[i] = src[i * sliver.rs];
+            else
+                for (; i < mr; ++i)
+                    out[i] = alpha * src[i * sliver.rs];
+
+            for (; i < MR; ++i)
+                out[i] = 0;
+
+            out += MR;
+        }
+    }
+}
+
+/*
+ * Packs (kc x nc) block of rhs, starting at (row0, col0), into NR wide slivers.
+ * Inside a sliver, elements are stored row by row.
+ * Columns past 'nc' are zero filled.
+ */
+template <typename ValueType, typename SrcType>
+static void gemm_pack_rhs(
+    ValueType * __restrict out,
+    const gemm_operand<SrcType> rhs,
+    const u32 row0,
+    const u32 col0,
+    const u32 kc,
+    const u32 nc,
+    const u32 NR,
+    ValueType *stage,
+    const cpu_cvt_kernels_t &cvt
+) {
+    for (u32 jr = 0; jr < nc; jr += NR) {
+        const u32 nr = std::min(NR, nc - jr);
+        const auto sliver = gemm_stage(stage, rhs, row0, col0 + jr, kc, nr, cvt);
+        const ValueType *src = sliver.data;
+
+        for (u32 k = 0; k < kc; ++k) {
+            u32 j = 0;
+
+            /* Rows of a plain rhs are contiguous, keep that loop trivial. */
+            if (sliver.cs == 1)
+                for (; j < nr; ++j)
+                    out[j] = src[j];
+            else
+                for (; j < nr; ++j)
+                    out[j] = src[j * sliver.cs];
+
+            for (; j < NR; ++j)
+                out[j] = 0;
+
+            src += sliver.rs;
+            out += NR;
+        }
+    }
+}
+
+/* out *= beta, where beta == 0 clears 'out' without reading it. */
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static void gemm_scale_out(ViewType out, const ValueType beta)
+{
+    for (u32 y = 0; y < out.height; ++y) {
+        ValueType * const row = &out.at(0, y);
+
+        if (beta == 0)
+            std::fill_n(row, out.width, 0);
+        else
+            for (u32 x = 0; x < out.width; ++x)
+                row[x] *= beta;
+    }
+}
+
+template <typename ViewType, typename InViewType, typename ValueType = ViewType::ValueType>
+static void gemm_cpu_blocked_(
+    ViewType out,
+    const InViewType lhs,
+    const InViewType rhs,
+    const cpu_kernels_t<ValueType> &kernels,
+    const ValueType alpha,
+    const ValueType beta,
+    const mat_trans_e trans
+) {
+    if (!mat_row_major(out, lhs, rhs)) {
+        gemm_cpu_any_layout(out, lhs, rhs, beta, trans, [&](auto out, auto lhs, auto rhs, auto trans) {
+            gemm_cpu_blocked_(out, lhs, rhs, kernels, alpha, beta, trans);
+        });
+        return;
+    }
+
+    const u32 MR = kernels.mr;
+    const u32 NR = kernels.nr;
+    const u32 MC = kernels.mc;
+    const u32 KC = kernels.kc;
+    const u32 NC = kernels.nc;
+
+    assert(MC % MR == 0);
+    assert(NC % NR == 0);
+
+    const bool trans_lhs = mat_trans_lhs(trans);
+    const bool trans_rhs = mat_trans_rhs(trans);
+
+    const u32 M = out.height;
+    const u32 N = out.width;
+    const u32 K = trans_lhs ? lhs.height : lhs.width;
+
+    assert(M == (trans_lhs ? lhs.width : lhs.height));
+    assert(K == (trans_rhs ? rhs.width : rhs.height));
+    assert(N == (trans_rhs ? rhs.height : rhs.width));
+
+    const auto a = gemm_make_operand(lhs, trans_lhs);
+    const auto b = gemm_make_operand(rhs, trans_rhs);
+
+    if (M == 0 || N == 0)
+        return;
+
+    if constexpr (std::is_same_v<ViewType, InViewType>)
+        if (gemv_cpu(out, lhs, rhs, kernels, alpha, beta, trans, nullptr))
+            return;
+
+    /* Empty sum, nothing will be accumulated below. */
+    if (K == 0) {
+        if (beta != 1)
+            gemm_scale_out(out, beta);
+        return;
+    }
+
+    /*
+     * With beta == 0 the first K slice overwrites 'out', like BLAS it is never
+     * read, so it doesn't even have to be initialized. Otherwise 'out' is
+     * scaled once and every slice accumulates into it.
+     */
+    if (beta != 0 && beta != 1)
+        gemm_scale_out(out, beta);
+
+    auto &buffers = gemm_pack_buffers<ValueType>::get();
+    buffers.reserve(kernels, !std::is_same_v<ViewType, InViewType>);
+
+    ValueType * const apack = buffers.a.get();
+    ValueType * const bpack = buffers.b.get();
+    ValueType * const stage = buffers.stage.get();
+    const auto &cvt = cpu_cvt_kernels(kernels.isa);
+
+    for (u32 jc = 0; jc < N; jc += NC) {
+        const u32 nc = std::min(NC, N - jc);
+
+        for (u32 pc = 0; pc < K; pc += KC) {
+            const u32 kc = std::min(KC, K - pc);
+            const bool accumulate = pc != 0 || beta != 0;
+
+            gemm_pack_rhs(bpack, b, pc, jc, kc, nc, NR, stage, cvt);
+
+            for (u32 ic = 0; ic < M; ic += MC) {
+                const u32 mc = std::min(MC, M - ic);
+
+                gemm_pack_lhs(apack, a, ic, pc, mc, kc, MR, alpha, stage, cvt);
+
+                for (u32 jr = 0; jr < nc; jr += NR) {
+                    const u32 nr = std::min(NR, nc - jr);
+
+                    for (u32 ir = 0; ir < mc; ir += MR) {
+                        const u32 mr = std::min(MR, mc - ir);
+
+                        kernels.micro_kernel(
+                            kc,
+                            apack + ir * kc,
+                            bpack + jr * kc,
+                            &out.at(jc + jr, ic + ir),
+                            out.stride,
+                            mr,
+                            nr,
+                            accumulate
+                        );
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <typename MatrixType, typename ViewType>
+static MatrixType mat_mul_cpu_blocked_(ViewType lhs, ViewType rhs)
+{
+    assert(lhs.width == rhs.height);
+
+    MatrixType out = MatrixType::make_matrix_uninit(rhs.width, lhs.height);
+
+    mat_mul_cpu_into(out, lhs, rhs);
+
+    return out;
+}
+
+void gemm_cpu_blocked(matview_i64_t out, matview_i64_t lhs, matview_i64_t rhs, i64 alpha, i64 beta, mat_trans_e trans)
+{ gemm_cpu_blocked_(out, lhs, rhs, cpu_kernels<i64>(), alpha, beta, trans); }
+
+void gemm_cpu_blocked(matview_f32_t out, matview_f32_t lhs, matview_f32_t rhs, f32 alpha, f32 beta, mat_trans_e trans)
+{ gemm_cpu_blocked_(out, lhs, rhs, cpu_kernels<f32>(), alpha, beta, trans); }
+
+void gemm_cpu_blocked(
+    matview_i64_t out,
+    matview_i64_t lhs,
+    matview_i64_t rhs,
+    const cpu_kernels_t<i64> &kernels,
+    i64 alpha,
+    i64 beta,
+    mat_trans_e trans
+) { gemm_cpu_blocked_(out, lhs, rhs, kernels, alpha, beta, trans); }
+
+void gemm_cpu_blocked(
+    matview_f32_t out,
+    matview_f32_t lhs,
+    matview_f32_t rhs,
+    const cpu_kernels_t<f32> &kernels,
+    f32 alpha,
+    f32 beta,
+    mat_trans_e trans
+) { gemm_cpu_blocked_(out, lhs, rhs, kernels, alpha, beta, trans); }
+
+void gemm_cpu_blocked(
+    matview_f32_t out,
+    matview_f16_t lhs,
+    matview_f16_t rhs,
+    const cpu_kernels_t<f32> &kernels,
+    f32 alpha,
+    f32 beta,
+    mat_trans_e trans
+) { gemm_cpu_blocked_(out, lhs, rhs, kernels, alpha, beta, trans); }
+
+void gemm_cpu_blocked(
+    matview_f32_t out,
+    matview_bf16_t lhs,
+    matview_bf16_t rhs,
+    const cpu_kernels_t<f32> &kernels,
+    f32 alpha,
+    f32 beta,
+    mat_trans_e trans
+) { gemm_cpu_blocked_(out, lhs, rhs, kernels, alpha, beta, trans); }
+
+void mat_mul_cpu_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs, i64 alpha, i64 beta, mat_trans_e trans)
+{ gemm_cpu_blocked_(dst, lhs, rhs, cpu_kernels<i64>(), alpha, beta, trans); }
+
+void mat_mul_cpu_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs, f32 alpha, f32 beta, mat_trans_e trans)
+{ gemm_cpu_blocked_(dst, lhs, rhs, cpu_kernels<f32>(), alpha, beta, trans); }
+
+mat_i64_t mat_mul_cpu(matview_i64_t lhs, matview_i64_t rhs)
+{ return mat_mul_cpu_blocked_<mat_i64_t, matview_i64_t>(lhs, rhs); }
+
+mat_f32_t mat_mul_cpu(matview_f32_t lhs, matview_f32_t rhs)
+{ return mat_mul_cpu_blocked_<mat_f32_t, matview_f32_t>(lhs, rhs); }
+
+void mat_mul_cpu_into(matview_f32_t dst, matview_f16_t lhs, matview_f16_t rhs, f32 alpha, f32 beta, mat_trans_e trans)
+{ gemm_cpu_blocked_(dst, lhs, rhs, cpu_kernels<f32>(), alpha, beta, trans); }
+
+void mat_mul_cpu_into(matview_f32_t dst, matview_bf16_t lhs, matview_bf16_t rhs, f32 alpha, f32 beta, mat_trans_e trans)
+{ gemm_cpu_blocked_(dst, lhs, rhs, cpu_kernels<f32>(), alpha, beta, trans); }
+
+mat_f32_t mat_mul_cpu(matview_f16_t lhs, matview_f16_t rhs)
+{ return mat_mul_cpu_blocked_<mat_f32_t, matview_f16_t>(lhs, rhs); }
+
+mat_f32_t mat_mul_cpu(matview_bf16_t lhs, matview_bf16_t rhs)
+{ return mat_mul_cpu_blocked_<mat_f32_t, matview_bf16_t>(lhs, rhs); }
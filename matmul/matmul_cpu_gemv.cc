@@ -0,0 +1,232 @@
+#include "mat.h"
+#include "matmul_cpu.h"
+#include "threading.h"
+#include "types.h"
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+/*
+ * Matrix-vector products and rank-1 updates.
+ *
+ * Both stream a whole matrix through the CPU and do a single multiply-add per
+ * element loaded, so they are bound by memory bandwidth, not by arithmetic.
+ * Packing for the blocked GEMM would only add traffic on top, so these shapes
+ * get paths of their own: every matrix element is read exactly once, in the
+ * order it is stored, while the vectors stay in cache.
+ *
+ * A matrix used as is is consumed by dot products of its rows with the
+ * vector, a transposed one by scaled additions (axpy) of its rows into the
+ * result. Both walk rows, the kernels come from the per ISA tables.
+ *
+ * With a pool, the matrix is cut into bands, each thread streams its own.
+ * One core can't keep enough loads in flight to saturate DRAM.
+ */
+
+/* Matrix elements, rows or columns of the matrix per band. */
+constexpr thread_bands_t CONFIG_GEMV_BANDS = {
+    .min_work = 128 * 1024,
+    .per_thread = 4,
+    .min_band = 64,
+};
+
+/* Element pointer and increment of a row or column vector. */
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+struct gemv_vec {
+    ValueType& operator[](const u32 i) const
+    {
+        return this->data[size_t(i) * this->inc];
+    }
+
+    ValueType *data;
+    u32 inc;
+};
+
+/* Contiguous copy of 'v', when it isn't contiguous already. */
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static const ValueType* gemv_gather(const gemv_vec<ViewType> v, const u32 n, std::vector<ValueType> &buf)
+{
+    if (v.inc == 1)
+        return v.data;
+
+    buf.resize(n);
+
+    for (u32 i = 0; i < n; ++i)
+        buf[i] = v[i];
+
+    return buf.data();
+}
+
+/* y = alpha * a @ x + beta * y, one dot product per row of 'a'. */
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static void gemv_rows(
+    const ViewType a,
+    const ValueType *x,
+    const gemv_vec<ViewType> y,
+    const ValueType alpha,
+    const ValueType beta,
+    const cpu_kernels_t<ValueType> &kernels
+) {
+    for (u32 i = 0; i < a.height; ++i) {
+        const ValueType t = alpha * kernels.dot_row(&a.at(0, i), x, a.width);
+
+        y[i] = beta == 0 ? t : t + beta * y[i];
+    }
+}
+
+/*
+ * y = alpha * a^T @ x + beta * y, rows of 'a' scaled by x and added up.
+ * The sum is kept contiguous, in 'y' itself when it is.
+ */
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static void gemv_cols(
+    const ViewType a,
+    const ValueType *x,
+    const gemv_vec<ViewType> y,
+    const ValueType alpha,
+    const ValueType beta,
+    const cpu_kernels_t<ValueType> &kernels
+) {
+    thread_local std::vector<ValueType> buf;
+    ValueType *acc = y.data;
+
+    if (y.inc != 1) {
+        buf.assign(a.width, 0);
+        acc = buf.data();
+    } else if (beta == 0) {
+        std::fill_n(acc, a.width, 0);
+    } else if (beta != 1) {
+        for (u32 j = 0; j < a.width; ++j)
+            acc[j] *= beta;
+    }
+
+    for (u32 k = 0; k < a.height; ++k)
+        kernels.axpy_row(acc, alpha * x[k], &a.at(0, k), a.width);
+
+    if (y.inc != 1)
+        for (u32 j = 0; j < a.width; ++j)
+            y[j] = beta == 0 ? acc[j] : acc[j] + beta * y[j];
+}
+
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static bool gemv_cpu_(
+    ViewType out,
+    const ViewType lhs,
+    const ViewType rhs,
+    const cpu_kernels_t<ValueType> &kernels,
+    const ValueType alpha,
+    const ValueType beta,
+    const mat_trans_e trans,
+    thread_pool *pool
+) {
+    const bool trans_lhs = mat_trans_lhs(trans);
+    const bool trans_rhs = mat_trans_rhs(trans);
+
+    const u32 M = out.height;
+    const u32 N = out.width;
+    const u32 K = trans_lhs ? lhs.height : lhs.width;
+
+    if ((M != 1 && N != 1) || M == 0 || N == 0 || K == 0)
+        return false;
+
+    /*
+     * Both shapes are y = op(a) @ x for a stored matrix 'a':
+     *
+     *   N == 1:  out = op(lhs) @ rhs,     x is the rhs column
+     *   M == 1:  out^T = op(rhs)^T @ lhs^T, x is the lhs row
+     */
+    ViewType a;
+    bool a_trans;
+    gemv_vec<ViewType> x, y;
+
+    if (N == 1) {
+        a = lhs;
+        a_trans = trans_lhs;
+        x = { rhs.data, trans_rhs ? 1 : rhs.stride };
+        y = { out.data, out.stride };
+    } else {
+        a = rhs;
+        a_trans = !trans_rhs;
+        x = { lhs.data, trans_lhs ? lhs.stride : 1 };
+        y = { out.data, 1 };
+    }
+
+    thread_local std::vector<ValueType> x_buf;
+    const ValueType * const xs = gemv_gather(x, K, x_buf);
+    const u64 elems = u64(a.width) * a.height;
+
+    if (!a_trans) {
+        thread_pool_for_bands(pool, a.height, elems, CONFIG_GEMV_BANDS, [&](const u32 begin, const u32 end) {
+            const ViewType band(&a.at(0, begin), a.width, end - begin, a.stride);
+            gemv_rows(band, xs, gemv_vec<ViewType>{ &y[begin], y.inc }, alpha, beta, kernels);
+        });
+    } else {
+        thread_pool_for_bands(pool, a.width, elems, CONFIG_GEMV_BANDS, [&](const u32 begin, const u32 end) {
+            const ViewType band(&a.at(begin, 0), end - begin, a.height, a.stride);
+            gemv_cols(band, xs, gemv_vec<ViewType>{ &y[begin], y.inc }, alpha, beta, kernels);
+        });
+    }
+
+    return true;
+}
+
+/* dst += alpha * x @ y^T, one axpy per row of 'dst'. */
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static void mat_rank1_cpu_into_(
+    ViewType dst,
+    const ViewType x,
+    const ViewType y,
+    const ValueType alpha,
+    thread_pool *pool
+) {
+    assert(x.width == 1 || x.height == 1);
+    assert(y.width == 1 || y.height == 1);
+    assert(u64(x.width) * x.height == dst.height);
+    assert(u64(y.width) * y.height == dst.width);
+    assert(mat_row_major(dst, x, y));
+
+    const auto &kernels = cpu_kernels<ValueType>();
+
+    const gemv_vec<ViewType> xv = { x.data, x.width == 1 ? x.stride : 1 };
+    const gemv_vec<ViewType> yv = { y.data, y.width == 1 ? y.stride : 1 };
+
+    std::vector<ValueType> y_buf;
+    const ValueType * const ys = gemv_gather(yv, dst.width, y_buf);
+
+    if (dst.width == 0)
+        return;
+
+    thread_pool_for_bands(pool, dst.height, u64(dst.width) * dst.height, CONFIG_GEMV_BANDS, [&](const u32 begin, const u32 end) {
+        for (u32 i = begin; i < end; ++i)
+            kernels.axpy_row(&dst.at(0, i), alpha * xv[i], ys, dst.width);
+    });
+}
+
+bool gemv_cpu(
+    matview_i64_t out,
+    matview_i64_t lhs,
+    matview_i64_t rhs,
+    const cpu_kernels_t<i64> &kernels,
+    i64 alpha,
+    i64 beta,
+    mat_trans_e trans,
+    thread_pool *pool
+) { return gemv_cpu_(out, lhs, rhs, kernels, alpha, beta, trans, pool); }
+
+bool gemv_cpu(
+    matview_f32_t out,
+    matview_f32_t lhs,
+    matview_f32_t rhs,
+    const cpu_kernels_t<f32> &kernels,
+    f32 alpha,
+    f32 beta,
+    mat_trans_e trans,
+    thread_pool *pool
+) { return gemv_cpu_(out, lhs, rhs, kernels, alpha, beta, trans, pool); }
+
+void mat_rank1_cpu_into(matview_i64_t dst, matview_i64_t x, matview_i64_t y, i64 alpha, thread_pool *pool)
+{ mat_rank1_cpu_into_(dst, x, y, alpha, pool ? pool : &cpu_thread_pool()); }
+
+void mat_rank1_cpu_into(matview_f32_t dst, matview_f32_t x, matview_f32_t y, f32 alpha, thread_pool *pool)
+{ mat_rank1_cpu_into_(dst, x, y, alpha, pool ? pool : &cpu_thread_pool()); }
@@ -0,0 +1,415 @@
+#include "matmul_cpu.h"
+#include "types.h"
+
+#include <algorithm>
+
+/*
+ * Portable CPU kernels and the ISA dispatch.
+ *
+ * Written so that the compiler has a fair chance of vectorizing them for
+ * whatever the baseline target is. The hand written variants live in
+ * matmul_cpu_avx2.cc and matmul_cpu_avx512.cc.
+ */
+
+template <typename ValueType, u32 MR, u32 NR>
+static void gemm_micro_kernel_generic(
+    const u32 kc,
+    const ValueType * __restrict a,
+    const ValueType * __restrict b,
+    ValueType * __restrict c,
+    const u32 ldc,
+    const u32 mr,
+    const u32 nr,
+    const bool accumulate
+) {
+    ValueType acc[MR][NR] = {};
+
+    for (u32 k = 0; k < kc; ++k) {
+        for (u32 i = 0; i < MR; ++i)
+            for (u32 j = 0; j < NR; ++j)
+                acc[i][j] += a[i] * b[j];
+
+        a += MR;
+        b += NR;
+    }
+
+    if (accumulate) {
+        for (u32 i = 0; i < mr; ++i)
+            for (u32 j = 0; j < nr; ++j)
+                c[i * ldc + j] += acc[i][j];
+    } else {
+        for (u32 i = 0; i < mr; ++i)
+            for (u32 j = 0; j < nr; ++j)
+                c[i * ldc + j] = acc[i][j];
+    }
+}
+
+template <typename ValueType>
+static void add_row_generic(
+    ValueType * __restrict out,
+    const ValueType * __restrict lhs,
+    const ValueType * __restrict rhs,
+    const u32 n
+) {
+    for (u32 i = 0; i < n; ++i)
+        out[i] = lhs[i] + rhs[i];
+}
+
+template <typename ValueType>
+static void sub_row_generic(
+    ValueType * __restrict out,
+    const ValueType * __restrict lhs,
+    const ValueType * __restrict rhs,
+    const u32 n
+) {
+    for (u32 i = 0; i < n; ++i)
+        out[i] = lhs[i] - rhs[i];
+}
+
+template <typename ValueType>
+static ValueType dot_row_generic(
+    const ValueType * __restrict a,
+    const ValueType * __restrict b,
+    const u32 n
+) {
+    /* Independent partial sums, otherwise the loop is one long dependency chain. */
+    constexpr u32 LANES = 16;
+
+    ValueType acc[LANES] = {};
+    ValueType sum = 0;
+    u32 i = 0;
+
+    for (; i + LANES <= n; i += LANES)
+        for (u32 j = 0; j < LANES; ++j)
+            acc[j] += a[i + j] * b[i + j];
+
+    for (; i < n; ++i)
+        sum += a[i] * b[i];
+
+    for (u32 j = 0; j < LANES; ++j)
+        sum += acc[j];
+
+    return sum;
+}
+
+template <typename ValueType>
+static void axpy_row_generic(
+    ValueType * __restrict y,
+    const ValueType alpha,
+    const ValueType * __restrict x,
+    const u32 n
+) {
+    for (u32 i = 0; i < n; ++i)
+        y[i] += alpha * x[i];
+}
+
+template <typename OutType, typename InType>
+static void cvt_row_generic(OutType * __restrict out, const InType * __restrict in, const u32 n)
+{
+    for (u32 i = 0; i < n; ++i)
+        out[i] = f32(in[i]);
+}
+
+/* Quantized micro-kernel on i16 pairs, see cpu_q8_kernels_t. */
+template <u32 MR, u32 NR>
+static void gemm_q8_micro_kernel_generic(
+    const u32 kg,
+    const void *a_,
+    const void *b_,
+    i32 * __restrict c,
+    const u32 ldc,
+    const u32 mr,
+    const u32 nr,
+    const bool accumulate
+) {
+    constexpr u32 G = 2;
+
+    const i16 * __restrict a = scast<const i16*>(a_);
+    const i16 * __restrict b = scast<const i16*>(b_);
+
+    i32 acc[MR][NR] = {};
+
+    for (u32 k = 0; k < kg; ++k) {
+        for (u32 i = 0; i < MR; ++i)
+            for (u32 j = 0; j < NR; ++j)
+                acc[i][j] += i32(a[i * G]) * b[j * G] + i32(a[i * G + 1]) * b[j * G + 1];
+
+        a += MR * G;
+        b += NR * G;
+    }
+
+    if (accumulate) {
+        for (u32 i = 0; i < mr; ++i)
+            for (u32 j = 0; j < nr; ++j)
+                c[i * ldc + j] += acc[i][j];
+    } else {
+        for (u32 i = 0; i < mr; ++i)
+            for (u32 j = 0; j < nr; ++j)
+                c[i * ldc + j] = acc[i][j];
+    }
+}
+
+/* Sparse row kernels, see cpu_sparse_kernels_t. NC wide sums, vectorized by the compiler. */
+static void spmm_store_generic(f32 * __restrict out, const f32 *acc, const f32 alpha, const f32 beta, const u32 n)
+{
+    if (beta == 0) {
+        for (u32 j = 0; j < n; ++j)
+            out[j] = alpha * acc[j];
+    } else {
+        for (u32 j = 0; j < n; ++j)
+            out[j] = alpha * acc[j] + beta * out[j];
+    }
+}
+
+template <u32 NC>
+static void spmm_csr_row_generic(
+    f32 * __restrict out,
+    const f32 * __restrict rhs,
+    const size_t rhs_stride,
+    const u32 *col_idx,
+    const f32 *values,
+    const u32 nnz,
+    const f32 alpha,
+    const f32 beta,
+    const u32 n
+) {
+    f32 acc[NC] = {};
+
+    for (u32 e = 0; e < nnz; ++e) {
+        const f32 *row = rhs + col_idx[e] * rhs_stride;
+
+        if (n == NC) [[likely]] {
+            for (u32 j = 0; j < NC; ++j)
+                acc[j] += values[e] * row[j];
+        } else {
+            for (u32 j = 0; j < n; ++j)
+                acc[j] += values[e] * row[j];
+        }
+    }
+
+    spmm_store_generic(out, acc, alpha, beta, n);
+}
+
+template <u32 NC, u32 MR>
+static void spmm_bsr_rows_generic(
+    f32 * __restrict out,
+    const size_t out_stride,
+    const f32 * __restrict rhs,
+    const size_t rhs_stride,
+    const u32 *block_col_idx,
+    const f32 *values,
+    const u32 num_blocks,
+    const u32 block_w,
+    const u32 block_size,
+    const u32 width,
+    const u32 rows,
+    const f32 alpha,
+    const f32 beta,
+    const u32 n
+) {
+    f32 acc[MR][NC] = {};
+
+    for (u32 b = 0; b < num_blocks; ++b) {
+        const u32 x0 = block_col_idx[b] * block_w;
+        const u32 w = std::min(block_w, width - x0);
+        const f32 *v = values + size_t(b) * block_size;
+
+        for (u32 k = 0; k < w; ++k) {
+            const f32 *row = rhs + (x0 + k) * rhs_stride;
+
+            for (u32 i = 0; i < rows; ++i)
+                for (u32 j = 0; j < n; ++j)
+                    acc[i][j] += v[i * block_w + k] * row[j];
+        }
+    }
+
+    for (u32 i = 0; i < rows; ++i)
+        spmm_store_generic(out + i * out_stride, acc[i], alpha, beta, n);
+}
+
+/* Philox lanes kept apart, see cpu_random_kernels_t. */
+template <u32 L>
+static void philox_generic(u32 *out, const u64 seed, const u64 stream, const u64 first)
+{
+    u32 c0[L], c1[L], c2[L], c3[L];
+
+    for (u32 l = 0; l < L; ++l) {
+        c0[l] = u32(first + l);
+        c1[l] = u32((first + l) >> 32);
+        c2[l] = u32(stream);
+        c3[l] = u32(stream >> 32);
+    }
+
+    u32 k0 = u32(seed);
+    u32 k1 = u32(seed >> 32);
+
+    for (u32 r = 0; r < PHILOX_ROUNDS; ++r) {
+        for (u32 l = 0; l < L; ++l) {
+            const u64 p0 = u64(PHILOX_M0) * c0[l];
+            const u64 p1 = u64(PHILOX_M1) * c2[l];
+
+            c0[l] = u32(p1 >> 32) ^ c1[l] ^ k0;
+            c2[l] = u32(p0 >> 32) ^ c3[l] ^ k1;
+            c1[l] = u32(p1);
+            c3[l] = u32(p0);
+        }
+
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+
+    for (u32 l = 0; l < L; ++l) {
+        out[l * 4 + 0] = c0[l];
+        out[l * 4 + 1] = c1[l];
+        out[l * 4 + 2] = c2[l];
+        out[l * 4 + 3] = c3[l];
+    }
+}
+
+const cpu_kernels_t<i64> cpu_kernels_i64_generic = {
+    .isa = cpu_isa_e::generic,
+    .mr = 4,
+    .nr = 8,
+    .mc = 64,
+    .kc = 128,
+    .nc = 2048,
+    .micro_kernel = gemm_micro_kernel_generic<i64, 4, 8>,
+    .add_row = add_row_generic<i64>,
+    .sub_row = sub_row_generic<i64>,
+    .dot_row = dot_row_generic<i64>,
+    .axpy_row = axpy_row_generic<i64>,
+};
+
+const cpu_kernels_t<f32> cpu_kernels_f32_generic = {
+    .isa = cpu_isa_e::generic,
+    .mr = 6,
+    .nr = 16,
+    .mc = 96,
+    .kc = 256,
+    .nc = 4096,
+    .micro_kernel = gemm_micro_kernel_generic<f32, 6, 16>,
+    .add_row = add_row_generic<f32>,
+    .sub_row = sub_row_generic<f32>,
+    .dot_row = dot_row_generic<f32>,
+    .axpy_row = axpy_row_generic<f32>,
+};
+
+template <>
+const cpu_kernels_t<i64>& cpu_kernels<i64>(const cpu_isa_e isa)
+{
+    switch(isa) {
+    case cpu_isa_e::generic:
+        return cpu_kernels_i64_generic;
+    case cpu_isa_e::avx2:
+        return cpu_kernels_i64_avx2;
+    case cpu_isa_e::avx512:
+        return cpu_kernels_i64_avx512;
+    }
+
+    __builtin_unreachable();
+}
+
+template <>
+const cpu_kernels_t<f32>& cpu_kernels<f32>(const cpu_isa_e isa)
+{
+    switch(isa) {
+    case cpu_isa_e::generic:
+        return cpu_kernels_f32_generic;
+    case cpu_isa_e::avx2:
+        return cpu_kernels_f32_avx2;
+    case cpu_isa_e::avx512:
+        return cpu_kernels_f32_avx512;
+    }
+
+    __builtin_unreachable();
+}
+
+const cpu_cvt_kernels_t cpu_cvt_kernels_generic = {
+    .isa = cpu_isa_e::generic,
+    .f16_to_f32 = cvt_row_generic<f32, f16>,
+    .f32_to_f16 = cvt_row_generic<f16, f32>,
+    .bf16_to_f32 = cvt_row_generic<f32, bf16>,
+    .f32_to_bf16 = cvt_row_generic<bf16, f32>,
+};
+
+const cpu_cvt_kernels_t& cpu_cvt_kernels(const cpu_isa_e isa)
+{
+    switch(isa) {
+    case cpu_isa_e::generic:
+        return cpu_cvt_kernels_generic;
+    case cpu_isa_e::avx2:
+        return cpu_cvt_kernels_avx2;
+    case cpu_isa_e::avx512:
+        return cpu_has_avx512_bf16() ? cpu_cvt_kernels_avx512_bf16 : cpu_cvt_kernels_avx512;
+    }
+
+    __builtin_unreachable();
+}
+
+const cpu_q8_kernels_t cpu_q8_kernels_generic = {
+    .isa = cpu_isa_e::generic,
+    .mr = 4,
+    .nr = 8,
+    .mc = 64,
+    .kc = 256,
+    .nc = 2048,
+    .kgroup = 2,
+    .widen = true,
+    .micro_kernel = gemm_q8_micro_kernel_generic<4, 8>,
+};
+
+const cpu_q8_kernels_t& cpu_q8_kernels(const cpu_isa_e isa)
+{
+    switch(isa) {
+    case cpu_isa_e::generic:
+        return cpu_q8_kernels_generic;
+    case cpu_isa_e::avx2:
+        return cpu_q8_kernels_avx2;
+    case cpu_isa_e::avx512:
+        return cpu_has_avx512_vnni() ? cpu_q8_kernels_avx512_vnni : cpu_q8_kernels_avx2;
+    }
+
+    __builtin_unreachable();
+}
+
+const cpu_sparse_kernels_t cpu_sparse_kernels_generic = {
+    .isa = cpu_isa_e::generic,
+    .nc = 64,
+    .mr = 4,
+    .csr_row = spmm_csr_row_generic<64>,
+    .bsr_rows = spmm_bsr_rows_generic<64, 4>,
+};
+
+const cpu_sparse_kernels_t& cpu_sparse_kernels(const cpu_isa_e isa)
+{
+    switch(isa) {
+    case cpu_isa_e::generic:
+        return cpu_sparse_kernels_generic;
+    case cpu_isa_e::avx2:
+        return cpu_sparse_kernels_avx2;
+    case cpu_isa_e::avx512:
+        return cpu_sparse_kernels_avx512;
+    }
+
+    __builtin_unreachable();
+}
+
+const cpu_random_kernels_t cpu_random_kernels_generic = {
+    .isa = cpu_isa_e::generic,
+    .lanes = 4,
+    .philox = philox_generic<4>,
+};
+
+const cpu_random_kernels_t& cpu_random_kernels(const cpu_isa_e isa)
+{
+    switch(isa) {
+    case cpu_isa_e::generic:
+        return cpu_random_kernels_generic;
+    case cpu_isa_e::avx2:
+        return cpu_random_kernels_avx2;
+    case cpu_isa_e::avx512:
+        return cpu_random_kernels_avx512;
+    }
+
+    __builtin_unreachable();
+}
@@ -1,4 +1,7 @@
 #include "mat.h"
+#include "mat_expr.h"
+#include "mat_fixed.h"
+#include "matmul_cpu.h"
 #include "types.h"
 
 #include <cassert>
@@ -7,17 +10,41 @@
  * Common implementations for matrix operations on CPU
  */
 
-template <typename MatrixType, typename ViewType>
-MatrixType mat_add_cpu_(ViewType lhs, ViewType rhs)
-{
+template <typename ViewType>
+void mat_binop_cpu_into_(
+    ViewType dst,
+    ViewType lhs,
+    ViewType rhs,
+    typename cpu_kernels_t<typename ViewType::ValueType>::row_binop_fn op
+) {
     assert(lhs.width == rhs.width);
     assert(lhs.height == rhs.height);
+    assert(dst.width == lhs.width);
+    assert(dst.height == lhs.height);
+
+    if (!mat_row_major(dst, lhs, rhs)) {
+        using MatrixType = typename ViewType::ParentType;
 
-    MatrixType out = MatrixType::make_matrix_zero(lhs.width, lhs.height, lhs.stride);
+        MatrixType tmp[3];
+        const ViewType out = mat_row_major_tmp(dst, tmp[0], false);
+
+        mat_binop_cpu_into_(out, mat_row_major_tmp(lhs, tmp[1], true), mat_row_major_tmp(rhs, tmp[2], true), op);
+
+        if (tmp[0].data)
+            mat_copy(dst, out);
+        return;
+    }
 
     for (u32 y = 0; y < lhs.height; ++y)
-        for (u32 x = 0; x < lhs.width; ++x)
-            out[x,y] = lhs[x,y] + rhs[x,y];
+        op(&dst[0,y], &lhs[0,y], &rhs[0,y], lhs.width);
+}
+
+template <typename MatrixType, typename ViewType>
+MatrixType mat_add_cpu_(ViewType lhs, ViewType rhs)
+{
+    MatrixType out = MatrixType::make_matrix_uninit(lhs.width, lhs.height);
+
+    mat_add_cpu_into(out, lhs, rhs);
 
     return out;
 }
@@ -25,45 +52,80 @@ MatrixType mat_add_cpu_(ViewType lhs, ViewType rhs)
 template <typename MatrixType, typename ViewType>
 MatrixType mat_sub_cpu_(ViewType lhs, ViewType rhs)
 {
-    assert(lhs.width == rhs.width);
-    assert(lhs.height == rhs.height);
+    MatrixType out = MatrixType::make_matrix_uninit(lhs.width, lhs.height);
 
-    MatrixType out = MatrixType::make_matrix_zero(lhs.width, lhs.height, lhs.stride);
-
-    for (u32 y = 0; y < lhs.height; ++y)
-        for (u32 x = 0; x < lhs.width; ++x)
-            out[x,y] = lhs[x,y] - rhs[x,y];
+    mat_sub_cpu_into(out, lhs, rhs);
 
     return out;
 }
 
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+void mat_mul_cpu_into_(
+    ViewType dst,
+    ViewType lhs,
+    ViewType rhs,
+    const ValueType alpha,
+    const ValueType beta,
+    const mat_trans_e trans
+) {
+    const bool trans_lhs = mat_trans_lhs(trans);
+    const bool trans_rhs = mat_trans_rhs(trans);
+    const u32 K = trans_lhs ? lhs.height : lhs.width;
+
+    assert(K == (trans_rhs ? rhs.width : rhs.height));
+    assert(dst.width == (trans_rhs ? rhs.height : rhs.width));
+    assert(dst.height == (trans_lhs ? lhs.width : lhs.height));
+
+    for (u32 y = 0; y < dst.height; ++y) {
+        for (u32 x = 0; x < dst.width; ++x) {
+            ValueType acc = 0;
+
+            for (u32 i = 0; i < K; ++i) {
+                const ValueType a = trans_lhs ? lhs[y,i] : lhs[i,y];
+                const ValueType b = trans_rhs ? rhs[i,x] : rhs[x,i];
+
+                acc += a * b;
+            }
+
+            dst[x,y] = beta == 0 ? alpha * acc : alpha * acc + beta * dst[x,y];
+        }
+    }
+}
+
 template <typename MatrixType, typename ViewType>
 MatrixType mat_mul_cpu_(ViewType lhs, ViewType rhs)
 {
     assert(lhs.width == rhs.height);
 
-    MatrixType out = MatrixType::make_matrix_zero(rhs.width, lhs.height);
+    MatrixType out = MatrixType::make_matrix_uninit(rhs.width, lhs.height);
 
-    for (u32 y = 0; y < out.height; ++y)
-        for (u32 x = 0; x < out.width; ++x)
-            for (u32 i = 0; i < lhs.width; ++i)
-                out[x,y] += lhs[i,y] * rhs[x,i];
+    mat_mul_cpu_into_<ViewType>(out, lhs, rhs, 1, 0, mat_trans_e::none);
 
     return out;
 }
 
-template <typename ViewType>
-void mat_copy_(ViewType dst, ViewType src)
+template <typename DstViewType, typename SrcViewType>
+void mat_convert_(DstViewType dst, SrcViewType src)
 {
     assert(dst.width == src.width);
     assert(dst.height == src.height);
 
-    const auto height = dst.height;
-    const auto width = dst.width;
+    if (!mat_row_major(dst, src)) {
+        typename DstViewType::ParentType dst_tmp;
+        typename SrcViewType::ParentType src_tmp;
+        const DstViewType out = mat_row_major_tmp(dst, dst_tmp, false);
+
+        mat_convert_(out, mat_row_major_tmp(src, src_tmp, true));
 
-    for (u32 y = 0; y < height; ++y)
-        for (u32 x = 0; x < width; ++x)
-            dst[x, y] = src[x, y];
+        if (dst_tmp.data)
+            mat_copy(dst, out);
+        return;
+    }
+
+    const auto &cvt = cpu_cvt_kernels();
+
+    for (u32 y = 0; y < dst.height; ++y)
+        cpu_cvt_row(cvt, &dst[0, y], &src[0, y], dst.width);
 }
 
 mat_i64_t mat_add_cpu(matview_i64_t lhs, matview_i64_t rhs)
@@ -72,11 +134,17 @@ mat_i64_t mat_add_cpu(matview_i64_t lhs, matview_i64_t rhs)
 mat_i64_t mat_sub_cpu(matview_i64_t lhs, matview_i64_t rhs)
 { return mat_sub_cpu_<mat_i64_t, matview_i64_t>(lhs, rhs); }
 
-mat_i64_t mat_mul_cpu(matview_i64_t lhs, matview_i64_t rhs)
+mat_i64_t mat_mul_cpu_naive(matview_i64_t lhs, matview_i64_t rhs)
 { return mat_mul_cpu_<mat_i64_t, matview_i64_t>(lhs, rhs); }
 
-void mat_copy(matview_i64_t dst, matview_i64_t src)
-{ mat_copy_<matview_i64_t>(dst, src); }
+void mat_add_cpu_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs)
+{ mat_binop_cpu_into_(dst, lhs, rhs, cpu_kernels<i64>().add_row); }
+
+void mat_sub_cpu_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs)
+{ mat_binop_cpu_into_(dst, lhs, rhs, cpu_kernels<i64>().sub_row); }
+
+void mat_mul_cpu_naive_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs, i64 alpha, i64 beta, mat_trans_e trans)
+{ mat_mul_cpu_into_(dst, lhs, rhs, alpha, beta, trans); }
 
 mat_f32_t mat_add_cpu(matview_f32_t lhs, matview_f32_t rhs)
 { return mat_add_cpu_<mat_f32_t, matview_f32_t>(lhs, rhs); }
@@ -84,11 +152,29 @@ mat_f32_t mat_add_cpu(matview_f32_t lhs, matview_f32_t rhs)
 mat_f32_t mat_sub_cpu(matview_f32_t lhs, matview_f32_t rhs)
 { return mat_sub_cpu_<mat_f32_t, matview_f32_t>(lhs, rhs); }
 
-mat_f32_t mat_mul_cpu(matview_f32_t lhs, matview_f32_t rhs)
+mat_f32_t mat_mul_cpu_naive(matview_f32_t lhs, matview_f32_t rhs)
 { return mat_mul_cpu_<mat_f32_t, matview_f32_t>(lhs, rhs); }
 
-void mat_copy(matview_f32_t dst, matview_f32_t src)
-{ mat_copy_<matview_f32_t>(dst, src); }
+void mat_add_cpu_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs)
+{ mat_binop_cpu_into_(dst, lhs, rhs, cpu_kernels<f32>().add_row); }
+
+void mat_sub_cpu_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs)
+{ mat_binop_cpu_into_(dst, lhs, rhs, cpu_kernels<f32>().sub_row); }
+
+void mat_mul_cpu_naive_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs, f32 alpha, f32 beta, mat_trans_e trans)
+{ mat_mul_cpu_into_(dst, lhs, rhs, alpha, beta, trans); }
+
+void mat_convert(matview_f16_t dst, matview_f32_t src)
+{ mat_convert_(dst, src); }
+
+void mat_convert(matview_f32_t dst, matview_f16_t src)
+{ mat_convert_(dst, src); }
+
+void mat_convert(matview_bf16_t dst, matview_f32_t src)
+{ mat_convert_(dst, src); }
+
+void mat_convert(matview_f32_t dst, matview_bf16_t src)
+{ mat_convert_(dst, src); }
 
 template <typename ViewType>
 static void assert_mat_square(ViewType m)
@@ -114,7 +200,16 @@ MatrixType strassen_cpu_small_(ViewType lhs, ViewType rhs, MatrixType out)
     assert(lhs.width == rhs.width);
     assert(lhs.width == out.width);
 
-    mat_copy(out, mat_mul_cpu(lhs, rhs));
+    using ValueType = typename ViewType::ValueType;
+    using Mat4 = mat_fixed_t<ValueType, 4, 4>;
+
+    /* The usual base case, unrolled product straight in registers. */
+    if (lhs.width == 4) {
+        (Mat4::from_view(lhs) * Mat4::from_view(rhs)).store(ViewType(out));
+        return out;
+    }
+
+    mat_mul_cpu_into(out, lhs, rhs);
 
     return out;
 }
@@ -124,7 +219,7 @@ MatrixType strassen_cpu_common(ViewType lhs, ViewType rhs)
 {
     assert_mat_mullable<ViewType>(lhs, rhs);
 
-    MatrixType out = MatrixType::make_matrix_zero(lhs.width, lhs.height, lhs.stride);
+    MatrixType out = MatrixType::make_matrix_uninit(lhs.width, lhs.height);
 
     if (lhs.width <= 4)
         return strassen_cpu_small_<ViewType>(lhs, rhs, std::move(out));
@@ -142,30 +237,30 @@ MatrixType strassen_cpu_common(ViewType lhs, ViewType rhs)
     ViewType b21(&rhs[0,quarter_size], quarter_size, quarter_size, rhs.stride);
     ViewType b22(&rhs[quarter_size,quarter_size], quarter_size, quarter_size, rhs.stride);
 
-    MatrixType m1 = strassen_cpu(mat_add_cpu(a11, a22), mat_add_cpu(b11, b22));
-    MatrixType m2 = strassen_cpu(mat_add_cpu(a21, a22), b11);
-    MatrixType m3 = strassen_cpu(a11, mat_sub_cpu(b12, b22));
-    MatrixType m4 = strassen_cpu(a22, mat_sub_cpu(b21, b11));
-    MatrixType m5 = strassen_cpu(mat_add_cpu(a11, a12), b22);
-    MatrixType m6 = strassen_cpu(mat_sub_cpu(a21, a11), mat_add_cpu(b11, b12));
-    MatrixType m7 = strassen_cpu(mat_sub_cpu(a12, a22), mat_add_cpu(b21, b22));
+    MatrixType m1 = strassen_cpu_naive(mat_add_cpu(a11, a22), mat_add_cpu(b11, b22));
+    MatrixType m2 = strassen_cpu_naive(mat_add_cpu(a21, a22), b11);
+    MatrixType m3 = strassen_cpu_naive(a11, mat_sub_cpu(b12, b22));
+    MatrixType m4 = strassen_cpu_naive(a22, mat_sub_cpu(b21, b11));
+    MatrixType m5 = strassen_cpu_naive(mat_add_cpu(a11, a12), b22);
+    MatrixType m6 = strassen_cpu_naive(mat_sub_cpu(a21, a11), mat_add_cpu(b11, b12));
+    MatrixType m7 = strassen_cpu_naive(mat_sub_cpu(a12, a22), mat_add_cpu(b21, b22));
 
     ViewType c11(&out[0,0], quarter_size, quarter_size, out.stride);
     ViewType c12(&out[quarter_size,0], quarter_size, quarter_size, out.stride);
     ViewType c21(&out[0,quarter_size], quarter_size, quarter_size, out.stride);
     ViewType c22(&out[quarter_size,quarter_size], quarter_size, quarter_size, out.stride);
 
-    mat_copy(c11, mat_add_cpu(mat_sub_cpu(mat_add_cpu(m1, m4), m5), m7));
-    mat_copy(c12, mat_add_cpu(m3, m5));
-    mat_copy(c21, mat_add_cpu(m2, m4));
-    mat_copy(c22, mat_add_cpu(mat_add_cpu(mat_sub_cpu(m1, m2), m3), m6));
+    mat_eval(c11, mat_expr(m1) + m4 - m5 + m7);
+    mat_eval(c12, mat_expr(m3) + m5);
+    mat_eval(c21, mat_expr(m2) + m4);
+    mat_eval(c22, mat_expr(m1) - m2 + m3 + m6);
 
     return out;
 }
 
-mat_i64_t strassen_cpu(matview_i64_t lhs, matview_i64_t rhs)
+mat_i64_t strassen_cpu_naive(matview_i64_t lhs, matview_i64_t rhs)
 { return strassen_cpu_common(lhs, rhs); }
 
-mat_f32_t strassen_cpu(matview_f32_t lhs, matview_f32_t rhs)
+mat_f32_t strassen_cpu_naive(matview_f32_t lhs, matview_f32_t rhs)
 { return strassen_cpu_common(lhs, rhs); }
 
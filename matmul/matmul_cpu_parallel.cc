@@ -0,0 +1,279 @@
+#include "mat.h"
+#include "matmul_cpu.h"
+#include "options.h"
+#include "threading.h"
+#include "types.h"
+
+#include <atomic>
+#include <cassert>
+#include <thread>
+#include <type_traits>
+
+/*
+ * Multithreaded GEMM on top of thread_pool.
+ *
+ * Output is split into a 2D grid of tiles, each tile is an independent
+ * blocked GEMM on sub-views of the operands. Threads pull tiles from a shared
+ * counter, so uneven tiles on the edges don't stall the whole pool.
+ *
+ * Tiles re-pack the operand panels they need on their own. That's some
+ * redundant work, but it is O(n^2) against O(n^3) of the product and it keeps
+ * threads completely independent, no barriers between the packing phases.
+ */
+
+/* Multiply-adds from which the pool is used, see thread_pool_for_bands(). */
+constexpr u64 CONFIG_GEMM_PARALLEL_MIN_WORK = 64 * 64 * 64;
+
+/* Tiles per thread, more tiles balance better, fewer pack less. */
+constexpr u32 CONFIG_GEMM_TILES_PER_THREAD = 2;
+
+/* Chunks of a batch per thread, products in a batch can differ a lot in size. */
+constexpr thread_bands_t CONFIG_GEMM_BATCH_CHUNKS = {
+    .min_work = CONFIG_GEMM_PARALLEL_MIN_WORK,
+    .per_thread = 8,
+};
+
+static u32 div_ceil(const u32 a, const u32 b)
+{
+    return (a + b - 1) / b;
+}
+
+static u32 round_up(const u32 a, const u32 b)
+{
+    return div_ceil(a, b) * b;
+}
+
+static u32 cpu_default_num_threads()
+{
+    if (opt_num_threads != 0)
+        return opt_num_threads;
+
+    const u32 num_cpus = std::thread::hardware_concurrency();
+
+    return num_cpus ? num_cpus : 4;
+}
+
+thread_pool& cpu_thread_pool()
+{
+    static thread_pool pool(cpu_default_num_threads());
+    return pool;
+}
+
+/* Waiting caller runs tasks too, one worker less keeps all the CPUs busy. */
+task_pool& cpu_task_pool()
+{
+    static task_pool pool(cpu_default_num_threads() - 1);
+    return pool;
+}
+
+template <typename ViewType, typename InViewType, typename ValueType = ViewType::ValueType>
+static void gemm_cpu_parallel_(
+    ViewType out,
+    InViewType lhs,
+    InViewType rhs,
+    thread_pool &pool,
+    const ValueType alpha,
+    const ValueType beta,
+    const mat_trans_e trans
+) {
+    if (!mat_row_major(out, lhs, rhs)) {
+        gemm_cpu_any_layout(out, lhs, rhs, beta, trans, [&](auto out, auto lhs, auto rhs, auto trans) {
+            gemm_cpu_parallel_(out, lhs, rhs, pool, alpha, beta, trans);
+        });
+        return;
+    }
+
+    const bool trans_lhs = mat_trans_lhs(trans);
+    const bool trans_rhs = mat_trans_rhs(trans);
+
+    const auto &kernels = cpu_kernels<ValueType>();
+
+    const u32 M = out.height;
+    const u32 N = out.width;
+    const u32 K = trans_lhs ? lhs.height : lhs.width;
+    const u32 num_threads = pool.num_threads();
+
+    assert(M == (trans_lhs ? lhs.width : lhs.height));
+    assert(K == (trans_rhs ? rhs.width : rhs.height));
+    assert(N == (trans_rhs ? rhs.height : rhs.width));
+
+    if constexpr (std::is_same_v<ViewType, InViewType>)
+        if (gemv_cpu(out, lhs, rhs, kernels, alpha, beta, trans, &pool))
+            return;
+
+    if (num_threads <= 1 || u64(M) * N * K < CONFIG_GEMM_PARALLEL_MIN_WORK) {
+        gemm_cpu_blocked(out, lhs, rhs, kernels, alpha, beta, trans);
+        return;
+    }
+
+    /*
+     * Grow the grid by splitting the longer side of the tile, until there
+     * are enough tiles or they would get thinner than a micro-tile.
+     */
+    const u32 target_tiles = num_threads * CONFIG_GEMM_TILES_PER_THREAD;
+    u32 grid_m = 1;
+    u32 grid_n = 1;
+
+    while (grid_m * grid_n < target_tiles) {
+        const bool can_split_m = M / (grid_m + 1) >= kernels.mr;
+        const bool can_split_n = N / (grid_n + 1) >= kernels.nr;
+
+        if (can_split_m && (M / grid_m >= N / grid_n || !can_split_n))
+            ++grid_m;
+        else if (can_split_n)
+            ++grid_n;
+        else
+            break;
+    }
+
+    /* Keep tile edges on micro-tile boundaries. */
+    const u32 tile_m = round_up(div_ceil(M, grid_m), kernels.mr);
+    const u32 tile_n = round_up(div_ceil(N, grid_n), kernels.nr);
+    const u32 num_tiles = div_ceil(M, tile_m) * div_ceil(N, tile_n);
+    const u32 tiles_per_row = div_ceil(N, tile_n);
+
+    std::atomic<u32> next_tile = 0;
+
+    pool.schedule([&](u32) {
+        for (;;) {
+            const u32 tile = next_tile.fetch_add(1, std::memory_order_relaxed);
+            if (tile >= num_tiles)
+                return;
+
+            const u32 y0 = (tile / tiles_per_row) * tile_m;
+            const u32 x0 = (tile % tiles_per_row) * tile_n;
+            const u32 h = std::min(tile_m, M - y0);
+            const u32 w = std::min(tile_n, N - x0);
+
+            /* Rows of the product are columns of a transposed lhs, likewise for rhs. */
+            const ViewType out_tile(&out.at(x0, y0), w, h, out.stride);
+            const InViewType lhs_rows = trans_lhs
+                ? InViewType(&lhs.at(y0, 0), h, K, lhs.stride)
+                : InViewType(&lhs.at(0, y0), K, h, lhs.stride);
+            const InViewType rhs_cols = trans_rhs
+                ? InViewType(&rhs.at(0, x0), K, w, rhs.stride)
+                : InViewType(&rhs.at(x0, 0), w, K, rhs.stride);
+
+            gemm_cpu_blocked(out_tile, lhs_rows, rhs_cols, kernels, alpha, beta, trans);
+        }
+    });
+
+    pool.sync();
+}
+
+/*
+ * Products of a batch are independent, so threads take whole products
+ * instead of tiles of one. Chunks of consecutive entries are pulled from
+ * a shared counter, which keeps the counter cold even for 4x4 products.
+ */
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static void gemm_cpu_batched_(
+    const mat_mul_batch_entry_t<ViewType> *batch,
+    const size_t count,
+    thread_pool &pool
+) {
+    const auto &kernels = cpu_kernels<ValueType>();
+
+    if (count == 1) {
+        gemm_cpu_parallel_<ViewType, ViewType>(batch[0].out, batch[0].lhs, batch[0].rhs, pool, ValueType(1), ValueType(0), mat_trans_e::none);
+        return;
+    }
+
+    u64 work = 0;
+    for (size_t i = 0; i < count; ++i) {
+        assert(batch[i].lhs.width == batch[i].rhs.height);
+        assert(batch[i].out.width == batch[i].rhs.width);
+        assert(batch[i].out.height == batch[i].lhs.height);
+
+        work += u64(batch[i].out.height) * batch[i].out.width * batch[i].lhs.width;
+    }
+
+    thread_pool_for_bands(&pool, count, work, CONFIG_GEMM_BATCH_CHUNKS, [&](const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            gemm_cpu_blocked(batch[i].out, batch[i].lhs, batch[i].rhs, kernels);
+    });
+}
+
+template <typename MatrixType, typename ViewType>
+static MatrixType mat_mul_cpu_parallel_(ViewType lhs, ViewType rhs, thread_pool *pool)
+{
+    assert(lhs.width == rhs.height);
+
+    MatrixType out = MatrixType::make_matrix_uninit(rhs.width, lhs.height);
+
+    mat_mul_cpu_parallel_into(out, lhs, rhs, 1, 0, mat_trans_e::none, pool);
+
+    return out;
+}
+
+void gemm_cpu_parallel(
+    matview_i64_t out,
+    matview_i64_t lhs,
+    matview_i64_t rhs,
+    thread_pool &pool,
+    i64 alpha,
+    i64 beta,
+    mat_trans_e trans
+) { gemm_cpu_parallel_(out, lhs, rhs, pool, alpha, beta, trans); }
+
+void gemm_cpu_parallel(
+    matview_f32_t out,
+    matview_f32_t lhs,
+    matview_f32_t rhs,
+    thread_pool &pool,
+    f32 alpha,
+    f32 beta,
+    mat_trans_e trans
+) { gemm_cpu_parallel_(out, lhs, rhs, pool, alpha, beta, trans); }
+
+void mat_mul_cpu_parallel_into(
+    matview_i64_t dst,
+    matview_i64_t lhs,
+    matview_i64_t rhs,
+    i64 alpha,
+    i64 beta,
+    mat_trans_e trans,
+    thread_pool *pool
+) { gemm_cpu_parallel_(dst, lhs, rhs, pool ? *pool : cpu_thread_pool(), alpha, beta, trans); }
+
+void mat_mul_cpu_parallel_into(
+    matview_f32_t dst,
+    matview_f32_t lhs,
+    matview_f32_t rhs,
+    f32 alpha,
+    f32 beta,
+    mat_trans_e trans,
+    thread_pool *pool
+) { gemm_cpu_parallel_(dst, lhs, rhs, pool ? *pool : cpu_thread_pool(), alpha, beta, trans); }
+
+void mat_mul_cpu_parallel_into(
+    matview_f32_t dst,
+    matview_f16_t lhs,
+    matview_f16_t rhs,
+    f32 alpha,
+    f32 beta,
+    mat_trans_e trans,
+    thread_pool *pool
+) { gemm_cpu_parallel_(dst, lhs, rhs, pool ? *pool : cpu_thread_pool(), alpha, beta, trans); }
+
+void mat_mul_cpu_parallel_into(
+    matview_f32_t dst,
+    matview_bf16_t lhs,
+    matview_bf16_t rhs,
+    f32 alpha,
+    f32 beta,
+    mat_trans_e trans,
+    thread_pool *pool
+) { gemm_cpu_parallel_(dst, lhs, rhs, pool ? *pool : cpu_thread_pool(), alpha, beta, trans); }
+
+mat_i64_t mat_mul_cpu_parallel(matview_i64_t lhs, matview_i64_t rhs, thread_pool *pool)
+{ return mat_mul_cpu_parallel_<mat_i64_t, matview_i64_t>(lhs, rhs, pool); }
+
+mat_f32_t mat_mul_cpu_parallel(matview_f32_t lhs, matview_f32_t rhs, thread_pool *pool)
+{ return mat_mul_cpu_parallel_<mat_f32_t, matview_f32_t>(lhs, rhs, pool); }
+
+void mat_mul_cpu_batched(const mat_mul_batch_i64_t *batch, size_t count, thread_pool *pool)
+{ gemm_cpu_batched_(batch, count, pool ? *pool : cpu_thread_pool()); }
+
+void mat_mul_cpu_batched(const mat_mul_batch_f32_t *batch, size_t count, thread_pool *pool)
+{ gemm_cpu_batched_(batch, count, pool ? *pool : cpu_thread_pool()); }
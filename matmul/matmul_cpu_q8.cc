@@ -0,0 +1,453 @@
+#include "mat.h"
+#include "matmul_cpu.h"
+#include "types.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+/*
+ * Quantized GEMM, u8 lhs times i8 rhs, accumulated in i32.
+ *
+ * Same structure as the blocked GEMM in matmul_cpu_blocked.cc: NC wide panels
+ * of rhs, KC deep slices of K and MC tall blocks of lhs, packed into slivers
+ * the micro-kernel streams through. The difference is in the packed layout.
+ * Instruments like vpdpbusd multiply and sum several consecutive k at once,
+ * so every k step of a sliver holds a group of 'kgroup' values per row or
+ * column, and K is zero padded to whole groups:
+ *
+ *   lhs sliver: [k group][MR rows][kgroup]
+ *   rhs sliver: [k group][NR cols][kgroup]
+ *
+ * A row of a lhs group is a single 32 bit value to broadcast, a rhs group
+ * one vector of NR columns.
+ *
+ * Zero points don't take part in the product, see mat.h for how they are
+ * applied afterwards.
+ */
+
+namespace {
+
+/* Per thread packing buffers, in bytes, as the packed type depends on the kernels. */
+struct q8_pack_buffers {
+    constexpr static size_t alignment = 64;
+
+    static u8* alloc(const size_t size_bytes)
+    {
+        return static_cast<u8*>(std::aligned_alloc(alignment, (size_bytes + alignment - 1) & ~(alignment - 1)));
+    }
+
+    void reserve(const cpu_q8_kernels_t &kernels)
+    {
+        const size_t elem_size = kernels.widen ? sizeof(i16) : sizeof(u8);
+        const size_t a_req = size_t(kernels.mc) * kernels.kc * elem_size;
+        const size_t b_req = size_t(kernels.kc) * kernels.nc * elem_size;
+
+        if (a_req > this->a_size) {
+            this->a.reset(alloc(a_req));
+            this->a_size = a_req;
+        }
+
+        if (b_req > this->b_size) {
+            this->b.reset(alloc(b_req));
+            this->b_size = b_req;
+        }
+    }
+
+    static q8_pack_buffers& get()
+    {
+        thread_local q8_pack_buffers buffers;
+        return buffers;
+    }
+
+    std::unique_ptr<u8[], free_deleter> a;
+    std::unique_ptr<u8[], free_deleter> b;
+    size_t a_size = 0;
+    size_t b_size = 0;
+};
+
+/* Same as gemm_operand in matmul_cpu_blocked.cc */
+template <typename ValueType>
+struct q8_operand {
+    ValueType at(const u32 row, const u32 col) const
+    {
+        return this->data[row * this->rs + col * this->cs];
+    }
+
+    const ValueType *data;
+    size_t rs;
+    size_t cs;
+};
+
+}
+
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static q8_operand<ValueType> q8_make_operand(const ViewType m, const bool trans)
+{
+    if (trans)
+        return { m.data, 1, m.stride };
+
+    return { m.data, m.stride, 1 };
+}
+
+/*
+ * Packs (mc x kc) block of lhs starting at (row0, col0) into MR tall slivers
+ * of k groups. Rows past 'mc' and k past 'kc' are zero filled.
+ */
+template <typename PackType, typename ValueType>
+static void q8_pack_lhs(
+    PackType * __restrict out,
+    const q8_operand<ValueType> lhs,
+    const u32 row0,
+    const u32 col0,
+    const u32 mc,
+    const u32 kc,
+    const u32 MR,
+    const u32 G
+) {
+    for (u32 ir = 0; ir < mc; ir += MR) {
+        const u32 mr = std::min(MR, mc - ir);
+
+        for (u32 k = 0; k < kc; k += G) {
+            const u32 g = std::min(G, kc - k);
+
+            for (u32 i = 0; i < MR; ++i) {
+                for (u32 j = 0; j < G; ++j)
+                    out[j] = i < mr && j < g ? PackType(lhs.at(row0 + ir + i, col0 + k + j)) : 0;
+
+                out += G;
+            }
+        }
+    }
+}
+
+/* Same for (kc x nc) block of rhs, NR wide slivers. */
+template <typename PackType, typename ValueType>
+static void q8_pack_rhs(
+    PackType * __restrict out,
+    const q8_operand<ValueType> rhs,
+    const u32 row0,
+    const u32 col0,
+    const u32 kc,
+    const u32 nc,
+    const u32 NR,
+    const u32 G
+) {
+    for (u32 jr = 0; jr < nc; jr += NR) {
+        const u32 nr = std::min(NR, nc - jr);
+
+        for (u32 k = 0; k < kc; k += G) {
+            const u32 g = std::min(G, kc - k);
+
+            for (u32 i = 0; i < NR; ++i) {
+                for (u32 j = 0; j < G; ++j)
+                    out[j] = i < nr && j < g ? PackType(rhs.at(row0 + k + j, col0 + jr + i)) : 0;
+
+                out += G;
+            }
+        }
+    }
+}
+
+template <typename LhsPackType, typename RhsPackType>
+static void gemm_q8_cpu_(
+    matview_i32_t out,
+    const matview_u8_t lhs,
+    const matview_i8_t rhs,
+    const cpu_q8_kernels_t &kernels,
+    const mat_trans_e trans
+) {
+    const u32 MR = kernels.mr;
+    const u32 NR = kernels.nr;
+    const u32 MC = kernels.mc;
+    const u32 KC = kernels.kc;
+    const u32 NC = kernels.nc;
+    const u32 G = kernels.kgroup;
+
+    assert(MC % MR == 0);
+    assert(NC % NR == 0);
+    assert(KC % G == 0);
+
+    const bool trans_lhs = mat_trans_lhs(trans);
+    const bool trans_rhs = mat_trans_rhs(trans);
+
+    const u32 M = out.height;
+    const u32 N = out.width;
+    const u32 K = trans_lhs ? lhs.height : lhs.width;
+
+    assert(M == (trans_lhs ? lhs.width : lhs.height));
+    assert(K == (trans_rhs ? rhs.width : rhs.height));
+    assert(N == (trans_rhs ? rhs.height : rhs.width));
+
+    const auto a = q8_make_operand(lhs, trans_lhs);
+    const auto b = q8_make_operand(rhs, trans_rhs);
+
+    if (M == 0 || N == 0)
+        return;
+
+    if (K == 0) {
+        for (u32 y = 0; y < M; ++y)
+            std::fill_n(&out.at(0, y), N, 0);
+        return;
+    }
+
+    auto &buffers = q8_pack_buffers::get();
+    buffers.reserve(kernels);
+
+    LhsPackType * const apack = rcast<LhsPackType*>(buffers.a.get());
+    RhsPackType * const bpack = rcast<RhsPackType*>(buffers.b.get());
+
+    for (u32 jc = 0; jc < N; jc += NC) {
+        const u32 nc = std::min(NC, N - jc);
+
+        for (u32 pc = 0; pc < K; pc += KC) {
+            const u32 kc = std::min(KC, K - pc);
+            const u32 kg = (kc + G - 1) / G;
+            const bool accumulate = pc != 0;
+
+            q8_pack_rhs(bpack, b, pc, jc, kc, nc, NR, G);
+
+            for (u32 ic = 0; ic < M; ic += MC) {
+                const u32 mc = std::min(MC, M - ic);
+
+                q8_pack_lhs(apack, a, ic, pc, mc, kc, MR, G);
+
+                for (u32 jr = 0; jr < nc; jr += NR) {
+                    const u32 nr = std::min(NR, nc - jr);
+
+                    for (u32 ir = 0; ir < mc; ir += MR) {
+                        const u32 mr = std::min(MR, mc - ir);
+
+                        kernels.micro_kernel(
+                            kg,
+                            apack + size_t(ir) * kg * G,
+                            bpack + size_t(jr) * kg * G,
+                            &out.at(jc + jr, ic + ir),
+                            out.stride,
+                            mr,
+                            nr,
+                            accumulate
+                        );
+                    }
+                }
+            }
+        }
+    }
+}
+
+void gemm_q8_cpu(
+    matview_i32_t out,
+    matview_u8_t lhs,
+    matview_i8_t rhs,
+    const cpu_q8_kernels_t &kernels,
+    mat_trans_e trans
+) {
+    assert(mat_row_major(out, lhs, rhs));
+
+    if (kernels.widen)
+        gemm_q8_cpu_<i16, i16>(out, lhs, rhs, kernels, trans);
+    else
+        gemm_q8_cpu_<u8, i8>(out, lhs, rhs, kernels, trans);
+}
+
+/*
+ * Real values of the product, from the raw one in 'acc':
+ *
+ *   sum((a - za) * (b - zb)) = sum(a * b) - zb * sum(a) - za * sum(b) + K * za * zb
+ *
+ * where sum(a) is over a row of lhs and sum(b) over a column of rhs. Calls
+ * 'store(x, y, real)' for every element.
+ */
+template <typename StoreFn>
+static void q8_dequantize_product(
+    const matview_i32_t acc,
+    const matview_quant_u8_t lhs,
+    const matview_quant_i8_t rhs,
+    const mat_trans_e trans,
+    const StoreFn &store
+) {
+    const bool trans_lhs = mat_trans_lhs(trans);
+    const bool trans_rhs = mat_trans_rhs(trans);
+
+    const u32 M = acc.height;
+    const u32 N = acc.width;
+    const u32 K = trans_lhs ? lhs.q.height : lhs.q.width;
+
+    /* Per row parameters have to be per row or column of the product, see mat.h */
+    assert(!lhs.per_row || !trans_lhs);
+    assert(!rhs.per_row || trans_rhs);
+
+    const auto a = q8_make_operand(lhs.q, trans_lhs);
+    const auto b = q8_make_operand(rhs.q, trans_rhs);
+
+    auto lhs_zp = [&](const u32 y) { return i64(lhs.row_zero_point(y)); };
+    auto rhs_zp = [&](const u32 x) { return i64(rhs.row_zero_point(x)); };
+
+    bool any_lhs_zp = false;
+    bool any_rhs_zp = false;
+
+    for (u32 y = 0; y < (lhs.per_row ? M : 1); ++y)
+        any_lhs_zp |= lhs_zp(y) != 0;
+
+    for (u32 x = 0; x < (rhs.per_row ? N : 1); ++x)
+        any_rhs_zp |= rhs_zp(x) != 0;
+
+    thread_local std::vector<i64> row_sums, col_sums;
+
+    row_sums.assign(M, 0);
+    col_sums.assign(N, 0);
+
+    if (any_rhs_zp)
+        for (u32 y = 0; y < M; ++y)
+            for (u32 k = 0; k < K; ++k)
+                row_sums[y] += a.at(y, k);
+
+    if (any_lhs_zp)
+        for (u32 k = 0; k < K; ++k)
+            for (u32 x = 0; x < N; ++x)
+                col_sums[x] += b.at(k, x);
+
+    for (u32 y = 0; y < M; ++y) {
+        const f32 lhs_scale = lhs.row_scale(y);
+        const i64 za = lhs_zp(y);
+
+        for (u32 x = 0; x < N; ++x) {
+            const i64 zb = rhs_zp(x);
+            const i64 sum = acc.at(x, y) - zb * row_sums[y] - za * col_sums[x] + i64(K) * za * zb;
+
+            store(x, y, f32(sum) * lhs_scale * rhs.row_scale(x));
+        }
+    }
+}
+
+void mat_mul_cpu_into(matview_i32_t dst, matview_u8_t lhs, matview_i8_t rhs, mat_trans_e trans)
+{ gemm_q8_cpu(dst, lhs, rhs, cpu_q8_kernels(cpu_isa()), trans); }
+
+void mat_mul_cpu_into(matview_f32_t dst, matview_quant_u8_t lhs, matview_quant_i8_t rhs, mat_trans_e trans)
+{
+    /* f32 and i32 are the same size, the raw product goes right into 'dst'. */
+    static_assert(sizeof(f32) == sizeof(i32));
+    assert(mat_row_major(dst));
+    const matview_i32_t acc(rcast<i32*>(dst.data), dst.width, dst.height, dst.stride);
+
+    gemm_q8_cpu(acc, lhs.q, rhs.q, cpu_q8_kernels(cpu_isa()), trans);
+
+    q8_dequantize_product(acc, lhs, rhs, trans, [&](const u32 x, const u32 y, const f32 v) {
+        dst.at(x, y) = v;
+    });
+}
+
+void mat_mul_cpu_into(matview_quant_i8_t dst, matview_quant_u8_t lhs, matview_quant_i8_t rhs, mat_trans_e trans)
+{
+    thread_local std::vector<i32> buf;
+
+    buf.resize(size_t(dst.q.width) * dst.q.height);
+    const matview_i32_t acc(buf.data(), dst.q.width, dst.q.height, dst.q.width);
+
+    gemm_q8_cpu(acc, lhs.q, rhs.q, cpu_q8_kernels(cpu_isa()), trans);
+
+    q8_dequantize_product(acc, lhs, rhs, trans, [&](const u32 x, const u32 y, const f32 v) {
+        const f32 q = std::nearbyint(v / dst.row_scale(y)) + f32(dst.row_zero_point(y));
+        dst.q.at(x, y) = i8(std::clamp(q, -128.0f, 127.0f));
+    });
+}
+
+/*
+ * Asymmetric quantization of [min, max] to the full range of QuantType.
+ * The range is stretched to include zero, so zero is exact, padding and ReLU
+ * outputs stay zero after a round trip.
+ */
+template <typename QuantType>
+static void q8_params(f32 lo, f32 hi, f32 &scale, i32 &zero_point)
+{
+    constexpr f32 qmin = std::numeric_limits<QuantType>::min();
+    constexpr f32 qmax = std::numeric_limits<QuantType>::max();
+
+    lo = std::min(lo, 0.0f);
+    hi = std::max(hi, 0.0f);
+
+    scale = (hi - lo) / (qmax - qmin);
+
+    if (scale == 0) {
+        scale = 1;
+        zero_point = 0;
+        return;
+    }
+
+    zero_point = i32(std::clamp(std::nearbyint(qmin - lo / scale), qmin, qmax));
+}
+
+template <typename MatrixType, typename QuantType = MatrixType::ValueType>
+static mat_quant_t<MatrixType> mat_quantize_(const matview_f32_t src, const bool per_row)
+{
+    constexpr f32 qmin = std::numeric_limits<QuantType>::min();
+    constexpr f32 qmax = std::numeric_limits<QuantType>::max();
+
+    assert(mat_row_major(src));
+
+    const u32 num_params = per_row ? src.height : 1;
+
+    mat_quant_t<MatrixType> ret = {
+        .q = MatrixType::make_matrix_uninit(src.width, src.height),
+        .scale = std::vector<f32>(num_params),
+        .zero_point = std::vector<i32>(num_params),
+    };
+
+    for (u32 p = 0; p < num_params; ++p) {
+        const u32 y0 = per_row ? p : 0;
+        const u32 y1 = per_row ? p + 1 : src.height;
+
+        f32 lo = 0;
+        f32 hi = 0;
+
+        for (u32 y = y0; y < y1; ++y) {
+            const auto [row_lo, row_hi] = std::minmax_element(&src.at(0, y), &src.at(0, y) + src.width);
+
+            if (src.width) {
+                lo = std::min(lo, *row_lo);
+                hi = std::max(hi, *row_hi);
+            }
+        }
+
+        q8_params<QuantType>(lo, hi, ret.scale[p], ret.zero_point[p]);
+
+        const f32 inv_scale = 1 / ret.scale[p];
+        const f32 zp = f32(ret.zero_point[p]);
+
+        for (u32 y = y0; y < y1; ++y)
+            for (u32 x = 0; x < src.width; ++x)
+                ret.q.at(x, y) = QuantType(std::clamp(std::nearbyint(src.at(x, y) * inv_scale) + zp, qmin, qmax));
+    }
+
+    return ret;
+}
+
+template <typename ViewType>
+static void mat_dequantize_(matview_f32_t dst, const matview_quant_t<ViewType> src)
+{
+    assert(dst.width == src.q.width);
+    assert(dst.height == src.q.height);
+
+    for (u32 y = 0; y < dst.height; ++y) {
+        const f32 scale = src.row_scale(y);
+        const i32 zp = src.row_zero_point(y);
+
+        for (u32 x = 0; x < dst.width; ++x)
+            dst.at(x, y) = scale * f32(i32(src.q.at(x, y)) - zp);
+    }
+}
+
+mat_quant_u8_t mat_quantize_u8(matview_f32_t src, bool per_row)
+{ return mat_quantize_<mat_u8_t>(src, per_row); }
+
+mat_quant_i8_t mat_quantize_i8(matview_f32_t src, bool per_row)
+{ return mat_quantize_<mat_i8_t>(src, per_row); }
+
+void mat_dequantize(matview_f32_t dst, matview_quant_u8_t src)
+{ mat_dequantize_(dst, src); }
+
+void mat_dequantize(matview_f32_t dst, matview_quant_i8_t src)
+{ mat_dequantize_(dst, src); }
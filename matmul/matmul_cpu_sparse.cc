@@ -0,0 +1,333 @@
+#include "mat.h"
+#include "mat_sparse.h"
+#include "matmul_cpu.h"
+#include "threading.h"
+#include "types.h"
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+/*
+ * Sparse times dense products.
+ *
+ * Every nonzero lhs[y, k] adds a scaled row k of rhs to row y of the result.
+ * Rows of rhs are only read where lhs has nonzeros, so the work is
+ * proportional to nnz * N instead of K * N.
+ *
+ * The columns are walked in panels as wide as the kernel keeps in registers,
+ * cpu_sparse_kernels_t::nc. A panel of the result row is summed up over all
+ * the nonzeros of the row before it is stored, once. The panel of rhs, which
+ * consecutive rows hit in random order, is small enough to stay in L2.
+ */
+
+/*
+ * Above these fractions of the matrix stored, the blocked dense GEMM wins:
+ * it reuses every element of rhs loaded many times, CSR once and BSR once per
+ * register block of rows. Measured on 1024x1024 products.
+ */
+constexpr f32 CONFIG_SPARSE_MAX_DENSITY_CSR = 0.15f;
+constexpr f32 CONFIG_SPARSE_MAX_DENSITY_BSR = 0.3f;
+
+/* BSR pays off only when its blocks aren't mostly zero padding. */
+constexpr f32 CONFIG_SPARSE_MIN_BLOCK_FILL = 0.5f;
+
+/* Row stride of rhs, in elements, that gets it packed, see sparse_rhs. */
+constexpr size_t CONFIG_SPARSE_PACK_STRIDE = 256;
+constexpr u32 CONFIG_SPARSE_PACK_MIN_ROWS = 64;
+
+/* Multiply-adds, rows per band. Rows of a pruned matrix are rarely equally full. */
+constexpr thread_bands_t CONFIG_SPARSE_BANDS = {
+    .min_work = 128 * 1024,
+    .per_thread = 4,
+};
+
+f32 mat_density(const matview_f32_t m)
+{
+    if (m.width == 0 || m.height == 0)
+        return 0;
+
+    size_t nnz = 0;
+
+    for (u32 y = 0; y < m.height; ++y)
+        for (u32 x = 0; x < m.width; ++x)
+            nnz += m.at(x, y) != 0;
+
+    return f32(nnz) / (f32(m.width) * f32(m.height));
+}
+
+mat_csr_f32_t mat_to_csr(const matview_f32_t src)
+{
+    mat_csr_f32_t ret;
+
+    ret.width = src.width;
+    ret.height = src.height;
+    ret.row_ptr.reserve(size_t(src.height) + 1);
+    ret.row_ptr.push_back(0);
+
+    for (u32 y = 0; y < src.height; ++y) {
+        for (u32 x = 0; x < src.width; ++x) {
+            const f32 v = src.at(x, y);
+
+            if (v != 0) {
+                ret.col_idx.push_back(x);
+                ret.values.push_back(v);
+            }
+        }
+
+        ret.row_ptr.push_back(u32(ret.values.size()));
+    }
+
+    return ret;
+}
+
+mat_bsr_f32_t mat_to_bsr(const matview_f32_t src, const u32 block_h, const u32 block_w)
+{
+    assert(block_h > 0 && block_w > 0);
+
+    mat_bsr_f32_t ret;
+
+    ret.width = src.width;
+    ret.height = src.height;
+    ret.block_h = block_h;
+    ret.block_w = block_w;
+    ret.row_ptr.reserve(size_t(ret.block_rows()) + 1);
+    ret.row_ptr.push_back(0);
+
+    const u32 block_cols = (src.width + block_w - 1) / block_w;
+
+    for (u32 br = 0; br < ret.block_rows(); ++br) {
+        const u32 y0 = br * block_h;
+        const u32 h = std::min(block_h, src.height - y0);
+
+        for (u32 bc = 0; bc < block_cols; ++bc) {
+            const u32 x0 = bc * block_w;
+            const u32 w = std::min(block_w, src.width - x0);
+
+            bool nonzero = false;
+
+            for (u32 i = 0; i < h && !nonzero; ++i)
+                for (u32 j = 0; j < w && !nonzero; ++j)
+                    nonzero = src.at(x0 + j, y0 + i) != 0;
+
+            if (!nonzero)
+                continue;
+
+            ret.col_idx.push_back(bc);
+
+            for (u32 i = 0; i < block_h; ++i)
+                for (u32 j = 0; j < block_w; ++j)
+                    ret.values.push_back(i < h && j < w ? src.at(x0 + j, y0 + i) : 0.0f);
+        }
+
+        ret.row_ptr.push_back(u32(ret.col_idx.size()));
+    }
+
+    return ret;
+}
+
+void mat_to_dense(matview_f32_t dst, const mat_csr_f32_t &src)
+{
+    assert(dst.width == src.width);
+    assert(dst.height == src.height);
+    assert(mat_row_major(dst));
+
+    for (u32 y = 0; y < dst.height; ++y) {
+        std::fill_n(&dst.at(0, y), dst.width, 0.0f);
+
+        for (u32 e = src.row_ptr[y]; e < src.row_ptr[y + 1]; ++e)
+            dst.at(src.col_idx[e], y) = src.values[e];
+    }
+}
+
+void mat_to_dense(matview_f32_t dst, const mat_bsr_f32_t &src)
+{
+    assert(dst.width == src.width);
+    assert(dst.height == src.height);
+    assert(mat_row_major(dst));
+
+    const u32 bh = src.block_h;
+    const u32 bw = src.block_w;
+
+    for (u32 y = 0; y < dst.height; ++y)
+        std::fill_n(&dst.at(0, y), dst.width, 0.0f);
+
+    for (u32 br = 0; br < src.block_rows(); ++br) {
+        for (u32 b = src.row_ptr[br]; b < src.row_ptr[br + 1]; ++b) {
+            const f32 *block = &src.values[size_t(b) * bh * bw];
+
+            for (u32 i = 0; i < bh && br * bh + i < dst.height; ++i)
+                for (u32 j = 0; j < bw && src.col_idx[b] * bw + j < dst.width; ++j)
+                    dst.at(src.col_idx[b] * bw + j, br * bh + i) = block[i * bw + j];
+        }
+    }
+}
+
+mat_sparse_f32_t mat_sparse_prepare(const matview_f32_t src, const u32 block_h, const u32 block_w)
+{
+    mat_sparse_f32_t ret;
+
+    const f32 size = f32(src.width) * f32(src.height);
+    const f32 density = mat_density(src);
+
+    if (block_h * block_w > 1 && density <= CONFIG_SPARSE_MAX_DENSITY_BSR) {
+        auto bsr = mat_to_bsr(src, block_h, block_w);
+        const f32 stored = f32(bsr.values.size());
+
+        if (stored <= CONFIG_SPARSE_MAX_DENSITY_BSR * size && density * size >= CONFIG_SPARSE_MIN_BLOCK_FILL * stored) {
+            ret.format = mat_sparse_format_e::bsr;
+            ret.bsr = std::move(bsr);
+            return ret;
+        }
+    }
+
+    if (density <= CONFIG_SPARSE_MAX_DENSITY_CSR) {
+        ret.format = mat_sparse_format_e::csr;
+        ret.csr = mat_to_csr(src);
+        return ret;
+    }
+
+    ret.format = mat_sparse_format_e::dense;
+    ret.dense = mat_f32_t::make_matrix_uninit(src.width, src.height);
+    mat_copy(ret.dense, src);
+    return ret;
+}
+
+/*
+ * Rows of rhs, in panels of 'nc' columns. Panel p starts at data + p * panel_step.
+ *
+ * Rows a multiple of CONFIG_SPARSE_PACK_STRIDE apart all map to the same few
+ * cache sets, so with rows read in random order the panel keeps evicting
+ * itself from L1 and L2. Such rhs is copied into contiguous panels first, it
+ * is read nnz / K times over anyway.
+ */
+struct sparse_rhs {
+    const f32* panel(const u32 jc, const u32 nc) const
+    {
+        return this->data + size_t(jc / nc) * this->panel_step;
+    }
+
+    const f32 *data;
+    size_t stride;
+    size_t panel_step;
+};
+
+static sparse_rhs sparse_prepare_rhs(const matview_f32_t rhs, const u32 nc, thread_pool &pool)
+{
+    const u32 K = rhs.height;
+    const u32 N = rhs.width;
+
+    if (rhs.stride % CONFIG_SPARSE_PACK_STRIDE != 0 || K < CONFIG_SPARSE_PACK_MIN_ROWS)
+        return { rhs.data, rhs.stride, nc };
+
+    thread_local std::vector<f32> buf;
+    buf.resize(size_t(K) * ((N + nc - 1) / nc) * nc);
+
+    thread_pool_for_bands(&pool, K, u64(K) * N, CONFIG_SPARSE_BANDS, [&](const u32 begin, const u32 end) {
+        for (u32 jc = 0; jc < N; jc += nc) {
+            const u32 w = std::min(nc, N - jc);
+            f32 * const panel = buf.data() + size_t(jc) * K;
+
+            for (u32 k = begin; k < end; ++k)
+                std::copy_n(&rhs.at(jc, k), w, panel + size_t(k) * nc);
+        }
+    });
+
+    return { buf.data(), nc, size_t(K) * nc };
+}
+
+void mat_mul_cpu_into(matview_f32_t dst, const mat_csr_f32_t &lhs, matview_f32_t rhs, f32 alpha, f32 beta, thread_pool *pool)
+{
+    assert(dst.height == lhs.height);
+    assert(rhs.height == lhs.width);
+    assert(dst.width == rhs.width);
+    assert(mat_row_major(dst, rhs));
+
+    const auto &kernels = cpu_sparse_kernels();
+    const u32 N = dst.width;
+
+    thread_pool &p = pool ? *pool : cpu_thread_pool();
+    const sparse_rhs b = sparse_prepare_rhs(rhs, kernels.nc, p);
+
+    thread_pool_for_bands(&p, dst.height, u64(lhs.nnz()) * N, CONFIG_SPARSE_BANDS, [&](const u32 begin, const u32 end) {
+        for (u32 jc = 0; jc < N; jc += kernels.nc) {
+            const u32 nc = std::min(kernels.nc, N - jc);
+            const f32 *panel = b.panel(jc, kernels.nc);
+
+            for (u32 y = begin; y < end; ++y) {
+                const u32 e = lhs.row_ptr[y];
+
+                kernels.csr_row(
+                    &dst.at(jc, y),
+                    panel,
+                    b.stride,
+                    lhs.col_idx.data() + e,
+                    lhs.values.data() + e,
+                    lhs.row_ptr[y + 1] - e,
+                    alpha,
+                    beta,
+                    nc
+                );
+            }
+        }
+    });
+}
+
+void mat_mul_cpu_into(matview_f32_t dst, const mat_bsr_f32_t &lhs, matview_f32_t rhs, f32 alpha, f32 beta, thread_pool *pool)
+{
+    assert(dst.height == lhs.height);
+    assert(rhs.height == lhs.width);
+    assert(dst.width == rhs.width);
+    assert(mat_row_major(dst, rhs));
+
+    const auto &kernels = cpu_sparse_kernels();
+    const u32 N = dst.width;
+    const u32 bh = lhs.block_h;
+    const u32 bw = lhs.block_w;
+
+    thread_pool &p = pool ? *pool : cpu_thread_pool();
+    const sparse_rhs b = sparse_prepare_rhs(rhs, kernels.nc, p);
+
+    thread_pool_for_bands(&p, lhs.block_rows(), u64(lhs.values.size()) * N, CONFIG_SPARSE_BANDS, [&](const u32 begin, const u32 end) {
+        for (u32 jc = 0; jc < N; jc += kernels.nc) {
+            const u32 nc = std::min(kernels.nc, N - jc);
+            const f32 *panel = b.panel(jc, kernels.nc);
+
+            for (u32 br = begin; br < end; ++br) {
+                const u32 first = lhs.row_ptr[br];
+                const u32 h = std::min(bh, dst.height - br * bh);
+
+                for (u32 i = 0; i < h; i += kernels.mr) {
+                    kernels.bsr_rows(
+                        &dst.at(jc, br * bh + i),
+                        dst.stride,
+                        panel,
+                        b.stride,
+                        lhs.col_idx.data() + first,
+                        lhs.values.data() + size_t(first) * bh * bw + i * bw,
+                        lhs.row_ptr[br + 1] - first,
+                        bw,
+                        bh * bw,
+                        lhs.width,
+                        std::min(kernels.mr, h - i),
+                        alpha,
+                        beta,
+                        nc
+                    );
+                }
+            }
+        }
+    });
+}
+
+void mat_mul_cpu_into(matview_f32_t dst, const mat_sparse_f32_t &lhs, matview_f32_t rhs, f32 alpha, f32 beta, thread_pool *pool)
+{
+    switch (lhs.format) {
+    case mat_sparse_format_e::dense:
+        return mat_mul_cpu_parallel_into(dst, lhs.dense, rhs, alpha, beta, mat_trans_e::none, pool);
+    case mat_sparse_format_e::csr:
+        return mat_mul_cpu_into(dst, lhs.csr, rhs, alpha, beta, pool);
+    case mat_sparse_format_e::bsr:
+        return mat_mul_cpu_into(dst, lhs.bsr, rhs, alpha, beta, pool);
+    }
+}
@@ -1,15 +1,44 @@
 #include "matmul_cuda.h"
 #include "mat.h"
+#include "mat_expr.h"
+
+/*
+ * CUDA runners copy whole rows, stride included, back to the host. That
+ * would clobber the neighbours of a 'dst' that is a view into a bigger matrix,
+ * so results land in a per thread staging matrix first, reused while the
+ * shape stays the same, and are merged into 'dst' with alpha and beta applied.
+ */
+template <typename MatrixType>
+static MatrixType& mat_mul_cu_staging(const u32 width, const u32 height)
+{
+    thread_local MatrixType staging;
 
-static mat_i64_t mat_mul_cu_(matview_i64_t lhs, matview_i64_t rhs, cuda_kernel_variant variant)
+    if (staging.width != width || staging.height != height)
+        staging = MatrixType::make_matrix_uninit(width, height);
+
+    return staging;
+}
+
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static void mat_mul_cu_merge(ViewType dst, ViewType product, const ValueType alpha, const ValueType beta)
+{
+    if (beta == 0 && alpha == 1)
+        mat_copy(dst, product);
+    else if (beta == 0)
+        mat_eval(dst, alpha * mat_expr(product));
+    else
+        mat_eval(dst, alpha * mat_expr(product) + beta * mat_expr(dst));
+}
+
+/* 'out' has to own whole rows, including the stride. */
+static int mat_mul_cu_run_(mat_i64_t &out, matview_i64_t lhs, matview_i64_t rhs, cuda_kernel_variant variant)
 {
     assert(lhs.width == lhs.height);
     assert(rhs.width == rhs.height);
     assert(lhs.width == rhs.width);
+    assert(mat_row_major(lhs, rhs));
 
-    mat_i64_t out = mat_i64_t::make_matrix(lhs.width, lhs.height);
-
-    run_kernel_cu(
+    return run_kernel_cu(
         lhs.data,
         lhs.width,
         lhs.height,
@@ -27,6 +56,37 @@ static mat_i64_t mat_mul_cu_(matview_i64_t lhs, matview_i64_t rhs, cuda_kernel_v
 
         variant
     );
+}
+
+static int mat_mul_cu_into_(
+    matview_i64_t dst,
+    matview_i64_t lhs,
+    matview_i64_t rhs,
+    const i64 alpha,
+    const i64 beta,
+    cuda_kernel_variant variant
+) {
+    assert(dst.width == lhs.width);
+    assert(dst.height == lhs.height);
+    assert(mat_row_major(dst));
+
+    mat_i64_t &out = mat_mul_cu_staging<mat_i64_t>(lhs.width, lhs.height);
+
+    const int err = mat_mul_cu_run_(out, lhs, rhs, variant);
+    if (err)
+        return err;
+
+    mat_mul_cu_merge<matview_i64_t>(dst, out, alpha, beta);
+
+    return 0;
+}
+
+static mat_i64_t mat_mul_cu_(matview_i64_t lhs, matview_i64_t rhs, cuda_kernel_variant variant)
+{
+    /* Returned even if the kernel fails, zeros rather than whatever was in memory. */
+    mat_i64_t out = mat_i64_t::make_matrix_zero(lhs.width, lhs.height);
+
+    mat_mul_cu_run_(out, lhs, rhs, variant);
 
     return out;
 }
@@ -36,35 +96,60 @@ mat_i64_t mat_mul_cu(matview_i64_t lhs, matview_i64_t rhs)
     return mat_mul_cu_(lhs, rhs, cuda_kernel_variant::UMEM);
 }
 
+int mat_mul_cu_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs, i64 alpha, i64 beta)
+{
+    return mat_mul_cu_into_(dst, lhs, rhs, alpha, beta, cuda_kernel_variant::UMEM);
+}
+
 mat_i64_t mat_mul_cu_umem_tiled(matview_i64_t lhs, matview_i64_t rhs)
 {
     return mat_mul_cu_(lhs, rhs, cuda_kernel_variant::UMEM_TILED);
 }
 
+int mat_mul_cu_umem_tiled_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs, i64 alpha, i64 beta)
+{
+    return mat_mul_cu_into_(dst, lhs, rhs, alpha, beta, cuda_kernel_variant::UMEM_TILED);
+}
+
 mat_i64_t mat_mul_cu_tiled(matview_i64_t lhs, matview_i64_t rhs)
 {
     return mat_mul_cu_(lhs, rhs, cuda_kernel_variant::TILED);
 }
 
+int mat_mul_cu_tiled_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs, i64 alpha, i64 beta)
+{
+    return mat_mul_cu_into_(dst, lhs, rhs, alpha, beta, cuda_kernel_variant::TILED);
+}
+
 mat_i64_t mat_mul_cu_tiled_input(matview_i64_t lhs, matview_i64_t rhs)
 {
     return mat_mul_cu_(lhs, rhs, cuda_kernel_variant::TILED_INPUT);
 }
 
+int mat_mul_cu_tiled_input_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs, i64 alpha, i64 beta)
+{
+    return mat_mul_cu_into_(dst, lhs, rhs, alpha, beta, cuda_kernel_variant::TILED_INPUT);
+}
+
 mat_i64_t mat_mul_cu_test(matview_i64_t lhs, matview_i64_t rhs)
 {
     return mat_mul_cu_(lhs, rhs, cuda_kernel_variant::TEST);
 }
 
-static mat_f32_t mat_mul_cu_(matview_f32_t lhs, matview_f32_t rhs, cuda_kernel_variant variant)
+int mat_mul_cu_test_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs, i64 alpha, i64 beta)
+{
+    return mat_mul_cu_into_(dst, lhs, rhs, alpha, beta, cuda_kernel_variant::TEST);
+}
+
+/* 'out' has to own whole rows, including the stride. */
+static int mat_mul_cu_run_(mat_f32_t &out, matview_f32_t lhs, matview_f32_t rhs, cuda_kernel_variant variant)
 {
     assert(lhs.width == lhs.height);
     assert(rhs.width == rhs.height);
     assert(lhs.width == rhs.width);
+    assert(mat_row_major(lhs, rhs));
 
-    mat_f32_t out = mat_f32_t::make_matrix(lhs.width, lhs.height);
-
-    run_kernel_cu_f32(
+    return run_kernel_cu_f32(
         lhs.data,
         lhs.width,
         lhs.height,
@@ -82,6 +167,37 @@ static mat_f32_t mat_mul_cu_(matview_f32_t lhs, matview_f32_t rhs, cuda_kernel_v
 
         variant
     );
+}
+
+static int mat_mul_cu_into_(
+    matview_f32_t dst,
+    matview_f32_t lhs,
+    matview_f32_t rhs,
+    const f32 alpha,
+    const f32 beta,
+    cuda_kernel_variant variant
+) {
+    assert(dst.width == lhs.width);
+    assert(dst.height == lhs.height);
+    assert(mat_row_major(dst));
+
+    mat_f32_t &out = mat_mul_cu_staging<mat_f32_t>(lhs.width, lhs.height);
+
+    const int err = mat_mul_cu_run_(out, lhs, rhs, variant);
+    if (err)
+        return err;
+
+    mat_mul_cu_merge<matview_f32_t>(dst, out, alpha, beta);
+
+    return 0;
+}
+
+static mat_f32_t mat_mul_cu_(matview_f32_t lhs, matview_f32_t rhs, cuda_kernel_variant variant)
+{
+    /* Returned even if the kernel fails, zeros rather than whatever was in memory. */
+    mat_f32_t out = mat_f32_t::make_matrix_zero(lhs.width, lhs.height);
+
+    mat_mul_cu_run_(out, lhs, rhs, variant);
 
     return out;
 }
@@ -91,22 +207,47 @@ mat_f32_t mat_mul_cu(matview_f32_t lhs, matview_f32_t rhs)
     return mat_mul_cu_(lhs, rhs, cuda_kernel_variant::UMEM);
 }
 
+int mat_mul_cu_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs, f32 alpha, f32 beta)
+{
+    return mat_mul_cu_into_(dst, lhs, rhs, alpha, beta, cuda_kernel_variant::UMEM);
+}
+
 mat_f32_t mat_mul_cu_umem_tiled(matview_f32_t lhs, matview_f32_t rhs)
 {
     return mat_mul_cu_(lhs, rhs, cuda_kernel_variant::UMEM_TILED);
 }
 
+int mat_mul_cu_umem_tiled_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs, f32 alpha, f32 beta)
+{
+    return mat_mul_cu_into_(dst, lhs, rhs, alpha, beta, cuda_kernel_variant::UMEM_TILED);
+}
+
 mat_f32_t mat_mul_cu_tiled(matview_f32_t lhs, matview_f32_t rhs)
 {
     return mat_mul_cu_(lhs, rhs, cuda_kernel_variant::TILED);
 }
 
+int mat_mul_cu_tiled_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs, f32 alpha, f32 beta)
+{
+    return mat_mul_cu_into_(dst, lhs, rhs, alpha, beta, cuda_kernel_variant::TILED);
+}
+
 mat_f32_t mat_mul_cu_tiled_input(matview_f32_t lhs, matview_f32_t rhs)
 {
     return mat_mul_cu_(lhs, rhs, cuda_kernel_variant::TILED_INPUT);
 }
 
+int mat_mul_cu_tiled_input_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs, f32 alpha, f32 beta)
+{
+    return mat_mul_cu_into_(dst, lhs, rhs, alpha, beta, cuda_kernel_variant::TILED_INPUT);
+}
+
 mat_f32_t mat_mul_cu_test(matview_f32_t lhs, matview_f32_t rhs)
 {
     return mat_mul_cu_(lhs, rhs, cuda_kernel_variant::TEST);
 }
+
+int mat_mul_cu_test_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs, f32 alpha, f32 beta)
+{
+    return mat_mul_cu_into_(dst, lhs, rhs, alpha, beta, cuda_kernel_variant::TEST);
+}
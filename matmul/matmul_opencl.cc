@@ -1,4 +1,5 @@
 #include <mutex>
+#include <vector>
 
 #include <CL/cl.h>
 
@@ -39,6 +40,19 @@ static u32 cl_size_round(u32 size_bytes)
     return (size_bytes + alignment_bytes-1) & (~(alignment_bytes-1));
 }
 
+/*
+ * Bytes of a view the kernel reads, up to the last element of its last row.
+ * Views of mapped files and of bigger matrices end right there, anything
+ * past it may not be readable, so only the device buffer gets rounded.
+ */
+static size_t cl_view_bytes(const matview_void_t &m)
+{
+    if (m.height == 0)
+        return 0;
+
+    return (size_t(m.height - 1) * m.stride + m.width) * mat_type_size(m.type);
+}
+
 static int init_kernel_context_(struct cl_kernel_context &kctx)
 {
     int err;
@@ -113,8 +127,27 @@ static int init_kernel_context()
     return 0;
 }
 
-static int run_kernel(matview_void_t lhs, matview_void_t rhs, matview_void_t out)
-{
+/*
+ * Computes:
+ *     out = alpha * op(lhs) @ op(rhs) + beta * out
+ *
+ * where op() transposes operands flagged in 'trans'. Those are uploaded as
+ * they are stored, the kernel indexes them transposed.
+ *
+ * 'alpha' and 'beta' point to values of the type of 'out'. Half width
+ * operands are uploaded as they are, half the bytes of f32 ones, and the
+ * kernel accumulates them into f32 'out'.
+ * 'out' is uploaded only when 'beta' isn't zero, see matmul.cl
+ */
+static int run_kernel(
+    matview_void_t lhs,
+    matview_void_t rhs,
+    matview_void_t out,
+    const void *alpha,
+    const void *beta,
+    const bool beta_zero,
+    const mat_trans_e trans
+) {
     int err;
 
     /* Actual work */
@@ -128,15 +161,33 @@ static int run_kernel(matview_void_t lhs, matview_void_t rhs, matview_void_t out
     u32 cl_rhs_buffer_size = cl_size_round(rhs.size_bytes());
     size_t local_size = 0, global_size = 0;
 
+    const size_t elem_size = mat_type_size(out.type);
+    const u32 trans_bits = u32(trans);
+
+    /*
+     * 'out' may be a view into a bigger matrix, only its rows are transferred,
+     * columns of the parent next to it are left alone.
+     */
+    const size_t out_origin[3] = { 0, 0, 0 };
+    const size_t out_region[3] = { out.width * elem_size, out.height, 1 };
+    const size_t out_pitch = out.stride * elem_size;
+
     const char * const kernel_name = [&]{
         assert(lhs.type == rhs.type);
-        assert(lhs.type == out.type);
 
         switch(lhs.type) {
         case mat_type_e::i64:
+            assert(out.type == mat_type_e::i64);
             return "matmul_i64";
         case mat_type_e::f32:
+            assert(out.type == mat_type_e::f32);
             return "matmul_f32";
+        case mat_type_e::f16:
+            assert(out.type == mat_type_e::f32);
+            return "matmul_f16";
+        case mat_type_e::bf16:
+            assert(out.type == mat_type_e::f32);
+            return "matmul_bf16";
         }
 
         __builtin_unreachable();
@@ -195,6 +246,10 @@ static int run_kernel(matview_void_t lhs, matview_void_t rhs, matview_void_t out
     err |= clSetKernelArg(kernel, 10, sizeof(u32),    &out.height);
     err |= clSetKernelArg(kernel, 11, sizeof(u32),    &out.stride);
 
+    err |= clSetKernelArg(kernel, 12, elem_size,      alpha);
+    err |= clSetKernelArg(kernel, 13, elem_size,      beta);
+    err |= clSetKernelArg(kernel, 14, sizeof(u32),    &trans_bits);
+
     if (err < 0) {
         fprintf(stderr, "Failed to set kernel args\n");
         return 1;
@@ -210,18 +265,27 @@ static int run_kernel(matview_void_t lhs, matview_void_t rhs, matview_void_t out
     if (local_size > global_size)
         local_size = global_size;
 
-    err = clEnqueueWriteBuffer(queue, cl_lhs_buffer, CL_FALSE, 0, cl_lhs_buffer_size, lhs.data, 0, NULL, NULL);
+    err = clEnqueueWriteBuffer(queue, cl_lhs_buffer, CL_FALSE, 0, cl_view_bytes(lhs), lhs.data, 0, NULL, NULL);
     if (err < 0) {
         fprintf(stderr, "clEnqueueWriteBuffer %s: %d\n", "lhs", err);
         return 1;
     }
 
-    err = clEnqueueWriteBuffer(queue, cl_rhs_buffer, CL_FALSE, 0, cl_rhs_buffer_size, rhs.data, 0, NULL, NULL);
+    err = clEnqueueWriteBuffer(queue, cl_rhs_buffer, CL_FALSE, 0, cl_view_bytes(rhs), rhs.data, 0, NULL, NULL);
     if (err < 0) {
         fprintf(stderr, "clEnqueueWriteBuffer %s: %d\n", "rhs", err);
         return 1;
     }
 
+    if (!beta_zero && out.height) {
+        err = clEnqueueWriteBufferRect(queue, cl_out_buffer, CL_FALSE, out_origin, out_origin, out_region,
+                                       out_pitch, 0, out_pitch, 0, out.data, 0, NULL, NULL);
+        if (err < 0) {
+            fprintf(stderr, "clEnqueueWriteBufferRect %s: %d\n", "out", err);
+            return 1;
+        }
+    }
+
     err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size, &local_size, 0, NULL, NULL);
     if (err < 0) {
         fprintf(stderr, "clEnqueueNDRangeKernel %s: %d\n", "out", err);
@@ -230,10 +294,13 @@ static int run_kernel(matview_void_t lhs, matview_void_t rhs, matview_void_t out
 
     clFinish(queue);
 
-    err = clEnqueueReadBuffer(queue, cl_out_buffer, CL_TRUE, 0, cl_out_buffer_size, out.data, 0, NULL, NULL);
-    if (err < 0) {
-        fprintf(stderr, "clEnqueueReadBuffer: %d\n", err);
-        return 1;
+    if (out.height) {
+        err = clEnqueueReadBufferRect(queue, cl_out_buffer, CL_TRUE, out_origin, out_origin, out_region,
+                                      out_pitch, 0, out_pitch, 0, out.data, 0, NULL, NULL);
+        if (err < 0) {
+            fprintf(stderr, "clEnqueueReadBufferRect: %d\n", err);
+            return 1;
+        }
     }
 
     clFinish(queue);
@@ -247,20 +314,251 @@ static int run_kernel(matview_void_t lhs, matview_void_t rhs, matview_void_t out
     return 0;
 }
 
+/*
+ * All products of a batch in one go, see matmul_batched_* in matmul.cl.
+ * Operands are gathered densely into one host buffer, uploaded with a single
+ * write, and products are scattered back into their 'out' views at the end.
+ */
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static int run_kernel_batched(const mat_mul_batch_entry_t<ViewType> *batch, const size_t count, const char *kernel_name)
+{
+    int err;
+
+    cl_command_queue queue;
+    cl_kernel kernel;
+    cl_mem cl_in_buffer;
+    cl_mem cl_out_buffer;
+    cl_mem cl_desc_buffer;
+
+    std::vector<u32> desc(6 * count);
+    size_t in_elems = 0;
+    size_t out_elems = 0;
+    size_t max_out_elems = 0;
+
+    if (count == 0)
+        return 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        const auto &e = batch[i];
+
+        assert(e.lhs.width == e.rhs.height);
+        assert(e.out.width == e.rhs.width);
+        assert(mat_row_major(e.out, e.lhs, e.rhs));
+        assert(e.out.height == e.lhs.height);
+
+        const size_t lhs_elems = size_t(e.lhs.width) * e.lhs.height;
+        const size_t rhs_elems = size_t(e.rhs.width) * e.rhs.height;
+        const size_t prod_elems = size_t(e.out.width) * e.out.height;
+
+        desc[6*i + 0] = in_elems;
+        desc[6*i + 1] = in_elems + lhs_elems;
+        desc[6*i + 2] = out_elems;
+        desc[6*i + 3] = e.out.height;
+        desc[6*i + 4] = e.lhs.width;
+        desc[6*i + 5] = e.out.width;
+
+        in_elems += lhs_elems + rhs_elems;
+        out_elems += prod_elems;
+        max_out_elems = std::max(max_out_elems, prod_elems);
+    }
+
+    /* Offsets in 'desc' and buffer sizes are 32 bit. */
+    if (in_elems * sizeof(ValueType) > UINT32_MAX - 64 || out_elems * sizeof(ValueType) > UINT32_MAX - 64) {
+        fprintf(stderr, "Batch too big: %zu input, %zu output elements\n", in_elems, out_elems);
+        return 1;
+    }
+
+    std::vector<ValueType> in(in_elems);
+    std::vector<ValueType> out(out_elems);
+
+    for (size_t i = 0; i < count; ++i) {
+        const auto &e = batch[i];
+
+        for (u32 y = 0; y < e.lhs.height; ++y)
+            std::copy_n(&e.lhs.at(0, y), e.lhs.width, &in[desc[6*i + 0] + y * e.lhs.width]);
+
+        for (u32 y = 0; y < e.rhs.height; ++y)
+            std::copy_n(&e.rhs.at(0, y), e.rhs.width, &in[desc[6*i + 1] + y * e.rhs.width]);
+    }
+
+    /* Empty products still need non-zero sized buffers. */
+    const u32 cl_in_buffer_size = cl_size_round(std::max<size_t>(in_elems, 1) * sizeof(ValueType));
+    const u32 cl_out_buffer_size = cl_size_round(std::max<size_t>(out_elems, 1) * sizeof(ValueType));
+    const size_t cl_desc_buffer_size = desc.size() * sizeof(u32);
+    const size_t global_size[2] = { std::max<size_t>(max_out_elems, 1), count };
+
+    err = init_kernel_context();
+    if (err)
+        return err;
+
+    cl_device_id device = kctx.device;
+    cl_context context = kctx.context;
+    cl_program program = kctx.program;
+
+    queue = clCreateCommandQueueWithProperties(context, device, NULL, &err);
+    if (err < 0) {
+        fprintf(stderr, "clCreateCommandQueueWithProperties: %d\n", err);
+        return 1;
+    }
+
+    kernel = clCreateKernel(program, kernel_name, &err);
+    if (err < 0) {
+        fprintf(stderr, "clCreateKernel: %d\n", err);
+        return 1;
+    }
+
+    cl_in_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY, cl_in_buffer_size, NULL, &err);
+    if (!cl_in_buffer) {
+        fprintf(stderr, "Failed to allocate %s memory on the GPU: %d\n", "in", err);
+        return 1;
+    }
+
+    cl_out_buffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY, cl_out_buffer_size, NULL, &err);
+    if (!cl_out_buffer) {
+        fprintf(stderr, "Failed to allocate %s memory on the GPU: %d\n", "out", err);
+        return 1;
+    }
+
+    cl_desc_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY, cl_desc_buffer_size, NULL, &err);
+    if (!cl_desc_buffer) {
+        fprintf(stderr, "Failed to allocate %s memory on the GPU: %d\n", "desc", err);
+        return 1;
+    }
+
+    err  = clSetKernelArg(kernel, 0, sizeof(cl_mem), &cl_in_buffer);
+    err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &cl_out_buffer);
+    err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &cl_desc_buffer);
+
+    if (err < 0) {
+        fprintf(stderr, "Failed to set kernel args\n");
+        return 1;
+    }
+
+    if (in_elems) {
+        err = clEnqueueWriteBuffer(queue, cl_in_buffer, CL_FALSE, 0, in_elems * sizeof(ValueType), in.data(), 0, NULL, NULL);
+        if (err < 0) {
+            fprintf(stderr, "clEnqueueWriteBuffer %s: %d\n", "in", err);
+            return 1;
+        }
+    }
+
+    err = clEnqueueWriteBuffer(queue, cl_desc_buffer, CL_FALSE, 0, cl_desc_buffer_size, desc.data(), 0, NULL, NULL);
+    if (err < 0) {
+        fprintf(stderr, "clEnqueueWriteBuffer %s: %d\n", "desc", err);
+        return 1;
+    }
+
+    /* Let the runtime pick the work-group shape, products have all kinds of sizes. */
+    err = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global_size, NULL, 0, NULL, NULL);
+    if (err < 0) {
+        fprintf(stderr, "clEnqueueNDRangeKernel %s: %d\n", "out", err);
+        return 1;
+    }
+
+    if (out_elems) {
+        err = clEnqueueReadBuffer(queue, cl_out_buffer, CL_TRUE, 0, out_elems * sizeof(ValueType), out.data(), 0, NULL, NULL);
+        if (err < 0) {
+            fprintf(stderr, "clEnqueueReadBuffer: %d\n", err);
+            return 1;
+        }
+    }
+
+    clFinish(queue);
+
+    clReleaseMemObject(cl_desc_buffer);
+    clReleaseMemObject(cl_out_buffer);
+    clReleaseMemObject(cl_in_buffer);
+    clReleaseKernel(kernel);
+    clReleaseCommandQueue(queue);
+
+    for (size_t i = 0; i < count; ++i) {
+        auto e = batch[i];
+
+        for (u32 y = 0; y < e.out.height; ++y)
+            std::copy_n(&out[desc[6*i + 2] + y * e.out.width], e.out.width, &e.out.at(0, y));
+    }
+
+    return 0;
+}
+
+int mat_mul_cl_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs, i64 alpha, i64 beta, mat_trans_e trans)
+{
+    assert((mat_trans_lhs(trans) ? lhs.height : lhs.width) == (mat_trans_rhs(trans) ? rhs.width : rhs.height));
+    assert(dst.width == (mat_trans_rhs(trans) ? rhs.height : rhs.width));
+    assert(dst.height == (mat_trans_lhs(trans) ? lhs.width : lhs.height));
+    assert(mat_row_major(dst, lhs, rhs));
+
+    return run_kernel(lhs, rhs, dst, &alpha, &beta, beta == 0, trans);
+}
+
+int mat_mul_cl_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs, f32 alpha, f32 beta, mat_trans_e trans)
+{
+    assert((mat_trans_lhs(trans) ? lhs.height : lhs.width) == (mat_trans_rhs(trans) ? rhs.width : rhs.height));
+    assert(dst.width == (mat_trans_rhs(trans) ? rhs.height : rhs.width));
+    assert(dst.height == (mat_trans_lhs(trans) ? lhs.width : lhs.height));
+    assert(mat_row_major(dst, lhs, rhs));
+
+    return run_kernel(lhs, rhs, dst, &alpha, &beta, beta == 0, trans);
+}
+
+int mat_mul_cl_into(matview_f32_t dst, matview_f16_t lhs, matview_f16_t rhs, f32 alpha, f32 beta, mat_trans_e trans)
+{
+    assert((mat_trans_lhs(trans) ? lhs.height : lhs.width) == (mat_trans_rhs(trans) ? rhs.width : rhs.height));
+    assert(dst.width == (mat_trans_rhs(trans) ? rhs.height : rhs.width));
+    assert(dst.height == (mat_trans_lhs(trans) ? lhs.width : lhs.height));
+    assert(mat_row_major(dst, lhs, rhs));
+
+    return run_kernel(lhs, rhs, dst, &alpha, &beta, beta == 0, trans);
+}
+
+int mat_mul_cl_into(matview_f32_t dst, matview_bf16_t lhs, matview_bf16_t rhs, f32 alpha, f32 beta, mat_trans_e trans)
+{
+    assert((mat_trans_lhs(trans) ? lhs.height : lhs.width) == (mat_trans_rhs(trans) ? rhs.width : rhs.height));
+    assert(dst.width == (mat_trans_rhs(trans) ? rhs.height : rhs.width));
+    assert(dst.height == (mat_trans_lhs(trans) ? lhs.width : lhs.height));
+    assert(mat_row_major(dst, lhs, rhs));
+
+    return run_kernel(lhs, rhs, dst, &alpha, &beta, beta == 0, trans);
+}
+
 mat_i64_t mat_mul_cl(matview_i64_t lhs, matview_i64_t rhs)
 {
-    mat_i64_t ret = mat_i64_t::make_matrix_zero(lhs.height, rhs.width);
+    mat_i64_t ret = mat_i64_t::make_matrix_uninit(rhs.width, lhs.height);
 
-    run_kernel(lhs, rhs, ret);
+    mat_mul_cl_into(ret, lhs, rhs);
 
     return ret;
 }
 
 mat_f32_t mat_mul_cl(matview_f32_t lhs, matview_f32_t rhs)
 {
-    mat_f32_t ret = mat_f32_t::make_matrix_zero(lhs.height, rhs.width);
+    mat_f32_t ret = mat_f32_t::make_matrix_uninit(rhs.width, lhs.height);
+
+    mat_mul_cl_into(ret, lhs, rhs);
+
+    return ret;
+}
+
+mat_f32_t mat_mul_cl(matview_f16_t lhs, matview_f16_t rhs)
+{
+    mat_f32_t ret = mat_f32_t::make_matrix_uninit(rhs.width, lhs.height);
 
-    run_kernel(lhs, rhs, ret);
+    mat_mul_cl_into(ret, lhs, rhs);
 
     return ret;
 }
+
+mat_f32_t mat_mul_cl(matview_bf16_t lhs, matview_bf16_t rhs)
+{
+    mat_f32_t ret = mat_f32_t::make_matrix_uninit(rhs.width, lhs.height);
+
+    mat_mul_cl_into(ret, lhs, rhs);
+
+    return ret;
+}
+
+int mat_mul_cl_batched(const mat_mul_batch_i64_t *batch, size_t count)
+{ return run_kernel_batched(batch, count, "matmul_batched_i64"); }
+
+int mat_mul_cl_batched(const mat_mul_batch_f32_t *batch, size_t count)
+{ return run_kernel_batched(batch, count, "matmul_batched_f32"); }
@@ -7,5 +7,8 @@ inline bool opt_enable_i64 = true;
 inline bool opt_enable_f32 = true;
 inline bool opt_grad = false;
 inline bool opt_classify = false;
+inline bool opt_tune = false;
+inline bool opt_no_pool = false;
 inline u32 opt_num_threads = 0;
+inline const char *opt_save_path = nullptr;
 
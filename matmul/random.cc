@@ -1,11 +1,25 @@
-#include "types.h"
+#include "random.h"
+#include "matmul_cpu.h"
+#include "threading.h"
 
+#include <algorithm>
+#include <atomic>
 #include <random>
+#include <string.h>
+
+/* Bytes, groups of blocks per band. Every block costs the same, one band per thread. */
+constexpr thread_bands_t CONFIG_RANDOM_BANDS = {
+    .min_work = 1 << 20,
+    .per_thread = 1,
+};
+
+constexpr size_t PHILOX_BLOCK_BYTES = 4 * sizeof(u32);
 
 namespace {
 
 struct {
-    std::mt19937_64 gen;
+    std::atomic<u64> seed = 0;
+    std::atomic<u64> next_stream = 0;
 } context_random;
 
 }
@@ -13,30 +27,71 @@ struct {
 __attribute__((constructor))
 static void seed_rand_gen()
 {
-    context_random.gen.seed(std::random_device()());
+    std::random_device dev;
+
+    random_seed_set(u64(dev()) << 32 | dev());
 }
 
-void memset_random(void *out_, u32 size)
+void random_seed_set(const u64 seed)
 {
-    const u32 size_u64 = size / sizeof(u64);
-    const u32 size_rem = size % sizeof(u64);
+    context_random.seed.store(seed, std::memory_order_relaxed);
+    context_random.next_stream.store(0, std::memory_order_relaxed);
+}
 
-    auto* out_u64 = static_cast<u64*>(out_);
-    auto* const out_u64_end = out_u64 + size_u64;
+u64 random_seed()
+{
+    return context_random.seed.load(std::memory_order_relaxed);
+}
 
-    auto* out_u8 = reinterpret_cast<u8*>(out_u64 + size_u64);
-    auto* const out_u8_end = out_u8 + size_rem;
+/* Blocks [begin, end) of 'out', 'begin' a multiple of the kernel's lanes. */
+static void philox_fill(
+    const cpu_random_kernels_t &kernels,
+    u8 *out,
+    const size_t size,
+    const u64 seed,
+    const u64 stream,
+    const u64 begin,
+    const u64 end
+) {
+    const size_t step = size_t(kernels.lanes) * PHILOX_BLOCK_BYTES;
 
-    while (out_u64 != out_u64_end) {
-        const u64 random_u64 = (static_cast<u64>(rand()) << 32) | static_cast<u64>(rand());
-        *out_u64 = random_u64;
+    u32 buf[PHILOX_MAX_LANES * 4];
 
-        ++out_u64;
-    }
+    for (u64 block = begin; block < end; block += kernels.lanes) {
+        const size_t offset = block * PHILOX_BLOCK_BYTES;
+        const size_t n = std::min((end - block) * PHILOX_BLOCK_BYTES, size - offset);
 
-    while (out_u8 != out_u8_end) {
-        *out_u8 = static_cast<u8>(rand());
-        ++out_u8;
+        /* Straight into the output, but for the tail. */
+        if (n >= step) {
+            kernels.philox(rcast<u32*>(out + offset), seed, stream, block);
+            continue;
+        }
+
+        kernels.philox(buf, seed, stream, block);
+        memcpy(out + offset, buf, n);
     }
 }
 
+void memset_random(void *out_, const size_t size, thread_pool *pool)
+{
+    u8 * const out = static_cast<u8*>(out_);
+
+    const u64 seed = context_random.seed.load(std::memory_order_relaxed);
+    const u64 stream = context_random.next_stream.fetch_add(1, std::memory_order_relaxed);
+    const u64 num_blocks = (size + PHILOX_BLOCK_BYTES - 1) / PHILOX_BLOCK_BYTES;
+
+    const cpu_random_kernels_t &kernels = cpu_random_kernels();
+    const u32 lanes = kernels.lanes;
+
+    /*
+     * Output depends on the offsets only, threads just take a slice each.
+     * Slices are in whole groups of 'lanes' blocks, as the kernels fill them.
+     */
+    const u64 num_groups = (num_blocks + lanes - 1) / lanes;
+    /* Small ones don't even start the default pool. */
+    thread_pool * const p = pool || size < CONFIG_RANDOM_BANDS.min_work ? pool : &cpu_thread_pool();
+
+    thread_pool_for_bands(p, num_groups, size, CONFIG_RANDOM_BANDS, [&](const u64 begin, const u64 end) {
+        philox_fill(kernels, out, size, seed, stream, begin * lanes, std::min(num_blocks, end * lanes));
+    });
+}
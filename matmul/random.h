@@ -2,4 +2,28 @@
 
 #include "types.h"
 
-void memset_random(void *out_, u32 size);
+#include <stddef.h>
+
+class thread_pool;
+
+/*
+ * Random matrix contents, from Philox4x32-10 (Salmon et al., "Parallel random
+ * numbers: as easy as 1, 2, 3"). Counter based: every 16 bytes of output are
+ * a pure function of the seed, the stream and their offset, so any part of a
+ * buffer can be generated on its own and threads split a buffer any way they
+ * like. Same seed, same sequence of calls, same bytes, whatever the number of
+ * threads.
+ *
+ * Every call to memset_random() draws from a new stream. Streams are counted
+ * from zero since the last random_seed_set(). Seeded from std::random_device
+ * at startup.
+ */
+
+void random_seed_set(u64 seed);
+u64 random_seed();
+
+/*
+ * Fills 'size' bytes at 'out' on the threads of 'pool', the default CPU pool
+ * if null, or on the caller if small.
+ */
+void memset_random(void *out, size_t size, thread_pool *pool = nullptr);
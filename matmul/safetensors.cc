@@ -0,0 +1,1103 @@
+#include "safetensors.h"
+#include "half.h"
+
+#include <algorithm>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <numeric>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+/* Deepest nesting of JSON values skipped in tensor entries, see skip_value(). */
+constexpr u32 CONFIG_SAFETENSORS_MAX_DEPTH = 64;
+
+/* Staging buffer of the writer, and size of each O_DIRECT write. */
+constexpr size_t CONFIG_SAFETENSORS_WRITE_BUFFER = 8 << 20;
+
+/* Rows shorter than this are copied into the staging buffer rather than getting an iovec. */
+constexpr size_t CONFIG_SAFETENSORS_WRITE_MIN_IOV = 4096;
+
+/* Iovecs per pwritev(), IOV_MAX on Linux. */
+constexpr int CONFIG_SAFETENSORS_WRITE_IOVS = 1024;
+
+/* O_DIRECT alignment of buffers, offsets and lengths: the logical block size of about any disk. */
+constexpr size_t CONFIG_SAFETENSORS_DIRECT_ALIGN = 4096;
+
+/* Writers pad the header for the data to start aligned to this. */
+constexpr size_t SAFETENSORS_DATA_ALIGN = 8;
+
+static size_t round_up(const size_t size, const size_t alignment)
+{
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+int safetensor_dtype_from_str(const std::string_view s, safetensor_dtype_e &out)
+{
+    for (u32 i = ucast(safetensor_dtype_e::boolean); i <= ucast(safetensor_dtype_e::f8_e5m2); ++i) {
+        const auto dtype = safetensor_dtype_e(i);
+
+        if (s == safetensor_dtype2str(dtype)) {
+            out = dtype;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+namespace {
+
+/*
+ * Recursive descent over the header, straight from the mapping. Strings
+ * come out as views into it, only those with escapes get copied, unescaped.
+ * Entries go to 'out' as they are parsed, nothing else is built.
+ */
+struct header_parser_t {
+    const char *p;
+    const char *end;
+    safetensors_t &out;
+    const char *error = nullptr;
+
+    int fail(const char * const what)
+    {
+        this->error = what;
+        return 1;
+    }
+
+    void skip_ws()
+    {
+        while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+            ++p;
+    }
+
+    bool consume(const char c)
+    {
+        skip_ws();
+        if (p < end && *p == c) {
+            ++p;
+            return true;
+        }
+
+        return false;
+    }
+
+    int expect(const char c)
+    {
+        if (consume(c))
+            return 0;
+
+        switch (c) {
+        case '{':
+            return fail("expected '{'");
+        case '}':
+            return fail("expected '}' or ','");
+        case '[':
+            return fail("expected '['");
+        case ']':
+            return fail("expected ']' or ','");
+        case ':':
+            return fail("expected ':'");
+        case '"':
+            return fail("expected a string");
+        }
+
+        return fail("unexpected character");
+    }
+
+    /* Between the quotes, [first, last), 'escaped' if there is any backslash. */
+    int string_raw(const char *&first, const char *&last, bool &escaped)
+    {
+        if (expect('"'))
+            return 1;
+
+        first = p;
+
+        /* Names are long and seldom escaped, find their end with memchr. */
+        const char *q = scast<const char*>(memchr(p, '"', end - p));
+        if (!q)
+            return fail("unterminated string");
+
+        escaped = memchr(p, '\\', q - p) != nullptr;
+
+        if (escaped) {
+            while (p < end && *p != '"')
+                p += *p == '\\' ? 2 : 1;
+
+            if (p >= end)
+                return fail("unterminated string");
+
+            q = p;
+        }
+
+        last = q;
+        p = q + 1;
+
+        return 0;
+    }
+
+    static int hex4(const char * const q, const char * const last, u32 &out)
+    {
+        if (last - q < 4)
+            return 1;
+
+        out = 0;
+        for (u32 i = 0; i < 4; ++i) {
+            const char c = q[i];
+            u32 digit;
+
+            if (c >= '0' && c <= '9')
+                digit = c - '0';
+            else if (c >= 'a' && c <= 'f')
+                digit = c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F')
+                digit = c - 'A' + 10;
+            else
+                return 1;
+
+            out = out << 4 | digit;
+        }
+
+        return 0;
+    }
+
+    static char* put_utf8(char *o, const u32 cp)
+    {
+        if (cp < 0x80) {
+            *o++ = char(cp);
+        } else if (cp < 0x800) {
+            *o++ = char(0xc0 | cp >> 6);
+            *o++ = char(0x80 | (cp & 0x3f));
+        } else if (cp < 0x10000) {
+            *o++ = char(0xe0 | cp >> 12);
+            *o++ = char(0x80 | (cp >> 6 & 0x3f));
+            *o++ = char(0x80 | (cp & 0x3f));
+        } else {
+            *o++ = char(0xf0 | cp >> 18);
+            *o++ = char(0x80 | (cp >> 12 & 0x3f));
+            *o++ = char(0x80 | (cp >> 6 & 0x3f));
+            *o++ = char(0x80 | (cp & 0x3f));
+        }
+
+        return o;
+    }
+
+    /* Never longer than escaped, UTF-8 of a \u escape takes at most its 6 characters. */
+    int unescape(const char *q, const char * const last, std::string_view &s)
+    {
+        auto buf = std::make_unique<char[]>(last - q);
+        char *o = buf.get();
+
+        while (q < last) {
+            if (*q != '\\') {
+                *o++ = *q++;
+                continue;
+            }
+
+            ++q;
+            switch (*q++) {
+            case '"':  *o++ = '"';  break;
+            case '\\': *o++ = '\\'; break;
+            case '/':  *o++ = '/';  break;
+            case 'b':  *o++ = '\b'; break;
+            case 'f':  *o++ = '\f'; break;
+            case 'n':  *o++ = '\n'; break;
+            case 'r':  *o++ = '\r'; break;
+            case 't':  *o++ = '\t'; break;
+            case 'u': {
+                u32 cp, lo;
+
+                if (hex4(q, last, cp))
+                    return fail("invalid \\u escape");
+                q += 4;
+
+                if (cp >= 0xdc00 && cp < 0xe000)
+                    return fail("unpaired surrogate");
+
+                if (cp >= 0xd800 && cp < 0xdc00) {
+                    if (last - q < 6 || q[0] != '\\' || q[1] != 'u' || hex4(q + 2, last, lo) ||
+                        lo < 0xdc00 || lo >= 0xe000)
+                        return fail("unpaired surrogate");
+
+                    q += 6;
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                }
+
+                o = put_utf8(o, cp);
+                break;
+            }
+            default:
+                return fail("invalid escape");
+            }
+        }
+
+        s = std::string_view(buf.get(), o - buf.get());
+        out.unescaped.push_back(std::move(buf));
+
+        return 0;
+    }
+
+    int string(std::string_view &s)
+    {
+        const char *first, *last;
+        bool escaped;
+
+        if (string_raw(first, last, escaped))
+            return 1;
+
+        if (escaped)
+            return unescape(first, last, s);
+
+        s = std::string_view(first, last - first);
+
+        return 0;
+    }
+
+    int number(u64 &v)
+    {
+        skip_ws();
+
+        if (p >= end || *p < '0' || *p > '9')
+            return fail("expected an unsigned integer");
+
+        v = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (__builtin_mul_overflow(v, 10, &v) || __builtin_add_overflow(v, u64(*p - '0'), &v))
+                return fail("integer overflows u64");
+
+            ++p;
+        }
+
+        if (p < end && (*p == '.' || *p == 'e' || *p == 'E'))
+            return fail("expected an unsigned integer");
+
+        return 0;
+    }
+
+    int u64_array(u64 * const vals, const u32 max, u32 &count)
+    {
+        count = 0;
+
+        if (expect('['))
+            return 1;
+
+        if (consume(']'))
+            return 0;
+
+        do {
+            if (count == max)
+                return fail("too many elements");
+
+            if (number(vals[count++]))
+                return 1;
+        } while (consume(','));
+
+        return expect(']');
+    }
+
+    /* Unknown members of tensor entries are skipped, whatever they are. */
+    int skip_value(const u32 depth)
+    {
+        const char *first, *last;
+        bool escaped;
+
+        if (depth == CONFIG_SAFETENSORS_MAX_DEPTH)
+            return fail("nested too deep");
+
+        skip_ws();
+        if (p >= end)
+            return fail("expected a value");
+
+        switch (*p) {
+        case '"':
+            return string_raw(first, last, escaped);
+
+        case '{':
+            ++p;
+            if (consume('}'))
+                return 0;
+
+            do {
+                if (string_raw(first, last, escaped) || expect(':') || skip_value(depth + 1))
+                    return 1;
+            } while (consume(','));
+
+            return expect('}');
+
+        case '[':
+            ++p;
+            if (consume(']'))
+                return 0;
+
+            do {
+                if (skip_value(depth + 1))
+                    return 1;
+            } while (consume(','));
+
+            return expect(']');
+        }
+
+        /* Numbers, true, false and null. */
+        first = p;
+        while (p < end && (isalnum(u8(*p)) || *p == '-' || *p == '+' || *p == '.'))
+            ++p;
+
+        return p == first ? fail("expected a value") : 0;
+    }
+
+    /*
+     * "A":{
+     *  "dtype":"I32",
+     *  "shape":[128,128],
+     *  "data_offsets":[0,65536]
+     * },
+     */
+    int tensor(const std::string_view name)
+    {
+        safetensor_t t;
+        bool has_dtype = false, has_shape = false, has_offsets = false;
+
+        t.name = name;
+
+        if (expect('{'))
+            return 1;
+
+        if (!consume('}')) {
+            do {
+                std::string_view key;
+
+                if (string(key) || expect(':'))
+                    return 1;
+
+                if (key == "dtype") {
+                    std::string_view dtype;
+
+                    if (string(dtype))
+                        return 1;
+
+                    if (safetensor_dtype_from_str(dtype, t.dtype))
+                        return fail("unknown dtype");
+
+                    has_dtype = true;
+                } else if (key == "shape") {
+                    if (u64_array(t.shape, SAFETENSOR_MAX_RANK, t.rank))
+                        return 1;
+
+                    has_shape = true;
+                } else if (key == "data_offsets") {
+                    u64 offsets[2];
+                    u32 count;
+
+                    if (u64_array(offsets, 2, count))
+                        return 1;
+
+                    if (count != 2)
+                        return fail("expected data_offsets to be [begin, end]");
+
+                    t.begin = offsets[0];
+                    t.end = offsets[1];
+                    has_offsets = true;
+                } else if (skip_value(0)) {
+                    return 1;
+                }
+            } while (consume(','));
+
+            if (expect('}'))
+                return 1;
+        }
+
+        if (!has_dtype)
+            return fail("missing dtype");
+
+        if (!has_shape)
+            return fail("missing shape");
+
+        if (!has_offsets)
+            return fail("missing data_offsets");
+
+        out.tensors.push_back(t);
+
+        return 0;
+    }
+
+    /* Strings only, by the format. */
+    int metadata()
+    {
+        if (expect('{'))
+            return 1;
+
+        if (consume('}'))
+            return 0;
+
+        do {
+            std::string_view key, value;
+
+            if (string(key) || expect(':') || string(value))
+                return 1;
+
+            out.metadata.emplace_back(key, value);
+        } while (consume(','));
+
+        return expect('}');
+    }
+
+    int header()
+    {
+        if (expect('{'))
+            return 1;
+
+        if (!consume('}')) {
+            do {
+                std::string_view key;
+
+                if (string(key) || expect(':'))
+                    return 1;
+
+                if (key == "__metadata__" ? metadata() : tensor(key))
+                    return 1;
+            } while (consume(','));
+
+            if (expect('}'))
+                return 1;
+        }
+
+        /* Writers pad the header with spaces to align the data. */
+        skip_ws();
+        if (p != end)
+            return fail("trailing characters");
+
+        return 0;
+    }
+};
+
+}
+
+static int tensor_invalid(const safetensor_t &t, const char * const what)
+{
+    fprintf(stderr, "Invalid safetensors tensor \"%.*s\": %s\n", int(t.name.size()), t.name.data(), what);
+    return 1;
+}
+
+/* Every tensor as long as it should be, and together tiling the data. */
+static int validate_offsets(safetensors_t &st, const u8 * const data, const u64 data_size)
+{
+    for (auto &t: st.tensors) {
+        u64 bytes = safetensor_dtype_size(t.dtype);
+
+        for (u32 i = 0; i < t.rank; ++i)
+            if (__builtin_mul_overflow(bytes, t.shape[i], &bytes))
+                return tensor_invalid(t, "shape overflows u64 bytes");
+
+        if (t.begin > t.end || t.end > data_size)
+            return tensor_invalid(t, "data_offsets out of the data");
+
+        if (t.end - t.begin != bytes)
+            return tensor_invalid(t, "data_offsets don't match shape and dtype");
+
+        t.data = data + t.begin;
+    }
+
+    std::vector<u32> by_offset(st.tensors.size());
+    for (u32 i = 0; i < by_offset.size(); ++i)
+        by_offset[i] = i;
+
+    std::sort(by_offset.begin(), by_offset.end(), [&](const u32 a, const u32 b) {
+        const safetensor_t &ta = st.tensors[a], &tb = st.tensors[b];
+        return ta.begin != tb.begin ? ta.begin < tb.begin : ta.end < tb.end;
+    });
+
+    u64 covered = 0;
+    for (const u32 i: by_offset) {
+        const safetensor_t &t = st.tensors[i];
+
+        if (t.begin < covered)
+            return tensor_invalid(t, "data overlaps that of another tensor");
+
+        if (t.begin > covered)
+            return tensor_invalid(t, "data not right after that of the previous tensor");
+
+        covered = t.end;
+    }
+
+    if (covered != data_size) {
+        fprintf(stderr, "Invalid safetensors: %lu bytes of data, tensors cover %lu\n", data_size, covered);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int build_index(safetensors_t &st)
+{
+    /* Names next to indices, sorting doesn't chase them through the tensors. */
+    std::vector<std::pair<std::string_view, u32>> names(st.tensors.size());
+    for (u32 i = 0; i < names.size(); ++i)
+        names[i] = {st.tensors[i].name, i};
+
+    /* Writers mostly sort names already. */
+    if (!std::is_sorted(names.begin(), names.end()))
+        std::sort(names.begin(), names.end());
+
+    st.by_name.resize(names.size());
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (i > 0 && names[i].first == names[i - 1].first)
+            return tensor_invalid(st.tensors[names[i].second], "duplicate name");
+
+        st.by_name[i] = names[i].second;
+    }
+
+    return 0;
+}
+
+const safetensor_t* safetensors_t::find(const std::string_view name) const
+{
+    const auto it = std::lower_bound(this->by_name.begin(), this->by_name.end(), name,
+        [&](const u32 i, const std::string_view n) {
+            return this->tensors[i].name < n;
+        });
+
+    if (it == this->by_name.end() || this->tensors[*it].name != name)
+        return nullptr;
+
+    return &this->tensors[*it];
+}
+
+int safetensors_parse(const u8 * const data, const size_t size, safetensors_t &out)
+{
+    if (size < sizeof(u64)) {
+        fprintf(stderr, "Invalid safetensors: %zu bytes, too short for the header size\n", size);
+        return 1;
+    }
+
+    /* Little endian, as the host. */
+    u64 header_size;
+    memcpy(&header_size, data, sizeof(u64));
+
+    if (header_size > size - sizeof(u64)) {
+        fprintf(stderr, "Invalid safetensors: header of %lu bytes in %zu bytes\n", header_size, size);
+        return 1;
+    }
+
+    safetensors_t ret;
+
+    const char * const header = rcast<const char*>(data + sizeof(u64));
+    header_parser_t parser = {
+        .p = header,
+        .end = header + header_size,
+        .out = ret,
+    };
+
+    if (parser.header()) {
+        fprintf(stderr, "Invalid safetensors header at byte %zu: %s\n",
+                size_t(parser.p - header) + sizeof(u64), parser.error);
+        return 1;
+    }
+
+    const size_t data_offset = sizeof(u64) + header_size;
+
+    if (validate_offsets(ret, data + data_offset, size - data_offset))
+        return 1;
+
+    if (build_index(ret))
+        return 1;
+
+    out = std::move(ret);
+
+    return 0;
+}
+
+int safetensors_open(const char * const path, const mat_file_prefetch_e prefetch, safetensors_t &out)
+{
+    mat_file_t file;
+    if (mat_file_map(path, prefetch, file))
+        return 1;
+
+    safetensors_t ret;
+    if (safetensors_parse(file.data, file.size, ret)) {
+        fprintf(stderr, "Failed to parse %s\n", path);
+        return 1;
+    }
+
+    ret.file = std::move(file);
+    out = std::move(ret);
+
+    return 0;
+}
+
+int safetensor_mat_shape(const safetensor_t &tensor, u32 &width, u32 &height)
+{
+    u64 w = 1, h = 1;
+    bool overflow = false;
+
+    if (tensor.rank == 1)
+        h = tensor.shape[0];
+
+    if (tensor.rank >= 2) {
+        w = tensor.shape[tensor.rank - 1];
+
+        for (u32 i = 0; i + 1 < tensor.rank; ++i)
+            overflow |= __builtin_mul_overflow(h, tensor.shape[i], &h);
+    }
+
+    if (overflow || w > UINT32_MAX || h > UINT32_MAX)
+        return tensor_invalid(tensor, "too big for a matrix");
+
+    width = w;
+    height = h;
+
+    return 0;
+}
+
+int safetensor_view(const safetensor_t &tensor, matview_f32_t &out)
+{
+    u32 width, height;
+
+    if (tensor.dtype != safetensor_dtype_e::f32)
+        return tensor_invalid(tensor, "not F32, can't be viewed as f32");
+
+    if (rcast<uintptr_t>(tensor.data) % alignof(f32))
+        return tensor_invalid(tensor, "not aligned for f32 in the file");
+
+    if (safetensor_mat_shape(tensor, width, height))
+        return 1;
+
+    out = matview_f32_t(const_cast<f32*>(rcast<const f32*>(tensor.data)), width, height, width);
+
+    return 0;
+}
+
+/* Elements loaded by memcpy, the file may not align them. */
+template <typename T, typename ValueType>
+static int tensor_convert(const safetensor_t &tensor, mat_base_t<ValueType> &out)
+{
+    u32 width, height;
+
+    if (safetensor_mat_shape(tensor, width, height))
+        return 1;
+
+    mat_base_t<ValueType> ret = mat_base_t<ValueType>::make_matrix_uninit(width, height);
+    const u8 *src = tensor.data;
+
+    for (u32 y = 0; y < height; ++y) {
+        ValueType * const row = ret.data.get() + size_t(y) * ret.stride;
+
+        for (u32 x = 0; x < width; ++x, src += sizeof(T)) {
+            T v;
+            memcpy(&v, src, sizeof(T));
+            row[x] = ValueType(v);
+        }
+
+        std::fill(row + width, row + ret.stride, ValueType(0));
+    }
+
+    out = std::move(ret);
+
+    return 0;
+}
+
+int safetensor_to_mat(const safetensor_t &tensor, mat_i64_t &out)
+{
+    switch (tensor.dtype) {
+    case safetensor_dtype_e::boolean:
+    case safetensor_dtype_e::u8:
+        return tensor_convert<u8>(tensor, out);
+    case safetensor_dtype_e::i8:
+        return tensor_convert<i8>(tensor, out);
+    case safetensor_dtype_e::i16:
+        return tensor_convert<i16>(tensor, out);
+    case safetensor_dtype_e::u16:
+        return tensor_convert<u16>(tensor, out);
+    case safetensor_dtype_e::i32:
+        return tensor_convert<i32>(tensor, out);
+    case safetensor_dtype_e::u32:
+        return tensor_convert<u32>(tensor, out);
+    case safetensor_dtype_e::i64:
+        return tensor_convert<i64>(tensor, out);
+    default:
+        return tensor_invalid(tensor, "can't be converted to i64");
+    }
+}
+
+int safetensor_to_mat(const safetensor_t &tensor, mat_f32_t &out)
+{
+    switch (tensor.dtype) {
+    case safetensor_dtype_e::f16:
+        return tensor_convert<f16>(tensor, out);
+    case safetensor_dtype_e::bf16:
+        return tensor_convert<bf16>(tensor, out);
+    case safetensor_dtype_e::f32:
+        return tensor_convert<f32>(tensor, out);
+    case safetensor_dtype_e::f64:
+        return tensor_convert<f64>(tensor, out);
+    default:
+        return tensor_invalid(tensor, "can't be converted to f32");
+    }
+}
+
+static void append_json_string(std::string &out, const std::string_view s)
+{
+    out += '"';
+
+    for (const char c: s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (u8(c) < 0x20) {
+            fmt::format_to(std::back_inserter(out), "\\u{:04x}", unsigned(c));
+        } else {
+            out += c;
+        }
+    }
+
+    out += '"';
+}
+
+namespace {
+
+/*
+ * Sequential writes of a file. Buffered, pieces are gathered into iovecs
+ * until there are CONFIG_SAFETENSORS_WRITE_IOVS of them or the staging
+ * buffer is full, then written by one pwritev(). Direct, everything goes
+ * through the staging buffer, written whenever full.
+ */
+struct write_stream_t {
+    const char *path = nullptr;
+    int fd = -1;
+    bool direct = false;
+
+    /* Of the file, where the next write goes. */
+    u64 offset = 0;
+
+    u8 *staging = nullptr;
+    size_t staged = 0;
+
+    iovec iov[CONFIG_SAFETENSORS_WRITE_IOVS];
+    int iovcnt = 0;
+
+    ~write_stream_t()
+    {
+        free(this->staging);
+
+        if (this->fd >= 0)
+            close(this->fd);
+    }
+
+    int error(const char * const what)
+    {
+        fprintf(stderr, "Failed to %s %s: %s\n", what, this->path, strerror(errno));
+        return 1;
+    }
+
+    int open(const char * const path, const bool direct)
+    {
+        const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+        this->path = path;
+        this->direct = direct;
+
+        if (direct) {
+            this->fd = ::open(path, flags | O_DIRECT, 0644);
+
+            /* Not supported by the filesystem. */
+            if (this->fd < 0 && errno == EINVAL)
+                this->direct = false;
+        }
+
+        if (!this->direct)
+            this->fd = ::open(path, flags, 0644);
+
+        if (this->fd < 0)
+            return error("open");
+
+        this->staging = scast<u8*>(aligned_alloc(CONFIG_SAFETENSORS_DIRECT_ALIGN, CONFIG_SAFETENSORS_WRITE_BUFFER));
+        if (!this->staging)
+            return error("allocate staging buffer for");
+
+        return 0;
+    }
+
+    int flush()
+    {
+        int first = 0;
+
+        while (first < this->iovcnt) {
+            const ssize_t n = pwritev(this->fd, this->iov + first, this->iovcnt - first, this->offset);
+
+            if (n < 0 && errno == EINTR)
+                continue;
+
+            if (n <= 0) {
+                if (n == 0)
+                    errno = ENOSPC;
+
+                return error("write");
+            }
+
+            this->offset += n;
+
+            /* Partially written, continue from where it stopped. */
+            size_t left = n;
+            while (first < this->iovcnt && left >= this->iov[first].iov_len)
+                left -= this->iov[first++].iov_len;
+
+            if (left) {
+                this->iov[first].iov_base = scast<u8*>(this->iov[first].iov_base) + left;
+                this->iov[first].iov_len -= left;
+            }
+        }
+
+        this->iovcnt = 0;
+        this->staged = 0;
+
+        return 0;
+    }
+
+    /* 'len' a multiple of CONFIG_SAFETENSORS_DIRECT_ALIGN. */
+    int flush_direct(const size_t len)
+    {
+        for (size_t done = 0; done < len;) {
+            const ssize_t n = pwrite(this->fd, this->staging + done, len - done, this->offset + done);
+
+            if (n < 0 && errno == EINTR)
+                continue;
+
+            if (n <= 0) {
+                if (n == 0)
+                    errno = ENOSPC;
+
+                return error("write");
+            }
+
+            done += n;
+        }
+
+        this->offset += len;
+        this->staged = 0;
+
+        return 0;
+    }
+
+    /* Buffered, 'data' must stay until flushed, see finish(). */
+    int put(const void * const data, size_t size)
+    {
+        const u8 *src = scast<const u8*>(data);
+
+        if (!this->direct && size >= CONFIG_SAFETENSORS_WRITE_MIN_IOV) {
+            if (this->iovcnt == CONFIG_SAFETENSORS_WRITE_IOVS && flush())
+                return 1;
+
+            this->iov[this->iovcnt++] = { const_cast<u8*>(src), size };
+            return 0;
+        }
+
+        while (size) {
+            if (this->staged == CONFIG_SAFETENSORS_WRITE_BUFFER) {
+                if (this->direct ? flush_direct(this->staged) : flush())
+                    return 1;
+            }
+
+            const size_t n = std::min(size, CONFIG_SAFETENSORS_WRITE_BUFFER - this->staged);
+            u8 * const dst = this->staging + this->staged;
+
+            if (!this->direct) {
+                iovec * const last = this->iovcnt ? &this->iov[this->iovcnt - 1] : nullptr;
+
+                if (last && scast<u8*>(last->iov_base) + last->iov_len == dst) {
+                    last->iov_len += n;
+                } else {
+                    /* Flushing empties the staging buffer, 'dst' would be stale. */
+                    if (this->iovcnt == CONFIG_SAFETENSORS_WRITE_IOVS) {
+                        if (flush())
+                            return 1;
+
+                        continue;
+                    }
+
+                    this->iov[this->iovcnt++] = { dst, n };
+                }
+            }
+
+            memcpy(dst, src, n);
+            this->staged += n;
+            src += n;
+            size -= n;
+        }
+
+        return 0;
+    }
+
+    /* O_DIRECT writes whole blocks, the padding of the last one is cut off. */
+    int finish(const u64 size)
+    {
+        if (!this->direct)
+            return flush();
+
+        if (this->staged) {
+            const size_t len = round_up(this->staged, CONFIG_SAFETENSORS_DIRECT_ALIGN);
+
+            memset(this->staging + this->staged, 0, len - this->staged);
+
+            if (flush_direct(len))
+                return 1;
+
+            if (ftruncate(this->fd, size))
+                return error("truncate");
+        }
+
+        return 0;
+    }
+
+    int close_file()
+    {
+        const int ret = close(this->fd);
+        this->fd = -1;
+
+        return ret ? error("close") : 0;
+    }
+};
+
+}
+
+static int write_invalid(const safetensor_write_t &t, const char * const what)
+{
+    fprintf(stderr, "Can't write safetensors tensor \"%.*s\": %s\n", int(t.name.size()), t.name.data(), what);
+    return 1;
+}
+
+static int write_stream(
+    write_stream_t &stream,
+    const std::string &header,
+    const safetensor_write_t * const tensors,
+    const std::vector<u32> &order,
+    const u64 size
+) {
+    const u64 header_size = header.size();
+
+    if (stream.put(&header_size, sizeof(header_size)) || stream.put(header.data(), header.size()))
+        return 1;
+
+    for (const u32 i: order) {
+        const safetensor_write_t &t = tensors[i];
+        const size_t elem_size = safetensor_dtype_size(t.dtype);
+        const size_t row_bytes = size_t(t.width) * elem_size;
+        const u8 * const data = scast<const u8*>(t.data);
+
+        if (t.stride == t.width) {
+            if (stream.put(data, row_bytes * t.height))
+                return 1;
+
+            continue;
+        }
+
+        for (u32 y = 0; y < t.height; ++y)
+            if (stream.put(data + size_t(y) * t.stride * elem_size, row_bytes))
+                return 1;
+    }
+
+    return stream.finish(size);
+}
+
+int safetensors_write(
+    const char * const path,
+    const safetensor_write_t * const tensors,
+    const size_t count,
+    const safetensors_write_config_t &config
+) {
+    for (size_t i = 0; i < count; ++i) {
+        const safetensor_write_t &t = tensors[i];
+
+        if (safetensor_dtype_size(t.dtype) == 0)
+            return write_invalid(t, "no dtype");
+
+        if (t.layout != mat_layout_e::row_major)
+            return write_invalid(t, "not row-major");
+
+        if (t.name == "__metadata__")
+            return write_invalid(t, "name reserved for metadata");
+    }
+
+    /* Header entries by name, readers find them sorted then, see build_index(). */
+    std::vector<u32> by_name(count);
+    std::iota(by_name.begin(), by_name.end(), 0);
+    std::sort(by_name.begin(), by_name.end(), [&](const u32 a, const u32 b) {
+        return tensors[a].name < tensors[b].name;
+    });
+
+    for (size_t i = 1; i < count; ++i) {
+        if (tensors[by_name[i]].name == tensors[by_name[i - 1]].name)
+            return write_invalid(tensors[by_name[i]], "duplicate name");
+    }
+
+    /* Data widest elements first, every tensor then starts aligned for its dtype. */
+    std::vector<u32> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](const u32 a, const u32 b) {
+        return safetensor_dtype_size(tensors[a].dtype) > safetensor_dtype_size(tensors[b].dtype);
+    });
+
+    std::vector<u64> offsets(count);
+    u64 data_size = 0;
+
+    for (const u32 i: order) {
+        offsets[i] = data_size;
+        data_size += u64(tensors[i].width) * tensors[i].height * safetensor_dtype_size(tensors[i].dtype);
+    }
+
+    std::string header = "{";
+
+    if (!config.metadata.empty()) {
+        header += "\"__metadata__\":{";
+
+        for (size_t i = 0; i < config.metadata.size(); ++i) {
+            if (i)
+                header += ',';
+
+            append_json_string(header, config.metadata[i].first);
+            header += ':';
+            append_json_string(header, config.metadata[i].second);
+        }
+
+        header += '}';
+    }
+
+    for (const u32 i: by_name) {
+        const safetensor_write_t &t = tensors[i];
+        const u64 bytes = u64(t.width) * t.height * safetensor_dtype_size(t.dtype);
+
+        if (header.size() > 1)
+            header += ',';
+
+        append_json_string(header, t.name);
+        fmt::format_to(std::back_inserter(header), ":{{\"dtype\":\"{}\",\"shape\":[{},{}],\"data_offsets\":[{},{}]}}",
+                       safetensor_dtype2str(t.dtype), t.height, t.width, offsets[i], offsets[i] + bytes);
+    }
+
+    header += '}';
+    header.resize(round_up(sizeof(u64) + header.size(), SAFETENSORS_DATA_ALIGN) - sizeof(u64), ' ');
+
+    const u64 size = sizeof(u64) + header.size() + data_size;
+
+    write_stream_t stream;
+    if (stream.open(path, config.direct))
+        return 1;
+
+    /*
+     * Only a hint: blocks allocated at once, and O_DIRECT writes that don't
+     * extend the file, which some filesystems do synchronously.
+     */
+    if (size)
+        fallocate(stream.fd, 0, 0, size);
+
+    if (write_stream(stream, header, tensors, order, size) || stream.close_file()) {
+        unlink(path);
+        return 1;
+    }
+
+    return 0;
+}
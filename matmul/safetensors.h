@@ -0,0 +1,297 @@
+#pragma once
+
+#include "mat.h"
+#include "mat_file.h"
+#include "types.h"
+
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/*
+ * Reader of safetensors files.
+ *
+ *   u64 n, little endian | n bytes of JSON header | data
+ *
+ * The header maps tensor names to their dtype, shape and data_offsets, a
+ * [begin, end) byte range of the data, plus an optional "__metadata__" object
+ * of strings. Opening a file only parses the header, straight from the
+ * mapping, in one pass and without building a document of it. Tensors are
+ * then looked up by name and materialized one at a time, the pages of those
+ * never asked for are never read in.
+ *
+ * Offsets are validated: the ranges of all tensors must tile the data exactly,
+ * without holes or overlaps, each as long as its shape and dtype say.
+ */
+
+/* Every dtype of the format, named as in the header by safetensor_dtype2str(). */
+enum class safetensor_dtype_e : u8 {
+    none,
+    boolean,
+    u8,
+    i8,
+    i16,
+    u16,
+    f16,
+    bf16,
+    i32,
+    u32,
+    f32,
+    f64,
+    i64,
+    u64,
+    f8_e4m3,
+    f8_e5m2,
+};
+
+constexpr static const char* safetensor_dtype2str(safetensor_dtype_e dtype)
+{
+    switch(dtype) {
+    case safetensor_dtype_e::none:
+        return "none";
+    case safetensor_dtype_e::boolean:
+        return "BOOL";
+    case safetensor_dtype_e::u8:
+        return "U8";
+    case safetensor_dtype_e::i8:
+        return "I8";
+    case safetensor_dtype_e::i16:
+        return "I16";
+    case safetensor_dtype_e::u16:
+        return "U16";
+    case safetensor_dtype_e::f16:
+        return "F16";
+    case safetensor_dtype_e::bf16:
+        return "BF16";
+    case safetensor_dtype_e::i32:
+        return "I32";
+    case safetensor_dtype_e::u32:
+        return "U32";
+    case safetensor_dtype_e::f32:
+        return "F32";
+    case safetensor_dtype_e::f64:
+        return "F64";
+    case safetensor_dtype_e::i64:
+        return "I64";
+    case safetensor_dtype_e::u64:
+        return "U64";
+    case safetensor_dtype_e::f8_e4m3:
+        return "F8_E4M3";
+    case safetensor_dtype_e::f8_e5m2:
+        return "F8_E5M2";
+    }
+
+    __builtin_unreachable();
+
+    return "none";
+}
+
+/* Bytes per element, 0 for none. */
+constexpr static u32 safetensor_dtype_size(safetensor_dtype_e dtype)
+{
+    switch(dtype) {
+    case safetensor_dtype_e::none:
+        return 0;
+    case safetensor_dtype_e::boolean:
+    case safetensor_dtype_e::u8:
+    case safetensor_dtype_e::i8:
+    case safetensor_dtype_e::f8_e4m3:
+    case safetensor_dtype_e::f8_e5m2:
+        return 1;
+    case safetensor_dtype_e::i16:
+    case safetensor_dtype_e::u16:
+    case safetensor_dtype_e::f16:
+    case safetensor_dtype_e::bf16:
+        return 2;
+    case safetensor_dtype_e::i32:
+    case safetensor_dtype_e::u32:
+    case safetensor_dtype_e::f32:
+        return 4;
+    case safetensor_dtype_e::f64:
+    case safetensor_dtype_e::i64:
+    case safetensor_dtype_e::u64:
+        return 8;
+    }
+
+    __builtin_unreachable();
+
+    return 0;
+}
+
+/* Returns non-zero if 's' names no dtype. */
+int safetensor_dtype_from_str(std::string_view s, safetensor_dtype_e &out);
+
+constexpr u32 SAFETENSOR_MAX_RANK = 8;
+
+/* Entry of the header. Nothing of the data is touched until materialized. */
+struct safetensor_t {
+    std::string_view name;
+
+    safetensor_dtype_e dtype = safetensor_dtype_e::none;
+
+    u32 rank = 0;
+    u64 shape[SAFETENSOR_MAX_RANK] = {};
+
+    /* data_offsets, relative to the end of the header. */
+    u64 begin = 0;
+    u64 end = 0;
+
+    /* First byte, in the mapping. Aligned only as far as the file keeps it. */
+    const u8 *data = nullptr;
+
+    u64 num_elems() const
+    {
+        u64 ret = 1;
+        for (u32 i = 0; i < this->rank; ++i)
+            ret *= this->shape[i];
+
+        return ret;
+    }
+};
+
+struct safetensors_t {
+    /* Empty if parsed from memory, see safetensors_parse(). */
+    mat_file_t file;
+
+    /* In header order. */
+    std::vector<safetensor_t> tensors;
+
+    /* "__metadata__", key and value. */
+    std::vector<std::pair<std::string_view, std::string_view>> metadata;
+
+    /* Indices of 'tensors' sorted by name. */
+    std::vector<u32> by_name;
+
+    /*
+     * Names and metadata are views into the header, unless they had to be
+     * unescaped, then into these.
+     */
+    std::vector<std::unique_ptr<char[]>> unescaped;
+
+    /* Null if not there. Binary search of 'by_name'. */
+    const safetensor_t* find(std::string_view name) const;
+};
+
+/* Returns non-zero if the file can't be mapped or isn't valid, 'out' is left untouched then. */
+int safetensors_open(const char *path, mat_file_prefetch_e prefetch, safetensors_t &out);
+
+/* Same, for a file already in memory. 'data' must outlive 'out'. */
+int safetensors_parse(const u8 *data, size_t size, safetensors_t &out);
+
+/*
+ * Tensors as matrices: rank 0 is 1 x 1, rank 1 a column, higher ranks have
+ * all but the last dimension folded into rows. Returns non-zero if the shape
+ * doesn't fit u32 sides.
+ */
+int safetensor_mat_shape(const safetensor_t &tensor, u32 &width, u32 &height);
+
+/*
+ * F32 tensor in place, with stride = width. Writing through the view faults,
+ * see mat_file.h. Returns non-zero if the tensor is of another dtype or not
+ * aligned for f32 in the file.
+ */
+int safetensor_view(const safetensor_t &tensor, matview_f32_t &out);
+
+/*
+ * Copies converted and restrided: bool and integer dtypes but U64 to i64,
+ * F16, BF16, F32 and F64 to f32. Returns non-zero for other dtypes.
+ */
+int safetensor_to_mat(const safetensor_t &tensor, mat_i64_t &out);
+int safetensor_to_mat(const safetensor_t &tensor, mat_f32_t &out);
+
+/*
+ * Writer.
+ *
+ * The header is computed from the tensors up front, then the header and the
+ * rows of every tensor are streamed in large sequential writes. Rows are
+ * written from where they are, gathered by pwritev(). Only rows too short to
+ * be worth an iovec of their own get copied, into a staging buffer. Nothing
+ * of the size of the file is ever built in memory.
+ *
+ * Header entries are sorted by name, data is laid out by decreasing element
+ * size, so the data of each tensor is aligned for its dtype in the file. The
+ * header is padded for the data to start 8 aligned, as safetensor_view()
+ * needs to use F32 tensors in place.
+ */
+
+/* Tensor to be written: rows of a row-major view, shape [height, width]. */
+struct safetensor_write_t {
+    safetensor_write_t(std::string_view name, matview_i64_t m)
+    :safetensor_write_t(name, safetensor_dtype_e::i64, m.data, m.width, m.height, m.stride, m.layout)
+    { }
+
+    safetensor_write_t(std::string_view name, matview_f32_t m)
+    :safetensor_write_t(name, safetensor_dtype_e::f32, m.data, m.width, m.height, m.stride, m.layout)
+    { }
+
+    safetensor_write_t(std::string_view name, matview_f16_t m)
+    :safetensor_write_t(name, safetensor_dtype_e::f16, m.data, m.width, m.height, m.stride, m.layout)
+    { }
+
+    safetensor_write_t(std::string_view name, matview_bf16_t m)
+    :safetensor_write_t(name, safetensor_dtype_e::bf16, m.data, m.width, m.height, m.stride, m.layout)
+    { }
+
+    safetensor_write_t(std::string_view name, matview_i32_t m)
+    :safetensor_write_t(name, safetensor_dtype_e::i32, m.data, m.width, m.height, m.stride, m.layout)
+    { }
+
+    safetensor_write_t(std::string_view name, matview_u8_t m)
+    :safetensor_write_t(name, safetensor_dtype_e::u8, m.data, m.width, m.height, m.stride, m.layout)
+    { }
+
+    safetensor_write_t(std::string_view name, matview_i8_t m)
+    :safetensor_write_t(name, safetensor_dtype_e::i8, m.data, m.width, m.height, m.stride, m.layout)
+    { }
+
+    safetensor_write_t(
+        std::string_view name,
+        safetensor_dtype_e dtype,
+        const void *data,
+        u32 width,
+        u32 height,
+        u32 stride,
+        mat_layout_e layout = mat_layout_e::row_major
+    )
+    :name(name)
+    ,dtype(dtype)
+    ,data(data)
+    ,width(width)
+    ,height(height)
+    ,stride(stride)
+    ,layout(layout)
+    { }
+
+    std::string_view name;
+    safetensor_dtype_e dtype;
+    const void *data;
+    u32 width;
+    u32 height;
+    u32 stride;
+    mat_layout_e layout;
+};
+
+struct safetensors_write_config_t {
+    /* "__metadata__", left out if empty. */
+    std::vector<std::pair<std::string_view, std::string_view>> metadata;
+
+    /*
+     * O_DIRECT: data goes from the staging buffer to the disk, bypassing the
+     * page cache, which a checkpoint bigger than RAM would otherwise thrash.
+     * Everything is copied through the buffer then. Falls back to buffered
+     * writes on filesystems without O_DIRECT.
+     */
+    bool direct = false;
+};
+
+/*
+ * Creates or truncates 'path'. Returns non-zero on I/O errors, duplicate
+ * names, unknown dtypes or views not row-major, see mat_copy().
+ */
+int safetensors_write(
+    const char *path,
+    const safetensor_write_t *tensors,
+    size_t count,
+    const safetensors_write_config_t &config = {}
+);
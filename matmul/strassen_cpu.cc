@@ -0,0 +1,1204 @@
+#include "mat.h"
+#include "mat_expr.h"
+#include "matmul_cpu.h"
+#include "threading.h"
+#include "types.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+/*
+ * Strassen on CPU without allocations inside the recursion.
+ *
+ * Works for any (M x K) @ (K x N). Every level splits all three dimensions in
+ * half and needs three temporaries: one for the lhs operand sum (M/2 x K/2),
+ * one for the rhs operand sum (K/2 x N/2) and one for the product that can't
+ * be computed straight into its C quadrant (M/2 x N/2). Children run one after
+ * another, so they can all reuse the same space right after their parent's
+ * temporaries. That makes the whole workspace a simple stack, for square
+ * operands:
+ *
+ *     3 * (n/2)^2 + 3 * (n/4)^2 + ... < n^2 elements
+ *
+ * It is allocated once, up front, and temporaries are carved out of it.
+ *
+ * C quadrants are accumulated in place, in the order that lets four of the
+ * seven products be written directly into C:
+ *
+ *     M1 = (A11 + A22)(B11 + B22)    C11  = M1, C22 = M1
+ *     M2 = (A21 + A22) B11           C21  = M2, C22 -= M2
+ *     M3 =  A11 (B12 - B22)          C12  = M3, C22 += M3
+ *     M4 =  A22 (B21 - B11)          C11 += M4, C21 += M4
+ *     M5 = (A11 + A12) B22           C11 -= M5, C12 += M5
+ *     M6 = (A21 - A11)(B11 + B12)    C22 += M6
+ *     M7 = (A12 - A22)(B21 + B22)    C11 += M7
+ *
+ * Odd dimensions are peeled off dynamically. Strassen runs on the even
+ * (M' x K') @ (K' x N') part and the leftovers are fixed up in place:
+ *
+ *     K odd:  C[0:M', 0:N'] += A[0:M', K'] * B[K', 0:N']  (rank-1 update)
+ *     N odd:  C[:, N']       = A @ B[:, N']                (matrix-vector)
+ *     M odd:  C[M', 0:N']    = A[M', :] @ B[:, 0:N']       (vector-matrix)
+ *
+ * Fix-ups are O(n^2) and touch no memory outside the operands, nothing is
+ * padded or copied.
+ *
+ * Recursion stops once any dimension gets down to 'crossover', and the
+ * blocked GEMM takes over. The public entry points take the crossover
+ * measured on the host, see strassen_tune.cc
+ *
+ * Winograd form of the same recursion, with 15 instead of 18 additions, is
+ * further below.
+ */
+
+/* Upper bound on the levels spawning tasks, 7^3 tasks is plenty for any machine. */
+constexpr u32 CONFIG_STRASSEN_MAX_TASK_DEPTH = 3;
+
+/* Largest ratio of the biggest to the smallest dimension padded to a Morton cube. */
+constexpr u32 CONFIG_STRASSEN_MORTON_MAX_ASPECT = 2;
+
+namespace {
+
+template <typename ValueType>
+struct strassen_arena {
+    ValueType* alloc(const size_t num_elems)
+    {
+        assert(this->top + num_elems <= this->size);
+
+        ValueType * const ret = this->base + this->top;
+
+        this->top += num_elems;
+        this->peak = std::max(this->peak, this->top);
+
+        return ret;
+    }
+
+    ValueType *base;
+    size_t size;
+    size_t top;
+    size_t peak;
+};
+
+}
+
+static bool strassen_should_split(const u32 m, const u32 k, const u32 n, const u32 crossover)
+{
+    return std::min({m, k, n}) > std::max(crossover, 1u);
+}
+
+/* Temporaries have padded rows, same as any other matrix. */
+static u32 strassen_tmp_stride(const u32 width)
+{
+    return mat_i64_t::gen_stride(width);
+}
+
+size_t strassen_cpu_workspace_elems(const u32 m, const u32 k, const u32 n, const u32 crossover)
+{
+    if (!strassen_should_split(m, k, n, crossover))
+        return 0;
+
+    const u32 hm = m / 2;
+    const u32 hk = k / 2;
+    const u32 hn = n / 2;
+
+    const size_t level = size_t(strassen_tmp_stride(hk)) * hm
+                       + size_t(strassen_tmp_stride(hn)) * hk
+                       + size_t(strassen_tmp_stride(hn)) * hm;
+
+    return level + strassen_cpu_workspace_elems(hm, hk, hn, crossover);
+}
+
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static void strassen_rows(
+    ViewType out,
+    ViewType lhs,
+    ViewType rhs,
+    typename cpu_kernels_t<ValueType>::row_binop_fn op
+) {
+    for (u32 y = 0; y < out.height; ++y)
+        op(&out.at(0, y), &lhs.at(0, y), &rhs.at(0, y), out.width);
+}
+
+/* out += col @ row, where 'col' is (1 x out.height) and 'row' is (out.width x 1) */
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static void strassen_rank1_update(ViewType out, ViewType col, ViewType row)
+{
+    const ValueType * const r = &row.at(0, 0);
+
+    for (u32 y = 0; y < out.height; ++y) {
+        const ValueType c = col.at(0, y);
+        ValueType * const o = &out.at(0, y);
+
+        for (u32 x = 0; x < out.width; ++x)
+            o[x] += c * r[x];
+    }
+}
+
+template <typename ViewType>
+static ViewType strassen_block(ViewType m, u32 x, u32 y, u32 w, u32 h)
+{
+    return ViewType(&m.at(x, y), w, h, m.stride);
+}
+
+/* Computes parts of 'out' left out by the even sized recursion, see the top. */
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static void strassen_peel_fixup(
+    ViewType out,
+    ViewType lhs,
+    ViewType rhs,
+    const cpu_kernels_t<ValueType> &kernels
+) {
+    const u32 M = lhs.height;
+    const u32 K = lhs.width;
+    const u32 N = rhs.width;
+
+    const u32 em = M & ~1u;
+    const u32 ek = K & ~1u;
+    const u32 en = N & ~1u;
+
+    if (ek != K)
+        strassen_rank1_update(
+            strassen_block(out, 0, 0, en, em),
+            strassen_block(lhs, ek, 0, 1, em),
+            strassen_block(rhs, 0, ek, en, 1)
+        );
+
+    if (en != N)
+        gemm_cpu_blocked(strassen_block(out, en, 0, 1, M), lhs, strassen_block(rhs, en, 0, 1, K), kernels);
+
+    if (em != M)
+        gemm_cpu_blocked(
+            strassen_block(out, 0, em, en, 1),
+            strassen_block(lhs, 0, em, K, 1),
+            strassen_block(rhs, 0, 0, en, K),
+            kernels
+        );
+}
+
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static void strassen_cpu_arena_(
+    ViewType out,
+    ViewType lhs,
+    ViewType rhs,
+    strassen_arena<ValueType> &arena,
+    const cpu_kernels_t<ValueType> &kernels,
+    const u32 crossover,
+    const u32 depth,
+    strassen_stats_t &stats
+) {
+    const u32 M = lhs.height;
+    const u32 K = lhs.width;
+    const u32 N = rhs.width;
+
+    if (!strassen_should_split(M, K, N, crossover)) {
+        gemm_cpu_blocked(out, lhs, rhs, kernels);
+        stats.depth = std::max(stats.depth, depth);
+        return;
+    }
+
+    const u32 hm = M / 2;
+    const u32 hk = K / 2;
+    const u32 hn = N / 2;
+
+    auto block = strassen_block<ViewType>;
+
+    const ViewType a11 = block(lhs, 0,  0,  hk, hm), a12 = block(lhs, hk, 0,  hk, hm);
+    const ViewType a21 = block(lhs, 0,  hm, hk, hm), a22 = block(lhs, hk, hm, hk, hm);
+    const ViewType b11 = block(rhs, 0,  0,  hn, hk), b12 = block(rhs, hn, 0,  hn, hk);
+    const ViewType b21 = block(rhs, 0,  hk, hn, hk), b22 = block(rhs, hn, hk, hn, hk);
+    const ViewType c11 = block(out, 0,  0,  hn, hm), c12 = block(out, hn, 0,  hn, hm);
+    const ViewType c21 = block(out, 0,  hm, hn, hm), c22 = block(out, hn, hm, hn, hm);
+
+    const size_t top = arena.top;
+
+    const u32 sa = strassen_tmp_stride(hk);
+    const u32 sb = strassen_tmp_stride(hn);
+
+    const ViewType ta(arena.alloc(size_t(sa) * hm), hk, hm, sa);
+    const ViewType tb(arena.alloc(size_t(sb) * hk), hn, hk, sb);
+    const ViewType tm(arena.alloc(size_t(sb) * hm), hn, hm, sb);
+
+    auto mul = [&](ViewType dst, ViewType l, ViewType r) {
+        strassen_cpu_arena_(dst, l, r, arena, kernels, crossover, depth + 1, stats);
+    };
+
+    const auto add = kernels.add_row;
+    const auto sub = kernels.sub_row;
+
+    /* M1 */
+    strassen_rows(ta, a11, a22, add);
+    strassen_rows(tb, b11, b22, add);
+    mul(c11, ta, tb);
+    mat_copy(c22, c11);
+
+    /* M2 */
+    strassen_rows(ta, a21, a22, add);
+    mul(c21, ta, b11);
+    strassen_rows(c22, c22, c21, sub);
+
+    /* M3 */
+    strassen_rows(tb, b12, b22, sub);
+    mul(c12, a11, tb);
+    strassen_rows(c22, c22, c12, add);
+
+    /* M4 */
+    strassen_rows(tb, b21, b11, sub);
+    mul(tm, a22, tb);
+    strassen_rows(c11, c11, tm, add);
+    strassen_rows(c21, c21, tm, add);
+
+    /* M5 */
+    strassen_rows(ta, a11, a12, add);
+    mul(tm, ta, b22);
+    strassen_rows(c11, c11, tm, sub);
+    strassen_rows(c12, c12, tm, add);
+
+    /* M6 */
+    strassen_rows(ta, a21, a11, sub);
+    strassen_rows(tb, b11, b12, add);
+    mul(tm, ta, tb);
+    strassen_rows(c22, c22, tm, add);
+
+    /* M7 */
+    strassen_rows(ta, a12, a22, sub);
+    strassen_rows(tb, b21, b22, add);
+    mul(tm, ta, tb);
+    strassen_rows(c11, c11, tm, add);
+
+    arena.top = top;
+
+    strassen_peel_fixup(out, lhs, rhs, kernels);
+}
+
+/*
+ * Strassen-Winograd.
+ *
+ * Shares the intermediate sums between the products, 7 multiplications and
+ * 15 additions per level. Schedule follows Boyer, Dumas, Pernet, Zhou,
+ * "Memory efficient scheduling of Strassen-Winograd's matrix multiplication
+ * algorithm", which gets by with just two temporaries: X for the lhs sums and
+ * P1 (M/2 x max(K/2, N/2)) and Y for the rhs sums (K/2 x N/2).
+ *
+ *     X   = A11 - A21       Y   = B22 - B12       C21 = X @ Y      (P7)
+ *     X   = A21 + A22       Y   = B12 - B11       C22 = X @ Y      (P5)
+ *     X   = X - A11         Y   = B22 - Y         C12 = X @ Y      (P6)
+ *     X   = A12 - X                               C11 = X @ B22    (P3)
+ *     X   = A11 @ B11                                              (P1)
+ *     C12 = X + C12         C21 = C12 + C21       C12 = C12 + C22
+ *     C22 = C21 + C22       C12 = C12 + C11
+ *     Y   = Y - B21                               C11 = A22 @ Y    (P4)
+ *     C21 = C21 - C11                             C11 = A12 @ B21  (P2)
+ *     C11 = X + C11
+ */
+size_t strassen_winograd_cpu_workspace_elems(const u32 m, const u32 k, const u32 n, const u32 crossover)
+{
+    if (!strassen_should_split(m, k, n, crossover))
+        return 0;
+
+    const u32 hm = m / 2;
+    const u32 hk = k / 2;
+    const u32 hn = n / 2;
+
+    const size_t level = size_t(strassen_tmp_stride(std::max(hk, hn))) * hm
+                       + size_t(strassen_tmp_stride(hn)) * hk;
+
+    return level + strassen_winograd_cpu_workspace_elems(hm, hk, hn, crossover);
+}
+
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static void strassen_winograd_cpu_arena_(
+    ViewType out,
+    ViewType lhs,
+    ViewType rhs,
+    strassen_arena<ValueType> &arena,
+    const cpu_kernels_t<ValueType> &kernels,
+    const u32 crossover,
+    const u32 depth,
+    strassen_stats_t &stats
+) {
+    const u32 M = lhs.height;
+    const u32 K = lhs.width;
+    const u32 N = rhs.width;
+
+    if (!strassen_should_split(M, K, N, crossover)) {
+        gemm_cpu_blocked(out, lhs, rhs, kernels);
+        stats.depth = std::max(stats.depth, depth);
+        return;
+    }
+
+    const u32 hm = M / 2;
+    const u32 hk = K / 2;
+    const u32 hn = N / 2;
+
+    auto block = strassen_block<ViewType>;
+
+    const ViewType a11 = block(lhs, 0,  0,  hk, hm), a12 = block(lhs, hk, 0,  hk, hm);
+    const ViewType a21 = block(lhs, 0,  hm, hk, hm), a22 = block(lhs, hk, hm, hk, hm);
+    const ViewType b11 = block(rhs, 0,  0,  hn, hk), b12 = block(rhs, hn, 0,  hn, hk);
+    const ViewType b21 = block(rhs, 0,  hk, hn, hk), b22 = block(rhs, hn, hk, hn, hk);
+    const ViewType c11 = block(out, 0,  0,  hn, hm), c12 = block(out, hn, 0,  hn, hm);
+    const ViewType c21 = block(out, 0,  hm, hn, hm), c22 = block(out, hn, hm, hn, hm);
+
+    const size_t top = arena.top;
+
+    const u32 sx = strassen_tmp_stride(std::max(hk, hn));
+    const u32 sy = strassen_tmp_stride(hn);
+
+    ValueType * const x = arena.alloc(size_t(sx) * hm);
+    ValueType * const y = arena.alloc(size_t(sy) * hk);
+
+    /* X holds the lhs sums first, and then P1. */
+    const ViewType xs(x, hk, hm, sx);
+    const ViewType xp(x, hn, hm, sx);
+    const ViewType ty(y, hn, hk, sy);
+
+    auto mul = [&](ViewType dst, ViewType l, ViewType r) {
+        strassen_winograd_cpu_arena_(dst, l, r, arena, kernels, crossover, depth + 1, stats);
+    };
+
+    const auto add = kernels.add_row;
+    const auto sub = kernels.sub_row;
+
+    strassen_rows(xs, a11, a21, sub);       /* S3 */
+    strassen_rows(ty, b22, b12, sub);       /* T3 */
+    mul(c21, xs, ty);                       /* P7 */
+
+    strassen_rows(xs, a21, a22, add);       /* S1 */
+    strassen_rows(ty, b12, b11, sub);       /* T1 */
+    mul(c22, xs, ty);                       /* P5 */
+
+    strassen_rows(xs, xs, a11, sub);        /* S2 = S1 - A11 */
+    strassen_rows(ty, b22, ty, sub);        /* T2 = B22 - T1 */
+    mul(c12, xs, ty);                       /* P6 */
+
+    strassen_rows(xs, a12, xs, sub);        /* S4 = A12 - S2 */
+    mul(c11, xs, b22);                      /* P3 */
+
+    mul(xp, a11, b11);                      /* P1 */
+
+    strassen_rows(c12, xp, c12, add);       /* U2 = P1 + P6 */
+    strassen_rows(c21, c12, c21, add);      /* U3 = U2 + P7 */
+    strassen_rows(c12, c12, c22, add);      /* U4 = U2 + P5 */
+    strassen_rows(c22, c21, c22, add);      /* U7 = U3 + P5 */
+    strassen_rows(c12, c12, c11, add);      /* U5 = U4 + P3 */
+
+    strassen_rows(ty, ty, b21, sub);        /* T4 = T2 - B21 */
+    mul(c11, a22, ty);                      /* P4 */
+    strassen_rows(c21, c21, c11, sub);      /* U6 = U3 - P4 */
+
+    mul(c11, a12, b21);                     /* P2 */
+    strassen_rows(c11, xp, c11, add);       /* U1 = P1 + P2 */
+
+    arena.top = top;
+
+    strassen_peel_fixup(out, lhs, rhs, kernels);
+}
+
+static size_t strassen_workspace_elems(
+    const strassen_variant_e variant,
+    const u32 m,
+    const u32 k,
+    const u32 n,
+    const u32 crossover
+) {
+    switch (variant) {
+    case strassen_variant_e::classic:
+        return strassen_cpu_workspace_elems(m, k, n, crossover);
+    case strassen_variant_e::winograd:
+        return strassen_winograd_cpu_workspace_elems(m, k, n, crossover);
+    }
+
+    __builtin_unreachable();
+}
+
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static void strassen_cpu_arena_common(
+    const strassen_variant_e variant,
+    ViewType out,
+    ViewType lhs,
+    ViewType rhs,
+    ValueType *workspace,
+    const u32 crossover,
+    strassen_stats_t *stats
+) {
+    assert(lhs.width == rhs.height);
+    assert(out.width == rhs.width);
+    assert(out.height == lhs.height);
+    assert(mat_row_major(out, lhs, rhs));
+
+    strassen_arena<ValueType> arena = {
+        .base = workspace,
+        .size = strassen_workspace_elems(variant, lhs.height, lhs.width, rhs.width, crossover),
+        .top = 0,
+        .peak = 0,
+    };
+
+    strassen_stats_t local_stats = {};
+
+    const auto &kernels = cpu_kernels<ValueType>();
+
+    switch (variant) {
+    case strassen_variant_e::classic:
+        strassen_cpu_arena_(out, lhs, rhs, arena, kernels, crossover, 0, local_stats);
+        break;
+    case strassen_variant_e::winograd:
+        strassen_winograd_cpu_arena_(out, lhs, rhs, arena, kernels, crossover, 0, local_stats);
+        break;
+    }
+
+    assert(arena.top == 0);
+
+    local_stats.workspace_bytes = arena.size * sizeof(ValueType);
+    local_stats.peak_bytes = arena.peak * sizeof(ValueType);
+
+    if (stats)
+        *stats = local_stats;
+}
+
+/*
+ * Task parallel Strassen.
+ *
+ * Top 'task_depth' levels run their seven products as tasks. Concurrent
+ * products can't share temporaries, so every task gets its own operand sums,
+ * its own product buffer and its own slice of workspace for its subtree:
+ *
+ *     M1 -> C11, M2 -> C21, M3 -> C12, M4..M7 -> own buffers
+ *
+ * and the quadrants are combined once all of them are done. C22 goes first,
+ * while C11, C21 and C12 still hold just M1, M2 and M3.
+ *
+ * Below 'task_depth' the serial, single arena recursion takes over.
+ */
+size_t strassen_cpu_parallel_workspace_elems(
+    const u32 m,
+    const u32 k,
+    const u32 n,
+    const u32 crossover,
+    const u32 task_depth
+) {
+    if (task_depth == 0 || !strassen_should_split(m, k, n, crossover))
+        return strassen_cpu_workspace_elems(m, k, n, crossover);
+
+    const u32 hm = m / 2;
+    const u32 hk = k / 2;
+    const u32 hn = n / 2;
+
+    const size_t level = 5 * size_t(strassen_tmp_stride(hk)) * hm
+                       + 5 * size_t(strassen_tmp_stride(hn)) * hk
+                       + 4 * size_t(strassen_tmp_stride(hn)) * hm;
+
+    return level + 7 * strassen_cpu_parallel_workspace_elems(hm, hk, hn, crossover, task_depth - 1);
+}
+
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static void strassen_cpu_tasks_(
+    ViewType out,
+    ViewType lhs,
+    ViewType rhs,
+    ValueType *workspace,
+    const cpu_kernels_t<ValueType> &kernels,
+    const u32 crossover,
+    const u32 task_depth,
+    const u32 depth,
+    task_pool &pool,
+    strassen_stats_t &stats
+) {
+    const u32 M = lhs.height;
+    const u32 K = lhs.width;
+    const u32 N = rhs.width;
+
+    if (task_depth == 0 || !strassen_should_split(M, K, N, crossover)) {
+        strassen_arena<ValueType> arena = {
+            .base = workspace,
+            .size = strassen_cpu_workspace_elems(M, K, N, crossover),
+            .top = 0,
+            .peak = 0,
+        };
+
+        strassen_cpu_arena_(out, lhs, rhs, arena, kernels, crossover, depth, stats);
+        stats.peak_bytes = arena.peak * sizeof(ValueType);
+        return;
+    }
+
+    const u32 hm = M / 2;
+    const u32 hk = K / 2;
+    const u32 hn = N / 2;
+
+    auto block = strassen_block<ViewType>;
+
+    const ViewType a11 = block(lhs, 0,  0,  hk, hm), a12 = block(lhs, hk, 0,  hk, hm);
+    const ViewType a21 = block(lhs, 0,  hm, hk, hm), a22 = block(lhs, hk, hm, hk, hm);
+    const ViewType b11 = block(rhs, 0,  0,  hn, hk), b12 = block(rhs, hn, 0,  hn, hk);
+    const ViewType b21 = block(rhs, 0,  hk, hn, hk), b22 = block(rhs, hn, hk, hn, hk);
+    const ViewType c11 = block(out, 0,  0,  hn, hm), c12 = block(out, hn, 0,  hn, hm);
+    const ViewType c21 = block(out, 0,  hm, hn, hm), c22 = block(out, hn, hm, hn, hm);
+
+    ValueType *top = workspace;
+
+    auto take = [&top](u32 w, u32 h) {
+        const u32 stride = strassen_tmp_stride(w);
+        const ViewType ret(top, w, h, stride);
+        top += size_t(stride) * h;
+        return ret;
+    };
+
+    const ViewType m4 = take(hn, hm), m5 = take(hn, hm), m6 = take(hn, hm), m7 = take(hn, hm);
+    const ViewType ta1 = take(hk, hm), ta2 = take(hk, hm), ta5 = take(hk, hm), ta6 = take(hk, hm), ta7 = take(hk, hm);
+    const ViewType tb1 = take(hn, hk), tb3 = take(hn, hk), tb4 = take(hn, hk), tb6 = take(hn, hk), tb7 = take(hn, hk);
+
+    const size_t level_elems = top - workspace;
+    const size_t child_elems = strassen_cpu_parallel_workspace_elems(hm, hk, hn, crossover, task_depth - 1);
+
+    const auto add = kernels.add_row;
+    const auto sub = kernels.sub_row;
+
+    strassen_stats_t child_stats[7] = {};
+    task_group group;
+
+    /* Task 'i' computes 'prepare', then dst = l @ r. */
+    auto spawn = [&](u32 i, ViewType dst, ViewType l, ViewType r, auto prepare) {
+        ValueType * const child_ws = top + i * child_elems;
+
+        pool.submit(group, [=, &kernels, &pool, &child_stats] {
+            prepare();
+            strassen_cpu_tasks_(dst, l, r, child_ws, kernels, crossover, task_depth - 1, depth + 1, pool, child_stats[i]);
+        });
+    };
+
+    spawn(0, c11, ta1, tb1, [=]{ strassen_rows(ta1, a11, a22, add); strassen_rows(tb1, b11, b22, add); });
+    spawn(1, c21, ta2, b11, [=]{ strassen_rows(ta2, a21, a22, add); });
+    spawn(2, c12, a11, tb3, [=]{ strassen_rows(tb3, b12, b22, sub); });
+    spawn(3, m4,  a22, tb4, [=]{ strassen_rows(tb4, b21, b11, sub); });
+    spawn(4, m5,  ta5, b22, [=]{ strassen_rows(ta5, a11, a12, add); });
+    spawn(5, m6,  ta6, tb6, [=]{ strassen_rows(ta6, a21, a11, sub); strassen_rows(tb6, b11, b12, add); });
+    spawn(6, m7,  ta7, tb7, [=]{ strassen_rows(ta7, a12, a22, sub); strassen_rows(tb7, b21, b22, add); });
+
+    pool.wait(group);
+
+    /* Fused, each quadrant is written in one pass. */
+    mat_eval(c22, mat_expr(c11) - c21 + c12 + m6);
+    mat_eval(c11, mat_expr(c11) + m4 - m5 + m7);
+    mat_eval(c21, mat_expr(c21) + m4);
+    mat_eval(c12, mat_expr(c12) + m5);
+
+    strassen_peel_fixup(out, lhs, rhs, kernels);
+
+    /* All the subtrees were live at once. */
+    stats.peak_bytes = level_elems * sizeof(ValueType);
+
+    for (const auto &cs: child_stats) {
+        stats.depth = std::max(stats.depth, cs.depth);
+        stats.peak_bytes += cs.peak_bytes;
+    }
+}
+
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static void strassen_cpu_parallel_arena_common(
+    ViewType out,
+    ViewType lhs,
+    ViewType rhs,
+    ValueType *workspace,
+    const u32 crossover,
+    const u32 task_depth,
+    task_pool &pool,
+    strassen_stats_t *stats
+) {
+    assert(lhs.width == rhs.height);
+    assert(out.width == rhs.width);
+    assert(out.height == lhs.height);
+    assert(mat_row_major(out, lhs, rhs));
+
+    strassen_stats_t local_stats = {};
+
+    strassen_cpu_tasks_(out, lhs, rhs, workspace, cpu_kernels<ValueType>(), crossover, task_depth, 0, pool, local_stats);
+
+    local_stats.workspace_bytes = sizeof(ValueType) *
+        strassen_cpu_parallel_workspace_elems(lhs.height, lhs.width, rhs.width, crossover, task_depth);
+
+    if (stats)
+        *stats = local_stats;
+}
+
+/* Enough task levels for every thread, and the waiting caller, to get a product. */
+static u32 strassen_task_depth(const u32 num_threads)
+{
+    if (num_threads == 0)
+        return 0;
+
+    u32 depth = 0;
+
+    for (u64 num_tasks = 1; num_tasks < num_threads + 1 && depth < CONFIG_STRASSEN_MAX_TASK_DEPTH; num_tasks *= 7)
+        ++depth;
+
+    return depth;
+}
+
+/*
+ * Workspace of the public entry points.
+ *
+ * Kept per thread and grown on demand, so repeated products of similar
+ * sizes don't allocate at all. A thread waiting in task_pool::wait() may
+ * pick up a task that runs Strassen again, while its own workspace is still
+ * in use. Such nested calls get a fresh one.
+ */
+namespace {
+
+template <typename ValueType>
+struct strassen_workspace {
+    constexpr static size_t alignment = 64;
+
+    static ValueType* alloc(const size_t num_elems)
+    {
+        /* Temporaries are multiples of 16 elements wide, so they all stay aligned. */
+        const size_t size_bytes = (num_elems * sizeof(ValueType) + alignment - 1) & ~(alignment - 1);
+        return static_cast<ValueType*>(std::aligned_alloc(alignment, size_bytes));
+    }
+
+    struct lease {
+        lease(const size_t num_elems)
+        {
+            strassen_workspace &cached = strassen_workspace::get();
+
+            if (cached.busy) {
+                if (num_elems)
+                    this->own.reset(alloc(num_elems));
+                this->data = this->own.get();
+                return;
+            }
+
+            if (num_elems > cached.size) {
+                cached.buffer.reset(alloc(num_elems));
+                cached.size = num_elems;
+            }
+
+            cached.busy = true;
+            this->cached = &cached;
+            this->data = cached.buffer.get();
+        }
+
+        ~lease()
+        {
+            if (this->cached)
+                this->cached->busy = false;
+        }
+
+        lease(const lease&) = delete;
+        lease& operator=(const lease&) = delete;
+
+        ValueType *data = nullptr;
+        strassen_workspace *cached = nullptr;
+        std::unique_ptr<ValueType[], free_deleter> own;
+    };
+
+    static strassen_workspace& get()
+    {
+        thread_local strassen_workspace workspace;
+        return workspace;
+    }
+
+    std::unique_ptr<ValueType[], free_deleter> buffer;
+    size_t size = 0;
+    bool busy = false;
+};
+
+}
+
+/*
+ * Strassen overwrites its output quadrant by quadrant, so it can't accumulate
+ * into 'dst'. For beta != 0 the product goes to a temporary at the end of the
+ * workspace, and is merged into 'dst' in one fused pass.
+ */
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static size_t strassen_epilogue_elems(ViewType dst, const ValueType beta)
+{
+    return beta == 0 ? 0 : size_t(strassen_tmp_stride(dst.width)) * dst.height;
+}
+
+/* Where the product should be computed, 'dst' itself, or the temporary. */
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static ViewType strassen_epilogue_out(ViewType dst, ValueType *tmp, const ValueType beta)
+{
+    return beta == 0 ? dst : ViewType(tmp, dst.width, dst.height, strassen_tmp_stride(dst.width));
+}
+
+/* dst = alpha * product + beta * dst */
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static void strassen_epilogue(ViewType dst, ViewType product, const ValueType alpha, const ValueType beta)
+{
+    if (beta == 0) {
+        if (alpha != 1)
+            mat_eval(dst, alpha * mat_expr(dst));
+    } else if (alpha == 1 && beta == 1) {
+        mat_eval(dst, mat_expr(dst) + product);
+    } else {
+        mat_eval(dst, alpha * mat_expr(product) + beta * mat_expr(dst));
+    }
+}
+
+/*
+ * Strassen on Morton ordered copies of the operands, see mat_layout_e.
+ *
+ * Quadrants of a Morton ordered matrix are its four quarters, one after
+ * another: X11, X12, X21, X22. Operand sums and quadrant updates are single
+ * passes over contiguous memory, every level walks memory linearly, and the
+ * base case gets square tiles stored row-major. Whatever the cache sizes are,
+ * from some level down each subproblem fits in them.
+ *
+ * Operands are copied into zero padded (n x n) Morton matrices, n = T * 2^L
+ * with T the tile side, the first one at most the crossover after L halvings.
+ * Tiles of zeros are multiplied as well, so the padding costs up to
+ * (n / max(M, K, N))^3 more work, and the rest of the product is the same
+ * recursion as strassen_cpu_arena_(), with the same stack of temporaries.
+ * Only worth it for operands about as big in all three dimensions, see
+ * strassen_morton_pays().
+ */
+namespace {
+
+struct strassen_morton_shape {
+    u32 tile;
+    u32 levels;
+    u32 size; /* tile << levels */
+};
+
+}
+
+static strassen_morton_shape strassen_morton_shape_of(const u32 m, const u32 k, const u32 n, const u32 crossover)
+{
+    const u32 size = std::max({m, k, n});
+    const u32 base = std::max(crossover, 1u);
+
+    u32 levels = 0;
+    while ((size - 1) >> levels >= base)
+        ++levels;
+
+    /* Tiles as wide as any other temporary, rows of a tile stay aligned. */
+    const u32 tile = strassen_tmp_stride(((size - 1) >> levels) + 1);
+
+    return { tile, levels, tile << levels };
+}
+
+/*
+ * Whether the product is close enough to a cube for padding it to one to pay
+ * off, and big enough for that cube to be split at least once.
+ */
+static bool strassen_morton_pays(const u32 m, const u32 k, const u32 n, const u32 crossover)
+{
+    const u32 lo = std::min({m, k, n});
+    const u32 hi = std::max({m, k, n});
+
+    if (lo == 0 || u64(hi) > u64(lo) * CONFIG_STRASSEN_MORTON_MAX_ASPECT)
+        return false;
+
+    const u32 size = strassen_morton_shape_of(m, k, n, crossover).size;
+
+    return strassen_should_split(size, size, size, crossover);
+}
+
+static size_t strassen_morton_workspace_elems(const strassen_morton_shape &shape)
+{
+    const size_t operand = size_t(shape.size) * shape.size;
+
+    size_t stack = 0;
+    for (u32 level = 1; level <= shape.levels; ++level)
+        stack += 3 * (operand >> (2 * level));
+
+    return 3 * operand + stack;
+}
+
+/* out = lhs (op) rhs over 'n' contiguous elements. */
+template <typename ValueType>
+static void strassen_span(
+    typename cpu_kernels_t<ValueType>::row_binop_fn op,
+    ValueType *out,
+    const ValueType *lhs,
+    const ValueType *rhs,
+    const size_t n
+) {
+    constexpr size_t chunk = size_t(1) << 30;
+
+    for (size_t i = 0; i < n; i += chunk)
+        op(out + i, lhs + i, rhs + i, u32(std::min(chunk, n - i)));
+}
+
+template <typename ValueType>
+static void strassen_morton_(
+    ValueType *c,
+    ValueType *a,
+    ValueType *b,
+    const u32 size,
+    const u32 tile,
+    strassen_arena<ValueType> &arena,
+    const cpu_kernels_t<ValueType> &kernels,
+    const u32 depth,
+    strassen_stats_t &stats
+) {
+    using ViewType = matview_base_t<mat_base_t<ValueType>>;
+
+    if (size == tile) {
+        gemm_cpu_blocked(ViewType(c, tile, tile, tile), ViewType(a, tile, tile, tile), ViewType(b, tile, tile, tile), kernels);
+        stats.depth = std::max(stats.depth, depth);
+        return;
+    }
+
+    const u32 half = size / 2;
+    const size_t q = size_t(half) * half;
+
+    ValueType * const a11 = a, * const a12 = a + q, * const a21 = a + 2 * q, * const a22 = a + 3 * q;
+    ValueType * const b11 = b, * const b12 = b + q, * const b21 = b + 2 * q, * const b22 = b + 3 * q;
+    ValueType * const c11 = c, * const c12 = c + q, * const c21 = c + 2 * q, * const c22 = c + 3 * q;
+
+    const size_t top = arena.top;
+
+    ValueType * const ta = arena.alloc(q);
+    ValueType * const tb = arena.alloc(q);
+    ValueType * const tm = arena.alloc(q);
+
+    auto mul = [&](ValueType *dst, ValueType *l, ValueType *r) {
+        strassen_morton_(dst, l, r, half, tile, arena, kernels, depth + 1, stats);
+    };
+
+    auto add = [&](ValueType *out, const ValueType *l, const ValueType *r) {
+        strassen_span(kernels.add_row, out, l, r, q);
+    };
+
+    auto sub = [&](ValueType *out, const ValueType *l, const ValueType *r) {
+        strassen_span(kernels.sub_row, out, l, r, q);
+    };
+
+    /* M1 */
+    add(ta, a11, a22);
+    add(tb, b11, b22);
+    mul(c11, ta, tb);
+    std::memcpy(c22, c11, q * sizeof(ValueType));
+
+    /* M2 */
+    add(ta, a21, a22);
+    mul(c21, ta, b11);
+    sub(c22, c22, c21);
+
+    /* M3 */
+    sub(tb, b12, b22);
+    mul(c12, a11, tb);
+    add(c22, c22, c12);
+
+    /* M4 */
+    sub(tb, b21, b11);
+    mul(tm, a22, tb);
+    add(c11, c11, tm);
+    add(c21, c21, tm);
+
+    /* M5 */
+    add(ta, a11, a12);
+    mul(tm, ta, b22);
+    sub(c11, c11, tm);
+    add(c12, c12, tm);
+
+    /* M6 */
+    sub(ta, a21, a11);
+    add(tb, b11, b12);
+    mul(tm, ta, tb);
+    add(c22, c22, tm);
+
+    /* M7 */
+    sub(ta, a12, a22);
+    add(tb, b21, b22);
+    mul(tm, ta, tb);
+    add(c11, c11, tm);
+
+    arena.top = top;
+}
+
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static void strassen_morton_into_(
+    ViewType dst,
+    ViewType lhs,
+    ViewType rhs,
+    const ValueType alpha,
+    const ValueType beta,
+    const u32 crossover,
+    strassen_stats_t *stats
+) {
+    const strassen_morton_shape shape = strassen_morton_shape_of(lhs.height, lhs.width, rhs.width, crossover);
+    const size_t operand = size_t(shape.size) * shape.size;
+    const size_t ws_elems = strassen_morton_workspace_elems(shape);
+    const typename strassen_workspace<ValueType>::lease workspace(ws_elems);
+
+    ValueType * const a = workspace.data;
+    ValueType * const b = a + operand;
+    ValueType * const c = b + operand;
+
+    auto morton = [&](ValueType *data, const ViewType m) {
+        return ViewType(data, m.width, m.height, shape.tile, mat_layout_e::morton);
+    };
+
+    /* Padding of the operands only ever meets zeros, that of the product is never read. */
+    std::fill(a, c, ValueType(0));
+    mat_copy(morton(a, lhs), lhs);
+    mat_copy(morton(b, rhs), rhs);
+
+    strassen_arena<ValueType> arena = {
+        .base = c + operand,
+        .size = ws_elems - 3 * operand,
+        .top = 0,
+        .peak = 0,
+    };
+
+    strassen_stats_t local_stats = {};
+
+    strassen_morton_(c, a, b, shape.size, shape.tile, arena, cpu_kernels<ValueType>(), 0, local_stats);
+
+    /*
+     * alpha and beta are applied in Morton order, to 'dst' copied over 'a'.
+     * Both are contiguous, taken as row-major (tile x size * 2^levels).
+     */
+    const ViewType cs(c, shape.tile, u32(operand / shape.tile), shape.tile);
+    const ViewType as(a, shape.tile, u32(operand / shape.tile), shape.tile);
+
+    if (beta != 0) {
+        mat_copy(morton(a, dst), dst);
+        mat_eval(cs, alpha * mat_expr(cs) + beta * mat_expr(as));
+    } else if (alpha != 1) {
+        mat_eval(cs, alpha * mat_expr(cs));
+    }
+
+    mat_copy(dst, morton(c, dst));
+
+    local_stats.workspace_bytes = ws_elems * sizeof(ValueType);
+    local_stats.peak_bytes = (3 * operand + arena.peak) * sizeof(ValueType);
+
+    if (stats)
+        *stats = local_stats;
+}
+
+/* Calls fn(dst, lhs, rhs) with row-major copies of whichever of them aren't row-major. */
+template <typename ViewType, typename Fn, typename ValueType = ViewType::ValueType>
+static void strassen_row_major(ViewType dst, ViewType lhs, ViewType rhs, const ValueType beta, Fn &&fn)
+{
+    using MatrixType = typename ViewType::ParentType;
+
+    MatrixType tmp[3];
+
+    const ViewType out = mat_row_major_tmp(dst, tmp[0], beta != 0);
+
+    fn(out, mat_row_major_tmp(lhs, tmp[1], true), mat_row_major_tmp(rhs, tmp[2], true));
+
+    if (tmp[0].data)
+        mat_copy(dst, out);
+}
+
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static void strassen_cpu_into_(
+    const strassen_variant_e variant,
+    ViewType dst,
+    ViewType lhs,
+    ViewType rhs,
+    const typename ViewType::ValueType alpha,
+    const typename ViewType::ValueType beta,
+    strassen_stats_t *stats
+) {
+    assert(lhs.width == rhs.height);
+    assert(dst.width == rhs.width);
+    assert(dst.height == lhs.height);
+
+    const u32 crossover = strassen_crossover<ValueType>(variant);
+
+    if (!mat_row_major(dst, lhs, rhs)) {
+        const u32 M = lhs.height, K = lhs.width, N = rhs.width;
+
+        if (!strassen_should_split(M, K, N, crossover)) {
+            /* Nothing to split, the blocked GEMM reads any layout without copies. */
+            if (stats)
+                *stats = {};
+            gemm_cpu_blocked(dst, lhs, rhs, alpha, beta);
+        } else if (variant == strassen_variant_e::classic && strassen_morton_pays(M, K, N, crossover)) {
+            strassen_morton_into_(dst, lhs, rhs, alpha, beta, crossover, stats);
+        } else {
+            strassen_row_major(dst, lhs, rhs, beta, [&](ViewType dst, ViewType lhs, ViewType rhs) {
+                strassen_cpu_into_(variant, dst, lhs, rhs, alpha, beta, stats);
+            });
+        }
+        return;
+    }
+
+    const size_t ws_elems = strassen_workspace_elems(variant, lhs.height, lhs.width, rhs.width, crossover);
+    const typename strassen_workspace<ValueType>::lease workspace(ws_elems + strassen_epilogue_elems(dst, beta));
+
+    const ViewType product = strassen_epilogue_out(dst, workspace.data + ws_elems, beta);
+
+    strassen_cpu_arena_common(variant, product, lhs, rhs, workspace.data, crossover, stats);
+    strassen_epilogue(dst, product, alpha, beta);
+}
+
+template <typename ViewType, typename ValueType = ViewType::ValueType>
+static void strassen_cpu_parallel_into_(
+    ViewType dst,
+    ViewType lhs,
+    ViewType rhs,
+    const typename ViewType::ValueType alpha,
+    const typename ViewType::ValueType beta,
+    task_pool *pool_,
+    strassen_stats_t *stats
+) {
+    assert(lhs.width == rhs.height);
+    assert(dst.width == rhs.width);
+    assert(dst.height == lhs.height);
+
+    if (!mat_row_major(dst, lhs, rhs)) {
+        strassen_row_major(dst, lhs, rhs, beta, [&](ViewType dst, ViewType lhs, ViewType rhs) {
+            strassen_cpu_parallel_into_(dst, lhs, rhs, alpha, beta, pool_, stats);
+        });
+        return;
+    }
+
+    task_pool &pool = pool_ ? *pool_ : cpu_task_pool();
+
+    const u32 crossover = strassen_crossover<ValueType>(strassen_variant_e::classic);
+    const u32 task_depth = strassen_task_depth(pool.num_threads());
+
+    const size_t ws_elems = strassen_cpu_parallel_workspace_elems(lhs.height, lhs.width, rhs.width, crossover, task_depth);
+    const typename strassen_workspace<ValueType>::lease workspace(ws_elems + strassen_epilogue_elems(dst, beta));
+
+    const ViewType product = strassen_epilogue_out(dst, workspace.data + ws_elems, beta);
+
+    strassen_cpu_parallel_arena_common(product, lhs, rhs, workspace.data, crossover, task_depth, pool, stats);
+    strassen_epilogue(dst, product, alpha, beta);
+}
+
+template <typename MatrixType, typename ViewType>
+static MatrixType strassen_cpu_(
+    const strassen_variant_e variant,
+    ViewType lhs,
+    ViewType rhs,
+    strassen_stats_t *stats
+) {
+    assert(lhs.width == rhs.height);
+
+    MatrixType out = MatrixType::make_matrix_uninit(rhs.width, lhs.height);
+
+    strassen_cpu_into_(variant, ViewType(out), lhs, rhs, 1, 0, stats);
+
+    return out;
+}
+
+template <typename MatrixType, typename ViewType>
+static MatrixType strassen_cpu_parallel_(ViewType lhs, ViewType rhs, task_pool *pool, strassen_stats_t *stats)
+{
+    assert(lhs.width == rhs.height);
+
+    MatrixType out = MatrixType::make_matrix_uninit(rhs.width, lhs.height);
+
+    strassen_cpu_parallel_into_(ViewType(out), lhs, rhs, 1, 0, pool, stats);
+
+    return out;
+}
+
+void strassen_cpu_arena(
+    matview_i64_t out,
+    matview_i64_t lhs,
+    matview_i64_t rhs,
+    i64 *workspace,
+    u32 crossover,
+    strassen_stats_t *stats
+) { strassen_cpu_arena_common(strassen_variant_e::classic, out, lhs, rhs, workspace, crossover, stats); }
+
+void strassen_cpu_arena(
+    matview_f32_t out,
+    matview_f32_t lhs,
+    matview_f32_t rhs,
+    f32 *workspace,
+    u32 crossover,
+    strassen_stats_t *stats
+) { strassen_cpu_arena_common(strassen_variant_e::classic, out, lhs, rhs, workspace, crossover, stats); }
+
+mat_i64_t strassen_cpu(matview_i64_t lhs, matview_i64_t rhs, strassen_stats_t *stats)
+{ return strassen_cpu_<mat_i64_t, matview_i64_t>(strassen_variant_e::classic, lhs, rhs, stats); }
+
+void strassen_cpu_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs, i64 alpha, i64 beta, strassen_stats_t *stats)
+{ strassen_cpu_into_(strassen_variant_e::classic, dst, lhs, rhs, alpha, beta, stats); }
+
+mat_f32_t strassen_cpu(matview_f32_t lhs, matview_f32_t rhs, strassen_stats_t *stats)
+{ return strassen_cpu_<mat_f32_t, matview_f32_t>(strassen_variant_e::classic, lhs, rhs, stats); }
+
+void strassen_cpu_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs, f32 alpha, f32 beta, strassen_stats_t *stats)
+{ strassen_cpu_into_(strassen_variant_e::classic, dst, lhs, rhs, alpha, beta, stats); }
+
+void strassen_cpu_parallel_arena(
+    matview_i64_t out,
+    matview_i64_t lhs,
+    matview_i64_t rhs,
+    i64 *workspace,
+    u32 crossover,
+    u32 task_depth,
+    task_pool &pool,
+    strassen_stats_t *stats
+) { strassen_cpu_parallel_arena_common(out, lhs, rhs, workspace, crossover, task_depth, pool, stats); }
+
+void strassen_cpu_parallel_arena(
+    matview_f32_t out,
+    matview_f32_t lhs,
+    matview_f32_t rhs,
+    f32 *workspace,
+    u32 crossover,
+    u32 task_depth,
+    task_pool &pool,
+    strassen_stats_t *stats
+) { strassen_cpu_parallel_arena_common(out, lhs, rhs, workspace, crossover, task_depth, pool, stats); }
+
+mat_i64_t strassen_cpu_parallel(matview_i64_t lhs, matview_i64_t rhs, task_pool *pool, strassen_stats_t *stats)
+{ return strassen_cpu_parallel_<mat_i64_t, matview_i64_t>(lhs, rhs, pool, stats); }
+
+void strassen_cpu_parallel_into(
+    matview_i64_t dst,
+    matview_i64_t lhs,
+    matview_i64_t rhs,
+    i64 alpha,
+    i64 beta,
+    task_pool *pool,
+    strassen_stats_t *stats
+) { strassen_cpu_parallel_into_(dst, lhs, rhs, alpha, beta, pool, stats); }
+
+mat_f32_t strassen_cpu_parallel(matview_f32_t lhs, matview_f32_t rhs, task_pool *pool, strassen_stats_t *stats)
+{ return strassen_cpu_parallel_<mat_f32_t, matview_f32_t>(lhs, rhs, pool, stats); }
+
+void strassen_cpu_parallel_into(
+    matview_f32_t dst,
+    matview_f32_t lhs,
+    matview_f32_t rhs,
+    f32 alpha,
+    f32 beta,
+    task_pool *pool,
+    strassen_stats_t *stats
+) { strassen_cpu_parallel_into_(dst, lhs, rhs, alpha, beta, pool, stats); }
+
+void strassen_winograd_cpu_arena(
+    matview_i64_t out,
+    matview_i64_t lhs,
+    matview_i64_t rhs,
+    i64 *workspace,
+    u32 crossover,
+    strassen_stats_t *stats
+) { strassen_cpu_arena_common(strassen_variant_e::winograd, out, lhs, rhs, workspace, crossover, stats); }
+
+void strassen_winograd_cpu_arena(
+    matview_f32_t out,
+    matview_f32_t lhs,
+    matview_f32_t rhs,
+    f32 *workspace,
+    u32 crossover,
+    strassen_stats_t *stats
+) { strassen_cpu_arena_common(strassen_variant_e::winograd, out, lhs, rhs, workspace, crossover, stats); }
+
+mat_i64_t strassen_winograd_cpu(matview_i64_t lhs, matview_i64_t rhs, strassen_stats_t *stats)
+{ return strassen_cpu_<mat_i64_t, matview_i64_t>(strassen_variant_e::winograd, lhs, rhs, stats); }
+
+void strassen_winograd_cpu_into(matview_i64_t dst, matview_i64_t lhs, matview_i64_t rhs, i64 alpha, i64 beta, strassen_stats_t *stats)
+{ strassen_cpu_into_(strassen_variant_e::winograd, dst, lhs, rhs, alpha, beta, stats); }
+
+mat_f32_t strassen_winograd_cpu(matview_f32_t lhs, matview_f32_t rhs, strassen_stats_t *stats)
+{ return strassen_cpu_<mat_f32_t, matview_f32_t>(strassen_variant_e::winograd, lhs, rhs, stats); }
+
+void strassen_winograd_cpu_into(matview_f32_t dst, matview_f32_t lhs, matview_f32_t rhs, f32 alpha, f32 beta, strassen_stats_t *stats)
+{ strassen_cpu_into_(strassen_variant_e::winograd, dst, lhs, rhs, alpha, beta, stats); }
@@ -0,0 +1,376 @@
+#include "cpu_features.h"
+#include "mat.h"
+#include "matmul_cpu.h"
+#include "timing.h"
+#include "types.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+/*
+ * Strassen crossover autotuning.
+ *
+ * For every candidate size n we time the blocked GEMM against exactly one
+ * level of Strassen on top of it (that is, crossover = n - 1). Crossover is
+ * the largest size where the extra level doesn't pay off yet, given that it
+ * pays off for every bigger size we tried. Small sizes tend to be noisy, so
+ * requiring a clean win from there up keeps one lucky run from pushing the
+ * crossover too low. If even the biggest size doesn't win, Strassen is left
+ * off altogether, rather than enabled from the biggest size we could measure.
+ * If every size wins, the crossover goes below the smallest one, so that it
+ * is split as well.
+ *
+ * Results are kept in a small text file:
+ *
+ *     # Strassen crossover, generated by --tune
+ *     isa avx512
+ *     classic_i64 256
+ *     ...
+ *
+ * Crossovers depend on the kernels we dispatch to, so the file is only used
+ * when its ISA level matches the active one.
+ */
+
+/* Used when there is no tuning file, measured on AVX-512 and AVX2 hosts. */
+constexpr u32 CONFIG_STRASSEN_CROSSOVER = 256;
+
+constexpr u32 CONFIG_STRASSEN_TUNE_SIZES[] = { 64, 96, 128, 192, 256, 384, 512, 768, 1024 };
+constexpr u32 CONFIG_STRASSEN_TUNE_REPEATS = 3;
+
+namespace {
+
+struct {
+    std::once_flag loaded;
+
+    /* Read on every Strassen call, from any thread. */
+    std::mutex mtx;
+    strassen_tuning_t active;
+} context_strassen_tuning;
+
+}
+
+strassen_tuning_t strassen_tuning_default()
+{
+    return {
+        .isa = cpu_isa(),
+        .classic_i64 = CONFIG_STRASSEN_CROSSOVER,
+        .classic_f32 = CONFIG_STRASSEN_CROSSOVER,
+        .winograd_i64 = CONFIG_STRASSEN_CROSSOVER,
+        .winograd_f32 = CONFIG_STRASSEN_CROSSOVER,
+    };
+}
+
+static void strassen_tuning_init()
+{
+    std::call_once(context_strassen_tuning.loaded, [] {
+        strassen_tuning_t tuning = strassen_tuning_default();
+
+        const std::string path = strassen_tuning_path();
+        strassen_tuning_t loaded;
+
+        /* No file is fine, we just run with the defaults. */
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && strassen_tuning_load(path.c_str(), loaded) == 0) {
+            if (loaded.isa == cpu_isa())
+                tuning = loaded;
+            else
+                fprintf(stderr, "%s: tuned for %s, but running on %s, using defaults. Rerun with --tune\n",
+                        path.c_str(), cpu_isa2str(loaded.isa), cpu_isa2str(cpu_isa()));
+        }
+
+        std::lock_guard lck(context_strassen_tuning.mtx);
+        context_strassen_tuning.active = tuning;
+    });
+}
+
+strassen_tuning_t strassen_tuning()
+{
+    strassen_tuning_init();
+
+    std::lock_guard lck(context_strassen_tuning.mtx);
+    return context_strassen_tuning.active;
+}
+
+void strassen_tuning_set(const strassen_tuning_t &tuning)
+{
+    strassen_tuning_init();
+
+    std::lock_guard lck(context_strassen_tuning.mtx);
+    context_strassen_tuning.active = tuning;
+}
+
+template <>
+u32 strassen_crossover<i64>(const strassen_variant_e variant)
+{
+    const strassen_tuning_t tuning = strassen_tuning();
+    return variant == strassen_variant_e::winograd ? tuning.winograd_i64 : tuning.classic_i64;
+}
+
+template <>
+u32 strassen_crossover<f32>(const strassen_variant_e variant)
+{
+    const strassen_tuning_t tuning = strassen_tuning();
+    return variant == strassen_variant_e::winograd ? tuning.winograd_f32 : tuning.classic_f32;
+}
+
+std::string strassen_tuning_path()
+{
+    if (const char *path = getenv("MATMUL_TUNING_FILE"); path && path[0])
+        return path;
+
+    if (const char *cache = getenv("XDG_CACHE_HOME"); cache && cache[0])
+        return std::string(cache) + "/matmul-tuning";
+
+    if (const char *home = getenv("HOME"); home && home[0])
+        return std::string(home) + "/.cache/matmul-tuning";
+
+    return "matmul-tuning";
+}
+
+int strassen_tuning_load(const char * const path, strassen_tuning_t &out)
+{
+    FILE * const f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    strassen_tuning_t tuning = strassen_tuning_default();
+    bool has_isa = false;
+    int ret = 0;
+
+    char line[128];
+    while (fgets(line, sizeof(line), f)) {
+        char key[32];
+        char value[32];
+
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+
+        if (sscanf(line, "%31s %31s", key, value) != 2) {
+            fprintf(stderr, "%s: malformed line: %s", path, line);
+            ret = 1;
+            break;
+        }
+
+        if (strcmp(key, "isa") == 0) {
+            if (cpu_isa_from_str(value, tuning.isa)) {
+                fprintf(stderr, "%s: unknown ISA level: %s\n", path, value);
+                ret = 1;
+                break;
+            }
+
+            has_isa = true;
+            continue;
+        }
+
+        u32 *field = nullptr;
+
+        if (strcmp(key, "classic_i64") == 0)
+            field = &tuning.classic_i64;
+        else if (strcmp(key, "classic_f32") == 0)
+            field = &tuning.classic_f32;
+        else if (strcmp(key, "winograd_i64") == 0)
+            field = &tuning.winograd_i64;
+        else if (strcmp(key, "winograd_f32") == 0)
+            field = &tuning.winograd_f32;
+
+        /* Unknown keys are skipped, so that older builds can read newer files. */
+        if (!field)
+            continue;
+
+        if (sscanf(value, "%u", field) != 1) {
+            fprintf(stderr, "%s: bad value of %s: %s\n", path, key, value);
+            ret = 1;
+            break;
+        }
+    }
+
+    fclose(f);
+
+    if (ret)
+        return ret;
+
+    if (!has_isa) {
+        fprintf(stderr, "%s: missing isa\n", path);
+        return 1;
+    }
+
+    out = tuning;
+
+    return 0;
+}
+
+int strassen_tuning_save(const char * const path, const strassen_tuning_t &tuning)
+{
+    /* Create the parent directory, ~/.cache might not exist yet. */
+    const std::string dir = std::string(path).substr(0, std::string(path).find_last_of('/'));
+    if (dir != path && mkdir(dir.c_str(), 0755) && errno != EEXIST) {
+        fprintf(stderr, "Failed to create %s: %s\n", dir.c_str(), strerror(errno));
+        return 1;
+    }
+
+    FILE * const f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    fprintf(f, "# Strassen crossover, generated by --tune\n");
+    fprintf(f, "isa %s\n", cpu_isa2str(tuning.isa));
+    fprintf(f, "classic_i64 %u\n", tuning.classic_i64);
+    fprintf(f, "classic_f32 %u\n", tuning.classic_f32);
+    fprintf(f, "winograd_i64 %u\n", tuning.winograd_i64);
+    fprintf(f, "winograd_f32 %u\n", tuning.winograd_f32);
+
+    if (fclose(f)) {
+        fprintf(stderr, "Failed to write %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Best of a few runs, the first one also warms up the caches and the pack buffers. */
+template <typename Func>
+static timeit_t::Duration strassen_tune_time(Func &&func)
+{
+    timeit_t timer;
+    auto best = timeit_t::Duration::max();
+
+    for (u32 i = 0; i < CONFIG_STRASSEN_TUNE_REPEATS; ++i) {
+        timer.start();
+        func();
+        timer.stop();
+
+        best = std::min(best, timer.get_duration());
+    }
+
+    return best;
+}
+
+/*
+ * Random bits would make f32 operands full of NaNs and denormals, which
+ * time very differently from the real data. Small integers do not.
+ */
+template <typename MatrixType>
+static MatrixType strassen_tune_matrix(const u32 n)
+{
+    MatrixType ret = MatrixType::make_matrix_uninit(n, n);
+
+    for (u32 y = 0; y < n; ++y)
+        for (u32 x = 0; x < n; ++x)
+            ret.at(x, y) = (x * 7 + y * 13) % 17;
+
+    return ret;
+}
+
+u32 strassen_tune_pick(const u32 * const sizes, const bool * const level_wins, const u32 num_sizes)
+{
+    if (num_sizes == 0 || !level_wins[num_sizes - 1])
+        return STRASSEN_CROSSOVER_NEVER;
+
+    /* Walk down from the biggest size, while another level keeps winning. */
+    u32 i = num_sizes - 1;
+    while (i > 0 && level_wins[i])
+        --i;
+
+    if (level_wins[i])
+        return sizes[0] / 2;
+
+    return sizes[i];
+}
+
+template <typename MatrixType, typename ValueType = MatrixType::ValueType>
+static u32 strassen_tune_crossover(const strassen_variant_e variant, FILE * const log)
+{
+    constexpr u32 num_sizes = std::size(CONFIG_STRASSEN_TUNE_SIZES);
+
+    bool level_wins[num_sizes];
+
+    for (u32 i = 0; i < num_sizes; ++i) {
+        const u32 n = CONFIG_STRASSEN_TUNE_SIZES[i];
+        const u32 crossover = n - 1;
+
+        const MatrixType lhs = strassen_tune_matrix<MatrixType>(n);
+        const MatrixType rhs = strassen_tune_matrix<MatrixType>(n);
+        MatrixType out = MatrixType::make_matrix_uninit(n, n);
+
+        const size_t ws_elems = variant == strassen_variant_e::winograd
+            ? strassen_winograd_cpu_workspace_elems(n, n, n, crossover)
+            : strassen_cpu_workspace_elems(n, n, n, crossover);
+
+        std::vector<ValueType> workspace(ws_elems);
+
+        const auto dur_blocked = strassen_tune_time([&] {
+            gemm_cpu_blocked(out, lhs, rhs);
+        });
+
+        const auto dur_level = strassen_tune_time([&] {
+            if (variant == strassen_variant_e::winograd)
+                strassen_winograd_cpu_arena(out, lhs, rhs, workspace.data(), crossover, nullptr);
+            else
+                strassen_cpu_arena(out, lhs, rhs, workspace.data(), crossover, nullptr);
+        });
+
+        level_wins[i] = dur_level < dur_blocked;
+
+        if (log)
+            fprintf(log, "  %5u: blocked %9.3f ms, one level %9.3f ms\n", n,
+                    std::chrono::duration<double, std::milli>(dur_blocked).count(),
+                    std::chrono::duration<double, std::milli>(dur_level).count());
+    }
+
+    return strassen_tune_pick(CONFIG_STRASSEN_TUNE_SIZES, level_wins, num_sizes);
+}
+
+strassen_tuning_t strassen_tune(FILE * const log)
+{
+    strassen_tuning_t tuning = strassen_tuning_default();
+
+    auto tune = [log](const char *name, auto crossover_func) {
+        if (log)
+            fprintf(log, "%s:\n", name);
+
+        const u32 crossover = crossover_func();
+
+        if (log)
+            fprintf(log, "  crossover: %u\n", crossover);
+
+        return crossover;
+    };
+
+    using enum strassen_variant_e;
+
+    tuning.classic_i64 = tune("classic_i64", [log] { return strassen_tune_crossover<mat_i64_t>(classic, log); });
+    tuning.classic_f32 = tune("classic_f32", [log] { return strassen_tune_crossover<mat_f32_t>(classic, log); });
+    tuning.winograd_i64 = tune("winograd_i64", [log] { return strassen_tune_crossover<mat_i64_t>(winograd, log); });
+    tuning.winograd_f32 = tune("winograd_f32", [log] { return strassen_tune_crossover<mat_f32_t>(winograd, log); });
+
+    return tuning;
+}
+
+int strassen_tune_and_save(FILE * const log)
+{
+    const strassen_tuning_t tuning = strassen_tune(log);
+
+    strassen_tuning_set(tuning);
+
+    const std::string path = strassen_tuning_path();
+
+    if (strassen_tuning_save(path.c_str(), tuning))
+        return 1;
+
+    if (log)
+        fprintf(log, "Saved to %s\n", path.c_str());
+
+    return 0;
+}
@@ -11,7 +11,15 @@
 
 #include "test.h"
 #include "mat.h"
+#include "mat_expr.h"
+#include "mat_file.h"
+#include "safetensors.h"
+#include "mat_fixed.h"
+#include "mat_sparse.h"
+#include "matmul_cpu.h"
+#include "cpu_features.h"
 #include "print_utils.h"
+#include "random.h"
 #include "get_type_name.h"
 #include "threading.h"
 #include "timing.h"
@@ -241,6 +249,2102 @@ void test_matrix_simple_strassen_mul()
             TEST_ASSERT((out0[x, y] == out1[x, y]));
 }
 
+/* Fills matrix with small integers, so that f32 products are exact. */
+template <typename MatrixType>
+static MatrixType make_matrix_small_ints(const u32 width, const u32 height)
+{
+    auto m = MatrixType::make_matrix(width, height);
+
+    for (u32 y = 0; y < height; ++y)
+        for (u32 x = 0; x < width; ++x)
+            m[x, y] = (rand() % 17) - 8;
+
+    return m;
+}
+
+template <typename MatrixType>
+void test_matrix_blocked_mul()
+{
+    /* Shapes picked to hit partial micro-tiles and multiple K/N blocks. */
+    constexpr u32 shapes[][3] = {
+        /* M,   K,    N */
+        {1,    1,    1   },
+        {3,    5,    7   },
+        {6,    16,   16  },
+        {17,   300,  33  },
+        {97,   257,  31  },
+        {128,  0,    64  },
+        {50,   40,   4100},
+    };
+
+    for (const auto &[M, K, N]: shapes) {
+        const auto lhs = make_matrix_small_ints<MatrixType>(K, M);
+        const auto rhs = make_matrix_small_ints<MatrixType>(N, K);
+
+        const auto out0 = mat_mul_cpu(lhs, rhs);
+        const auto out1 = mat_mul_cpu_naive(lhs, rhs);
+
+        TEST_ASSERT(out0.width == N);
+        TEST_ASSERT(out0.height == M);
+
+        for (u32 y = 0; y < out0.height; ++y)
+            for (u32 x = 0; x < out0.width; ++x)
+                TEST_ASSERT((out0[x, y] == out1[x, y]));
+    }
+}
+
+template <typename MatrixType>
+void test_matrix_parallel_mul()
+{
+    constexpr u32 shapes[][3] = {
+        /* M,   K,    N */
+        {5,    3,    2   },
+        {131,  77,   259 },
+        {256,  256,  256 },
+        {20,   130,  1000},
+    };
+
+    thread_pool pools[] = {
+        thread_pool(1),
+        thread_pool(3),
+        thread_pool(7),
+    };
+
+    for (const auto &[M, K, N]: shapes) {
+        const auto lhs = make_matrix_small_ints<MatrixType>(K, M);
+        const auto rhs = make_matrix_small_ints<MatrixType>(N, K);
+        const auto expected = mat_mul_cpu_naive(lhs, rhs);
+
+        auto check = [&](const MatrixType &out) {
+            TEST_ASSERT(out.width == N);
+            TEST_ASSERT(out.height == M);
+
+            for (u32 y = 0; y < out.height; ++y)
+                for (u32 x = 0; x < out.width; ++x)
+                    TEST_ASSERT((out[x, y] == expected[x, y]));
+        };
+
+        for (auto &pool: pools)
+            check(mat_mul_cpu_parallel(lhs, rhs, &pool));
+
+        check(mat_mul_cpu_parallel(lhs, rhs));
+    }
+}
+
+/* Small crossovers, so that the recursion goes a few levels deep. */
+constexpr u32 strassen_test_cases[][5] = {
+    /* M,   K,    N,    crossover, expected depth */
+    {1,    1,    1,    8,         0},
+    {16,   16,   16,   16,        0},
+    {32,   32,   32,   8,         2},
+    {97,   131,  75,   8,         4},
+    {200,  200,  200,  16,        4},
+    {256,  256,  256,  4,         6},
+    {64,   300,  20,   4,         3},
+    {33,   1,    40,   4,         0},
+};
+
+template <typename MatrixType>
+void test_matrix_strassen_arena()
+{
+    using ValueType = MatrixType::ValueType;
+
+    for (const auto &[M, K, N, crossover, depth]: strassen_test_cases) {
+        const auto lhs = make_matrix_small_ints<MatrixType>(K, M);
+        const auto rhs = make_matrix_small_ints<MatrixType>(N, K);
+        const auto expected = mat_mul_cpu_naive(lhs, rhs);
+
+        const size_t ws_elems = strassen_cpu_workspace_elems(M, K, N, crossover);
+        std::vector<ValueType> workspace(ws_elems);
+
+        auto out = MatrixType::make_matrix(N, M);
+        strassen_stats_t stats;
+        strassen_cpu_arena(out, lhs, rhs, workspace.data(), crossover, &stats);
+
+        TEST_ASSERT(stats.workspace_bytes == ws_elems * sizeof(ValueType));
+        TEST_ASSERT(stats.peak_bytes == stats.workspace_bytes);
+        TEST_ASSERT(stats.depth == depth);
+
+        for (u32 y = 0; y < M; ++y)
+            for (u32 x = 0; x < N; ++x)
+                TEST_ASSERT((out[x, y] == expected[x, y]));
+    }
+
+    /* Public entry point, with the default crossover. */
+    constexpr u32 shapes[][3] = {
+        /* M,   K,    N */
+        {1024, 1024, 1024},
+        {1000, 777,  1001},
+    };
+
+    for (const auto &[M, K, N]: shapes) {
+        const auto lhs = make_matrix_small_ints<MatrixType>(K, M);
+        const auto rhs = make_matrix_small_ints<MatrixType>(N, K);
+        const auto expected = mat_mul_cpu(lhs, rhs);
+
+        strassen_stats_t stats;
+        const auto out = strassen_cpu(lhs, rhs, &stats);
+
+        /* Temporaries of all the levels together stay under the size of the output. */
+        TEST_ASSERT(stats.depth >= 1);
+        TEST_ASSERT(stats.peak_bytes <= stats.workspace_bytes);
+        TEST_ASSERT(stats.workspace_bytes < size_t(N) * M * sizeof(ValueType));
+
+        TEST_ASSERT(out.width == N);
+        TEST_ASSERT(out.height == M);
+
+        for (u32 y = 0; y < M; ++y)
+            for (u32 x = 0; x < N; ++x)
+                TEST_ASSERT((out[x, y] == expected[x, y]));
+    }
+}
+
+template <typename MatrixType>
+void test_matrix_strassen_winograd()
+{
+    using ValueType = MatrixType::ValueType;
+
+    for (const auto &[M, K, N, crossover, depth]: strassen_test_cases) {
+        const auto lhs = make_matrix_small_ints<MatrixType>(K, M);
+        const auto rhs = make_matrix_small_ints<MatrixType>(N, K);
+        const auto expected = mat_mul_cpu_naive(lhs, rhs);
+
+        const size_t ws_elems = strassen_winograd_cpu_workspace_elems(M, K, N, crossover);
+        std::vector<ValueType> workspace(ws_elems);
+
+        /* Two temporaries per level instead of three. */
+        TEST_ASSERT(ws_elems <= strassen_cpu_workspace_elems(M, K, N, crossover));
+
+        auto out = MatrixType::make_matrix(N, M);
+        strassen_stats_t stats;
+        strassen_winograd_cpu_arena(out, lhs, rhs, workspace.data(), crossover, &stats);
+
+        TEST_ASSERT(stats.workspace_bytes == ws_elems * sizeof(ValueType));
+        TEST_ASSERT(stats.peak_bytes == stats.workspace_bytes);
+        TEST_ASSERT(stats.depth == depth);
+
+        for (u32 y = 0; y < M; ++y)
+            for (u32 x = 0; x < N; ++x)
+                TEST_ASSERT((out[x, y] == expected[x, y]));
+    }
+
+    constexpr u32 M = 1000, K = 777, N = 1001;
+
+    const auto lhs = make_matrix_small_ints<MatrixType>(K, M);
+    const auto rhs = make_matrix_small_ints<MatrixType>(N, K);
+    const auto expected = mat_mul_cpu(lhs, rhs);
+    const auto out = strassen_winograd_cpu(lhs, rhs);
+
+    TEST_ASSERT(out.width == N);
+    TEST_ASSERT(out.height == M);
+
+    for (u32 y = 0; y < M; ++y)
+        for (u32 x = 0; x < N; ++x)
+            TEST_ASSERT((out[x, y] == expected[x, y]));
+}
+
+template <typename MatrixType>
+void test_matrix_strassen_parallel()
+{
+    using ValueType = MatrixType::ValueType;
+
+    constexpr u32 cases[][5] = {
+        /* M,   K,    N,    crossover, task depth */
+        {5,    5,    5,    8,         2},
+        {97,   131,  75,   8,         2},
+        {256,  256,  256,  16,        1},
+        {200,  300,  100,  8,         3},
+    };
+
+    task_pool pools[] = {
+        task_pool(0),
+        task_pool(1),
+        task_pool(3),
+        task_pool(8),
+    };
+
+    for (const auto &[M, K, N, crossover, task_depth]: cases) {
+        const auto lhs = make_matrix_small_ints<MatrixType>(K, M);
+        const auto rhs = make_matrix_small_ints<MatrixType>(N, K);
+        const auto expected = mat_mul_cpu_naive(lhs, rhs);
+
+        const size_t ws_elems = strassen_cpu_parallel_workspace_elems(M, K, N, crossover, task_depth);
+        std::vector<ValueType> workspace(ws_elems);
+
+        for (auto &pool: pools) {
+            auto out = MatrixType::make_matrix(N, M);
+            strassen_stats_t stats;
+            strassen_cpu_parallel_arena(out, lhs, rhs, workspace.data(), crossover, task_depth, pool, &stats);
+
+            TEST_ASSERT(stats.workspace_bytes == ws_elems * sizeof(ValueType));
+            TEST_ASSERT(stats.peak_bytes == stats.workspace_bytes);
+
+            for (u32 y = 0; y < M; ++y)
+                for (u32 x = 0; x < N; ++x)
+                    TEST_ASSERT((out[x, y] == expected[x, y]));
+        }
+    }
+
+    /* Public entry point, with the default crossover and task depth. */
+    constexpr u32 M = 1000, K = 777, N = 1001;
+
+    const auto lhs = make_matrix_small_ints<MatrixType>(K, M);
+    const auto rhs = make_matrix_small_ints<MatrixType>(N, K);
+    const auto expected = mat_mul_cpu(lhs, rhs);
+
+    auto check = [&](const MatrixType &out) {
+        TEST_ASSERT(out.width == N);
+        TEST_ASSERT(out.height == M);
+
+        for (u32 y = 0; y < M; ++y)
+            for (u32 x = 0; x < N; ++x)
+                TEST_ASSERT((out[x, y] == expected[x, y]));
+    };
+
+    check(strassen_cpu_parallel(lhs, rhs, &pools[2]));
+    check(strassen_cpu_parallel(lhs, rhs));
+}
+
+static void test_strassen_tuning_file()
+{
+    char path[] = "/tmp/matmul-tuning-XXXXXX";
+    const int fd = mkstemp(path);
+    TEST_ASSERT(fd >= 0);
+    close(fd);
+
+    const strassen_tuning_t saved = {
+        .isa = cpu_isa(),
+        .classic_i64 = 100,
+        .classic_f32 = 200,
+        .winograd_i64 = 300,
+        .winograd_f32 = 400,
+    };
+
+    TEST_ASSERT(strassen_tuning_save(path, saved) == 0);
+
+    strassen_tuning_t loaded = {};
+    TEST_ASSERT(strassen_tuning_load(path, loaded) == 0);
+
+    TEST_ASSERT(loaded.isa == saved.isa);
+    TEST_ASSERT(loaded.classic_i64 == saved.classic_i64);
+    TEST_ASSERT(loaded.classic_f32 == saved.classic_f32);
+    TEST_ASSERT(loaded.winograd_i64 == saved.winograd_i64);
+    TEST_ASSERT(loaded.winograd_f32 == saved.winograd_f32);
+
+    /* Runtime picks up the active tuning. */
+    const strassen_tuning_t prev = strassen_tuning();
+    strassen_tuning_set(saved);
+
+    TEST_ASSERT(strassen_crossover<i64>(strassen_variant_e::classic) == 100);
+    TEST_ASSERT(strassen_crossover<f32>(strassen_variant_e::classic) == 200);
+    TEST_ASSERT(strassen_crossover<i64>(strassen_variant_e::winograd) == 300);
+    TEST_ASSERT(strassen_crossover<f32>(strassen_variant_e::winograd) == 400);
+
+    strassen_tuning_set(prev);
+
+    /* Crossovers picked from which of the probed sizes one level won at. */
+    const u32 sizes[] = { 64, 128, 256 };
+    const bool never[] = { true, true, false };
+    const bool above_128[] = { false, false, true };
+    const bool above_64[] = { false, true, true };
+    const bool noisy[] = { true, false, true };
+    const bool always[] = { true, true, true };
+
+    TEST_ASSERT(strassen_tune_pick(sizes, never, 3) == STRASSEN_CROSSOVER_NEVER);
+    TEST_ASSERT(strassen_tune_pick(sizes, above_128, 3) == 128);
+    TEST_ASSERT(strassen_tune_pick(sizes, above_64, 3) == 64);
+    TEST_ASSERT(strassen_tune_pick(sizes, noisy, 3) == 128);
+    TEST_ASSERT(strassen_tune_pick(sizes, always, 3) == 32);
+
+    /* Garbage is rejected, and the output is left untouched. */
+    FILE *f = fopen(path, "w");
+    TEST_ASSERT(f);
+    fprintf(f, "isa avx9000\n");
+    fclose(f);
+
+    TEST_ASSERT(strassen_tuning_load(path, loaded) != 0);
+    TEST_ASSERT(loaded.classic_i64 == saved.classic_i64);
+
+    unlink(path);
+}
+
+/* Every CPU *_into() product, into a view of a bigger matrix, with alpha and beta. */
+template <typename MatrixType>
+void test_matrix_mul_into()
+{
+    using ValueType = MatrixType::ValueType;
+    using ViewType = matview_base_t<MatrixType>;
+
+    using into_fn = void (*)(ViewType dst, ViewType lhs, ViewType rhs, ValueType alpha, ValueType beta);
+
+    const into_fn backends[] = {
+        [](ViewType d, ViewType l, ViewType r, ValueType a, ValueType b) { mat_mul_cpu_into(d, l, r, a, b); },
+        [](ViewType d, ViewType l, ViewType r, ValueType a, ValueType b) { mat_mul_cpu_naive_into(d, l, r, a, b); },
+        [](ViewType d, ViewType l, ViewType r, ValueType a, ValueType b) { mat_mul_cpu_parallel_into(d, l, r, a, b); },
+        [](ViewType d, ViewType l, ViewType r, ValueType a, ValueType b) { strassen_cpu_into(d, l, r, a, b); },
+        [](ViewType d, ViewType l, ViewType r, ValueType a, ValueType b) { strassen_winograd_cpu_into(d, l, r, a, b); },
+        [](ViewType d, ViewType l, ViewType r, ValueType a, ValueType b) { strassen_cpu_parallel_into(d, l, r, a, b); },
+    };
+
+    constexpr ValueType scales[][2] = {
+        /* alpha, beta */
+        {1,  0},
+        {3,  0},
+        {1,  1},
+        {-2, 3},
+    };
+
+    /* Big enough for Strassen to recurse at the default crossover. */
+    constexpr u32 M = 301, K = 280, N = 259;
+    constexpr u32 x0 = 5, y0 = 3;
+
+    const auto lhs = make_matrix_small_ints<MatrixType>(K, M);
+    const auto rhs = make_matrix_small_ints<MatrixType>(N, K);
+    const auto prod = mat_mul_cpu_naive(lhs, rhs);
+    const auto init = make_matrix_small_ints<MatrixType>(N + 2 * x0, M + 2 * y0);
+
+    for (const auto backend: backends) {
+        for (const auto &[alpha, beta]: scales) {
+            auto big = MatrixType::make_matrix(init.width, init.height);
+            mat_copy(big, init);
+
+            ViewType dst(&big[x0, y0], N, M, big.stride);
+            backend(dst, lhs, rhs, alpha, beta);
+
+            for (u32 y = 0; y < big.height; ++y) {
+                for (u32 x = 0; x < big.width; ++x) {
+                    const bool inside = x >= x0 && x < x0 + N && y >= y0 && y < y0 + M;
+
+                    if (inside)
+                        TEST_ASSERT((big[x, y] == alpha * prod[x - x0, y - y0] + beta * init[x, y]));
+                    else
+                        TEST_ASSERT((big[x, y] == init[x, y]));
+                }
+            }
+        }
+    }
+
+    /* With beta == 0 previous contents are not read, not even NaNs. */
+    if constexpr (std::is_floating_point_v<ValueType>) {
+        auto out = MatrixType::make_matrix(N, M);
+
+        for (u32 y = 0; y < M; ++y)
+            std::fill_n(&out[0, y], N, NAN);
+
+        for (const auto backend: backends) {
+            backend(out, lhs, rhs, 1, 0);
+
+            for (u32 y = 0; y < M; ++y)
+                for (u32 x = 0; x < N; ++x)
+                    TEST_ASSERT((out[x, y] == prod[x, y]));
+        }
+    }
+
+    auto sum = MatrixType::make_matrix(N, M);
+    mat_add_cpu_into(sum, prod, ViewType(const_cast<ValueType*>(&init[0, 0]), N, M, init.stride));
+    mat_sub_cpu_into(sum, sum, prod);
+
+    for (u32 y = 0; y < M; ++y)
+        for (u32 x = 0; x < N; ++x)
+            TEST_ASSERT((sum[x, y] == init[x, y]));
+}
+
+template <typename MatrixType>
+static MatrixType transposed_copy(const MatrixType &m)
+{
+    auto ret = MatrixType::make_matrix(m.height, m.width);
+
+    for (u32 y = 0; y < m.height; ++y)
+        for (u32 x = 0; x < m.width; ++x)
+            ret[y, x] = m[x, y];
+
+    return ret;
+}
+
+/* Products with transposed operands, against the plain product of explicit transposes. */
+template <typename MatrixType>
+void test_matrix_mul_trans()
+{
+    using ViewType = matview_base_t<MatrixType>;
+
+    using into_fn = void (*)(ViewType dst, ViewType lhs, ViewType rhs, mat_trans_e trans);
+
+    const into_fn backends[] = {
+        [](ViewType d, ViewType l, ViewType r, mat_trans_e t) { mat_mul_cpu_into(d, l, r, 1, 0, t); },
+        [](ViewType d, ViewType l, ViewType r, mat_trans_e t) { mat_mul_cpu_naive_into(d, l, r, 1, 0, t); },
+        [](ViewType d, ViewType l, ViewType r, mat_trans_e t) {
+            /* More than one thread, so that the output is actually tiled. */
+            static thread_pool pool(3);
+            mat_mul_cpu_parallel_into(d, l, r, 1, 0, t, &pool);
+        },
+    };
+
+    /* Not multiples of any micro-tile, and more than one KC slice deep. */
+    constexpr u32 M = 133, K = 517, N = 71;
+
+    const auto lhs = make_matrix_small_ints<MatrixType>(K, M);
+    const auto rhs = make_matrix_small_ints<MatrixType>(N, K);
+    const auto lhs_t = transposed_copy(lhs);
+    const auto rhs_t = transposed_copy(rhs);
+    const auto prod = mat_mul_cpu_naive(lhs, rhs);
+
+    const mat_trans_e all_trans[] = {
+        mat_trans_e::none,
+        mat_trans_e::lhs,
+        mat_trans_e::rhs,
+        mat_trans_e::both,
+    };
+
+    for (const auto backend: backends) {
+        for (const auto trans: all_trans) {
+            const auto &l = mat_trans_lhs(trans) ? lhs_t : lhs;
+            const auto &r = mat_trans_rhs(trans) ? rhs_t : rhs;
+
+            auto out = MatrixType::make_matrix(N, M);
+            backend(out, l, r, trans);
+
+            for (u32 y = 0; y < M; ++y)
+                for (u32 x = 0; x < N; ++x)
+                    TEST_ASSERT((out[x, y] == prod[x, y]));
+        }
+    }
+}
+
+/* Lots of small products of all shapes, including empty ones, in one batch. */
+template <typename MatrixType>
+void test_matrix_mul_batched()
+{
+    using ViewType = matview_base_t<MatrixType>;
+
+    constexpr u32 num_products = 500;
+
+    std::vector<MatrixType> lhs, rhs, out, expected;
+    std::vector<mat_mul_batch_entry_t<ViewType>> batch;
+
+    for (u32 i = 0; i < num_products; ++i) {
+        /* Cheap deterministic spread of shapes in 0..64, with 4x4 the most common. */
+        const u32 M = i % 7 ? 4 : (i * 37) % 65;
+        const u32 K = i % 7 ? 4 : (i * 11) % 65;
+        const u32 N = i % 7 ? 4 : (i * 23) % 65;
+
+        lhs.push_back(make_matrix_small_ints<MatrixType>(K, M));
+        rhs.push_back(make_matrix_small_ints<MatrixType>(N, K));
+        out.push_back(MatrixType::make_matrix(N, M));
+        expected.push_back(mat_mul_cpu_naive(lhs.back(), rhs.back()));
+    }
+
+    for (u32 i = 0; i < num_products; ++i)
+        batch.push_back({ lhs[i], rhs[i], out[i] });
+
+    thread_pool pools[] = {
+        thread_pool(1),
+        thread_pool(3),
+    };
+
+    auto check = [&] {
+        for (u32 i = 0; i < num_products; ++i)
+            for (u32 y = 0; y < out[i].height; ++y)
+                for (u32 x = 0; x < out[i].width; ++x)
+                    TEST_ASSERT((out[i][x, y] == expected[i][x, y]));
+    };
+
+    for (auto &pool: pools) {
+        mat_mul_cpu_batched(batch.data(), batch.size(), &pool);
+        check();
+    }
+
+    mat_mul_cpu_batched(batch.data(), batch.size());
+    check();
+
+    /* Single product goes through the tiled parallel GEMM. */
+    mat_mul_cpu_batched(batch.data(), 1, &pools[1]);
+    check();
+
+    mat_mul_cpu_batched(batch.data(), 0);
+}
+
+template <typename ValueType, u32 M, u32 K, u32 N, typename MatrixType = mat_base_t<ValueType>>
+static void test_matrix_fixed_shape()
+{
+    using Lhs = mat_fixed_t<ValueType, M, K>;
+    using Rhs = mat_fixed_t<ValueType, K, N>;
+    using Out = mat_fixed_t<ValueType, M, N>;
+
+    /* Not a multiple of any lane count, so the last group is partial. */
+    constexpr u32 count = 37;
+
+    std::vector<MatrixType> lhs, rhs, expected;
+    std::vector<Lhs> lhs_fixed(count);
+    std::vector<Rhs> rhs_fixed(count);
+    std::vector<Out> out_fixed(count);
+
+    for (u32 i = 0; i < count; ++i) {
+        lhs.push_back(make_matrix_small_ints<MatrixType>(K, M));
+        rhs.push_back(make_matrix_small_ints<MatrixType>(N, K));
+        expected.push_back(mat_mul_cpu_naive(lhs[i], rhs[i]));
+
+        lhs_fixed[i] = Lhs::from_view(matview_base_t<MatrixType>(lhs[i]));
+        rhs_fixed[i] = Rhs::from_view(matview_base_t<MatrixType>(rhs[i]));
+    }
+
+    auto check = [&](const Out &out, const MatrixType &ref) {
+        for (u32 y = 0; y < M; ++y)
+            for (u32 x = 0; x < N; ++x)
+                TEST_ASSERT((out[x, y] == ref[x, y]));
+    };
+
+    for (u32 i = 0; i < count; ++i)
+        check(lhs_fixed[i] * rhs_fixed[i], expected[i]);
+
+    mat_fixed_mul_batch(lhs_fixed.data(), rhs_fixed.data(), out_fixed.data(), count);
+    for (u32 i = 0; i < count; ++i)
+        check(out_fixed[i], expected[i]);
+
+    /* One transform for all. */
+    mat_fixed_transform(lhs_fixed[0], rhs_fixed.data(), out_fixed.data(), count);
+    for (u32 i = 0; i < count; ++i)
+        check(out_fixed[i], mat_mul_cpu_naive(lhs[0], rhs[i]));
+
+    /* The same through SoA groups, the last one partially filled. */
+    using LhsGroup = mat_fixed_soa_t<ValueType, M, K>;
+    using RhsGroup = mat_fixed_soa_t<ValueType, K, N>;
+    using OutGroup = mat_fixed_soa_t<ValueType, M, N>;
+    constexpr u32 lanes = LhsGroup::lanes;
+    constexpr u32 num_groups = (count + lanes - 1) / lanes;
+
+    std::vector<LhsGroup> lhs_groups(num_groups);
+    std::vector<RhsGroup> rhs_groups(num_groups);
+    std::vector<OutGroup> out_groups(num_groups);
+
+    for (u32 g = 0; g < num_groups; ++g) {
+        const u32 n = std::min(lanes, count - g * lanes);
+
+        lhs_groups[g] = LhsGroup::load(&lhs_fixed[g * lanes], n);
+        rhs_groups[g] = RhsGroup::load(&rhs_fixed[g * lanes], n);
+    }
+
+    auto check_groups = [&](auto ref) {
+        for (u32 g = 0; g < num_groups; ++g) {
+            const u32 n = std::min(lanes, count - g * lanes);
+
+            out_groups[g].store(&out_fixed[g * lanes], n);
+
+            for (u32 i = 0; i < n; ++i)
+                check(out_fixed[g * lanes + i], ref(g * lanes + i));
+        }
+    };
+
+    mat_fixed_mul_batch(lhs_groups.data(), rhs_groups.data(), out_groups.data(), num_groups);
+    check_groups([&](u32 i) { return mat_mul_cpu_naive(lhs[i], rhs[i]); });
+
+    mat_fixed_transform(lhs_fixed[0], rhs_groups.data(), out_groups.data(), num_groups);
+    check_groups([&](u32 i) { return mat_mul_cpu_naive(lhs[0], rhs[i]); });
+
+    /* And back into a view. */
+    auto out = MatrixType::make_matrix(N, M);
+    out_fixed[0].store(matview_base_t<MatrixType>(out));
+    check(out_fixed[0], out);
+}
+
+/* Compile time sized products, one at a time and in SoA groups. */
+template <typename MatrixType>
+void test_matrix_fixed()
+{
+    using ValueType = MatrixType::ValueType;
+
+    test_matrix_fixed_shape<ValueType, 4, 4, 4>();
+    test_matrix_fixed_shape<ValueType, 8, 8, 8>();
+    test_matrix_fixed_shape<ValueType, 4, 4, 1>();
+    test_matrix_fixed_shape<ValueType, 3, 5, 2>();
+    test_matrix_fixed_shape<ValueType, 1, 1, 1>();
+}
+
+/* Products where one side is a vector, and rank-1 updates. */
+template <typename MatrixType>
+void test_matrix_gemv()
+{
+    using ValueType = MatrixType::ValueType;
+    using ViewType = matview_base_t<MatrixType>;
+
+    using into_fn = void (*)(ViewType dst, ViewType lhs, ViewType rhs, ValueType alpha, ValueType beta, mat_trans_e trans);
+
+    const into_fn backends[] = {
+        [](ViewType d, ViewType l, ViewType r, ValueType a, ValueType b, mat_trans_e t) { mat_mul_cpu_into(d, l, r, a, b, t); },
+        [](ViewType d, ViewType l, ViewType r, ValueType a, ValueType b, mat_trans_e t) {
+            static thread_pool pool(3);
+            mat_mul_cpu_parallel_into(d, l, r, a, b, t, &pool);
+        },
+    };
+
+    /* Last two are big enough to be split across the pool. */
+    constexpr u32 shapes[][3] = {
+        /* M,   K,   N */
+        {1,    1,   1   },
+        {300,  517, 1   },
+        {1,    517, 300 },
+        {1,    33,  1   },
+        {1000, 700, 1   },
+        {1,    700, 1000},
+    };
+
+    constexpr ValueType scales[][2] = {
+        /* alpha, beta */
+        {1,  0},
+        {-2, 3},
+    };
+
+    const mat_trans_e all_trans[] = {
+        mat_trans_e::none,
+        mat_trans_e::lhs,
+        mat_trans_e::rhs,
+        mat_trans_e::both,
+    };
+
+    for (const auto &[M, K, N]: shapes) {
+        const auto lhs = make_matrix_small_ints<MatrixType>(K, M);
+        const auto rhs = make_matrix_small_ints<MatrixType>(N, K);
+        const auto lhs_t = transposed_copy(lhs);
+        const auto rhs_t = transposed_copy(rhs);
+        const auto prod = mat_mul_cpu_naive(lhs, rhs);
+        const auto init = make_matrix_small_ints<MatrixType>(N, M);
+
+        for (const auto backend: backends) {
+            for (const auto trans: all_trans) {
+                for (const auto &[alpha, beta]: scales) {
+                    const auto &l = mat_trans_lhs(trans) ? lhs_t : lhs;
+                    const auto &r = mat_trans_rhs(trans) ? rhs_t : rhs;
+
+                    auto out = MatrixType::make_matrix(N, M);
+                    mat_copy(out, init);
+
+                    backend(out, l, r, alpha, beta, trans);
+
+                    for (u32 y = 0; y < M; ++y)
+                        for (u32 x = 0; x < N; ++x)
+                            TEST_ASSERT((out[x, y] == alpha * prod[x, y] + beta * init[x, y]));
+                }
+            }
+        }
+    }
+
+    /* dst += alpha * x @ y^T, with x and y as both rows and columns. */
+    for (const auto &[M, N]: {std::pair{1u, 1u}, {37u, 53u}, {400u, 400u}}) {
+        const auto x_col = make_matrix_small_ints<MatrixType>(1, M);
+        const auto y_col = make_matrix_small_ints<MatrixType>(1, N);
+        const auto x_row = transposed_copy(x_col);
+        const auto y_row = transposed_copy(y_col);
+        const auto init = make_matrix_small_ints<MatrixType>(N, M);
+
+        thread_pool pool(3);
+
+        for (const bool x_is_col: {true, false}) {
+            for (const bool y_is_col: {true, false}) {
+                auto dst = MatrixType::make_matrix(N, M);
+                mat_copy(dst, init);
+
+                mat_rank1_cpu_into(dst, x_is_col ? x_col : x_row, y_is_col ? y_col : y_row, -2, &pool);
+
+                for (u32 y = 0; y < M; ++y)
+                    for (u32 x = 0; x < N; ++x)
+                        TEST_ASSERT((dst[x, y] == init[x, y] - 2 * x_col[0, y] * y_col[0, x]));
+            }
+        }
+    }
+}
+
+/* Fused expressions against the same chain done one operation at a time. */
+template <typename MatrixType>
+void test_matrix_expr()
+{
+    using ValueType = MatrixType::ValueType;
+    using ViewType = matview_base_t<MatrixType>;
+
+    /* Widths around the packet sizes, to hit both the packet and the tail loop. */
+    for (const u32 width: {1u, 15u, 16u, 17u, 37u, 100u}) {
+        constexpr u32 height = 9;
+
+        const auto a = make_matrix_small_ints<MatrixType>(width, height);
+        const auto b = make_matrix_small_ints<MatrixType>(width, height);
+        const auto c = make_matrix_small_ints<MatrixType>(width, height);
+        const auto d = make_matrix_small_ints<MatrixType>(width, height);
+
+        auto out = MatrixType::make_matrix(width, height);
+
+        mat_eval(out, mat_expr(a) + b - c + d);
+        const auto expected = mat_add_cpu(mat_sub_cpu(mat_add_cpu(a, b), c), d);
+
+        for (u32 y = 0; y < height; ++y)
+            for (u32 x = 0; x < width; ++x)
+                TEST_ASSERT((out[x, y] == expected[x, y]));
+
+        mat_eval(out, ValueType(3) * (mat_expr(a) - b) - mat_expr(c) * ValueType(2));
+
+        for (u32 y = 0; y < height; ++y)
+            for (u32 x = 0; x < width; ++x)
+                TEST_ASSERT((out[x, y] == 3 * (a[x, y] - b[x, y]) - c[x, y] * 2));
+
+        /* In place, destination is also an operand. */
+        mat_eval(out, -mat_expr(out) + a);
+
+        for (u32 y = 0; y < height; ++y)
+            for (u32 x = 0; x < width; ++x)
+                TEST_ASSERT((out[x, y] == a[x, y] - 3 * (a[x, y] - b[x, y]) + c[x, y] * 2));
+
+        /* Sub-views, with the stride of the parent. */
+        if (width < 2)
+            continue;
+
+        const u32 hw = width / 2;
+        const ViewType a_right(const_cast<ValueType*>(&a[width - hw, 0]), hw, height, a.stride);
+        ViewType out_left(&out[0, 0], hw, height, out.stride);
+
+        mat_eval(out_left, mat_expr(a_right) + a_right);
+
+        for (u32 y = 0; y < height; ++y)
+            for (u32 x = 0; x < hw; ++x)
+                TEST_ASSERT((out[x, y] == 2 * a[width - hw + x, y]));
+    }
+}
+
+/* Runs GEMM, add and sub kernels of every ISA level the host supports. */
+template <typename MatrixType>
+void test_matrix_isa_variants()
+{
+    using ValueType = MatrixType::ValueType;
+
+    constexpr u32 M = 67, K = 301, N = 45;
+
+    const auto lhs = make_matrix_small_ints<MatrixType>(K, M);
+    const auto rhs = make_matrix_small_ints<MatrixType>(N, K);
+    const auto expected = mat_mul_cpu_naive(lhs, rhs);
+
+    const auto lhs_sq = make_matrix_small_ints<MatrixType>(N, M);
+    const auto rhs_sq = make_matrix_small_ints<MatrixType>(N, M);
+
+    for (const auto isa: {cpu_isa_e::generic, cpu_isa_e::avx2, cpu_isa_e::avx512}) {
+        if (ucast(isa) > ucast(cpu_isa_detect()))
+            break;
+
+        const auto &kernels = cpu_kernels<ValueType>(isa);
+        TEST_ASSERT(kernels.isa == isa);
+
+        auto out = MatrixType::make_matrix(N, M);
+        gemm_cpu_blocked(out, lhs, rhs, kernels);
+
+        for (u32 y = 0; y < M; ++y)
+            for (u32 x = 0; x < N; ++x)
+                TEST_ASSERT((out[x, y] == expected[x, y]));
+
+        for (u32 y = 0; y < M; ++y) {
+            kernels.add_row(&out[0, y], &lhs_sq[0, y], &rhs_sq[0, y], N);
+
+            for (u32 x = 0; x < N; ++x)
+                TEST_ASSERT((out[x, y] == lhs_sq[x, y] + rhs_sq[x, y]));
+
+            kernels.sub_row(&out[0, y], &lhs_sq[0, y], &rhs_sq[0, y], N);
+
+            for (u32 x = 0; x < N; ++x)
+                TEST_ASSERT((out[x, y] == lhs_sq[x, y] - rhs_sq[x, y]));
+        }
+
+        /* Lengths around every vector width and unroll factor. */
+        for (const u32 n: {0u, 1u, 7u, 8u, 15u, 16u, 17u, 33u, 63u, 64u, 65u, 200u}) {
+            ValueType dot = 0;
+            for (u32 i = 0; i < n; ++i)
+                dot += lhs_sq.data[i] * rhs_sq.data[i];
+
+            TEST_ASSERT(kernels.dot_row(lhs_sq.data.get(), rhs_sq.data.get(), n) == dot);
+
+            std::vector<ValueType> y(rhs_sq.data.get(), rhs_sq.data.get() + n + 1);
+            kernels.axpy_row(y.data(), 3, lhs_sq.data.get(), n);
+
+            for (u32 i = 0; i < n; ++i)
+                TEST_ASSERT((y[i] == rhs_sq.data[i] + 3 * lhs_sq.data[i]));
+
+            TEST_ASSERT(y[n] == rhs_sq.data[n]);
+        }
+
+        /* Matrix-vector shapes go through dot_row and axpy_row. */
+        const auto xs = make_matrix_small_ints<MatrixType>(1, K);
+        const auto ys = mat_mul_cpu_naive(lhs, xs);
+        auto out_vec = MatrixType::make_matrix(1, M);
+        gemm_cpu_blocked(out_vec, lhs, xs, kernels);
+
+        for (u32 y = 0; y < M; ++y)
+            TEST_ASSERT((out_vec[0, y] == ys[0, y]));
+    }
+}
+
+/* Bits of 'v' after a round trip through f32, NaNs compare by class only. */
+template <typename HalfType>
+static bool half_same(const HalfType a, const HalfType b)
+{
+    const f32 fa = a;
+    const f32 fb = b;
+
+    return (fa != fa && fb != fb) || a.bits == b.bits;
+}
+
+/* Half width conversions and products, against f32 on exactly representable values. */
+template <typename HalfMatrixType>
+void test_matrix_half()
+{
+    using HalfType = HalfMatrixType::ValueType;
+    using HalfViewType = matview_base_t<HalfMatrixType>;
+
+    constexpr bool is_f16 = std::is_same_v<HalfType, f16>;
+
+    /* Every half value survives a round trip through f32. */
+    for (u32 bits = 0; bits <= 0xffff; ++bits) {
+        const HalfType h = HalfType::from_bits(u16(bits));
+        TEST_ASSERT(half_same(HalfType(f32(h)), h));
+    }
+
+    /* Rounding: ties go to even, overflow to infinity. */
+    if constexpr (is_f16) {
+        TEST_ASSERT(HalfType(1.0f + 0x1p-11f).bits == 0x3c00);
+        TEST_ASSERT(HalfType(1.0f + 0x3p-11f).bits == 0x3c02);
+        TEST_ASSERT(HalfType(65520.0f).bits == 0x7c00);
+        TEST_ASSERT(HalfType(65519.0f).bits == 0x7bff);
+        TEST_ASSERT(HalfType(0x1p-24f).bits == 0x0001);
+    } else {
+        TEST_ASSERT(HalfType(1.0f + 0x1p-8f).bits == 0x3f80);
+        TEST_ASSERT(HalfType(1.0f + 0x3p-8f).bits == 0x3f82);
+        TEST_ASSERT(HalfType(0x1.fffffep127f).bits == 0x7f80);
+    }
+
+    /* Normal f32 values, for which every conversion kernel has to agree with the scalar one. */
+    std::vector<f32> values;
+    for (u32 i = 0; i < 1000; ++i)
+        values.push_back(f32_from_bits(u32((rand() % 0xfc) + 1) << 23 | (u32(rand()) & 0x807fffff)));
+    values.push_back(-0.0f);
+    values.push_back(INFINITY);
+    values.push_back(NAN);
+
+    for (const auto isa: {cpu_isa_e::generic, cpu_isa_e::avx2, cpu_isa_e::avx512}) {
+        if (ucast(isa) > ucast(cpu_isa_detect()))
+            break;
+
+        const auto &cvt = cpu_cvt_kernels(isa);
+
+        for (const u32 n: {0u, 1u, 7u, 8u, 15u, 16u, 17u, 33u, u32(values.size())}) {
+            std::vector<HalfType> h(n + 1, HalfType::from_bits(0x1234));
+            std::vector<f32> f(n + 1, 7.0f);
+
+            cpu_cvt_row(cvt, h.data(), values.data(), n);
+
+            for (u32 i = 0; i < n; ++i)
+                TEST_ASSERT(half_same(h[i], HalfType(values[i])));
+
+            TEST_ASSERT(h[n].bits == 0x1234);
+
+            cpu_cvt_row(cvt, f.data(), h.data(), n);
+
+            for (u32 i = 0; i < n; ++i)
+                TEST_ASSERT((f32_bits(f[i]) == f32_bits(f32(h[i])) || f[i] != f[i]));
+
+            TEST_ASSERT(f[n] == 7.0f);
+        }
+    }
+
+    /* Small integers are exact in both, so products have to match f32 ones exactly. */
+    constexpr u32 shapes[][3] = {
+        /* M,   K,   N */
+        {1,    1,   1  },
+        {67,   301, 45 },
+        {100,  600, 130},
+        {1,    300, 77 },
+        {77,   300, 1  },
+    };
+
+    const mat_trans_e all_trans[] = {
+        mat_trans_e::none,
+        mat_trans_e::lhs,
+        mat_trans_e::rhs,
+        mat_trans_e::both,
+    };
+
+    thread_pool pool(3);
+
+    for (const auto &[M, K, N]: shapes) {
+        const auto lhs = make_matrix_small_ints<mat_f32_t>(K, M);
+        const auto rhs = make_matrix_small_ints<mat_f32_t>(N, K);
+        const auto init = make_matrix_small_ints<mat_f32_t>(N, M);
+        const auto prod = mat_mul_cpu_naive(lhs, rhs);
+
+        auto lhs_h = HalfMatrixType::make_matrix(K, M);
+        auto rhs_h = HalfMatrixType::make_matrix(N, K);
+        mat_convert(lhs_h, lhs);
+        mat_convert(rhs_h, rhs);
+
+        const auto lhs_ht = transposed_copy(lhs_h);
+        const auto rhs_ht = transposed_copy(rhs_h);
+
+        const auto plain = mat_mul_cpu(HalfViewType(lhs_h), HalfViewType(rhs_h));
+
+        for (u32 y = 0; y < M; ++y)
+            for (u32 x = 0; x < N; ++x)
+                TEST_ASSERT((plain[x, y] == prod[x, y]));
+
+        for (const auto trans: all_trans) {
+            const auto &l = mat_trans_lhs(trans) ? lhs_ht : lhs_h;
+            const auto &r = mat_trans_rhs(trans) ? rhs_ht : rhs_h;
+
+            auto out = mat_f32_t::make_matrix(N, M);
+            mat_copy(out, init);
+            mat_mul_cpu_into(out, l, r, -2, 3, trans);
+
+            auto out_par = mat_f32_t::make_matrix(N, M);
+            mat_copy(out_par, init);
+            mat_mul_cpu_parallel_into(out_par, l, r, -2, 3, trans, &pool);
+
+            for (u32 y = 0; y < M; ++y) {
+                for (u32 x = 0; x < N; ++x) {
+                    TEST_ASSERT((out[x, y] == -2 * prod[x, y] + 3 * init[x, y]));
+                    TEST_ASSERT((out_par[x, y] == out[x, y]));
+                }
+            }
+        }
+
+        for (const auto isa: {cpu_isa_e::generic, cpu_isa_e::avx2, cpu_isa_e::avx512}) {
+            if (ucast(isa) > ucast(cpu_isa_detect()))
+                break;
+
+            auto out = mat_f32_t::make_matrix(N, M);
+            gemm_cpu_blocked(out, lhs_h, rhs_h, cpu_kernels<f32>(isa));
+
+            for (u32 y = 0; y < M; ++y)
+                for (u32 x = 0; x < N; ++x)
+                    TEST_ASSERT((out[x, y] == prod[x, y]));
+        }
+
+        /* And back to half width. */
+        auto back = HalfMatrixType::make_matrix(N, M);
+        mat_convert(back, plain);
+
+        for (u32 y = 0; y < M; ++y)
+            for (u32 x = 0; x < N; ++x)
+                TEST_ASSERT((back[x, y].bits == HalfType(prod[x, y]).bits));
+    }
+}
+
+/* Matrix of random values over the full range of the (u8 or i8) value type. */
+template <typename MatrixType>
+static MatrixType make_matrix_random_bytes(const u32 width, const u32 height)
+{
+    using ValueType = MatrixType::ValueType;
+
+    auto ret = MatrixType::make_matrix(width, height);
+
+    for (u32 y = 0; y < height; ++y)
+        for (u32 x = 0; x < width; ++x)
+            ret[x, y] = ValueType(rand());
+
+    return ret;
+}
+
+template <typename MatrixType>
+static mat_i64_t to_i64(const MatrixType &m, const i32 offset = 0)
+{
+    auto ret = mat_i64_t::make_matrix(m.width, m.height);
+
+    for (u32 y = 0; y < m.height; ++y)
+        for (u32 x = 0; x < m.width; ++x)
+            ret[x, y] = i64(m[x, y]) - offset;
+
+    return ret;
+}
+
+/* Quantized products against the i64 ones, which are exact for any K here. */
+void test_matrix_q8()
+{
+    constexpr u32 shapes[][3] = {
+        /* M,   K,    N */
+        {1,    1,    1  },
+        {7,    3,    5  },
+        {67,   301,  45 },
+        {130,  1100, 70 },
+        {1,    517,  77 },
+    };
+
+    const mat_trans_e all_trans[] = {
+        mat_trans_e::none,
+        mat_trans_e::lhs,
+        mat_trans_e::rhs,
+        mat_trans_e::both,
+    };
+
+    for (const auto &[M, K, N]: shapes) {
+        const auto lhs = make_matrix_random_bytes<mat_u8_t>(K, M);
+        const auto rhs = make_matrix_random_bytes<mat_i8_t>(N, K);
+        const auto lhs_t = transposed_copy(lhs);
+        const auto rhs_t = transposed_copy(rhs);
+
+        const auto prod = mat_mul_cpu_naive(to_i64(lhs), to_i64(rhs));
+
+        /* Raw i32 product, every kernel and operand layout. */
+        for (const auto isa: {cpu_isa_e::generic, cpu_isa_e::avx2, cpu_isa_e::avx512}) {
+            if (ucast(isa) > ucast(cpu_isa_detect()))
+                break;
+
+            for (const auto trans: all_trans) {
+                const auto &l = mat_trans_lhs(trans) ? lhs_t : lhs;
+                const auto &r = mat_trans_rhs(trans) ? rhs_t : rhs;
+
+                auto out = mat_i32_t::make_matrix(N, M);
+                gemm_q8_cpu(out, l, r, cpu_q8_kernels(isa), trans);
+
+                for (u32 y = 0; y < M; ++y)
+                    for (u32 x = 0; x < N; ++x)
+                        TEST_ASSERT((out[x, y] == prod[x, y]));
+            }
+        }
+
+        auto out_i32 = mat_i32_t::make_matrix(N, M);
+        mat_mul_cpu_into(out_i32, lhs, rhs);
+
+        for (u32 y = 0; y < M; ++y)
+            for (u32 x = 0; x < N; ++x)
+                TEST_ASSERT((out_i32[x, y] == prod[x, y]));
+
+        /* Zero points and scales, per tensor and per row, in f32 and requantized to i8. */
+        for (const bool per_row: {false, true}) {
+            const u32 lhs_params = per_row ? M : 1;
+            const u32 rhs_params = per_row ? N : 1;
+
+            std::vector<f32> lhs_scale, rhs_scale, dst_scale;
+            std::vector<i32> lhs_zp, rhs_zp, dst_zp;
+
+            for (u32 i = 0; i < lhs_params; ++i) {
+                lhs_scale.push_back(f32(1 + rand() % 4) / 64);
+                lhs_zp.push_back(rand() % 256);
+                dst_scale.push_back(f32(K) * (1 + rand() % 4));
+                dst_zp.push_back(rand() % 256 - 128);
+            }
+
+            for (u32 i = 0; i < rhs_params; ++i) {
+                rhs_scale.push_back(f32(1 + rand() % 4) / 32);
+                rhs_zp.push_back(rand() % 256 - 128);
+            }
+
+            /* Per row rhs parameters only work with rhs transposed. */
+            for (const auto trans: per_row ? std::vector{mat_trans_e::rhs} : std::vector(std::begin(all_trans), std::end(all_trans))) {
+                const auto &l = mat_trans_lhs(trans) ? lhs_t : lhs;
+                const auto &r = mat_trans_rhs(trans) ? rhs_t : rhs;
+
+                const matview_quant_u8_t ql(l, lhs_scale.data(), lhs_zp.data(), per_row);
+                const matview_quant_i8_t qr(r, rhs_scale.data(), rhs_zp.data(), per_row);
+
+                auto out = mat_f32_t::make_matrix(N, M);
+                mat_mul_cpu_into(out, ql, qr, trans);
+
+                auto out_q = mat_i8_t::make_matrix(N, M);
+                mat_mul_cpu_into(matview_quant_i8_t(out_q, dst_scale.data(), dst_zp.data(), per_row), ql, qr, trans);
+
+                for (u32 y = 0; y < M; ++y) {
+                    for (u32 x = 0; x < N; ++x) {
+                        const i64 za = lhs_zp[per_row ? y : 0];
+                        const i64 zb = rhs_zp[per_row ? x : 0];
+
+                        i64 sum = 0;
+                        for (u32 k = 0; k < K; ++k)
+                            sum += (i64(lhs[k, y]) - za) * (i64(rhs[x, k]) - zb);
+
+                        const f32 real = f32(sum) * lhs_scale[per_row ? y : 0] * rhs_scale[per_row ? x : 0];
+                        TEST_ASSERT((out[x, y] == real));
+
+                        const f32 q = std::nearbyint(real / dst_scale[per_row ? y : 0]) + f32(dst_zp[per_row ? y : 0]);
+                        TEST_ASSERT((out_q[x, y] == i8(std::clamp(q, -128.0f, 127.0f))));
+                    }
+                }
+            }
+        }
+    }
+
+    /* Quantization round trip, off by half a step at most. Zero stays exact. */
+    for (const bool per_row: {false, true}) {
+        auto src = mat_f32_t::make_matrix(37, 11);
+
+        for (u32 y = 0; y < src.height; ++y)
+            for (u32 x = 0; x < src.width; ++x)
+                src[x, y] = x == 3 ? 0.0f : f32(rand() % 20001 - 5000) / 1000 * f32(y + 1);
+
+        const auto qu = mat_quantize_u8(src, per_row);
+        const auto qi = mat_quantize_i8(src, per_row);
+
+        TEST_ASSERT(qu.scale.size() == (per_row ? src.height : 1));
+        TEST_ASSERT(qi.scale.size() == (per_row ? src.height : 1));
+
+        auto back_u = mat_f32_t::make_matrix(src.width, src.height);
+        auto back_i = mat_f32_t::make_matrix(src.width, src.height);
+        mat_dequantize(back_u, qu);
+        mat_dequantize(back_i, qi);
+
+        for (u32 y = 0; y < src.height; ++y) {
+            const f32 su = qu.scale[per_row ? y : 0];
+            const f32 si = qi.scale[per_row ? y : 0];
+
+            for (u32 x = 0; x < src.width; ++x) {
+                TEST_ASSERT(std::abs(back_u[x, y] - src[x, y]) <= su * 0.501f);
+                TEST_ASSERT(std::abs(back_i[x, y] - src[x, y]) <= si * 0.501f);
+            }
+
+            TEST_ASSERT((back_u[3, y] == 0.0f));
+            TEST_ASSERT((back_i[3, y] == 0.0f));
+        }
+    }
+}
+
+/* Small integers with about 'density' of them nonzero, in clusters of (cluster x cluster). */
+static mat_f32_t make_matrix_sparse(const u32 width, const u32 height, const f32 density, const u32 cluster = 1)
+{
+    auto m = mat_f32_t::make_matrix(width, height);
+
+    for (u32 y = 0; y < height; ++y)
+        for (u32 x = 0; x < width; ++x)
+            m[x, y] = 0;
+
+    for (u32 y = 0; y < height; y += cluster) {
+        for (u32 x = 0; x < width; x += cluster) {
+            if (rand() % 1000 >= density * 1000)
+                continue;
+
+            for (u32 i = y; i < std::min(y + cluster, height); ++i)
+                for (u32 j = x; j < std::min(x + cluster, width); ++j)
+                    m[j, i] = f32(rand() % 8 + 1) * (rand() % 2 ? 1 : -1);
+        }
+    }
+
+    return m;
+}
+
+static bool matrices_same(const mat_f32_t &a, const mat_f32_t &b)
+{
+    if (a.width != b.width || a.height != b.height)
+        return false;
+
+    for (u32 y = 0; y < a.height; ++y)
+        for (u32 x = 0; x < a.width; ++x)
+            if (a[x, y] != b[x, y])
+                return false;
+
+    return true;
+}
+
+/* Sparse products against the naive dense one, exact on small integers. */
+void test_matrix_sparse()
+{
+    constexpr u32 shapes[][3] = {
+        /* M,   K,   N */
+        {1,    1,   1  },
+        {37,   53,  70 },
+        {130,  300, 129},
+        {64,   256, 256},
+        {9,    512, 33 },
+    };
+
+    constexpr u32 blocks[][2] = {
+        {1, 1},
+        {4, 4},
+        {3, 5},
+        {8, 2},
+    };
+
+    const cpu_isa_e prev_isa = cpu_isa();
+    thread_pool pool(3);
+
+    for (const auto &[M, K, N]: shapes) {
+        for (const f32 density: {0.0f, 0.05f, 0.3f, 1.0f}) {
+            const auto lhs = make_matrix_sparse(K, M, density, 2);
+            const auto rhs = make_matrix_small_ints<mat_f32_t>(N, K);
+            const auto init = make_matrix_small_ints<mat_f32_t>(N, M);
+            const auto prod = mat_mul_cpu_naive(lhs, rhs);
+
+            const auto csr = mat_to_csr(lhs);
+            auto back = mat_f32_t::make_matrix(K, M);
+
+            TEST_ASSERT(csr.nnz() == size_t(std::llround(mat_density(lhs) * M * K)));
+            mat_to_dense(back, csr);
+            TEST_ASSERT(matrices_same(back, lhs));
+
+            auto check = [&](const auto &sparse) {
+                for (const auto isa: {cpu_isa_e::generic, cpu_isa_e::avx2, cpu_isa_e::avx512}) {
+                    if (cpu_isa_set(isa))
+                        break;
+
+                    for (thread_pool *p: {&pool, (thread_pool*)nullptr}) {
+                        auto out = mat_f32_t::make_matrix(N, M);
+                        mat_copy(out, init);
+                        mat_mul_cpu_into(out, sparse, rhs, -2, 3, p);
+
+                        for (u32 y = 0; y < M; ++y)
+                            for (u32 x = 0; x < N; ++x)
+                                TEST_ASSERT((out[x, y] == -2 * prod[x, y] + 3 * init[x, y]));
+                    }
+
+                    auto out = mat_f32_t::make_matrix(N, M);
+                    for (u32 y = 0; y < M; ++y)
+                        for (u32 x = 0; x < N; ++x)
+                            out[x, y] = NAN;
+
+                    mat_mul_cpu_into(out, sparse, rhs);
+                    TEST_ASSERT(matrices_same(out, prod));
+                }
+
+                cpu_isa_set(prev_isa);
+            };
+
+            check(csr);
+
+            for (const auto &[bh, bw]: blocks) {
+                const auto bsr = mat_to_bsr(lhs, bh, bw);
+
+                mat_to_dense(back, bsr);
+                TEST_ASSERT(matrices_same(back, lhs));
+                TEST_ASSERT(bsr.values.size() == bsr.num_blocks() * bh * bw);
+
+                check(bsr);
+            }
+
+            check(mat_sparse_prepare(lhs));
+        }
+    }
+
+    /* Format picked by density and structure. */
+    TEST_ASSERT(mat_sparse_prepare(make_matrix_sparse(256, 256, 0.05f, 4)).format == mat_sparse_format_e::bsr);
+    TEST_ASSERT(mat_sparse_prepare(make_matrix_sparse(256, 256, 0.05f, 1)).format == mat_sparse_format_e::csr);
+    TEST_ASSERT(mat_sparse_prepare(make_matrix_sparse(256, 256, 0.9f, 1)).format == mat_sparse_format_e::dense);
+}
+
+static bool is_aligned(const void *p, const size_t alignment)
+{
+    return (uintptr_t(p) & (alignment - 1)) == 0;
+}
+
+/* Matrix memory: alignment, statistics, huge pages and a custom allocator. */
+void test_mat_alloc()
+{
+    const mat_alloc_config_t prev_config = mat_alloc_config();
+    const mat_allocator_t &prev_allocator = mat_allocator();
+
+    /* The default allocator, whichever one the tests run with. */
+    mat_allocator_set(nullptr);
+
+    for (const u32 width: {1u, 3u, 17u, 100u, 1000u}) {
+        const auto a = mat_f32_t::make_matrix(width, 7);
+        const auto b = mat_u8_t::make_matrix(width, 3);
+
+        TEST_ASSERT(is_aligned(a.data.get(), 64));
+        TEST_ASSERT(is_aligned(b.data.get(), 64));
+
+        /* Zeroed, padding included. */
+        for (size_t i = 0; i < a.num_elems(); ++i)
+            TEST_ASSERT(a.data[i] == 0);
+    }
+
+    /* Stats count every matrix, moves don't. */
+    const mat_alloc_stats_t before = mat_alloc_stats();
+    {
+        auto a = mat_f32_t::make_matrix(10, 10);
+        auto b = mat_f32_t::make_matrix(20, 10);
+        auto c = std::move(a);
+
+        const mat_alloc_stats_t during = mat_alloc_stats();
+        TEST_ASSERT(during.num_allocs == before.num_allocs + 2);
+        TEST_ASSERT(during.bytes_live == before.bytes_live + c.size_bytes() + b.size_bytes());
+        TEST_ASSERT(during.bytes_peak >= during.bytes_live);
+        TEST_ASSERT(during.bytes_total == before.bytes_total + c.size_bytes() + b.size_bytes());
+    }
+    const mat_alloc_stats_t after = mat_alloc_stats();
+    TEST_ASSERT(after.num_frees == before.num_frees + 2);
+    TEST_ASSERT(after.bytes_live == before.bytes_live);
+
+    mat_alloc_configure({ .alignment = 4096 });
+    {
+        const auto a = mat_i64_t::make_matrix(3, 3);
+        TEST_ASSERT(is_aligned(a.data.get(), 4096));
+    }
+
+    /* Huge page modes, hugetlb falls back when no pages are reserved. THP may be disabled. */
+    for (const auto mode: {mat_huge_pages_e::transparent, mat_huge_pages_e::hugetlb}) {
+        mat_alloc_configure({ .huge_pages = mode, .huge_pages_min_bytes = 1 << 20 });
+
+        const auto small = mat_f32_t::make_matrix(64, 64);
+        auto big = mat_f32_t::make_matrix(1024, 1024);
+
+        TEST_ASSERT(is_aligned(small.data.get(), 64));
+        TEST_ASSERT(is_aligned(big.data.get(), 2 << 20));
+        TEST_ASSERT(!(small.data.get_deleter().flags & MAT_BLOCK_HUGE_PAGES));
+
+        big.data[big.num_elems() - 1] = 1;
+    }
+
+    mat_alloc_configure(prev_config);
+
+    /* Pluggable allocator, matrices go back to the one they came from. */
+    struct counting_allocator {
+        static mat_block_t alloc(const mat_allocator_t *self, const size_t size_bytes, const bool zeroed)
+        {
+            ++*static_cast<i32*>(self->ctx);
+            return mat_allocator_default().alloc(&mat_allocator_default(), size_bytes, zeroed);
+        }
+
+        static void free(const mat_allocator_t *self, const mat_block_t &block)
+        {
+            --*static_cast<i32*>(self->ctx);
+            mat_allocator_default().free(&mat_allocator_default(), block);
+        }
+    };
+
+    i32 outstanding = 0;
+    const mat_allocator_t counting = {
+        .alloc = counting_allocator::alloc,
+        .free = counting_allocator::free,
+        .ctx = &outstanding,
+    };
+
+    {
+        mat_allocator_set(&counting);
+        auto a = mat_f32_t::make_matrix(5, 5);
+        auto b = mat_f16_t::make_matrix(5, 5);
+        mat_allocator_set(nullptr);
+
+        auto c = mat_f32_t::make_matrix(5, 5);
+
+        TEST_ASSERT(outstanding == 2);
+        TEST_ASSERT(&mat_allocator() == &mat_allocator_default());
+    }
+
+    TEST_ASSERT(outstanding == 0);
+
+    mat_allocator_set(&prev_allocator);
+}
+
+void test_matrix_init_modes()
+{
+    const mat_alloc_config_t prev_config = mat_alloc_config();
+    const mat_allocator_t &prev_allocator = mat_allocator();
+
+    /* The default allocator, whichever one the tests run with. */
+    mat_allocator_set(nullptr);
+
+    const auto zeros = [](const auto &m) {
+        return std::all_of(m.data.get(), m.data.get() + m.num_elems(), [](const auto v) { return v == 0; });
+    };
+
+    for (const size_t alignment: {size_t(64), size_t(16384), size_t(2 << 20)}) {
+        mat_alloc_configure({ .alignment = alignment, .zeroed_mmap_min_bytes = 1 << 20 });
+
+        /* Small ones get cleared by mat_alloc(), big ones are fresh pages. */
+        const mat_alloc_stats_t before = mat_alloc_stats();
+        const auto small = mat_f32_t::make_matrix(100, 100);
+        const mat_alloc_stats_t after_small = mat_alloc_stats();
+        const auto big = mat_f32_t::make_matrix(1000, 1000);
+        const mat_alloc_stats_t after_big = mat_alloc_stats();
+
+        TEST_ASSERT(is_aligned(small.data.get(), alignment));
+        TEST_ASSERT(is_aligned(big.data.get(), alignment));
+        TEST_ASSERT(zeros(small));
+        TEST_ASSERT(zeros(big));
+        TEST_ASSERT(after_small.bytes_memset == before.bytes_memset + small.size_bytes());
+        TEST_ASSERT(after_big.bytes_memset == after_small.bytes_memset);
+        TEST_ASSERT(big.data.get_deleter().flags & MAT_BLOCK_ZEROED);
+
+        /* Nothing cleared at all. */
+        auto uninit = mat_f32_t::make_matrix_uninit(1000, 1000);
+        TEST_ASSERT(mat_alloc_stats().bytes_memset == after_big.bytes_memset);
+        TEST_ASSERT(is_aligned(uninit.data.get(), alignment));
+        uninit.data[uninit.num_elems() - 1] = 1;
+    }
+
+    mat_alloc_configure(prev_config);
+
+    const auto filled = mat_i64_t::make_matrix_filled(5, 3, 7);
+    const auto filled_zero = mat_f32_t::make_matrix_filled(5, 3, 0);
+    TEST_ASSERT(zeros(filled_zero));
+
+    const i64 data[] = { 1, 2, 3, 4, 5, 6 };
+    const auto from_data = mat_i64_t::make_matrix_from_data(data, 3, 2);
+
+    for (u32 y = 0; y < 3; ++y) {
+        for (u32 x = 0; x < filled.stride; ++x)
+            TEST_ASSERT(filled.data[x + y * filled.stride] == (x < 5 ? 7 : 0));
+    }
+
+    for (u32 y = 0; y < 2; ++y) {
+        for (u32 x = 0; x < from_data.stride; ++x)
+            TEST_ASSERT(from_data.data[x + y * from_data.stride] == (x < 3 ? data[x + y * 3] : 0));
+    }
+
+    /* Allocators that know nothing about zeroing still hand out zeroed matrices. */
+    struct dirty_allocator {
+        static mat_block_t alloc(const mat_allocator_t *, const size_t size_bytes, const bool)
+        {
+            const mat_block_t block = mat_allocator_default().alloc(&mat_allocator_default(), size_bytes, false);
+            if (block.ptr)
+                memset(block.ptr, 0xa5, size_bytes);
+            return { block.ptr, block.size_bytes, block.flags & ~MAT_BLOCK_ZEROED };
+        }
+
+        static void free(const mat_allocator_t *, const mat_block_t &block)
+        {
+            mat_allocator_default().free(&mat_allocator_default(), block);
+        }
+    };
+
+    const mat_allocator_t dirty = {
+        .alloc = dirty_allocator::alloc,
+        .free = dirty_allocator::free,
+        .ctx = nullptr,
+    };
+
+    mat_allocator_set(&dirty);
+    const auto a = mat_f32_t::make_matrix(300, 1000);
+    const auto b = mat_f32_t::make_matrix_zero(7, 7);
+    mat_allocator_set(nullptr);
+
+    TEST_ASSERT(zeros(a));
+    TEST_ASSERT(zeros(b));
+
+    mat_allocator_set(&prev_allocator);
+}
+
+void test_mat_pool()
+{
+    const mat_allocator_t &prev_allocator = mat_allocator();
+
+    mat_allocator_set(&mat_pool_allocator());
+    mat_pool_trim();
+    mat_pool_stats_reset();
+
+    const mat_pool_stats_t before = mat_pool_stats();
+    TEST_ASSERT(before.bytes_cached == 0);
+
+    /* Same shape over and over, one miss, then all hits. */
+    for (u32 i = 0; i < 100; ++i) {
+        auto m = mat_f32_t::make_matrix_uninit(100, 100);
+        m[99, 99] = 1;
+    }
+
+    const mat_pool_stats_t steady = mat_pool_stats();
+    TEST_ASSERT(steady.num_misses == before.num_misses + 1);
+    TEST_ASSERT(steady.num_hits == before.num_hits + 99);
+    TEST_ASSERT(steady.bytes_footprint == before.bytes_footprint + steady.bytes_cached);
+    TEST_ASSERT(steady.bytes_cached >= 100 * 112 * sizeof(f32));
+    TEST_ASSERT(steady.bytes_cached <= 100 * 112 * sizeof(f32) * 5 / 4);
+
+    /* Recycled memory is dirty, zeroed matrices still come out zeroed. */
+    {
+        auto dirty = mat_i64_t::make_matrix_filled(30, 30, -1);
+    }
+    {
+        const auto m = mat_i64_t::make_matrix(30, 30);
+        TEST_ASSERT(std::all_of(m.data.get(), m.data.get() + m.num_elems(), [](const i64 v) { return v == 0; }));
+        TEST_ASSERT(mat_pool_stats().num_hits == steady.num_hits + 1);
+    }
+
+    /* Freed by another thread, cached there, handed over when it exits. */
+    std::thread([] {
+        auto m = mat_f32_t::make_matrix_uninit(1000, 10);
+        m[0, 0] = 1;
+    }).join();
+
+    {
+        const mat_pool_stats_t prev = mat_pool_stats();
+        auto m = mat_f32_t::make_matrix_uninit(1000, 10);
+        TEST_ASSERT(mat_pool_stats().num_hits == prev.num_hits + 1);
+    }
+
+    /* Too big to pool, straight back to the default allocator. */
+    {
+        const mat_pool_stats_t prev = mat_pool_stats();
+        {
+            auto big = mat_u8_t::make_matrix_uninit(1 << 16, 1 << 13);
+            big[0, 0] = 1;
+        }
+        const mat_pool_stats_t after = mat_pool_stats();
+        TEST_ASSERT(after.num_misses == prev.num_misses + 1);
+        TEST_ASSERT(after.bytes_footprint == prev.bytes_footprint);
+        TEST_ASSERT(after.bytes_footprint_peak >= prev.bytes_footprint + (u64(1) << 29));
+    }
+
+    mat_pool_trim();
+
+    const mat_pool_stats_t trimmed = mat_pool_stats();
+    TEST_ASSERT(trimmed.bytes_cached == 0);
+    TEST_ASSERT(trimmed.bytes_footprint == before.bytes_footprint);
+
+    mat_allocator_set(&prev_allocator);
+}
+
+void test_random()
+{
+    const u64 prev_seed = random_seed();
+
+    /* Known answer of Philox4x32-10, counter and key all zeros. */
+    random_seed_set(0);
+    u32 kat[4];
+    memset_random(kat, sizeof(kat));
+    TEST_ASSERT(kat[0] == 0x6627e8d5 && kat[1] == 0xe169c58d && kat[2] == 0xbc57ac4c && kat[3] == 0x9b00dbd8);
+
+    /* Same blocks at every ISA level, the high word of the counter included. */
+    for (const auto isa: {cpu_isa_e::generic, cpu_isa_e::avx2, cpu_isa_e::avx512}) {
+        if (ucast(isa) > ucast(cpu_isa_detect()))
+            break;
+
+        const auto &kernels = cpu_random_kernels(isa);
+        const auto &generic = cpu_random_kernels(cpu_isa_e::generic);
+        TEST_ASSERT(kernels.isa == isa);
+        TEST_ASSERT(kernels.lanes <= PHILOX_MAX_LANES && kernels.lanes % generic.lanes == 0);
+
+        for (const u64 first: {u64(0), u64(48), (u64(1) << 32) - 16, u64(0xfffffff0fffffff0)}) {
+            u32 expect[PHILOX_MAX_LANES * 4];
+            u32 got[PHILOX_MAX_LANES * 4];
+
+            for (u32 l = 0; l < kernels.lanes; l += generic.lanes)
+                generic.philox(expect + l * 4, 0x0123456789abcdef, 77, first + l);
+
+            kernels.philox(got, 0x0123456789abcdef, 77, first);
+            TEST_ASSERT(std::equal(got, got + kernels.lanes * 4, expect));
+        }
+    }
+
+    /* Same bytes whatever the number of threads, odd sizes included. */
+    const size_t size = (3 << 20) + 13;
+    std::vector<u8> ref(size);
+    std::vector<u8> out(size);
+
+    random_seed_set(1234);
+    memset_random(ref.data(), size, nullptr);
+
+    for (const u32 num_threads: {1u, 2u, 3u, 7u}) {
+        thread_pool pool(num_threads);
+
+        random_seed_set(1234);
+        memset_random(out.data(), size, &pool);
+        TEST_ASSERT(out == ref);
+
+        /* Next call, next stream. */
+        memset_random(out.data(), size, &pool);
+        TEST_ASSERT(out != ref);
+    }
+
+    /* Shorter output is a prefix of the longer one. */
+    random_seed_set(1234);
+    memset_random(out.data(), 37);
+    TEST_ASSERT(std::equal(out.begin(), out.begin() + 37, ref.begin()));
+
+    /* A different seed, different bytes. */
+    random_seed_set(4321);
+    memset_random(out.data(), size);
+    TEST_ASSERT(out != ref);
+
+    random_seed_set(1234);
+    const auto a = mat_f32_t::make_matrix_in_range(100, 50, 0, -3, 5);
+    const auto b = mat_i64_t::make_matrix_in_range(100, 50, 0, -3, 5);
+    random_seed_set(1234);
+    const auto c = mat_f32_t::make_matrix_in_range(100, 50, 0, -3, 5);
+
+    for (u32 y = 0; y < a.height; ++y) {
+        for (u32 x = 0; x < a.stride; ++x) {
+            if (x >= a.width) {
+                TEST_ASSERT(a.data[x + y * a.stride] == 0 && b.data[x + y * b.stride] == 0);
+                continue;
+            }
+
+            TEST_ASSERT(a.at(x, y) >= -3 && a.at(x, y) < 5);
+            TEST_ASSERT(b.at(x, y) >= -3 && b.at(x, y) < 5);
+            TEST_ASSERT(a.at(x, y) == c.at(x, y));
+        }
+    }
+
+    random_seed_set(prev_seed);
+}
+
+/* Every layout, converted from and to every other one, and in products. */
+void test_mat_layout()
+{
+    constexpr mat_layout_e layouts[] = {
+        mat_layout_e::row_major,
+        mat_layout_e::col_major,
+        mat_layout_e::tiled,
+        mat_layout_e::morton,
+    };
+
+    TEST_ASSERT(mat_morton_index(1, 0) == 1 && mat_morton_index(0, 1) == 2);
+    TEST_ASSERT(mat_morton_index(3, 3) == 15 && mat_morton_index(4, 0) == 16);
+
+    /* Tiles of 'side', the default stride of the others. */
+    auto tile = [](const mat_layout_e layout, const u32 side) {
+        return layout == mat_layout_e::tiled || layout == mat_layout_e::morton ? side : 0;
+    };
+
+    /* Every element in a place of its own, Morton grid padded to 8 x 8 tiles. */
+    for (const auto layout: layouts) {
+        const auto m = mat_i64_t::make_matrix_layout(37, 21, layout, tile(layout, 8));
+        std::vector<bool> taken(m.num_elems());
+
+        for (u32 y = 0; y < m.height; ++y) {
+            for (u32 x = 0; x < m.width; ++x) {
+                const size_t offset = m.offset(x, y);
+                TEST_ASSERT(offset < m.num_elems() && !taken[offset]);
+                taken[offset] = true;
+            }
+        }
+    }
+
+    TEST_ASSERT(mat_i64_t::make_matrix_layout(37, 21, mat_layout_e::morton, 8).num_elems() == 64 * 64);
+
+    auto to_layout = [&](const mat_i64_t &m, const mat_layout_e layout) {
+        auto ret = mat_i64_t::make_matrix_layout(m.width, m.height, layout, tile(layout, 8));
+        mat_copy(ret, m);
+        return ret;
+    };
+
+    auto same = [](const mat_i64_t &a, const mat_i64_t &b) {
+        for (u32 y = 0; y < a.height; ++y)
+            for (u32 x = 0; x < a.width; ++x)
+                if (a.at(x, y) != b.at(x, y))
+                    return false;
+
+        return a.width == b.width && a.height == b.height;
+    };
+
+    const auto src = mat_i64_t::make_matrix_in_range(37, 21, 0, -100, 100);
+
+    for (const auto from: layouts) {
+        for (const auto to: layouts) {
+            const auto a = to_layout(src, from);
+            auto b = mat_i64_t::make_matrix_layout(37, 21, to, tile(to, 16));
+            mat_copy(b, a);
+            TEST_ASSERT(same(a, src) && same(b, src));
+        }
+    }
+
+    /* Element-wise ones, any layout of each operand and of the output. */
+    const auto other = mat_i64_t::make_matrix_in_range(37, 21, 0, -100, 100);
+    const auto sum = mat_add_cpu(src, other);
+    const auto diff = mat_sub_cpu(src, other);
+
+    const auto src_f32 = mat_f32_t::make_matrix_in_range(37, 21, 0, -100, 100);
+    auto half = mat_f16_t::make_matrix_uninit(37, 21);
+    auto back = mat_f32_t::make_matrix_uninit(37, 21);
+    mat_convert(half, src_f32);
+    mat_convert(back, half);
+
+    for (const auto lo: layouts) {
+        for (const auto ro: layouts) {
+            const auto l = to_layout(src, lo);
+            const auto r = to_layout(other, ro);
+
+            auto out = mat_i64_t::make_matrix_layout(37, 21, ro, tile(ro, 16));
+            mat_add_cpu_into(out, l, r);
+            TEST_ASSERT(same(out, sum));
+            mat_sub_cpu_into(out, l, r);
+            TEST_ASSERT(same(out, diff));
+
+            auto f32 = mat_f32_t::make_matrix_layout(37, 21, lo, tile(lo, 8));
+            auto f16 = mat_f16_t::make_matrix_layout(37, 21, ro, tile(ro, 16));
+            mat_copy(f32, src_f32);
+            mat_convert(f16, f32);
+            mat_convert(f32, f16);
+
+            for (u32 y = 0; y < f32.height; ++y)
+                for (u32 x = 0; x < f32.width; ++x)
+                    TEST_ASSERT(f32.at(x, y) == back.at(x, y));
+        }
+    }
+
+    /* GEMM, any layout of each operand and of the output, any transposition. */
+    const u32 M = 45;
+    const u32 K = 37;
+    const u32 N = 29;
+
+    for (const auto trans: {mat_trans_e::none, mat_trans_e::lhs, mat_trans_e::rhs, mat_trans_e::both}) {
+        const bool tl = mat_trans_lhs(trans);
+        const bool tr = mat_trans_rhs(trans);
+
+        const auto lhs = mat_i64_t::make_matrix_in_range(tl ? M : K, tl ? K : M, 0, -5, 5);
+        const auto rhs = mat_i64_t::make_matrix_in_range(tr ? K : N, tr ? N : K, 0, -5, 5);
+        const auto init = mat_i64_t::make_matrix_in_range(N, M, 0, -5, 5);
+
+        auto ref = to_layout(init, mat_layout_e::row_major);
+        mat_mul_cpu_into(ref, lhs, rhs, 3, 2, trans);
+
+        for (const auto lo: layouts) {
+            for (const auto ro: layouts) {
+                for (const auto oo: layouts) {
+                    const auto l = to_layout(lhs, lo);
+                    const auto r = to_layout(rhs, ro);
+                    auto out = to_layout(init, oo);
+
+                    if ((ucast(lo) + ucast(ro) + ucast(oo)) % 2)
+                        mat_mul_cpu_parallel_into(out, l, r, 3, 2, trans);
+                    else
+                        mat_mul_cpu_into(out, l, r, 3, 2, trans);
+
+                    TEST_ASSERT(same(out, ref));
+                }
+            }
+        }
+    }
+
+    /* Strassen, on Morton copies for the classic one, row-major for the others. */
+    const strassen_tuning_t prev = strassen_tuning();
+    strassen_tuning_t tuning = prev;
+    tuning.classic_i64 = 16;
+    tuning.winograd_i64 = 16;
+    strassen_tuning_set(tuning);
+
+    const auto lhs = mat_i64_t::make_matrix_in_range(50, 70, 0, -5, 5);
+    const auto rhs = mat_i64_t::make_matrix_in_range(61, 50, 0, -5, 5);
+    const auto init = mat_i64_t::make_matrix_in_range(61, 70, 0, -5, 5);
+
+    auto ref = to_layout(init, mat_layout_e::row_major);
+    mat_mul_cpu_into(ref, lhs, rhs, 2, -1);
+
+    for (const auto layout: layouts) {
+        const auto l = to_layout(lhs, layout);
+        const auto r = to_layout(rhs, mat_layout_e::morton);
+
+        strassen_stats_t stats = {};
+        auto out = to_layout(init, layout);
+        strassen_cpu_into(out, l, r, 2, -1, &stats);
+        TEST_ASSERT(same(out, ref));
+        TEST_ASSERT(stats.depth == 3);
+
+        out = to_layout(init, layout);
+        strassen_winograd_cpu_into(out, l, r, 2, -1);
+        TEST_ASSERT(same(out, ref));
+
+        out = to_layout(init, layout);
+        strassen_cpu_parallel_into(out, l, r, 2, -1);
+        TEST_ASSERT(same(out, ref));
+    }
+
+    /*
+     * Far from cubic ones aren't padded to a Morton cube. Too thin to split
+     * goes to the blocked GEMM, the rest to Strassen on row-major copies.
+     */
+    const struct {
+        u32 m, k, n, depth;
+    } shapes[] = {
+        { 120, 120, 8, 0 },
+        { 40, 200, 40, 2 },
+    };
+
+    for (const auto &shape: shapes) {
+        const auto lhs = mat_i64_t::make_matrix_in_range(shape.k, shape.m, 0, -5, 5);
+        const auto rhs = mat_i64_t::make_matrix_in_range(shape.n, shape.k, 0, -5, 5);
+        const auto init = mat_i64_t::make_matrix_in_range(shape.n, shape.m, 0, -5, 5);
+
+        auto ref = to_layout(init, mat_layout_e::row_major);
+        mat_mul_cpu_into(ref, lhs, rhs, 2, -1);
+
+        for (const auto layout: layouts) {
+            if (layout == mat_layout_e::row_major)
+                continue;
+
+            strassen_stats_t stats = {};
+            auto out = to_layout(init, layout);
+            strassen_cpu_into(out, to_layout(lhs, layout), to_layout(rhs, layout), 2, -1, &stats);
+            TEST_ASSERT(same(out, ref));
+            TEST_ASSERT(stats.depth == shape.depth);
+        }
+    }
+
+    strassen_tuning_set(prev);
+}
+
+/* Packed rows in a mapped file, used in place. */
+void test_mat_file()
+{
+    char path[] = "/tmp/matmul-file-XXXXXX";
+    const int fd = mkstemp(path);
+    TEST_ASSERT(fd >= 0);
+
+    /* Something else first, like the header of a safetensors file. */
+    const u32 skip = 2;
+    const auto lhs = mat_f32_t::make_matrix_in_range(37, 21, 0, -5, 5);
+    std::vector<f32> packed(skip + lhs.width * lhs.height);
+
+    for (u32 y = 0; y < lhs.height; ++y)
+        for (u32 x = 0; x < lhs.width; ++x)
+            packed[skip + x + y * lhs.width] = lhs[x, y];
+
+    const ssize_t size = packed.size() * sizeof(f32);
+    TEST_ASSERT(write(fd, packed.data(), size) == size);
+    close(fd);
+
+    const auto rhs = mat_f32_t::make_matrix_in_range(13, 37, 0, -5, 5);
+    const auto expected = mat_mul_cpu(lhs, rhs);
+
+    for (const auto prefetch: {mat_file_prefetch_e::none, mat_file_prefetch_e::willneed, mat_file_prefetch_e::populate}) {
+        mat_file_t file;
+        TEST_ASSERT(mat_file_map(path, prefetch, file) == 0);
+        TEST_ASSERT(file.size == size_t(size));
+
+        f32 * const data = const_cast<f32*>(rcast<const f32*>(file.data)) + skip;
+        const matview_f32_t view(data, lhs.width, lhs.height, lhs.width);
+
+        TEST_ASSERT(matrices_same(mat_mul_cpu(view, rhs), expected));
+
+        /* Moved, still mapped. */
+        const mat_file_t moved = std::move(file);
+        TEST_ASSERT(!file.data && rcast<const f32*>(moved.data) + skip == data);
+        TEST_ASSERT(view.at(36, 20) == lhs.at(36, 20));
+    }
+
+    unlink(path);
+
+    mat_file_t missing;
+    TEST_ASSERT(mat_file_map(path, mat_file_prefetch_e::none, missing) != 0);
+    TEST_ASSERT(!missing.data && missing.size == 0);
+}
+
+/* Header padded with spaces for the data to start 8 aligned, as writers do. */
+static std::vector<u64> make_safetensors(std::string header, const void * const data, const size_t data_size, size_t &size)
+{
+    header.resize((header.size() + 7) & ~7UL, ' ');
+    size = sizeof(u64) + header.size() + data_size;
+
+    std::vector<u64> ret((size + 7) / 8);
+    ret[0] = header.size();
+    memcpy(&ret[1], header.data(), header.size());
+    memcpy(rcast<u8*>(&ret[1]) + header.size(), data, data_size);
+
+    return ret;
+}
+
+void test_safetensors()
+{
+    const f32 w[] = {1, 2, 3, 4, 5, 6};
+    const i32 idx[] = {-1, 2, -3, 4};
+    const u16 h[] = {0x3e00, 0xc000}; /* 1.5, -2 */
+    const u8 flag = 1;
+
+    std::vector<u8> data(sizeof(w) + sizeof(idx) + sizeof(h) + sizeof(flag));
+    memcpy(&data[0], w, sizeof(w));
+    memcpy(&data[24], idx, sizeof(idx));
+    memcpy(&data[40], h, sizeof(h));
+    memcpy(&data[44], &flag, sizeof(flag));
+
+    const std::string header =
+        "{\"__metadata__\":{\"format\":\"pt\"},"
+        " \"w\": {\"dtype\":\"F32\", \"shape\":[2,3], \"data_offsets\":[0,24]},"
+        " \"idx\": {\"shape\":[4], \"dtype\":\"I32\", \"extra\":{\"a\":[1,{\"b\":null}]}, \"data_offsets\":[24,40]},"
+        " \"h\": {\"dtype\":\"F16\", \"shape\":[1,2], \"data_offsets\":[40,44]},"
+        " \"esc\\u00e9\\\"q\": {\"dtype\":\"BOOL\", \"shape\":[], \"data_offsets\":[44,45]}}";
+
+    size_t size;
+    const auto file = make_safetensors(header, data.data(), data.size(), size);
+    const u8 * const bytes = rcast<const u8*>(file.data());
+
+    safetensors_t tensors;
+    TEST_ASSERT(safetensors_parse(bytes, size, tensors) == 0);
+
+    /* Header order kept, lookup by name. */
+    TEST_ASSERT(tensors.tensors.size() == 4);
+    TEST_ASSERT(tensors.tensors[0].name == "w" && tensors.tensors[3].name == "escé\"q");
+    TEST_ASSERT(tensors.find("w") == &tensors.tensors[0]);
+    TEST_ASSERT(tensors.find("idx") == &tensors.tensors[1]);
+    TEST_ASSERT(tensors.find("h") == &tensors.tensors[2]);
+    TEST_ASSERT(tensors.find("escé\"q") == &tensors.tensors[3]);
+    TEST_ASSERT(tensors.find("nope") == nullptr);
+
+    TEST_ASSERT(tensors.metadata.size() == 1);
+    TEST_ASSERT(tensors.metadata[0].first == "format" && tensors.metadata[0].second == "pt");
+
+    const safetensor_t &tw = *tensors.find("w");
+    TEST_ASSERT(tw.dtype == safetensor_dtype_e::f32 && tw.rank == 2 && tw.num_elems() == 6);
+    TEST_ASSERT(tw.data == bytes + size - data.size());
+
+    /* In place, rows of 3. */
+    matview_f32_t view;
+    TEST_ASSERT(safetensor_view(tw, view) == 0);
+    TEST_ASSERT(view.width == 3 && view.height == 2 && view.stride == 3);
+    TEST_ASSERT(view.at(2, 1) == 6.0f && view.data == rcast<const f32*>(tw.data));
+
+    /* Rank 1 is a column. */
+    mat_i64_t mat_idx;
+    TEST_ASSERT(safetensor_to_mat(*tensors.find("idx"), mat_idx) == 0);
+    TEST_ASSERT(mat_idx.width == 1 && mat_idx.height == 4);
+    TEST_ASSERT(mat_idx.at(0, 2) == -3);
+
+    mat_f32_t mat_h;
+    TEST_ASSERT(safetensor_to_mat(*tensors.find("h"), mat_h) == 0);
+    TEST_ASSERT(mat_h.width == 2 && mat_h.height == 1);
+    TEST_ASSERT(mat_h.at(0, 0) == 1.5f && mat_h.at(1, 0) == -2.0f);
+
+    /* Rank 0 is 1 x 1. */
+    mat_i64_t mat_flag;
+    TEST_ASSERT(safetensor_to_mat(tensors.tensors[3], mat_flag) == 0);
+    TEST_ASSERT(mat_flag.width == 1 && mat_flag.height == 1 && mat_flag.at(0, 0) == 1);
+
+    TEST_ASSERT(safetensor_view(*tensors.find("idx"), view) != 0);
+    TEST_ASSERT(safetensor_to_mat(*tensors.find("idx"), mat_h) != 0);
+
+    /* Invalid files leave what was parsed before untouched. */
+    const f32 two[2] = {};
+    const struct {
+        const char *header;
+        size_t data_size;
+    } invalid[] = {
+        { "{\"a\":{\"dtype\":\"F32\",\"shape\":[1],\"data_offsets\":[4,8]}}", 8 },  /* Hole. */
+        { "{\"a\":{\"dtype\":\"F32\",\"shape\":[1],\"data_offsets\":[0,4]},"
+          "\"b\":{\"dtype\":\"F32\",\"shape\":[1],\"data_offsets\":[0,4]}}", 4 },   /* Overlap. */
+        { "{\"a\":{\"dtype\":\"F32\",\"shape\":[2],\"data_offsets\":[0,4]}}", 4 },  /* Size. */
+        { "{\"a\":{\"dtype\":\"F32\",\"shape\":[2],\"data_offsets\":[0,8]}}", 4 },  /* Past the data. */
+        { "{\"a\":{\"dtype\":\"F32\",\"shape\":[1],\"data_offsets\":[0,4]}}", 8 },  /* Trailing data. */
+        { "{\"a\":{\"dtype\":\"F32\",\"shape\":[1],\"data_offsets\":[0,4]},"
+          "\"a\":{\"dtype\":\"F32\",\"shape\":[1],\"data_offsets\":[4,8]}}", 8 },   /* Duplicate. */
+        { "{\"a\":{\"dtype\":\"Q8\",\"shape\":[1],\"data_offsets\":[0,1]}}", 1 },   /* Dtype. */
+        { "{\"a\":{\"dtype\":\"F32\",\"shape\":[1]}}", 0 },                         /* Offsets. */
+        { "{\"a\":{\"dtype\":\"F32\",\"shape\":[1],\"data_offsets\":[0,4]}}x", 4 }, /* Trailing. */
+        { "{\"a\":{\"dtype\":\"F32\",\"shape\":[1],\"data_offsets\":[0,4]}", 4 },   /* Unterminated. */
+    };
+
+    for (const auto &test: invalid) {
+        const auto bad = make_safetensors(test.header, two, test.data_size, size);
+        TEST_ASSERT(safetensors_parse(rcast<const u8*>(bad.data()), size, tensors) != 0);
+        TEST_ASSERT(tensors.tensors.size() == 4 && tensors.find("w") != nullptr);
+    }
+
+    /* Header size past the end of the file. */
+    TEST_ASSERT(safetensors_parse(bytes, 16, tensors) != 0);
+    TEST_ASSERT(safetensors_parse(bytes, 4, tensors) != 0);
+
+    /* Lots of tensors, the index still finds each. */
+    const u32 num_tensors = 20000;
+    std::string many = "{";
+    std::vector<f32> values(num_tensors);
+
+    for (u32 i = 0; i < num_tensors; ++i) {
+        many += fmt::format("{}\"t{}\":{{\"dtype\":\"F32\",\"shape\":[1,1],\"data_offsets\":[{},{}]}}",
+                            i ? "," : "", i, i * 4, i * 4 + 4);
+        values[i] = f32(i);
+    }
+    many += "}";
+
+    const auto big = make_safetensors(many, values.data(), values.size() * sizeof(f32), size);
+    TEST_ASSERT(safetensors_parse(rcast<const u8*>(big.data()), size, tensors) == 0);
+    TEST_ASSERT(tensors.tensors.size() == num_tensors);
+
+    for (u32 i = 0; i < num_tensors; i += 7) {
+        const safetensor_t * const t = tensors.find(fmt::format("t{}", i));
+        TEST_ASSERT(t != nullptr && t->num_elems() == 1);
+
+        f32 v;
+        memcpy(&v, t->data, sizeof(v));
+        TEST_ASSERT(v == f32(i));
+    }
+
+    TEST_ASSERT(safetensors_open("/nonexistent/file.safetensors", mat_file_prefetch_e::none, tensors) != 0);
+    TEST_ASSERT(tensors.tensors.size() == num_tensors);
+}
+
+/* Written and read back, buffered and direct. */
+void test_safetensors_write()
+{
+    char path[] = "/tmp/matmul-safetensors-XXXXXX";
+    const int fd = mkstemp(path);
+    TEST_ASSERT(fd >= 0);
+    close(fd);
+
+    /*
+     * Rows short enough to be copied, rows long enough to be written from
+     * the matrix, more of them than the staging buffer holds, packed and
+     * strided, elements of every size so they get reordered.
+     */
+    const auto w = mat_f32_t::make_matrix_in_range(37, 21, 0, -5, 5);
+    const auto big = mat_f32_t::make_matrix_in_range(1500, 1500, 0, -5, 5);
+    const auto idx = mat_i64_t::make_matrix_in_range(5, 3, 0, -100, 100);
+    const auto bytes = mat_u8_t::make_matrix_random(7, 3);
+    const auto packed = mat_f32_t::make_matrix_in_range(16, 4, 0, -5, 5);
+
+    TEST_ASSERT(w.stride != w.width && big.stride != big.width && packed.stride == packed.width);
+
+    const safetensor_write_t tensors[] = {
+        { "bytes", bytes },
+        { "w", w },
+        { "big", big },
+        { "idx", idx },
+        { "packed \"quoted\"", packed },
+    };
+
+    const std::string loss = "0.25";
+
+    for (const bool direct: {false, true}) {
+        safetensors_write_config_t config;
+        config.metadata = { {"loss", loss} };
+        config.direct = direct;
+
+        TEST_ASSERT(safetensors_write(path, tensors, std::size(tensors), config) == 0);
+
+        safetensors_t read;
+        TEST_ASSERT(safetensors_open(path, mat_file_prefetch_e::none, read) == 0);
+        TEST_ASSERT(read.tensors.size() == std::size(tensors));
+        TEST_ASSERT(read.metadata.size() == 1 && read.metadata[0].second == loss);
+
+        /* Header by name, data widest first, then in the order given. */
+        for (u32 i = 0; i < read.tensors.size(); ++i)
+            TEST_ASSERT(read.by_name[i] == i);
+
+        const u64 begins[] = {
+            read.find("idx")->begin,
+            read.find("w")->begin,
+            read.find("big")->begin,
+            read.find("packed \"quoted\"")->begin,
+            read.find("bytes")->begin,
+        };
+
+        TEST_ASSERT(begins[0] == 0 && std::is_sorted(std::begin(begins), std::end(begins)));
+
+        for (const auto &t: read.tensors)
+            TEST_ASSERT(rcast<uintptr_t>(t.data) % safetensor_dtype_size(t.dtype) == 0);
+
+        for (const auto &[name, expected]: {std::pair{"w", &w}, {"big", &big}, {"packed \"quoted\"", &packed}}) {
+            const safetensor_t * const t = read.find(name);
+            TEST_ASSERT(t != nullptr && t->rank == 2 && t->shape[0] == expected->height);
+
+            matview_f32_t view;
+            TEST_ASSERT(safetensor_view(*t, view) == 0);
+
+            mat_f32_t copy;
+            TEST_ASSERT(safetensor_to_mat(*t, copy) == 0);
+            TEST_ASSERT(matrices_same(copy, *expected));
+        }
+
+        mat_i64_t read_idx, read_bytes;
+        TEST_ASSERT(safetensor_to_mat(*read.find("idx"), read_idx) == 0);
+        TEST_ASSERT(safetensor_to_mat(*read.find("bytes"), read_bytes) == 0);
+
+        for (u32 y = 0; y < idx.height; ++y)
+            for (u32 x = 0; x < idx.width; ++x)
+                TEST_ASSERT(read_idx.at(x, y) == idx.at(x, y));
+
+        for (u32 y = 0; y < bytes.height; ++y)
+            for (u32 x = 0; x < bytes.width; ++x)
+                TEST_ASSERT(read_bytes.at(x, y) == i64(bytes.at(x, y)));
+    }
+
+    /* Nothing to write but the header. */
+    TEST_ASSERT(safetensors_write(path, nullptr, 0) == 0);
+
+    safetensors_t empty;
+    TEST_ASSERT(safetensors_open(path, mat_file_prefetch_e::none, empty) == 0);
+    TEST_ASSERT(empty.tensors.empty() && empty.metadata.empty());
+
+    const safetensor_write_t duplicate[] = { { "w", w }, { "w", packed } };
+    TEST_ASSERT(safetensors_write(path, duplicate, std::size(duplicate)) != 0);
+
+    const auto cols = mat_f32_t::make_matrix_layout(4, 4, mat_layout_e::col_major);
+    const safetensor_write_t col_major[] = { { "cols", cols } };
+    TEST_ASSERT(safetensors_write(path, col_major, std::size(col_major)) != 0);
+
+    unlink(path);
+}
+
 static void test_matrix_simple_opencl_mul()
 {
     using init_t = mat_i64_t::InitializerType;
@@ -284,6 +2388,7 @@ constexpr static i64 BENCHMARK_LINE_ALIGNMENT = 62;
 void test_matrix_vs_pytorch_i32(const char *safetensors_path, test_flags_t flags);
 void test_matrix_vs_pytorch_f32(const char *safetensors_path, test_flags_t flags);
 void test_threading(bool explicit_exit);
+void test_task_pool();
 
 static std::queue<std::string> test_status;
 static std::mutex test_status_mtx;
@@ -385,28 +2490,149 @@ int run_tests()
     const std::vector<test> all_tests {
         /* SIMPLE CPU TESTS */
         {
-            .name = "test_threading(explicit_exit = 0)",
-            .func = std::bind(test_threading, false),
+            .name = "test_threading(explicit_exit = 0)",
+            .func = std::bind(test_threading, false),
+            .group = test_group::i64,
+        },
+        {
+            .name = "test_threading(explicit_exit = 1)",
+            .func = std::bind(test_threading, true),
+            .group = test_group::i64,
+        },
+        {
+            .name = "test_task_pool",
+            .func = std::bind(test_task_pool),
+            .group = test_group::i64,
+        },
+        {
+            .name = "test_strassen_tuning_file",
+            .func = std::bind(test_strassen_tuning_file),
+            .group = test_group::i64,
+            .serial = true,
+        },
+        {
+            .name = "test_matrix_simple_add_i64",
+            .func = std::bind(test_matrix_simple_add<mat_i64_t>),
+            .group = test_group::i64,
+        },
+        {
+            .name = "test_matrix_simple_mul_i64",
+            .func = std::bind(test_matrix_simple_mul<mat_i64_t>),
+            .group = test_group::i64,
+        },
+        {
+            .name = "test_matrix_simple_strassen_mul_i64",
+            .func = std::bind(test_matrix_simple_strassen_mul<mat_i64_t>),
+            .group = test_group::i64,
+        },
+        {
+            .name = "test_matrix_blocked_mul_i64",
+            .func = std::bind(test_matrix_blocked_mul<mat_i64_t>),
+            .group = test_group::i64,
+        },
+        {
+            .name = "test_matrix_mul_into_i64",
+            .func = std::bind(test_matrix_mul_into<mat_i64_t>),
+            .group = test_group::i64,
+        },
+        {
+            .name = "test_matrix_mul_trans_i64",
+            .func = std::bind(test_matrix_mul_trans<mat_i64_t>),
+            .group = test_group::i64,
+        },
+        {
+            .name = "test_matrix_mul_batched_i64",
+            .func = std::bind(test_matrix_mul_batched<mat_i64_t>),
+            .group = test_group::i64,
+        },
+        {
+            .name = "test_matrix_fixed_i64",
+            .func = std::bind(test_matrix_fixed<mat_i64_t>),
+            .group = test_group::i64,
+        },
+        {
+            .name = "test_matrix_gemv_i64",
+            .func = std::bind(test_matrix_gemv<mat_i64_t>),
+            .group = test_group::i64,
+        },
+        {
+            .name = "test_matrix_expr_i64",
+            .func = std::bind(test_matrix_expr<mat_i64_t>),
+            .group = test_group::i64,
+        },
+        {
+            .name = "test_matrix_isa_variants_i64",
+            .func = std::bind(test_matrix_isa_variants<mat_i64_t>),
+            .group = test_group::i64,
+        },
+        {
+            .name = "test_matrix_parallel_mul_i64",
+            .func = std::bind(test_matrix_parallel_mul<mat_i64_t>),
+            .group = test_group::i64,
+        },
+        {
+            .name = "test_matrix_strassen_arena_i64",
+            .func = std::bind(test_matrix_strassen_arena<mat_i64_t>),
+            .group = test_group::i64,
+        },
+        {
+            .name = "test_matrix_strassen_winograd_i64",
+            .func = std::bind(test_matrix_strassen_winograd<mat_i64_t>),
+            .group = test_group::i64,
+        },
+        {
+            .name = "test_matrix_strassen_parallel_i64",
+            .func = std::bind(test_matrix_strassen_parallel<mat_i64_t>),
+            .group = test_group::i64,
+        },
+        {
+            .name = "test_matrix_q8",
+            .func = std::bind(test_matrix_q8),
             .group = test_group::i64,
         },
         {
-            .name = "test_threading(explicit_exit = 1)",
-            .func = std::bind(test_threading, true),
+            .name = "test_mat_alloc",
+            .func = std::bind(test_mat_alloc),
             .group = test_group::i64,
+            .serial = true,
         },
         {
-            .name = "test_matrix_simple_add_i64",
-            .func = std::bind(test_matrix_simple_add<mat_i64_t>),
+            .name = "test_matrix_init_modes",
+            .func = std::bind(test_matrix_init_modes),
             .group = test_group::i64,
+            .serial = true,
         },
         {
-            .name = "test_matrix_simple_mul_i64",
-            .func = std::bind(test_matrix_simple_mul<mat_i64_t>),
+            .name = "test_random",
+            .func = std::bind(test_random),
             .group = test_group::i64,
+            .serial = true,
         },
         {
-            .name = "test_matrix_simple_strassen_mul_i64",
-            .func = std::bind(test_matrix_simple_strassen_mul<mat_i64_t>),
+            .name = "test_mat_pool",
+            .func = std::bind(test_mat_pool),
+            .group = test_group::i64,
+            .serial = true,
+        },
+        {
+            .name = "test_mat_layout",
+            .func = std::bind(test_mat_layout),
+            .group = test_group::i64,
+            .serial = true,
+        },
+        {
+            .name = "test_mat_file",
+            .func = std::bind(test_mat_file),
+            .group = test_group::i64,
+        },
+        {
+            .name = "test_safetensors",
+            .func = std::bind(test_safetensors),
+            .group = test_group::i64,
+        },
+        {
+            .name = "test_safetensors_write",
+            .func = std::bind(test_safetensors_write),
             .group = test_group::i64,
         },
 
@@ -426,6 +2652,82 @@ int run_tests()
             .func = std::bind(test_matrix_simple_strassen_mul<mat_f32_t>),
             .group = test_group::f32,
         },
+        {
+            .name = "test_matrix_blocked_mul_f32",
+            .func = std::bind(test_matrix_blocked_mul<mat_f32_t>),
+            .group = test_group::f32,
+        },
+        {
+            .name = "test_matrix_mul_into_f32",
+            .func = std::bind(test_matrix_mul_into<mat_f32_t>),
+            .group = test_group::f32,
+        },
+        {
+            .name = "test_matrix_mul_trans_f32",
+            .func = std::bind(test_matrix_mul_trans<mat_f32_t>),
+            .group = test_group::f32,
+        },
+        {
+            .name = "test_matrix_mul_batched_f32",
+            .func = std::bind(test_matrix_mul_batched<mat_f32_t>),
+            .group = test_group::f32,
+        },
+        {
+            .name = "test_matrix_fixed_f32",
+            .func = std::bind(test_matrix_fixed<mat_f32_t>),
+            .group = test_group::f32,
+        },
+        {
+            .name = "test_matrix_gemv_f32",
+            .func = std::bind(test_matrix_gemv<mat_f32_t>),
+            .group = test_group::f32,
+        },
+        {
+            .name = "test_matrix_half_f16",
+            .func = std::bind(test_matrix_half<mat_f16_t>),
+            .group = test_group::f32,
+        },
+        {
+            .name = "test_matrix_half_bf16",
+            .func = std::bind(test_matrix_half<mat_bf16_t>),
+            .group = test_group::f32,
+        },
+        {
+            .name = "test_matrix_sparse",
+            .func = std::bind(test_matrix_sparse),
+            .group = test_group::f32,
+            .serial = true,
+        },
+        {
+            .name = "test_matrix_expr_f32",
+            .func = std::bind(test_matrix_expr<mat_f32_t>),
+            .group = test_group::f32,
+        },
+        {
+            .name = "test_matrix_isa_variants_f32",
+            .func = std::bind(test_matrix_isa_variants<mat_f32_t>),
+            .group = test_group::f32,
+        },
+        {
+            .name = "test_matrix_parallel_mul_f32",
+            .func = std::bind(test_matrix_parallel_mul<mat_f32_t>),
+            .group = test_group::f32,
+        },
+        {
+            .name = "test_matrix_strassen_arena_f32",
+            .func = std::bind(test_matrix_strassen_arena<mat_f32_t>),
+            .group = test_group::f32,
+        },
+        {
+            .name = "test_matrix_strassen_winograd_f32",
+            .func = std::bind(test_matrix_strassen_winograd<mat_f32_t>),
+            .group = test_group::f32,
+        },
+        {
+            .name = "test_matrix_strassen_parallel_f32",
+            .func = std::bind(test_matrix_strassen_parallel<mat_f32_t>),
+            .group = test_group::f32,
+        },
 
 
         /* SIMPLE OPENCL TESTS */
@@ -464,25 +2766,19 @@ int run_tests()
         {
             .name = "test_matrix_vs_pytorch(pytorch_512x512.safetensors)",
             .func = std::bind(test_matrix_vs_pytorch_i32, CONFIG_TEST_FILES_PATH "pytorch_512x512.safetensors",
-                              test_flags_t{
-                                  .skip_cpu = 1
-                              }),
+                              test_flags_t{}),
             .group = test_group::i64,
         },
         {
             .name = "test_matrix_vs_pytorch(pytorch_1024x1024.safetensors)",
             .func = std::bind(test_matrix_vs_pytorch_i32, CONFIG_TEST_FILES_PATH "pytorch_1024x1024.safetensors",
-                              test_flags_t{
-                                  .skip_cpu = 1
-                              }),
+                              test_flags_t{}),
             .group = test_group::i64,
         },
         {
             .name = "test_matrix_vs_pytorch(pytorch_2048x2048.safetensors)",
             .func = std::bind(test_matrix_vs_pytorch_i32, CONFIG_TEST_FILES_PATH "pytorch_2048x2048.safetensors",
-                              test_flags_t{
-                                  .skip_cpu = 1
-                              }),
+                              test_flags_t{}),
             .group = test_group::i64,
         },
 
@@ -509,30 +2805,25 @@ int run_tests()
         {
             .name = "test_matrix_vs_pytorch(pytorch_512x512_f32.safetensors)",
             .func = std::bind(test_matrix_vs_pytorch_f32, CONFIG_TEST_FILES_PATH "pytorch_512x512_f32.safetensors",
-                              test_flags_t{
-                                  .skip_cpu = 1
-                              }),
+                              test_flags_t{}),
             .group = test_group::f32,
         },
         {
             .name = "test_matrix_vs_pytorch(pytorch_1024x1024_f32.safetensors)",
             .func = std::bind(test_matrix_vs_pytorch_f32, CONFIG_TEST_FILES_PATH "pytorch_1024x1024_f32.safetensors",
-                              test_flags_t{
-                                  .skip_cpu = 1
-                              }),
+                              test_flags_t{}),
             .group = test_group::f32,
         },
         {
             .name = "test_matrix_vs_pytorch(pytorch_2048x2048_f32.safetensors)",
             .func = std::bind(test_matrix_vs_pytorch_f32, CONFIG_TEST_FILES_PATH "pytorch_2048x2048_f32.safetensors",
-                              test_flags_t{
-                                  .skip_cpu = 1
-                              }),
+                              test_flags_t{}),
             .group = test_group::f32,
         },
     };
 
     std::vector<const test*> tests;
+    std::vector<const test*> serial_tests;
     tests.reserve(all_tests.size());
     for (const auto &test : all_tests) {
         if (test.group == test_group::i64 && !opt_enable_i64)
@@ -541,7 +2832,19 @@ int run_tests()
         if (test.group == test_group::f32 && !opt_enable_f32)
             continue;
 
-        tests.emplace_back(&test);
+        if (test.serial)
+            serial_tests.emplace_back(&test);
+        else
+            tests.emplace_back(&test);
+    }
+
+    for (const test *test : serial_tests) {
+        RUN_TEST(*test);
+
+        std::unique_lock lck(test_status_mtx);
+        printf(test_status.front().c_str());
+        test_status.pop();
+        fflush(stdout);
     }
 
     const u32 num_threads = [&] {
@@ -592,163 +2895,73 @@ int run_tests()
     return 0;
 }
 
-#include <mipc/file.h>
-#include <rapidjson/document.h>
-
-int run_gradient_descent()
+/*
+ * Training set of a safetensors file: "x" and "y", F32, and nothing else.
+ * Returns non-zero if the file isn't one.
+ */
+static int load_training_set(const char * const path, mat_f32_t &mat_x, mat_f32_t &mat_y)
 {
-    mat_f32_t xs, ypred, outw;
-
-    /*
-     * Parse safetensors file
-     */
-    auto ftensors = mipc::finbuf(CONFIG_GRAD_FILE_PATH);
-    if (!ftensors) {
-        fprintf(stderr, "Error: failed to open %s\n", CONFIG_GRAD_FILE_PATH);
+    safetensors_t tensors;
+    if (safetensors_open(path, mat_file_prefetch_e::none, tensors))
         return 1;
-    }
-
-    const char *begin = ftensors.begin();
-
-    u64 metadata_size = 0;
-    std::memcpy(&metadata_size, begin, sizeof(u64));
-
-    begin += sizeof(u64);
-
-    std::string header_str;
-    header_str.assign(begin, metadata_size+1);
-    header_str[metadata_size] = '\0';
-
-    rapidjson::Document header_json;
-    header_json.Parse(header_str.c_str());
-    assert(header_json.IsObject());
-
-    struct safetensor_f32 {
-        // Shape
-        u32 rows = 0;
-        u32 cols = 0;
-
-        const f32* data = nullptr;
-    };
-
-    safetensor_f32 x, y;
-
-    for (auto &m: header_json.GetObject()) {
-
-        auto parse_tensor_data = [&] (safetensor_f32 &t) -> int {
-
-            /*
-             * Parse dtype
-             */
-            if (!m.value.HasMember("dtype")) {
-                fmt::print(stderr, "{}: Missing {} field\n", m.name.GetString(), "dtype");
-                return 1;
-            }
-
-            if (!m.value["dtype"].IsString()) {
-                fmt::print(stderr, "{}: Expected {} field to be of type {}\n",
-                        m.name.GetString(), "dtype", "string");
-                return 1;
-            }
-
-            if (strcmp(m.value["dtype"].GetString(), "F32") != 0) {
-                fmt::print(stderr, "{}: Expected {} field to be \"I32\", but got {}\n",
-                        m.name.GetString(), "dtype", m.value.GetString());
-                return 1;
-            }
-
-            /*
-             * Parse shape
-             */
-            if (!m.value.HasMember("shape")) {
-                fmt::print(stderr, "{}: Missing {} field\n", m.name.GetString(), "shape");
-                return 1;
-            }
-
-            if (!m.value["shape"].IsArray()) {
-                fmt::print(stderr, "{}: Expected {} field to be of type {}\n",
-                       m.name.GetString(), "shape", "array");
-                return 1;
-            }
-
-            if (m.value["shape"].GetArray().Size() != 2) {
-                fmt::print(stderr, "{}: Expected shape to be array of size 2\n",
-                       m.name.GetString());
-                return 1;
-            }
-
-            t.rows = m.value["shape"].GetArray()[0].GetUint();
-            t.cols = m.value["shape"].GetArray()[1].GetUint();
-
-
-            /*
-             * Parse data
-             */
-            if (!m.value.HasMember("data_offsets")) {
-                fmt::print(stderr, "{}: Missing {} field\n", m.name.GetString(), "data_offsets");
-                return 1;
-            }
 
-            if (!m.value["data_offsets"].IsArray()) {
-                fmt::print(stderr, "{}: Expected {} field to be of type {}\n",
-                        m.name.GetString(), "data_offsets", "array");
-                return 1;
-            }
+    for (const auto &t: tensors.tensors) {
+        if (t.name != "x" && t.name != "y") {
+            fprintf(stderr, "Expected \"x\" or \"y\", got: \"%.*s\"\n", int(t.name.size()), t.name.data());
+            return 1;
+        }
 
-            if (m.value["data_offsets"].GetArray().Size() != 2) {
-                fmt::print(stderr, "{}: Expected data_offsets to be array of size 2\n",
-                        m.name.GetString());
-                return 1;
-            }
+        if (t.dtype != safetensor_dtype_e::f32) {
+            fprintf(stderr, "%.*s: Expected dtype to be \"F32\", but got %s\n",
+                    int(t.name.size()), t.name.data(), safetensor_dtype2str(t.dtype));
+            return 1;
+        }
+    }
 
-            t.data = rcast<const f32*>(
-                /* Get data offset as base. */
-                m.value["data_offsets"].GetArray()[0].GetUint64() +
+    const safetensor_t * const x = tensors.find("x");
+    const safetensor_t * const y = tensors.find("y");
 
-                /* Skip metadata size. */
-                sizeof(u64) +
+    if (!x || !y) {
+        fprintf(stderr, "%s: Expected both \"x\" and \"y\"\n", path);
+        return 1;
+    }
 
-                /* Skip the actual metadata. */
-                metadata_size +
+    if (safetensor_to_mat(*x, mat_x) || safetensor_to_mat(*y, mat_y))
+        return 1;
 
-                /* Finally, offset from base of mmaped file to obtain data pointer. */
-                ftensors.begin()
-            );
+    return 0;
+}
 
-            return 0;
-        };
+/* Trained weights to --save=PATH, if given, with the final loss as metadata. */
+static int save_weights(const safetensor_write_t * const weights, const size_t count, const f32 loss)
+{
+    if (!opt_save_path)
+        return 0;
 
-        if (strcmp(m.name.GetString(), "x") == 0) {
+    const std::string loss_str = fmt::format("{}", loss);
 
-            if (parse_tensor_data(x)) {
-                fprintf(stderr, "Failed to parse %s\n", "x");
-                return 1;
-            }
+    safetensors_write_config_t config;
+    config.metadata = { {"loss", loss_str} };
 
-            continue;
-        }
+    if (safetensors_write(opt_save_path, weights, count, config)) {
+        fprintf(stderr, "Error: failed to save weights to %s\n", opt_save_path);
+        return 1;
+    }
 
-        if (strcmp(m.name.GetString(), "y") == 0) {
+    printf("weights saved to %s\n", opt_save_path);
 
-            if (parse_tensor_data(y)) {
-                fprintf(stderr, "Failed to parse %s\n", "y");
-                return 1;
-            }
+    return 0;
+}
 
-            continue;
-        }
+int run_gradient_descent()
+{
+    mat_f32_t mat_x, mat_y;
 
-        fprintf(stderr, "Expected \"x\" or \"y\", got: \"%s\"\n", m.name.GetString());
+    if (load_training_set(CONFIG_GRAD_FILE_PATH, mat_x, mat_y)) {
+        fprintf(stderr, "Error: failed to load %s\n", CONFIG_GRAD_FILE_PATH);
         return 1;
     }
 
-    auto make_mat_from_tensor_data = [] (const safetensor_f32 &tensor) {
-        return mat_f32_t::make_matrix_from_data(tensor.data, tensor.cols, tensor.rows);
-    };
-
-    auto mat_x = make_mat_from_tensor_data(x),
-         mat_y = make_mat_from_tensor_data(y);
-
     mat_f32_t mat_w;
     f32 loss;
 
@@ -771,165 +2984,20 @@ int run_gradient_descent()
 
     printf("loss: %f\n", loss);
 
-    return 0;
+    const safetensor_write_t weights[] = { { "w", mat_w } };
+
+    return save_weights(weights, std::size(weights), loss);
 }
 
 int run_classify()
 {
-    /*
-     * Parse safetensors file
-     */
-    auto ftensors = mipc::finbuf(CONFIG_CLASSIFY_FILE_PATH);
-    if (!ftensors) {
-        fprintf(stderr, "Error: failed to open %s\n", CONFIG_GRAD_FILE_PATH);
-        return 1;
-    }
-
-    const char *begin = ftensors.begin();
-
-    u64 metadata_size = 0;
-    std::memcpy(&metadata_size, begin, sizeof(u64));
-
-    begin += sizeof(u64);
-
-    std::string header_str;
-    header_str.assign(begin, metadata_size+1);
-    header_str[metadata_size] = '\0';
-
-    rapidjson::Document header_json;
-    header_json.Parse(header_str.c_str());
-    assert(header_json.IsObject());
-
-    struct safetensor_f32 {
-        // Shape
-        u32 rows = 0;
-        u32 cols = 0;
-
-        const f32* data = nullptr;
-    };
-
-    safetensor_f32 x, y;
-
-    for (auto &m: header_json.GetObject()) {
-
-        auto parse_tensor_data = [&] (safetensor_f32 &t) -> int {
-
-            /*
-             * Parse dtype
-             */
-            if (!m.value.HasMember("dtype")) {
-                fmt::print(stderr, "{}: Missing {} field\n", m.name.GetString(), "dtype");
-                return 1;
-            }
-
-            if (!m.value["dtype"].IsString()) {
-                fmt::print(stderr, "{}: Expected {} field to be of type {}\n",
-                        m.name.GetString(), "dtype", "string");
-                return 1;
-            }
-
-            if (strcmp(m.value["dtype"].GetString(), "F32") != 0) {
-                fmt::print(stderr, "{}: Expected {} field to be \"I32\", but got {}\n",
-                        m.name.GetString(), "dtype", m.value.GetString());
-                return 1;
-            }
-
-            /*
-             * Parse shape
-             */
-            if (!m.value.HasMember("shape")) {
-                fmt::print(stderr, "{}: Missing {} field\n", m.name.GetString(), "shape");
-                return 1;
-            }
-
-            if (!m.value["shape"].IsArray()) {
-                fmt::print(stderr, "{}: Expected {} field to be of type {}\n",
-                       m.name.GetString(), "shape", "array");
-                return 1;
-            }
-
-            if (m.value["shape"].GetArray().Size() == 0) {
-                fmt::print(stderr, "{}: Expected shape to be non-zero\n",
-                       m.name.GetString());
-                return 1;
-            }
-
-            t.rows = m.value["shape"].GetArray()[0].GetUint();
-
-            if (m.value["shape"].GetArray().Size() == 2)
-                t.cols = m.value["shape"].GetArray()[1].GetUint();
-            else
-                t.cols = 1;
-
-
-            /*
-             * Parse data
-             */
-            if (!m.value.HasMember("data_offsets")) {
-                fmt::print(stderr, "{}: Missing {} field\n", m.name.GetString(), "data_offsets");
-                return 1;
-            }
-
-            if (!m.value["data_offsets"].IsArray()) {
-                fmt::print(stderr, "{}: Expected {} field to be of type {}\n",
-                        m.name.GetString(), "data_offsets", "array");
-                return 1;
-            }
-
-            if (m.value["data_offsets"].GetArray().Size() != 2) {
-                fmt::print(stderr, "{}: Expected data_offsets to be array of size 2\n",
-                        m.name.GetString());
-                return 1;
-            }
-
-            t.data = rcast<const f32*>(
-                /* Get data offset as base. */
-                m.value["data_offsets"].GetArray()[0].GetUint64() +
-
-                /* Skip metadata size. */
-                sizeof(u64) +
-
-                /* Skip the actual metadata. */
-                metadata_size +
-
-                /* Finally, offset from base of mmaped file to obtain data pointer. */
-                ftensors.begin()
-            );
-
-            return 0;
-        };
-
-        if (strcmp(m.name.GetString(), "x") == 0) {
+    mat_f32_t mat_x, mat_y;
 
-            if (parse_tensor_data(x)) {
-                fprintf(stderr, "Failed to parse %s\n", "x");
-                return 1;
-            }
-
-            continue;
-        }
-
-        if (strcmp(m.name.GetString(), "y") == 0) {
-
-            if (parse_tensor_data(y)) {
-                fprintf(stderr, "Failed to parse %s\n", "y");
-                return 1;
-            }
-
-            continue;
-        }
-
-        fprintf(stderr, "Expected \"x\" or \"y\", got: \"%s\"\n", m.name.GetString());
+    if (load_training_set(CONFIG_CLASSIFY_FILE_PATH, mat_x, mat_y)) {
+        fprintf(stderr, "Error: failed to load %s\n", CONFIG_CLASSIFY_FILE_PATH);
         return 1;
     }
 
-    auto make_mat_from_tensor_data = [] (const safetensor_f32 &tensor) {
-        return mat_f32_t::make_matrix_from_data(tensor.data, tensor.cols, tensor.rows);
-    };
-
-    auto mat_x = make_mat_from_tensor_data(x),
-         mat_y = make_mat_from_tensor_data(y);
-
 #if 0
     printf("xs: [%u;%u]\nys: [%u;%u]\n", mat_x.width, mat_x.height, mat_y.width, mat_y.height);
     puts("xs");
@@ -946,7 +3014,13 @@ int run_classify()
 
     printf("loss: %.2f\n", loss);
 
-    return 0;
+    const safetensor_write_t weights[] = {
+        { "hidden.0", hidden[0] },
+        { "hidden.1", hidden[1] },
+        { "hidden.2", hidden[2] },
+    };
+
+    return save_weights(weights, std::size(weights), loss);
 
 }
 
@@ -973,6 +3047,11 @@ int main(int argc, char **argv)
                 "                        -ei64 | --enablei64 # Enables int64 tests\n"
                 "       --grad         Run only gradient descend test\n"
                 "       --class        Run only classify test\n"
+                "       --save=PATH    Save weights trained by --grad or --class to PATH as safetensors\n"
+                "       --isa=LEVEL    Force CPU kernels to given ISA level: generic, avx2, avx512\n"
+                "       --huge-pages=MODE  Back big matrices with huge pages: none, transparent, hugetlb\n"
+                "       --no-pool      Allocate every matrix afresh instead of recycling freed ones\n"
+                "       --tune         Measure Strassen crossover on this host and save it\n"
             );
             return 0;
         }
@@ -1018,8 +3097,60 @@ int main(int argc, char **argv)
             opt_classify = true;
             continue;
         }
+
+        if (strcmp(s, "--tune") == 0) {
+            opt_tune = true;
+            continue;
+        }
+
+        if (strncmp(s, "--isa=", 6) == 0) {
+            cpu_isa_e isa;
+
+            if (cpu_isa_from_str(s + 6, isa)) {
+                fprintf(stderr, "Unknown ISA level: %s\n", s + 6);
+                return 1;
+            }
+
+            if (cpu_isa_set(isa)) {
+                fprintf(stderr, "ISA level %s not supported by this CPU (max: %s)\n",
+                        cpu_isa2str(isa), cpu_isa2str(cpu_isa_detect()));
+                return 1;
+            }
+
+            continue;
+        }
+
+        if (strncmp(s, "--huge-pages=", 13) == 0) {
+            mat_alloc_config_t config = mat_alloc_config();
+
+            if (mat_huge_pages_from_str(s + 13, config.huge_pages)) {
+                fprintf(stderr, "Unknown huge page mode: %s\n", s + 13);
+                return 1;
+            }
+
+            mat_alloc_configure(config);
+            continue;
+        }
+
+        if (strncmp(s, "--save=", 7) == 0) {
+            opt_save_path = s + 7;
+            continue;
+        }
+
+        if (strcmp(s, "--no-pool") == 0) {
+            opt_no_pool = true;
+            continue;
+        }
     }
 
+    /* Tests and training loops make the same shapes over and over. */
+    if (!opt_no_pool)
+        mat_allocator_set(&mat_pool_allocator());
+
+    /* After all the options, tuning has to run with the final ISA level. */
+    if (opt_tune)
+        return strassen_tune_and_save(stdout);
+
     if (opt_grad || opt_classify)
         register_interrupt_handler();
 
@@ -1038,6 +3169,9 @@ int main(int argc, char **argv)
     if (opt_list_cuda)
         return 0;
 
+    /* Tests assert on recursion depths, a tuning file of the host must not change them. */
+    strassen_tuning_set(strassen_tuning_default());
+
     ret = run_tests();
 
     /* Print detailed benchmark/timing information */
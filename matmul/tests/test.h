@@ -25,6 +25,9 @@ struct test {
     std::string name;
     std::function<void()> func;
     test_group group = test_group::common;
+
+    /* Changes process-wide state, like the Strassen tuning. Runs alone, before the others. */
+    bool serial = false;
 };
 
 struct test_flags_t {
@@ -4,69 +4,59 @@
 
 #include <string>
 #include <map>
+#include <vector>
 
 #include <fmt/format.h>
 
-#include <mipc/file.h>
-
-#include <rapidjson/document.h>
-
 #include "test.h"
 #include "mat.h"
+#include "safetensors.h"
 #include "types.h"
 #include "print_utils.h"
 #include "timing.h"
 #include "bench.h"
 #include "options.h"
 
-struct safetensor {
-    enum class dtype {
-        none,
-        i32,
-        f32,
-    };
-
-    // Shape
-    u32 rows = 0;
-    u32 cols = 0;
-
-    dtype type = dtype::none;
-
-    const void* data = nullptr;
+struct test_tripplet {
+    const safetensor_t *a = nullptr;
+    const safetensor_t *b = nullptr;
+    const safetensor_t *c = nullptr;
 };
 
-constexpr static const char* dtype2str(safetensor::dtype t)
+static mat_i64_t make_mat_i32_from_tensor_data(const safetensor_t &tensor)
 {
-    using dtype = safetensor::dtype;
-
-    switch(t) {
-    case dtype::none:
-        return "none";
-    case dtype::i32:
-        return "i32";
-    case dtype::f32:
-        return "f32";
-    }
-
-    __builtin_unreachable();
+    mat_i64_t ret;
+    if (safetensor_to_mat(tensor, ret))
+        throw test_failure(fmt::format("Failed to convert {}\n", tensor.name));
 
-    return "none";
+    return ret;
 }
 
-struct test_tripplet {
-    safetensor a;
-    safetensor b;
-    safetensor c;
-};
-
-static mat_i64_t make_mat_i32_from_tensor_data(const safetensor &tensor)
+static mat_f32_t make_mat_f32_from_tensor_data(const safetensor_t &tensor)
 {
-    return mat_i64_t::make_matrix_from_data(reinterpret_cast<const i32*>(tensor.data), tensor.cols, tensor.rows);
+    mat_f32_t ret;
+    if (safetensor_to_mat(tensor, ret))
+        throw test_failure(fmt::format("Failed to convert {}\n", tensor.name));
+
+    return ret;
 }
 
-static mat_f32_t make_mat_f32_from_tensor_data(const safetensor &tensor)
+/*
+ * F32 tensor used in place, straight from the mapped file. Copied into
+ * 'copy' only if the file doesn't keep it aligned for f32.
+ */
+static matview_f32_t view_f32_from_tensor_data(const safetensor_t &tensor, mat_f32_t &copy)
 {
-    return mat_f32_t::make_matrix_from_data(reinterpret_cast<const f32*>(tensor.data), tensor.cols, tensor.rows);
+    if (rcast<uintptr_t>(tensor.data) % alignof(f32)) {
+        copy = make_mat_f32_from_tensor_data(tensor);
+        return copy;
+    }
+
+    matview_f32_t ret;
+    if (safetensor_view(tensor, ret))
+        throw test_failure(fmt::format("Failed to view {}\n", tensor.name));
+
+    return ret;
 }
 
 static const char* filename_from_path(std::string_view filepath)
@@ -78,174 +68,119 @@ static const char* filename_from_path(std::string_view filepath)
     return &filepath[pos+1];
 }
 
-static int parse_safetensors(mipc::finbuf &ftensors, std::map<u64, test_tripplet> &ttrips)
+/* Tensors named A<id>, B<id> and C<id>: operands and product of test <id>. */
+static void collect_tripplets(const safetensors_t &tensors, std::map<u64, test_tripplet> &ttrips)
 {
-    const char *begin = ftensors.begin();
-
-    u64 metadata_size = 0;
-    std::memcpy(&metadata_size, begin, sizeof(u64));
-
-    begin += sizeof(u64);
-
-    std::string header_str;
-    header_str.assign(begin, metadata_size+1);
-    header_str[metadata_size] = '\0';
-
-    rapidjson::Document header_json;
-    header_json.Parse(header_str.c_str());
-
-    assert(header_json.IsObject());
-    for (auto &m: header_json.GetObject()) {
+    for (const auto &t: tensors.tensors) {
+        const std::string name(t.name);
         char c;
         u64 id;
 
-        if (sscanf(m.name.GetString(), "%c%lu", &c, &id) != 2)
-            throw test_failure(fmt::format("Expected %c%lu, got: {}\n", m.name.GetString()));
-
-        auto& ttrip = ttrips[id];
-
-        /*
-         * "A":{
-         *  "dtype":"I32",
-         *  "shape":[128,128],
-         *  "data_offsets":[0,65536]
-         * },
-         */
-
-        auto parse_tensor_data = [&] (safetensor &t) {
-
-            /*
-             * Parse dtype
-             */
-            if (!m.value.HasMember("dtype")) {
-                fmt::print(stderr, "{}: Missing {} field\n", m.name.GetString(), "dtype");
-                return 1;
-            }
-
-            if (!m.value["dtype"].IsString()) {
-                fmt::print(stderr, "{}: Expected {} field to be of type {}\n",
-                       m.name.GetString(), "dtype", "string");
-                return 1;
-            }
-
-            t.type = safetensor::dtype::none;
-            const char * const typestr = m.value["dtype"].GetString();
-
-            if (strcmp(typestr, "I32") == 0)
-                t.type = safetensor::dtype::i32;
-
-            if (strcmp(typestr, "F32") == 0)
-                t.type = safetensor::dtype::f32;
-
-            if (t.type == safetensor::dtype::none) {
-                fmt::print(stderr, "{}: Expected {} field to be \"I32\" or \"F32\", but got {}\n",
-                       m.name.GetString(), "dtype", m.value.GetString());
-                return 1;
-            }
-
+        if (sscanf(name.c_str(), "%c%lu", &c, &id) != 2)
+            throw test_failure(fmt::format("Expected %c%lu, got: {}\n", name));
 
-            /*
-             * Parse shape
-             */
-            if (!m.value.HasMember("shape")) {
-                fmt::print(stderr, "{}: Missing {} field\n", m.name.GetString(), "shape");
-                return 1;
-            }
-
-            if (!m.value["shape"].IsArray()) {
-                fmt::print(stderr, "{}: Expected {} field to be of type {}\n",
-                       m.name.GetString(), "shape", "array");
-                return 1;
-            }
+        switch (c) {
+        case 'A':
+            ttrips[id].a = &t;
+            break;
 
-            if (m.value["shape"].GetArray().Size() != 2) {
-                fmt::print(stderr, "{}: Expected shape to be array of size 2\n",
-                       m.name.GetString());
-                return 1;
-            }
+        case 'B':
+            ttrips[id].b = &t;
+            break;
 
-            t.rows = m.value["shape"].GetArray()[0].GetUint();
-            t.cols = m.value["shape"].GetArray()[1].GetUint();
+        case 'C':
+            ttrips[id].c = &t;
+            break;
 
+        default:
+            fmt::print(stderr, "SKIP: Unexpected matrix name: {}\n", name);
+            break;
+        }
+    }
+}
 
-            /*
-             * Parse data
-             */
-            if (!m.value.HasMember("data_offsets")) {
-                fmt::print(stderr, "{}: Missing {} field\n", m.name.GetString(), "data_offsets");
-                return 1;
-            }
+/*
+ * All products of a file submitted as one batch. Reports average time per
+ * product, to compare against the one call per product numbers.
+ */
+template <typename MatrixType>
+static void test_batched_vs_pytorch(
+    const char * const filepath,
+    const std::map<u64, test_tripplet> &ttrips,
+    MatrixType (*make_mat)(const safetensor_t&),
+    const char * const suffix,
+    test_flags_t flags
+) {
+    using ViewType = matview_base_t<MatrixType>;
 
-            if (!m.value["data_offsets"].IsArray()) {
-                fmt::print(stderr, "{}: Expected {} field to be of type {}\n",
-                       m.name.GetString(), "data_offsets", "array");
-                return 1;
-            }
+    const char * const filename = filename_from_path(filepath);
+    constexpr u32 align = 36u;
+    timeit_t timer;
 
-            if (m.value["data_offsets"].GetArray().Size() != 2) {
-                fmt::print(stderr, "{}: Expected data_offsets to be array of size 2\n",
-                       m.name.GetString());
-                return 1;
-            }
+    std::vector<MatrixType> mats_a, mats_b, mats_c, mats_out;
+    std::vector<mat_mul_batch_entry_t<ViewType>> batch;
 
-            t.data = rcast<const void*>(
-                /* Get data offset as base. */
-                m.value["data_offsets"].GetArray()[0].GetUint64() +
+    for (const auto &ttrip: ttrips) {
+        mats_a.push_back(make_mat(*ttrip.second.a));
+        mats_b.push_back(make_mat(*ttrip.second.b));
+        mats_c.push_back(make_mat(*ttrip.second.c));
+        mats_out.push_back(MatrixType::make_matrix(mats_c.back().width, mats_c.back().height));
+    }
 
-                /* Skip metadata size. */
-                sizeof(u64) +
+    for (size_t i = 0; i < mats_out.size(); ++i)
+        batch.push_back({ mats_a[i], mats_b[i], mats_out[i] });
 
-                /* Skip the actual metadata. */
-                metadata_size +
+    auto compare = [&](const char *backend) {
+        size_t i = 0;
 
-                /* Finally, offset from base of mmaped file to obtain data pointer. */
-                ftensors.begin()
-            );
+        for (const auto &ttrip: ttrips) {
+            const std::string test_name = fmt::format("{}.{}.{}", filepath, ttrip.first, backend);
+            mat_compare_or_fail(test_name.c_str(), mats_out[i], mats_c[i], mats_a[i], mats_b[i], mat_op::mul);
+            ++i;
+        }
+    };
 
-            return 0;
-        };
+    if (batch.empty())
+        return;
 
-        switch (c) {
-        case 'A':
-            if (parse_tensor_data(ttrip.a))
-                return 1;
-            break;
+    if (!flags.skip_cpu) {
+        timer.start();
+        mat_mul_cpu_batched(batch.data(), batch.size());
+        timer.stop();
 
-        case 'B':
-            if (parse_tensor_data(ttrip.b))
-                return 1;
-            break;
+        compare("mat_mul_cpu_batched");
+        benchinfo.add(fmt::format("{: <{}}cpu_batched{}", filename, align, suffix), timer.get_duration() / batch.size());
+    }
 
-        case 'C':
-            if (parse_tensor_data(ttrip.c))
-                return 1;
-            break;
+    timer.start();
+    const int err = mat_mul_cl_batched(batch.data(), batch.size());
+    timer.stop();
 
-        default:
-            fmt::print(stderr, "SKIP: Unexpected matrix name: {}\n", m.name.GetString());
-            break;
-        }
-    }
+    if (err)
+        throw test_failure("mat_mul_cl_batched failed\n");
 
-    return 0;
+    compare("cl_batched");
+    benchinfo.add(fmt::format("{: <{}}opencl_batched{}", filename, align, suffix), timer.get_duration() / batch.size());
 }
 
 void test_matrix_vs_pytorch_i32(const char * const filepath, test_flags_t flags)
 {
-    auto ftensors = mipc::finbuf(filepath);
-    if (!ftensors)
+    safetensors_t tensors;
+    if (safetensors_open(filepath, mat_file_prefetch_e::populate, tensors))
         throw test_failure("Failed to open safetensors file\n");
 
     std::map<u64, test_tripplet> ttrips;
-    if (parse_safetensors(ftensors, ttrips))
-        return;
+    collect_tripplets(tensors, ttrips);
 
     const char * const filename = filename_from_path(filepath);
     timeit_t timer;
 
     /* For calculating averages. */
     auto dur_cpu             = timeit_t::Duration::zero();
+    auto dur_cpu_parallel    = timeit_t::Duration::zero();
     auto dur_strassen_cpu    = timeit_t::Duration::zero();
+    auto dur_winograd_cpu    = timeit_t::Duration::zero();
+    auto dur_strassen_par    = timeit_t::Duration::zero();
     auto dur_cl              = timeit_t::Duration::zero();
     auto dur_cuda            = timeit_t::Duration::zero();
     auto dur_cuda_umem_tiled = timeit_t::Duration::zero();
@@ -260,24 +195,28 @@ void test_matrix_vs_pytorch_i32(const char * const filepath, test_flags_t flags)
      */
     for (const auto &ttrip: ttrips) {
         const auto& test_id = ttrip.first;
-        const auto& tensa   = ttrip.second.a;
-        const auto& tensb   = ttrip.second.b;
-        const auto& tensc   = ttrip.second.c;
+
+        if (!ttrip.second.a || !ttrip.second.b || !ttrip.second.c)
+            throw test_failure(fmt::format("Incomplete data for id{}\n", test_id));
+
+        const auto& tensa   = *ttrip.second.a;
+        const auto& tensb   = *ttrip.second.b;
+        const auto& tensc   = *ttrip.second.c;
 
         std::string test_name;
         const bool run_on_cpu = !flags.skip_cpu;
         const bool run_opencl = true;
         const bool run_cuda = true;
 
-        if (tensa.data == nullptr || tensb.data == nullptr || tensc.data == nullptr)
-            throw test_failure(fmt::format("Incomplete data for id{}\n", test_id));
-
-        using dtype = safetensor::dtype;
-        if (tensa.type != dtype::i32 || tensb.type != dtype::i32 || tensc.type != dtype::i32)
+        using dtype = safetensor_dtype_e;
+        if (tensa.dtype != dtype::i32 || tensb.dtype != dtype::i32 || tensc.dtype != dtype::i32)
             throw test_failure(fmt::format(
                 "Mismatched tensor types for id{}. "
                 "Expected all to be i32, got A.dtype = {}, B.dtype = {}, C.dtype = {}",
-                test_id, dtype2str(tensa.type), dtype2str(tensb.type), dtype2str(tensc.type)
+                test_id,
+                safetensor_dtype2str(tensa.dtype),
+                safetensor_dtype2str(tensb.dtype),
+                safetensor_dtype2str(tensc.dtype)
             ));
 
 
@@ -302,6 +241,20 @@ void test_matrix_vs_pytorch_i32(const char * const filepath, test_flags_t flags)
             mat_compare_or_fail(test_name.c_str(), matc_computed, matc_expected, mata, matb, mat_op::mul);
 
 
+            /* Test using mat_mul_cpu_parallel() */
+            timer.start();
+            mat_i64_t matc_computed_parallel = mat_mul_cpu_parallel(mata, matb);
+            timer.stop();
+
+            dur_cpu_parallel += timer.get_duration();
+
+            TEST_ASSERT(matc_expected.width == matc_computed_parallel.width);
+            TEST_ASSERT(matc_expected.height == matc_computed_parallel.height);
+
+            test_name = fmt::format("{}.{}.{}", filepath, test_id, "mat_mul_cpu_parallel");
+            mat_compare_or_fail(test_name.c_str(), matc_computed_parallel, matc_expected, mata, matb, mat_op::mul);
+
+
             /* Test using strassen_cpu() */
             timer.start();
             mat_i64_t matc_computed_strassen = strassen_cpu(mata, matb);
@@ -314,6 +267,34 @@ void test_matrix_vs_pytorch_i32(const char * const filepath, test_flags_t flags)
 
             test_name = fmt::format("{}.{}.{}", filepath, test_id, "strassen_cpu");
             mat_compare_or_fail(test_name.c_str(), matc_computed_strassen, matc_expected, mata, matb, mat_op::mul);
+
+
+            /* Test using strassen_winograd_cpu() */
+            timer.start();
+            mat_i64_t matc_computed_winograd_cpu = strassen_winograd_cpu(mata, matb);
+            timer.stop();
+
+            dur_winograd_cpu += timer.get_duration();
+
+            TEST_ASSERT(matc_expected.width == matc_computed_winograd_cpu.width);
+            TEST_ASSERT(matc_expected.height == matc_computed_winograd_cpu.height);
+
+            test_name = fmt::format("{}.{}.{}", filepath, test_id, "strassen_winograd_cpu");
+            mat_compare_or_fail(test_name.c_str(), matc_computed_winograd_cpu, matc_expected, mata, matb, mat_op::mul);
+
+
+            /* Test using strassen_cpu_parallel() */
+            timer.start();
+            mat_i64_t matc_computed_strassen_par = strassen_cpu_parallel(mata, matb);
+            timer.stop();
+
+            dur_strassen_par += timer.get_duration();
+
+            TEST_ASSERT(matc_expected.width == matc_computed_strassen_par.width);
+            TEST_ASSERT(matc_expected.height == matc_computed_strassen_par.height);
+
+            test_name = fmt::format("{}.{}.{}", filepath, test_id, "strassen_cpu_parallel");
+            mat_compare_or_fail(test_name.c_str(), matc_computed_strassen_par, matc_expected, mata, matb, mat_op::mul);
         }
 
 
@@ -418,9 +399,18 @@ void test_matrix_vs_pytorch_i32(const char * const filepath, test_flags_t flags)
     if (dur_cpu.count())
         benchinfo.add(fmt::format("{: <{}}cpu", filename, align), dur_cpu / num_runs);
 
+    if (dur_cpu_parallel.count())
+        benchinfo.add(fmt::format("{: <{}}cpu_parallel", filename, align), dur_cpu_parallel / num_runs);
+
     if (dur_strassen_cpu.count())
         benchinfo.add(fmt::format("{: <{}}strassen_cpu", filename, align), dur_strassen_cpu / num_runs);
 
+    if (dur_winograd_cpu.count())
+        benchinfo.add(fmt::format("{: <{}}strassen_winograd_cpu", filename, align), dur_winograd_cpu / num_runs);
+
+    if (dur_strassen_par.count())
+        benchinfo.add(fmt::format("{: <{}}strassen_cpu_parallel", filename, align), dur_strassen_par / num_runs);
+
     if (dur_cl.count())
         benchinfo.add(fmt::format("{: <{}}opencl", filename, align), dur_cl / num_runs);
 
@@ -438,24 +428,28 @@ void test_matrix_vs_pytorch_i32(const char * const filepath, test_flags_t flags)
 
     if (dur_cuda_test.count())
         benchinfo.add(fmt::format("{: <{}}cuda_test_25k", filename, align), dur_cuda_test / num_runs);
+
+    test_batched_vs_pytorch(filepath, ttrips, make_mat_i32_from_tensor_data, "", flags);
 }
 
 void test_matrix_vs_pytorch_f32(const char * const filepath, test_flags_t flags)
 {
-    auto ftensors = mipc::finbuf(filepath);
-    if (!ftensors)
+    safetensors_t tensors;
+    if (safetensors_open(filepath, mat_file_prefetch_e::populate, tensors))
         throw test_failure("Failed to open safetensors file\n");
 
     std::map<u64, test_tripplet> ttrips;
-    if (parse_safetensors(ftensors, ttrips))
-        return;
+    collect_tripplets(tensors, ttrips);
 
     const char * const filename = filename_from_path(filepath);
     timeit_t timer;
 
     /* For calculating averages. */
     auto dur_cpu             = timeit_t::Duration::zero();
+    auto dur_cpu_parallel    = timeit_t::Duration::zero();
     auto dur_strassen_cpu    = timeit_t::Duration::zero();
+    auto dur_winograd_cpu    = timeit_t::Duration::zero();
+    auto dur_strassen_par    = timeit_t::Duration::zero();
     auto dur_cl              = timeit_t::Duration::zero();
     auto dur_cuda            = timeit_t::Duration::zero();
     auto dur_cuda_umem_tiled = timeit_t::Duration::zero();
@@ -469,30 +463,35 @@ void test_matrix_vs_pytorch_f32(const char * const filepath, test_flags_t flags)
      */
     for (const auto &ttrip: ttrips) {
         const auto& test_id = ttrip.first;
-        const auto& tensa   = ttrip.second.a;
-        const auto& tensb   = ttrip.second.b;
-        const auto& tensc   = ttrip.second.c;
+
+        if (!ttrip.second.a || !ttrip.second.b || !ttrip.second.c)
+            throw test_failure(fmt::format("Incomplete data for id{}\n", test_id));
+
+        const auto& tensa   = *ttrip.second.a;
+        const auto& tensb   = *ttrip.second.b;
+        const auto& tensc   = *ttrip.second.c;
 
         std::string test_name;
         const bool run_on_cpu = !flags.skip_cpu;
         const bool run_opencl = true;
         const bool run_cuda = true;
 
-        if (tensa.data == nullptr || tensb.data == nullptr || tensc.data == nullptr)
-            throw test_failure(fmt::format("Incomplete data for id{}\n", test_id));
-
-        using dtype = safetensor::dtype;
-        if (tensa.type != dtype::f32 || tensb.type != dtype::f32 || tensc.type != dtype::f32)
+        using dtype = safetensor_dtype_e;
+        if (tensa.dtype != dtype::f32 || tensb.dtype != dtype::f32 || tensc.dtype != dtype::f32)
             throw test_failure(fmt::format(
                 "Mismatched tensor types for id{}. "
                 "Expected all to be f32, got A.dtype = {}, B.dtype = {}, C.dtype = {}",
-                test_id, dtype2str(tensa.type), dtype2str(tensb.type), dtype2str(tensc.type)
+                test_id,
+                safetensor_dtype2str(tensa.dtype),
+                safetensor_dtype2str(tensb.dtype),
+                safetensor_dtype2str(tensc.dtype)
             ));
 
-        /* Prepare data from pytorch */
-        mat_f32_t mata = make_mat_f32_from_tensor_data(tensa);
-        mat_f32_t matb = make_mat_f32_from_tensor_data(tensb);
-        mat_f32_t matc_expected = make_mat_f32_from_tensor_data(tensc);
+        /* Data from pytorch, used in place. */
+        mat_f32_t copies[3];
+        const matview_f32_t mata = view_f32_from_tensor_data(tensa, copies[0]);
+        const matview_f32_t matb = view_f32_from_tensor_data(tensb, copies[1]);
+        const matview_f32_t matc_expected = view_f32_from_tensor_data(tensc, copies[2]);
 
         if (run_on_cpu) {
             /* Test using mat_mul_cpu() */
@@ -509,6 +508,20 @@ void test_matrix_vs_pytorch_f32(const char * const filepath, test_flags_t flags)
             mat_compare_or_fail(test_name.c_str(), matc_computed, matc_expected, mata, matb, mat_op::mul);
 
 
+            /* Test using mat_mul_cpu_parallel() */
+            timer.start();
+            mat_f32_t matc_computed_parallel = mat_mul_cpu_parallel(mata, matb);
+            timer.stop();
+
+            dur_cpu_parallel += timer.get_duration();
+
+            TEST_ASSERT(matc_expected.width == matc_computed_parallel.width);
+            TEST_ASSERT(matc_expected.height == matc_computed_parallel.height);
+
+            test_name = fmt::format("{}.{}.{}", filepath, test_id, "mat_mul_cpu_parallel");
+            mat_compare_or_fail(test_name.c_str(), matc_computed_parallel, matc_expected, mata, matb, mat_op::mul);
+
+
             /* Test using strassen_cpu() */
             timer.start();
             mat_f32_t matc_computed_strassen = strassen_cpu(mata, matb);
@@ -521,6 +534,34 @@ void test_matrix_vs_pytorch_f32(const char * const filepath, test_flags_t flags)
 
             test_name = fmt::format("{}.{}.{}", filepath, test_id, "strassen_cpu");
             mat_compare_or_fail(test_name.c_str(), matc_computed_strassen, matc_expected, mata, matb, mat_op::mul);
+
+
+            /* Test using strassen_winograd_cpu() */
+            timer.start();
+            mat_f32_t matc_computed_winograd_cpu = strassen_winograd_cpu(mata, matb);
+            timer.stop();
+
+            dur_winograd_cpu += timer.get_duration();
+
+            TEST_ASSERT(matc_expected.width == matc_computed_winograd_cpu.width);
+            TEST_ASSERT(matc_expected.height == matc_computed_winograd_cpu.height);
+
+            test_name = fmt::format("{}.{}.{}", filepath, test_id, "strassen_winograd_cpu");
+            mat_compare_or_fail(test_name.c_str(), matc_computed_winograd_cpu, matc_expected, mata, matb, mat_op::mul);
+
+
+            /* Test using strassen_cpu_parallel() */
+            timer.start();
+            mat_f32_t matc_computed_strassen_par = strassen_cpu_parallel(mata, matb);
+            timer.stop();
+
+            dur_strassen_par += timer.get_duration();
+
+            TEST_ASSERT(matc_expected.width == matc_computed_strassen_par.width);
+            TEST_ASSERT(matc_expected.height == matc_computed_strassen_par.height);
+
+            test_name = fmt::format("{}.{}.{}", filepath, test_id, "strassen_cpu_parallel");
+            mat_compare_or_fail(test_name.c_str(), matc_computed_strassen_par, matc_expected, mata, matb, mat_op::mul);
         }
 
         if (run_opencl) {
@@ -623,9 +664,18 @@ void test_matrix_vs_pytorch_f32(const char * const filepath, test_flags_t flags)
     if (dur_cpu.count())
         benchinfo.add(fmt::format("{: <{}}cpu_f32", filename, align), dur_cpu / num_runs);
 
+    if (dur_cpu_parallel.count())
+        benchinfo.add(fmt::format("{: <{}}cpu_parallel_f32", filename, align), dur_cpu_parallel / num_runs);
+
     if (dur_strassen_cpu.count())
         benchinfo.add(fmt::format("{: <{}}strassen_cpu_f32", filename, align), dur_strassen_cpu / num_runs);
 
+    if (dur_winograd_cpu.count())
+        benchinfo.add(fmt::format("{: <{}}strassen_winograd_cpu_f32", filename, align), dur_winograd_cpu / num_runs);
+
+    if (dur_strassen_par.count())
+        benchinfo.add(fmt::format("{: <{}}strassen_cpu_parallel_f32", filename, align), dur_strassen_par / num_runs);
+
     if (dur_cl.count())
         benchinfo.add(fmt::format("{: <{}}opencl_f32", filename, align), dur_cl / num_runs);
 
@@ -643,4 +693,6 @@ void test_matrix_vs_pytorch_f32(const char * const filepath, test_flags_t flags)
 
     if (dur_cuda_test.count())
         benchinfo.add(fmt::format("{: <{}}cuda_test_25k_f32", filename, align), dur_cuda_test / num_runs);
+
+    test_batched_vs_pytorch(filepath, ttrips, make_mat_f32_from_tensor_data, "_f32", flags);
 }
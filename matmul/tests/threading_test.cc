@@ -4,6 +4,8 @@
 
 #include <fmt/format.h>
 
+#include <atomic>
+
 constexpr u32 thread_pool_sizes[] = {
     0, 1, 5, 13, 16, 32, 64
 };
@@ -64,3 +66,38 @@ void test_threading(bool explicit_exit)
         test_threading_(explicit_exit);
 }
 
+
+/* Counts nodes of a tree, where every node is a task waiting for its children. */
+static void count_task_tree(task_pool &tp, std::atomic<u32> &counter, u32 depth, u32 fanout)
+{
+    counter.fetch_add(1, std::memory_order_relaxed);
+
+    if (depth == 0)
+        return;
+
+    task_group group;
+
+    for (u32 i = 0; i < fanout; ++i)
+        tp.submit(group, [&tp, &counter, depth, fanout]{ count_task_tree(tp, counter, depth - 1, fanout); });
+
+    tp.wait(group);
+}
+
+void test_task_pool()
+{
+    constexpr u32 depth = 4;
+    constexpr u32 fanout = 7;
+
+    /* 1 + 7 + 7^2 + 7^3 + 7^4 */
+    constexpr u32 expected = 2801;
+
+    for (const auto pool_size: thread_pool_sizes) {
+        task_pool tp(pool_size);
+        TEST_ASSERT(tp.num_threads() == pool_size);
+
+        std::atomic<u32> counter = 0;
+        count_task_tree(tp, counter, depth, fanout);
+
+        TEST_ASSERT(counter.load() == expected);
+    }
+}
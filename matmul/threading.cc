@@ -128,3 +128,87 @@ void thread_pool::resize(const u32 num_threads_)
     }
 }
 
+
+/* Pops the first queued task and runs it with the lock released. */
+void task_pool::run_front(std::unique_lock<std::mutex> &lck)
+{
+    task t = std::move(this->queue.front());
+    this->queue.pop_front();
+
+    lck.unlock();
+    t.func();
+    lck.lock();
+
+    if (--t.group->pending == 0)
+        this->cv.notify_all();
+}
+
+void task_pool::idle()
+{
+    std::unique_lock lck(this->m);
+
+    while (1) {
+        this->cv.wait(lck, [this]{ return this->exiting || !this->queue.empty(); });
+
+        /* Queue is drained before exiting, nobody waits forever. */
+        if (this->queue.empty())
+            return;
+
+        this->run_front(lck);
+    }
+}
+
+void task_pool::submit(task_group &group, TaskType task)
+{
+    /* lock guard */ {
+        std::unique_lock lck(this->m);
+
+        ++group.pending;
+        this->queue.push_back({ .func = std::move(task), .group = &group });
+    }
+
+    this->cv.notify_one();
+}
+
+void task_pool::wait(task_group &group)
+{
+    std::unique_lock lck(this->m);
+
+    while (group.pending != 0) {
+        if (!this->queue.empty()) {
+            this->run_front(lck);
+            continue;
+        }
+
+        this->cv.wait(lck, [this, &group]{ return group.pending == 0 || !this->queue.empty(); });
+    }
+}
+
+void task_pool::exit_threads()
+{
+    /* lock guard */ {
+        std::unique_lock lck(this->m);
+        this->exiting = true;
+    }
+
+    this->cv.notify_all();
+
+    for (auto &th: this->threads)
+        if (th.joinable())
+            th.join();
+
+    this->threads.clear();
+    this->exiting = false;
+}
+
+void task_pool::resize(const u32 num_threads_)
+{
+    const u32 num_threads = std::min(num_threads_, CONFIG_MAX_THREADS);
+
+    this->exit_threads();
+
+    this->threads.reserve(num_threads);
+
+    for (u32 i = 0; i < num_threads; ++i)
+        this->threads.emplace_back(std::thread(&task_pool::idle, this));
+}
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <mutex>
 #include <thread>
@@ -56,3 +59,101 @@ private:
     ContainerType threads;
     work_context wctx;
 };
+
+/* How thread_pool_for_bands() splits a range. */
+struct thread_bands_t {
+    u64 min_work;         /* Below this, the caller runs everything alone. */
+    u32 per_thread;       /* Bands per thread, more balance better. */
+    u32 min_band = 1;     /* Narrowest band worth handing out. */
+};
+
+/*
+ * Splits [0, n) into bands and runs 'fn(begin, end)' for each of them on the
+ * threads of 'pool'. Bands are pulled from a shared counter, so threads that
+ * got lighter ones take more and uneven work doesn't stall the pool.
+ *
+ * Runs fn(0, n) on the caller instead with a single thread, or when 'work' is
+ * below bands.min_work: waking up the pool costs more than it saves there.
+ * Work is in whatever unit the caller sizes its threshold in.
+ */
+template <typename SizeType, typename Fn>
+void thread_pool_for_bands(
+    thread_pool *pool,
+    const SizeType n,
+    const u64 work,
+    const thread_bands_t &bands,
+    const Fn &fn
+) {
+    const u32 num_threads = pool ? pool->num_threads() : 1;
+
+    if (num_threads <= 1 || work < bands.min_work) {
+        fn(SizeType(0), n);
+        return;
+    }
+
+    const SizeType band = std::max<SizeType>(bands.min_band, n / (SizeType(num_threads) * bands.per_thread));
+    std::atomic<SizeType> next = 0;
+
+    pool->schedule([&](u32) {
+        for (;;) {
+            const SizeType begin = next.fetch_add(band, std::memory_order_relaxed);
+            if (begin >= n)
+                return;
+
+            fn(begin, std::min<SizeType>(begin + band, n));
+        }
+    });
+
+    pool->sync();
+}
+
+/* Set of tasks submitted to a task_pool, that can be waited for together. */
+class task_group {
+private:
+    friend class task_pool;
+
+    /* Tasks submitted, but not finished yet. Guarded by the pool's mutex. */
+    u32 pending = 0;
+};
+
+/*
+ * Pool of threads running independent tasks.
+ *
+ * Unlike thread_pool, which runs one function on all of its threads, tasks
+ * are queued and picked up by whichever thread is free. Tasks may submit more
+ * tasks and wait for them. A waiting thread keeps running queued tasks until
+ * its group is done, so nested submission never deadlocks, not even with
+ * zero worker threads, when the waiter simply runs everything itself.
+ */
+class task_pool {
+private:
+    using ThreadType = std::thread;
+    using TaskType = std::function<void()>;
+    using ContainerType = std::vector<ThreadType>;
+
+    struct task {
+        TaskType func;
+        task_group *group;
+    };
+
+    void idle();
+    void run_front(std::unique_lock<std::mutex> &lck);
+    void exit_threads();
+
+public:
+    task_pool() = default;
+    task_pool(u32 num_threads) { this->resize(num_threads); }
+    ~task_pool() { this->exit_threads(); }
+
+    void submit(task_group &group, TaskType task);
+    void wait(task_group &group);
+    void resize(u32 num_threads);
+    u32  num_threads() { return this->threads.size(); }
+
+private:
+    ContainerType threads;
+    std::mutex m;
+    std::condition_variable cv;
+    std::deque<task> queue;
+    bool exiting = false;
+};